@@ -0,0 +1,147 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <string.h>
+
+#include "channel-display-buffers.h"
+
+struct primary_buffers {
+    guint n;
+    gint width, height, bpp;
+    gsize stride;
+    guint8 *data[PRIMARY_BUFFERS_MAX];
+    /* what changed since each buffer was last written */
+    pixman_region32_t stale[PRIMARY_BUFFERS_MAX];
+    /* what the current batch of messages changed */
+    pixman_region32_t damage;
+    guint back;
+    /* read from any thread: set once the buffer it names is written */
+    gint front;
+    /* the previous front buffer when triple buffering */
+    guint pending;
+};
+
+primary_buffers *primary_buffers_new(gint width, gint height, gsize stride, gint bpp,
+                                     guint n)
+{
+    primary_buffers *b;
+    guint i;
+
+    g_return_val_if_fail(n >= 2 && n <= PRIMARY_BUFFERS_MAX, NULL);
+
+    b = g_new0(primary_buffers, 1);
+    b->n = n;
+    b->width = width;
+    b->height = height;
+    b->bpp = bpp;
+    b->stride = stride;
+    for (i = 0; i < n; i++) {
+        b->data[i] = g_malloc0(height * stride);
+        pixman_region32_init(&b->stale[i]);
+    }
+    pixman_region32_init(&b->damage);
+
+    b->front = 0;
+    b->back = 1;
+    b->pending = 2;
+
+    return b;
+}
+
+void primary_buffers_free(primary_buffers *b)
+{
+    guint i;
+
+    for (i = 0; i < b->n; i++) {
+        g_free(b->data[i]);
+        pixman_region32_fini(&b->stale[i]);
+    }
+    pixman_region32_fini(&b->damage);
+    g_free(b);
+}
+
+/* any thread: the buffer the last swap published, whole */
+guint8 *primary_buffers_get_front(primary_buffers *b)
+{
+    /* pairs with the one in primary_buffers_swap(), so that the pixels
+     * copied before it are seen too */
+    return b->data[g_atomic_int_get(&b->front)];
+}
+
+void primary_buffers_damage(primary_buffers *b, gint x, gint y, gint width, gint height)
+{
+    pixman_region32_union_rect(&b->damage, &b->damage, x, y, width, height);
+}
+
+/* whether a batch of messages is being drawn */
+gboolean primary_buffers_has_damage(primary_buffers *b)
+{
+    return pixman_region32_not_empty(&b->damage);
+}
+
+static void primary_buffers_copy(primary_buffers *b, const guint8 *src, guint i)
+{
+    pixman_box32_t *boxes;
+    int n, y;
+
+    boxes = pixman_region32_rectangles(&b->stale[i], &n);
+    for (; n > 0; n--, boxes++) {
+        gsize offset = boxes->y1 * b->stride + boxes->x1 * b->bpp;
+        gsize len = (boxes->x2 - boxes->x1) * b->bpp;
+
+        for (y = boxes->y1; y < boxes->y2; y++, offset += b->stride)
+            memcpy(b->data[i] + offset, src + offset, len);
+    }
+    pixman_region32_clear(&b->stale[i]);
+}
+
+/* Publishes the damage of the current batch: it is copied from @src into
+ * the back buffer, which becomes the front one. Returns FALSE if nothing
+ * changed, else the damage is moved to @damage, to be finalized. */
+gboolean primary_buffers_swap(primary_buffers *b, const guint8 *src,
+                              pixman_region32_t *damage)
+{
+    guint front, i;
+
+    if (!pixman_region32_not_empty(&b->damage))
+        return FALSE;
+
+    pixman_region32_intersect_rect(&b->damage, &b->damage,
+                                   0, 0, b->width, b->height);
+    for (i = 0; i < b->n; i++)
+        pixman_region32_union(&b->stale[i], &b->stale[i], &b->damage);
+
+    primary_buffers_copy(b, src, b->back);
+
+    /* only this thread writes it */
+    front = b->front;
+    g_atomic_int_set(&b->front, b->back);
+    if (b->n == 3) {
+        b->back = b->pending;
+        b->pending = front;
+    } else {
+        b->back = front;
+    }
+
+    pixman_region32_init(damage);
+    pixman_region32_copy(damage, &b->damage);
+    pixman_region32_clear(&b->damage);
+
+    return TRUE;
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIENT_DISPLAY_BUFFERS_H__
+#define __SPICE_CLIENT_DISPLAY_BUFFERS_H__
+
+#include <glib.h>
+#include <pixman.h>
+
+G_BEGIN_DECLS
+
+/* Presentation buffers of the primary surface.
+ *
+ * The canvas keeps drawing into the surface data, while the widgets read
+ * one of the buffers below. The damage of a batch of messages is copied
+ * to the back buffer, which is then swapped with the front one, so the
+ * widgets never see a half-updated frame. With 3 buffers, the previous
+ * front buffer waits one more batch before it is written again, so a
+ * reader still holding it has until the next swap to repaint. The front
+ * buffer only changes on swap: every reader sees the same one.
+ *
+ * The buffers are written and swapped by one thread, the one running the
+ * channel, while primary_buffers_get_front() may be called from any. */
+typedef struct primary_buffers primary_buffers;
+
+#define PRIMARY_BUFFERS_MAX 3
+
+primary_buffers *primary_buffers_new(gint width, gint height, gsize stride, gint bpp,
+                                     guint n);
+void primary_buffers_free(primary_buffers *b);
+
+guint8 *primary_buffers_get_front(primary_buffers *b);
+void primary_buffers_damage(primary_buffers *b, gint x, gint y, gint width, gint height);
+gboolean primary_buffers_has_damage(primary_buffers *b);
+gboolean primary_buffers_swap(primary_buffers *b, const guint8 *src,
+                              pixman_region32_t *damage);
+
+G_END_DECLS
+
+#endif /* __SPICE_CLIENT_DISPLAY_BUFFERS_H__ */
@@ -0,0 +1,302 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include "channel-display-controller.h"
+
+/* weight of a new sample in the moving averages, as a shift */
+#define CONTROLLER_EWMA_SHIFT 3
+
+/* the decoder is the bottleneck when it needs that much of the frame interval */
+#define CONTROLLER_DECODE_BUSY_PERCENT 80
+/* the main loop is the bottleneck when it is late by that much of the
+ * frame interval, or by CONTROLLER_LOOP_LAG_MAX */
+#define CONTROLLER_LOOP_LAG_PERCENT 50
+#define CONTROLLER_LOOP_LAG_MAX (20 * 1000)
+/* the network is the bottleneck when the socket holds more than that many
+ * frame intervals, or when that many percents of the frames arrive late */
+#define CONTROLLER_QUEUE_FRAMES 2
+#define CONTROLLER_LATE_PERCENT 25
+
+/* the most the reported latency is lowered by, in ms */
+#define CONTROLLER_MAX_ADJUSTMENT 400
+
+/* a codec is switched to when it decodes at most that much of the
+ * current codec time, with enough samples, and not more often than
+ * CONTROLLER_CODEC_SWITCH_INTERVAL */
+#define CONTROLLER_CODEC_GAIN_PERCENT 75
+#define CONTROLLER_CODEC_MIN_SAMPLES 30
+#define CONTROLLER_CODEC_SWITCH_INTERVAL (10 * G_USEC_PER_SEC)
+
+#define CONTROLLER_CODECS SPICE_VIDEO_CODEC_TYPE_ENUM_END
+
+typedef struct codec_cost {
+    /* decoding time of a megapixel, in us */
+    gint64 cost;
+    guint samples;
+} codec_cost;
+
+/* the frame interval is measured for each stream: the gap between the
+ * frames of two streams says nothing */
+typedef struct stream_arrival {
+    guint frames;
+    gint64 last_arrival;
+    gint64 frame_interval;
+} stream_arrival;
+
+struct StreamController {
+    guint frames;
+    GHashTable *streams;
+    /* of the stream which got the last frame */
+    gint64 frame_interval;
+    guint64 frame_size;
+    gint64 decode_time;
+    gint64 loop_lag;
+    guint64 socket_queue;
+    /* percentage of the late frames */
+    guint late;
+    guint drops;
+
+    SpiceStreamingBottleneck bottleneck;
+    gboolean congestion_reported;
+    gint32 latency_adjustment;
+
+    codec_cost codecs[CONTROLLER_CODECS];
+    gint codec_type;
+    gint64 last_switch;
+};
+
+static gint64 ewma(gint64 average, gint64 sample)
+{
+    return average + ((sample - average) >> CONTROLLER_EWMA_SHIFT);
+}
+
+static void controller_update(StreamController *ctl)
+{
+    SpiceStreamingBottleneck bottleneck = SPICE_STREAMING_BOTTLENECK_NONE;
+    gint64 interval = ctl->frame_interval;
+    gint64 penalty = 0;
+
+    if (interval <= 0) {
+        ctl->bottleneck = bottleneck;
+        ctl->latency_adjustment = 0;
+        return;
+    }
+
+    if (ctl->decode_time * 100 > interval * CONTROLLER_DECODE_BUSY_PERCENT) {
+        bottleneck = SPICE_STREAMING_BOTTLENECK_DECODE;
+        /* what each frame adds to the backlog of the decoder */
+        penalty = ctl->decode_time - interval * CONTROLLER_DECODE_BUSY_PERCENT / 100;
+    } else if (ctl->loop_lag * 100 > interval * CONTROLLER_LOOP_LAG_PERCENT ||
+               ctl->loop_lag > CONTROLLER_LOOP_LAG_MAX) {
+        bottleneck = SPICE_STREAMING_BOTTLENECK_MAIN_LOOP;
+        penalty = ctl->loop_lag;
+    } else if ((ctl->frame_size > 0 &&
+                ctl->socket_queue > ctl->frame_size * CONTROLLER_QUEUE_FRAMES) ||
+               ctl->late > CONTROLLER_LATE_PERCENT) {
+        bottleneck = SPICE_STREAMING_BOTTLENECK_NETWORK;
+        /* how long the data waiting on the socket takes to arrive */
+        if (ctl->frame_size > 0)
+            penalty = ctl->socket_queue * interval / ctl->frame_size;
+    }
+
+    if (bottleneck == SPICE_STREAMING_BOTTLENECK_NONE)
+        ctl->congestion_reported = FALSE;
+    ctl->bottleneck = bottleneck;
+    ctl->latency_adjustment = MIN(penalty / 1000, CONTROLLER_MAX_ADJUSTMENT);
+}
+
+G_GNUC_INTERNAL
+StreamController *stream_controller_new(void)
+{
+    StreamController *ctl = g_new0(StreamController, 1);
+
+    ctl->streams = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    return ctl;
+}
+
+G_GNUC_INTERNAL
+void stream_controller_free(StreamController *ctl)
+{
+    g_hash_table_unref(ctl->streams);
+    g_free(ctl);
+}
+
+/* A frame of the stream @stream_id was received: @now is its arrival
+ * time, @size its size and @socket_queue the number of bytes still
+ * waiting to be read. */
+G_GNUC_INTERNAL
+void stream_controller_add_arrival(StreamController *ctl, guint32 stream_id, gint64 now,
+                                   gsize size, guint64 socket_queue)
+{
+    stream_arrival *arrival = g_hash_table_lookup(ctl->streams, GUINT_TO_POINTER(stream_id));
+
+    if (arrival == NULL) {
+        arrival = g_new0(stream_arrival, 1);
+        g_hash_table_insert(ctl->streams, GUINT_TO_POINTER(stream_id), arrival);
+    }
+    if (arrival->frames++ > 0) {
+        gint64 interval = MAX(now - arrival->last_arrival, 0);
+
+        /* the first interval is the best guess so far */
+        arrival->frame_interval = arrival->frames == 2 ?
+            interval : ewma(arrival->frame_interval, interval);
+    }
+    arrival->last_arrival = now;
+    ctl->frame_interval = arrival->frame_interval;
+
+    if (ctl->frames++ == 0) {
+        ctl->frame_size = size;
+        ctl->socket_queue = socket_queue;
+    } else {
+        ctl->frame_size = ewma(ctl->frame_size, size);
+        ctl->socket_queue = ewma(ctl->socket_queue, socket_queue);
+    }
+    controller_update(ctl);
+}
+
+/* The stream @stream_id was destroyed: a new stream with the same id
+ * starts its frame interval over */
+G_GNUC_INTERNAL
+void stream_controller_remove_stream(StreamController *ctl, guint32 stream_id)
+{
+    g_hash_table_remove(ctl->streams, GUINT_TO_POINTER(stream_id));
+}
+
+/* A frame of @pixels pixels was decoded with @codec_type in @decode_time us */
+G_GNUC_INTERNAL
+void stream_controller_add_decode(StreamController *ctl, gint codec_type,
+                                  guint pixels, gint64 decode_time)
+{
+    codec_cost *codec;
+    gint64 cost;
+
+    g_return_if_fail(codec_type > 0 && codec_type < CONTROLLER_CODECS);
+
+    if (decode_time < 0 || pixels == 0)
+        return;
+
+    if (codec_type != ctl->codec_type) {
+        /* the decoding time of the previous codec doesn't apply anymore */
+        ctl->codec_type = codec_type;
+        ctl->decode_time = decode_time;
+    } else {
+        ctl->decode_time = ewma(ctl->decode_time, decode_time);
+    }
+
+    codec = &ctl->codecs[codec_type];
+    cost = decode_time * 1000000 / pixels;
+    codec->cost = codec->samples++ ? ewma(codec->cost, cost) : cost;
+    controller_update(ctl);
+}
+
+/* The decoders may drop frames from their own thread */
+G_GNUC_INTERNAL
+void stream_controller_add_drop(StreamController *ctl)
+{
+    g_atomic_int_inc(&ctl->drops);
+}
+
+/* The main loop ran @lag us later than it was asked to */
+G_GNUC_INTERNAL
+void stream_controller_add_loop_lag(StreamController *ctl, gint64 lag)
+{
+    ctl->loop_lag = ewma(ctl->loop_lag, MAX(lag, 0));
+    controller_update(ctl);
+}
+
+/* Returns the @latency to report to the server, in ms. The server lowers
+ * the bit rate when the latency it sees shrinks, so the client takes off
+ * what its own bottleneck costs. Drops, with a negative latency, are
+ * left alone, and a frame on time is never reported as a drop. */
+G_GNUC_INTERNAL
+gint32 stream_controller_adjust_latency(StreamController *ctl, gint32 latency)
+{
+    ctl->late = ewma(ctl->late, latency < 0 ? 100 : 0);
+    controller_update(ctl);
+
+    if (latency < 0)
+        return latency;
+    return MAX(latency - ctl->latency_adjustment, 0);
+}
+
+/* Returns TRUE once when the streams become congested, so the server can
+ * be told without waiting for the end of the report window. */
+G_GNUC_INTERNAL
+gboolean stream_controller_congestion_started(StreamController *ctl)
+{
+    if (ctl->bottleneck == SPICE_STREAMING_BOTTLENECK_NONE || ctl->congestion_reported)
+        return FALSE;
+
+    ctl->congestion_reported = TRUE;
+    return TRUE;
+}
+
+static gint controller_fastest_codec(StreamController *ctl)
+{
+    gint i, best = 0;
+
+    for (i = 1; i < CONTROLLER_CODECS; i++) {
+        if (ctl->codecs[i].samples < CONTROLLER_CODEC_MIN_SAMPLES)
+            continue;
+        if (best == 0 || ctl->codecs[i].cost < ctl->codecs[best].cost)
+            best = i;
+    }
+
+    return best;
+}
+
+/* Returns the codec the server should switch to, or 0 to keep the current
+ * one. Only a decoder bound stream switches, to a codec which was seen to
+ * decode noticeably faster, and not more often than every 10 seconds. */
+G_GNUC_INTERNAL
+gint stream_controller_pick_codec(StreamController *ctl, gint64 now)
+{
+    codec_cost *current;
+    gint best;
+
+    if (ctl->bottleneck != SPICE_STREAMING_BOTTLENECK_DECODE || ctl->codec_type == 0)
+        return 0;
+    if (ctl->last_switch != 0 && now - ctl->last_switch < CONTROLLER_CODEC_SWITCH_INTERVAL)
+        return 0;
+
+    best = controller_fastest_codec(ctl);
+    current = &ctl->codecs[ctl->codec_type];
+    if (best == 0 || best == ctl->codec_type ||
+        current->samples < CONTROLLER_CODEC_MIN_SAMPLES ||
+        ctl->codecs[best].cost * 100 > current->cost * CONTROLLER_CODEC_GAIN_PERCENT)
+        return 0;
+
+    ctl->last_switch = now;
+    return best;
+}
+
+G_GNUC_INTERNAL
+gboolean stream_controller_get_state(StreamController *ctl, SpiceStreamingState *state)
+{
+    state->bottleneck = ctl->bottleneck;
+    state->frame_interval = ctl->frame_interval;
+    state->decode_time = ctl->decode_time;
+    state->loop_lag = ctl->loop_lag;
+    state->socket_queue = ctl->socket_queue;
+    state->drops = g_atomic_int_get(&ctl->drops);
+    state->latency_adjustment = ctl->latency_adjustment;
+    state->preferred_codec = controller_fastest_codec(ctl);
+
+    return ctl->frames > 0;
+}
@@ -0,0 +1,50 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIENT_DISPLAY_CONTROLLER_H__
+#define __SPICE_CLIENT_DISPLAY_CONTROLLER_H__
+
+#include "spice-client.h"
+
+G_BEGIN_DECLS
+
+/* Client side view of the video streaming: it finds out what slows the
+ * streams down, tells the server through the stream reports, and picks
+ * the codec this machine decodes the fastest. It only works on the
+ * samples it is given, so it can be driven by a simulated stream. */
+typedef struct StreamController StreamController;
+
+StreamController *stream_controller_new(void);
+void stream_controller_free(StreamController *ctl);
+
+void stream_controller_add_arrival(StreamController *ctl, guint32 stream_id, gint64 now,
+                                   gsize size, guint64 socket_queue);
+void stream_controller_remove_stream(StreamController *ctl, guint32 stream_id);
+void stream_controller_add_decode(StreamController *ctl, gint codec_type,
+                                  guint pixels, gint64 decode_time);
+void stream_controller_add_drop(StreamController *ctl);
+void stream_controller_add_loop_lag(StreamController *ctl, gint64 lag);
+
+gint32 stream_controller_adjust_latency(StreamController *ctl, gint32 latency);
+gboolean stream_controller_congestion_started(StreamController *ctl);
+gint stream_controller_pick_codec(StreamController *ctl, gint64 now);
+
+gboolean stream_controller_get_state(StreamController *ctl, SpiceStreamingState *state);
+
+G_END_DECLS
+
+#endif /* __SPICE_CLIENT_DISPLAY_CONTROLLER_H__ */
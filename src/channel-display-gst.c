@@ -23,6 +23,7 @@
 
 #include "channel-display-priv.h"
 
+#include <errno.h>
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include <gst/app/gstappsink.h>
@@ -42,9 +43,13 @@ typedef struct SpiceGstDecoder {
     GstAppSink *appsink;
     GstElement *pipeline;
     GstClock *clock;
+    guint bus_watch_id;
 
     guintptr win_handle;
 
+    /* where the pipeline goes when the stream is destroyed, or NULL */
+    SpiceGstPipelinePool *pool;
+
     /* ---------- Decoding and display queues ---------- */
 
     uint32_t last_mm_time;
@@ -115,6 +120,35 @@ static int spice_gst_buffer_get_stride(GstBuffer *buffer)
     return video && video->n_planes > 0 ? video->stride[0] : SPICE_UNKNOWN_STRIDE;
 }
 
+/* Keeps the decoded buffer mapped for as long as its pixels are used */
+typedef struct SpiceGstMapping {
+    GstBuffer *buffer;
+    GstMapInfo mapinfo;
+} SpiceGstMapping;
+
+static void spice_gst_mapping_free(gpointer data)
+{
+    SpiceGstMapping *mapping = data;
+
+    gst_buffer_unmap(mapping->buffer, &mapping->mapinfo);
+    gst_buffer_unref(mapping->buffer);
+    g_free(mapping);
+}
+
+static GBytes *spice_gst_buffer_map_bytes(GstBuffer *buffer)
+{
+    SpiceGstMapping *mapping = g_new(SpiceGstMapping, 1);
+
+    if (!gst_buffer_map(buffer, &mapping->mapinfo, GST_MAP_READ)) {
+        g_free(mapping);
+        return NULL;
+    }
+    mapping->buffer = gst_buffer_ref(buffer);
+
+    return g_bytes_new_with_free_func(mapping->mapinfo.data, mapping->mapinfo.size,
+                                      spice_gst_mapping_free, mapping);
+}
+
 /* main context */
 static gboolean display_frame(gpointer video_decoder)
 {
@@ -124,7 +158,7 @@ static gboolean display_frame(gpointer video_decoder)
     gint width, height;
     GstStructure *s;
     GstBuffer *buffer;
-    GstMapInfo mapinfo;
+    GBytes *pixels;
 
     g_mutex_lock(&decoder->queues_mutex);
     decoder->timer_id = 0;
@@ -153,14 +187,15 @@ static gboolean display_frame(gpointer video_decoder)
     }
 
     buffer = gst_sample_get_buffer(gstframe->sample);
-    if (!gst_buffer_map(buffer, &mapinfo, GST_MAP_READ)) {
+    pixels = spice_gst_buffer_map_bytes(buffer);
+    if (!pixels) {
         spice_warning("GStreamer error: could not map the buffer");
         goto error;
     }
 
     stream_display_frame(decoder->base.stream, gstframe->frame,
-                         width, height, spice_gst_buffer_get_stride(buffer), mapinfo.data);
-    gst_buffer_unmap(buffer, &mapinfo);
+                         width, height, spice_gst_buffer_get_stride(buffer), pixels);
+    g_bytes_unref(pixels);
 
  error:
     free_gst_frame(gstframe);
@@ -171,7 +206,7 @@ static gboolean display_frame(gpointer video_decoder)
 /* main loop or GStreamer streaming thread */
 static void schedule_frame(SpiceGstDecoder *decoder)
 {
-    guint32 now = stream_get_time(decoder->base.stream);
+    guint32 now = stream_get_present_time(decoder->base.stream);
     g_mutex_lock(&decoder->queues_mutex);
 
     while (!decoder->timer_id) {
@@ -184,7 +219,17 @@ static void schedule_frame(SpiceGstDecoder *decoder)
             break;
         }
 
-        if (spice_mmtime_diff(now, gstframe->frame->mm_time) < 0) {
+        if (decoder->base.stream->low_latency) {
+            if (decoder->pending_samples) {
+                /* A more recent frame is already decoded, skip this one */
+                SPICE_DEBUG("%s: low latency, dropping an outdated frame", __FUNCTION__);
+                stream_dropped_frame_on_playback(decoder->base.stream, gstframe->frame);
+                decoder->display_frame = NULL;
+                free_gst_frame(gstframe);
+            } else {
+                decoder->timer_id = g_timeout_add(0, display_frame, decoder);
+            }
+        } else if (spice_mmtime_diff(now, gstframe->frame->mm_time) < 0) {
             decoder->timer_id = g_timeout_add(gstframe->frame->mm_time - now,
                                               display_frame, decoder);
         } else if (decoder->display_frame && !decoder->pending_samples) {
@@ -196,7 +241,7 @@ static void schedule_frame(SpiceGstDecoder *decoder)
             SPICE_DEBUG("%s: rendering too late by %u ms (ts: %u, mmtime: %u), dropping",
                         __FUNCTION__, now - gstframe->frame->mm_time,
                         gstframe->frame->mm_time, now);
-            stream_dropped_frame_on_playback(decoder->base.stream);
+            stream_dropped_frame_on_playback(decoder->base.stream, gstframe->frame);
             decoder->display_frame = NULL;
             free_gst_frame(gstframe);
         }
@@ -229,6 +274,8 @@ static void fetch_pending_sample(SpiceGstDecoder *decoder)
                 /* The frame is now ready for display */
                 gstframe->sample = sample;
                 decoder->display_frame = gstframe;
+                stream_timing_mark(decoder->base.stream, gstframe->frame,
+                                   SPICE_STREAM_TIMING_DECODE_END);
 
                 /* Now that we know there is a match, remove it and the older
                  * frames from the decoding queue.
@@ -290,12 +337,14 @@ static void free_pipeline(SpiceGstDecoder *decoder)
     }
 
     gst_element_set_state(decoder->pipeline, GST_STATE_NULL);
-    gst_object_unref(decoder->appsrc);
-    if (decoder->appsink) {
-        gst_object_unref(decoder->appsink);
+    if (decoder->bus_watch_id) {
+        g_source_remove(decoder->bus_watch_id);
+        decoder->bus_watch_id = 0;
     }
+    g_clear_pointer(&decoder->appsrc, gst_object_unref);
+    g_clear_pointer(&decoder->appsink, gst_object_unref);
+    g_clear_pointer(&decoder->clock, gst_object_unref);
     gst_object_unref(decoder->pipeline);
-    gst_object_unref(decoder->clock);
     decoder->pipeline = NULL;
 }
 
@@ -381,9 +430,41 @@ static void app_source_setup(GstElement *pipeline G_GNUC_UNUSED,
 }
 #endif
 
-static gboolean create_pipeline(SpiceGstDecoder *decoder)
+/* Hooks the pipeline up to the decoder and starts it */
+static gboolean start_pipeline(SpiceGstDecoder *decoder)
 {
     GstBus *bus;
+
+#if GST_CHECK_VERSION(1,9,0)
+    g_signal_connect(decoder->pipeline, "source-setup", G_CALLBACK(app_source_setup), decoder);
+#endif
+
+    /* the probe pulls the samples itself, from its own thread */
+    if (decoder->base.stream) {
+        if (decoder->appsink) {
+            GstAppSinkCallbacks appsink_cbs = { NULL };
+            appsink_cbs.new_sample = new_sample;
+            gst_app_sink_set_callbacks(decoder->appsink, &appsink_cbs, decoder, NULL);
+        }
+        bus = gst_pipeline_get_bus(GST_PIPELINE(decoder->pipeline));
+        gst_bus_set_flushing(bus, FALSE);
+        decoder->bus_watch_id = gst_bus_add_watch(bus, handle_pipeline_message, decoder);
+        gst_object_unref(bus);
+    }
+
+    decoder->clock = gst_pipeline_get_clock(GST_PIPELINE(decoder->pipeline));
+
+    if (gst_element_set_state(decoder->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        SPICE_DEBUG("GStreamer error: Unable to set the pipeline to the playing state.");
+        free_pipeline(decoder);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean create_pipeline(SpiceGstDecoder *decoder)
+{
 #if GST_CHECK_VERSION(1,9,0)
     GstElement *playbin, *sink;
     SpiceGstPlayFlags flags;
@@ -395,11 +476,6 @@ static gboolean create_pipeline(SpiceGstDecoder *decoder)
         return FALSE;
     }
 
-    /* Will try to get window handle in order to apply the GstVideoOverlay
-     * interface, setting overlay to this window will happen only when
-     * prepare-window-handle message is received
-     */
-    decoder->win_handle = get_window_handle(decoder->base.stream);
     SPICE_DEBUG("Creating Gstreamer pipline (handle for overlay %s)\n",
                 decoder->win_handle ? "received" : "not received");
     if (decoder->win_handle == 0) {
@@ -441,8 +517,6 @@ static gboolean create_pipeline(SpiceGstDecoder *decoder)
         }
     }
 
-    g_signal_connect(playbin, "source-setup", G_CALLBACK(app_source_setup), decoder);
-
     g_object_set(playbin,
                  "uri", "appsrc://",
                  NULL);
@@ -485,24 +559,173 @@ static gboolean create_pipeline(SpiceGstDecoder *decoder)
 #endif
 
     if (decoder->appsink) {
-        GstAppSinkCallbacks appsink_cbs = { NULL };
-        appsink_cbs.new_sample = new_sample;
-        gst_app_sink_set_callbacks(decoder->appsink, &appsink_cbs, decoder, NULL);
         gst_app_sink_set_max_buffers(decoder->appsink, 2);
         gst_app_sink_set_drop(decoder->appsink, FALSE);
     }
-    bus = gst_pipeline_get_bus(GST_PIPELINE(decoder->pipeline));
-    gst_bus_add_watch(bus, handle_pipeline_message, decoder);
-    gst_object_unref(bus);
 
-    decoder->clock = gst_pipeline_get_clock(GST_PIPELINE(decoder->pipeline));
+    return start_pipeline(decoder);
+}
 
-    if (gst_element_set_state(decoder->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
-        SPICE_DEBUG("GStreamer error: Unable to set the pipeline to the playing state.");
-        free_pipeline(decoder);
+
+/* ---------- Pipeline pool ---------- */
+
+/* idle pipelines kept per codec, and for how long, in seconds */
+#define PIPELINE_POOL_MAX_IDLE 2
+#define PIPELINE_POOL_IDLE_TIMEOUT 30
+
+/* Building a pipeline, and with playbin plugging its decoder, takes tens
+ * of ms, paid on each stream by the windows repeatedly detected as video.
+ * So when SPICE_PIPELINE_POOL is set, the appsink pipelines of the
+ * destroyed streams are stopped and kept for the next streams of the
+ * same codec. The overlay ones are tied to their window and are not kept. */
+struct SpiceGstPipelinePool {
+    GQueue *idle;
+    guint trim_id;
+};
+
+typedef struct SpiceGstPooledPipeline {
+    int codec_type;
+    GstElement *pipeline;
+    GstAppSrc *appsrc;
+    GstAppSink *appsink;
+    gint64 released;
+} SpiceGstPooledPipeline;
+
+static void pooled_pipeline_free(SpiceGstPooledPipeline *pooled)
+{
+    gst_element_set_state(pooled->pipeline, GST_STATE_NULL);
+    if (pooled->appsrc) {
+        gst_object_unref(pooled->appsrc);
+    }
+    gst_object_unref(pooled->appsink);
+    gst_object_unref(pooled->pipeline);
+    g_free(pooled);
+}
+
+G_GNUC_INTERNAL
+SpiceGstPipelinePool *gstvideo_pipeline_pool_new(void)
+{
+    SpiceGstPipelinePool *pool = g_new0(SpiceGstPipelinePool, 1);
+
+    pool->idle = g_queue_new();
+    return pool;
+}
+
+G_GNUC_INTERNAL
+void gstvideo_pipeline_pool_free(SpiceGstPipelinePool *pool)
+{
+    if (pool->trim_id) {
+        g_source_remove(pool->trim_id);
+    }
+    g_queue_free_full(pool->idle, (GDestroyNotify)pooled_pipeline_free);
+    g_free(pool);
+}
+
+static gboolean pipeline_pool_trim(gpointer data)
+{
+    SpiceGstPipelinePool *pool = data;
+    gint64 expired = g_get_monotonic_time() - PIPELINE_POOL_IDLE_TIMEOUT * G_USEC_PER_SEC;
+    SpiceGstPooledPipeline *pooled;
+
+    /* the most recently released pipelines are at the head */
+    while ((pooled = g_queue_peek_tail(pool->idle)) && pooled->released <= expired) {
+        g_queue_pop_tail(pool->idle);
+        pooled_pipeline_free(pooled);
+    }
+
+    if (g_queue_is_empty(pool->idle)) {
+        pool->trim_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/* main context */
+static gboolean pipeline_pool_take(SpiceGstDecoder *decoder)
+{
+    SpiceGstPipelinePool *pool = decoder->pool;
+    SpiceGstPooledPipeline *pooled = NULL;
+    GList *l;
+
+    if (pool == NULL || decoder->win_handle != 0) {
+        return FALSE;
+    }
+
+    for (l = g_queue_peek_head_link(pool->idle); l != NULL; l = l->next) {
+        pooled = l->data;
+        if (pooled->codec_type == decoder->base.codec_type) {
+            g_queue_delete_link(pool->idle, l);
+            break;
+        }
+    }
+    if (l == NULL) {
+        return FALSE;
+    }
+
+    SPICE_DEBUG("reusing a %s GStreamer pipeline", gst_opts[decoder->base.codec_type].name);
+    decoder->pipeline = pooled->pipeline;
+    decoder->appsrc = pooled->appsrc;
+    decoder->appsink = pooled->appsink;
+    g_free(pooled);
+
+    return start_pipeline(decoder);
+}
+
+/* main context */
+static gboolean pipeline_pool_put(SpiceGstDecoder *decoder)
+{
+    SpiceGstPipelinePool *pool = decoder->pool;
+    SpiceGstPooledPipeline *pooled;
+    GstAppSinkCallbacks appsink_cbs = { NULL };
+    GstBus *bus;
+    GList *l;
+    guint idle = 0;
+
+    if (pool == NULL || decoder->pipeline == NULL || decoder->appsink == NULL) {
+        return FALSE;
+    }
+    for (l = g_queue_peek_head_link(pool->idle); l != NULL; l = l->next) {
+        pooled = l->data;
+        if (pooled->codec_type == decoder->base.codec_type) {
+            idle++;
+        }
+    }
+    if (idle >= PIPELINE_POOL_MAX_IDLE) {
         return FALSE;
     }
 
+    /* Going back to READY waits for the streaming threads and drops the
+     * queued frames, so the pipeline no longer refers to the decoder */
+    if (gst_element_set_state(decoder->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+        return FALSE;
+    }
+    g_source_remove(decoder->bus_watch_id);
+    decoder->bus_watch_id = 0;
+    bus = gst_pipeline_get_bus(GST_PIPELINE(decoder->pipeline));
+    gst_bus_set_flushing(bus, TRUE);
+    gst_object_unref(bus);
+    gst_app_sink_set_callbacks(decoder->appsink, &appsink_cbs, NULL, NULL);
+    g_signal_handlers_disconnect_by_data(decoder->pipeline, decoder);
+#if GST_CHECK_VERSION(1,9,0)
+    /* playbin builds a new source when it starts again */
+    g_clear_pointer(&decoder->appsrc, gst_object_unref);
+#endif
+    g_clear_pointer(&decoder->clock, gst_object_unref);
+
+    pooled = g_new0(SpiceGstPooledPipeline, 1);
+    pooled->codec_type = decoder->base.codec_type;
+    pooled->pipeline = decoder->pipeline;
+    pooled->appsrc = decoder->appsrc;
+    pooled->appsink = decoder->appsink;
+    pooled->released = g_get_monotonic_time();
+    g_queue_push_head(pool->idle, pooled);
+    decoder->pipeline = NULL;
+    decoder->appsrc = NULL;
+    decoder->appsink = NULL;
+
+    if (pool->trim_id == 0) {
+        pool->trim_id = g_timeout_add_seconds(PIPELINE_POOL_IDLE_TIMEOUT, pipeline_pool_trim, pool);
+    }
     return TRUE;
 }
 
@@ -534,10 +757,12 @@ static void spice_gst_decoder_destroy(VideoDecoder *video_decoder)
 {
     SpiceGstDecoder *decoder = (SpiceGstDecoder*)video_decoder;
 
-    /* Stop and free the pipeline to ensure there will not be any further
-     * new_sample() call (clearing thread-safety concerns).
+    /* Stop and free, or pool, the pipeline to ensure there will not be any
+     * further new_sample() call (clearing thread-safety concerns).
      */
-    free_pipeline(decoder);
+    if (!pipeline_pool_put(decoder)) {
+        free_pipeline(decoder);
+    }
 
     /* Even if we kept the decoder around, once we return the stream will be
      * destroyed making it impossible to display frames. So cancel any
@@ -635,7 +860,7 @@ static gboolean spice_gst_decoder_queue_frame(VideoDecoder *video_decoder,
 #if GST_CHECK_VERSION(1,9,0)
     if (decoder->appsrc == NULL) {
         spice_warning("Error: Playbin has not yet initialized the Appsrc element");
-        stream_dropped_frame_on_playback(decoder->base.stream);
+        stream_dropped_frame_on_playback(decoder->base.stream, frame);
         frame->free(frame);
         return TRUE;
     }
@@ -661,9 +886,12 @@ static gboolean spice_gst_decoder_queue_frame(VideoDecoder *video_decoder,
         frame = NULL;
     }
 
+    if (frame != NULL) {
+        stream_timing_mark(decoder->base.stream, frame, SPICE_STREAM_TIMING_DECODE_START);
+    }
     if (gst_app_src_push_buffer(decoder->appsrc, buffer) != GST_FLOW_OK) {
         SPICE_DEBUG("GStreamer error: unable to push frame");
-        stream_dropped_frame_on_playback(decoder->base.stream);
+        stream_dropped_frame_on_playback(decoder->base.stream, NULL);
     }
     return TRUE;
 }
@@ -700,8 +928,15 @@ VideoDecoder* create_gstreamer_decoder(int codec_type, display_stream *stream)
         decoder->base.stream = stream;
         g_mutex_init(&decoder->queues_mutex);
         decoder->decoding_queue = g_queue_new();
+        decoder->pool = stream_get_pipeline_pool(stream);
+
+        /* Will try to get window handle in order to apply the GstVideoOverlay
+         * interface, setting overlay to this window will happen only when
+         * prepare-window-handle message is received
+         */
+        decoder->win_handle = get_window_handle(stream);
 
-        if (!create_pipeline(decoder)) {
+        if (!pipeline_pool_take(decoder) && !create_pipeline(decoder)) {
             decoder->base.destroy((VideoDecoder*)decoder);
             decoder = NULL;
         }
@@ -769,3 +1004,309 @@ gboolean gstvideo_has_codec(int codec_type)
     gst_plugin_feature_list_free(all_decoders);
     return TRUE;
 }
+
+
+/* ---------- Decoder speed probing ---------- */
+
+#define PROBE_VERSION 1
+#define PROBE_FRAMES 30
+#define PROBE_WIDTH 1280
+#define PROBE_HEIGHT 720
+#define PROBE_TIMEOUT (5 * GST_SECOND)
+
+/* The sample clips are encoded from a test pattern with the first of
+ * these encoders found, in the format spice-server streams. */
+static const gchar *const probe_encoders[][3] = {
+    /* SpiceVideoCodecType starts at index 1 */
+    { NULL },
+
+    /* SPICE_VIDEO_CODEC_TYPE_MJPEG */
+    { "jpegenc", NULL },
+
+    /* SPICE_VIDEO_CODEC_TYPE_VP8 */
+    { "vp8enc deadline=1", NULL },
+
+    /* SPICE_VIDEO_CODEC_TYPE_H264 */
+    { "x264enc tune=zerolatency speed-preset=ultrafast ! video/x-h264,stream-format=byte-stream",
+      "openh264enc ! video/x-h264,stream-format=byte-stream", NULL },
+
+    /* SPICE_VIDEO_CODEC_TYPE_VP9 */
+    { "vp9enc deadline=1", NULL },
+
+    /* SPICE_VIDEO_CODEC_TYPE_H265 */
+    { "x265enc tune=zerolatency speed-preset=ultrafast ! video/x-h265,stream-format=byte-stream",
+      NULL },
+};
+
+G_STATIC_ASSERT(G_N_ELEMENTS(probe_encoders) == G_N_ELEMENTS(gst_opts));
+
+/* decoding time of a frame of each codec, in us, or -1 if unknown */
+static gint64 probe_results[G_N_ELEMENTS(gst_opts)];
+
+#if GST_CHECK_VERSION(1,10,0)
+static GPtrArray *probe_encode_clip(int codec_type)
+{
+    GPtrArray *clip = NULL;
+    GstElement *pipeline = NULL;
+    GstAppSink *sink;
+    GstSample *sample;
+    guint i;
+
+    for (i = 0; probe_encoders[codec_type][i] != NULL && pipeline == NULL; i++) {
+        gchar *desc;
+
+        desc = g_strdup_printf("videotestsrc num-buffers=%d pattern=smpte ! "
+                               "video/x-raw,format=I420,width=%d,height=%d,framerate=30/1 ! "
+                               "%s ! %s ! appsink name=sink sync=false",
+                               PROBE_FRAMES, PROBE_WIDTH, PROBE_HEIGHT,
+                               probe_encoders[codec_type][i],
+                               gst_opts[codec_type].dec_caps);
+        pipeline = gst_parse_launch_full(desc, NULL, GST_PARSE_FLAG_FATAL_ERRORS, NULL);
+        g_free(desc);
+    }
+    if (pipeline == NULL) {
+        SPICE_DEBUG("no encoder to probe the %s decoder", gst_opts[codec_type].name);
+        return NULL;
+    }
+
+    sink = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(pipeline), "sink"));
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE) {
+        clip = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+        while ((sample = gst_app_sink_try_pull_sample(sink, PROBE_TIMEOUT))) {
+            g_ptr_array_add(clip, gst_buffer_ref(gst_sample_get_buffer(sample)));
+            gst_sample_unref(sample);
+        }
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+
+    if (clip != NULL && clip->len < PROBE_FRAMES) {
+        SPICE_DEBUG("could not encode the %s sample clip", gst_opts[codec_type].name);
+        g_clear_pointer(&clip, g_ptr_array_unref);
+    }
+    return clip;
+}
+
+/* Returns the time it takes to decode a frame of @clip, in us, through the
+ * same pipeline as the video streams, or -1 if it could not be decoded */
+static gint64 probe_decode_clip(int codec_type, GPtrArray *clip)
+{
+    SpiceGstDecoder *decoder = g_new0(SpiceGstDecoder, 1);
+    GstSample *sample;
+    gint64 start = 0, end = 0;
+    guint i, decoded = 0;
+
+    decoder->base.codec_type = codec_type;
+    g_mutex_init(&decoder->queues_mutex);
+    decoder->decoding_queue = g_queue_new();
+
+    if (create_pipeline(decoder) && decoder->appsrc != NULL && decoder->appsink != NULL) {
+        for (i = 0; i < clip->len; i++) {
+            gst_app_src_push_buffer(decoder->appsrc, gst_buffer_copy(g_ptr_array_index(clip, i)));
+        }
+        gst_app_src_end_of_stream(decoder->appsrc);
+
+        /* the first frame also pays for building the decoder */
+        while ((sample = gst_app_sink_try_pull_sample(decoder->appsink, PROBE_TIMEOUT))) {
+            end = g_get_monotonic_time();
+            if (decoded++ == 0) {
+                start = end;
+            }
+            gst_sample_unref(sample);
+        }
+    }
+    spice_gst_decoder_destroy((VideoDecoder*)decoder);
+
+    if (decoded < clip->len) {
+        SPICE_DEBUG("the %s decoder only decoded %u frames out of %u",
+                    gst_opts[codec_type].name, decoded, clip->len);
+        return -1;
+    }
+    return (end - start) / (decoded - 1);
+}
+#endif
+
+static gint compare_strings(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* Identifies the set of GStreamer plugins the results were measured with */
+static gchar *probe_registry_hash(void)
+{
+    GList *plugins, *l;
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    gchar *hash;
+    guint i;
+
+    plugins = gst_registry_get_plugin_list(gst_registry_get());
+    for (l = plugins; l != NULL; l = l->next) {
+        GstPlugin *plugin = l->data;
+
+        g_ptr_array_add(names, g_strdup_printf("%s %s %s",
+                                               gst_plugin_get_name(plugin),
+                                               gst_plugin_get_version(plugin),
+                                               gst_plugin_get_filename(plugin)));
+    }
+    gst_plugin_list_free(plugins);
+
+    /* the registry order is not stable */
+    g_ptr_array_sort(names, compare_strings);
+    for (i = 0; i < names->len; i++) {
+        g_checksum_update(checksum, g_ptr_array_index(names, i), -1);
+        g_checksum_update(checksum, (const guchar *)"\n", 1);
+    }
+    hash = g_strdup_printf("%d-%s", PROBE_VERSION, g_checksum_get_string(checksum));
+
+    g_checksum_free(checksum);
+    g_ptr_array_unref(names);
+    return hash;
+}
+
+static gchar *probe_cache_filename(void)
+{
+    return g_build_filename(g_get_user_cache_dir(), "spice-gtk", "video-decoders.ini", NULL);
+}
+
+static gboolean probe_load(const gchar *filename, const gchar *hash)
+{
+    GKeyFile *keyfile = g_key_file_new();
+    gboolean loaded = FALSE;
+    gchar *cached = NULL;
+    guint i;
+
+    if (!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, NULL))
+        goto end;
+
+    cached = g_key_file_get_string(keyfile, "decoders", "registry", NULL);
+    if (g_strcmp0(cached, hash) != 0)
+        goto end;
+
+    for (i = 1; i < G_N_ELEMENTS(gst_opts); i++) {
+        GError *err = NULL;
+
+        probe_results[i] = g_key_file_get_int64(keyfile, "decoders", gst_opts[i].name, &err);
+        if (err != NULL) {
+            probe_results[i] = -1;
+            g_clear_error(&err);
+        }
+    }
+    loaded = TRUE;
+
+end:
+    g_free(cached);
+    g_key_file_free(keyfile);
+    return loaded;
+}
+
+static void probe_save(const gchar *filename, const gchar *hash)
+{
+    GKeyFile *keyfile = g_key_file_new();
+    gchar *dir = g_path_get_dirname(filename);
+    GError *err = NULL;
+    guint i;
+
+    g_key_file_set_string(keyfile, "decoders", "registry", hash);
+    for (i = 1; i < G_N_ELEMENTS(gst_opts); i++) {
+        g_key_file_set_int64(keyfile, "decoders", gst_opts[i].name, probe_results[i]);
+    }
+
+    if (g_mkdir_with_parents(dir, 0700) != 0 ||
+        !g_key_file_save_to_file(keyfile, filename, &err)) {
+        SPICE_DEBUG("could not save the video decoders speed: %s",
+                    err ? err->message : g_strerror(errno));
+        g_clear_error(&err);
+    }
+
+    g_free(dir);
+    g_key_file_free(keyfile);
+}
+
+static gpointer probe_codecs(gpointer data G_GNUC_UNUSED)
+{
+    gchar *filename = probe_cache_filename();
+    gchar *hash = probe_registry_hash();
+    guint i;
+
+    if (probe_load(filename, hash)) {
+        SPICE_DEBUG("video decoders speed loaded from %s", filename);
+        goto end;
+    }
+
+    for (i = 1; i < G_N_ELEMENTS(gst_opts); i++) {
+        probe_results[i] = -1;
+#if GST_CHECK_VERSION(1,10,0)
+        if (gstvideo_has_codec(i)) {
+            GPtrArray *clip = probe_encode_clip(i);
+
+            if (clip != NULL) {
+                probe_results[i] = probe_decode_clip(i, clip);
+                g_ptr_array_unref(clip);
+            }
+        }
+#endif
+        SPICE_DEBUG("%s decoder: %" G_GINT64_FORMAT " us per %dx%d frame",
+                    gst_opts[i].name, probe_results[i], PROBE_WIDTH, PROBE_HEIGHT);
+    }
+    probe_save(filename, hash);
+
+end:
+    g_free(hash);
+    g_free(filename);
+    return NULL;
+}
+
+static gint compare_probe_results(gconstpointer a, gconstpointer b)
+{
+    gint64 ra = probe_results[*(const gint *)a], rb = probe_results[*(const gint *)b];
+
+    return ra < rb ? -1 : ra > rb;
+}
+
+static void probe_codecs_thread(GTask *task,
+                                gpointer source_object G_GNUC_UNUSED,
+                                gpointer task_data G_GNUC_UNUSED,
+                                GCancellable *cancellable G_GNUC_UNUSED)
+{
+    static GOnce probe_once = G_ONCE_INIT;
+    GArray *codecs = g_array_new(FALSE, FALSE, sizeof(gint));
+    gint codec_type;
+
+    g_once(&probe_once, probe_codecs, NULL);
+
+    for (codec_type = 1; codec_type < G_N_ELEMENTS(gst_opts); codec_type++) {
+        if (probe_results[codec_type] >= 0)
+            g_array_append_val(codecs, codec_type);
+    }
+    g_array_sort(codecs, compare_probe_results);
+
+    g_task_return_pointer(task, codecs, (GDestroyNotify)g_array_unref);
+}
+
+/* Measures, or loads from the cache, how fast GStreamer decodes each
+ * codec. This is done once per process, in a thread. */
+G_GNUC_INTERNAL
+void gstvideo_probe_codecs_async(gpointer source_object,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data)
+{
+    GTask *task = g_task_new(source_object, NULL, callback, user_data);
+
+    if (!gstvideo_init()) {
+        g_task_return_new_error(task, SPICE_CLIENT_ERROR, SPICE_CLIENT_ERROR_FAILED,
+                                "GStreamer is not available");
+    } else {
+        g_task_run_in_thread(task, probe_codecs_thread);
+    }
+    g_object_unref(task);
+}
+
+/* Returns the codecs that could be measured, fastest first */
+G_GNUC_INTERNAL
+GArray *gstvideo_probe_codecs_finish(GAsyncResult *result, GError **error)
+{
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
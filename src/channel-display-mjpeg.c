@@ -26,35 +26,83 @@
 
 /* MJpeg decoder implementation */
 
+/* The decoded frames go to stream_display_frame() as GBytes, and their
+ * buffer comes back to the pool once they are released: right away when
+ * the frame is written to the canvas, later when a widget keeps it. */
+typedef struct MJpegBufferPool {
+    gint refs;
+    GMutex lock;
+    gsize size;
+    GQueue free;
+} MJpegBufferPool;
+
+typedef struct MJpegBuffer {
+    MJpegBufferPool *pool;
+    gsize size;
+    uint8_t data[];
+} MJpegBuffer;
+
+/* the unused buffers kept, enough for the frames decoded concurrently */
+#define MJPEG_POOL_MAX 4
+
 typedef struct MJpegDecoder {
     VideoDecoder base;
 
-    /* ---------- The builtin mjpeg decoder ---------- */
-
-    struct jpeg_source_mgr         mjpeg_src;
-    struct jpeg_decompress_struct  mjpeg_cinfo;
-    struct jpeg_error_mgr          mjpeg_jerr;
-
     /* ---------- Frame queue ---------- */
 
     GQueue *msgq;
     SpiceFrame *cur_frame;
     guint timer_id;
 
-    /* ---------- Output frame data ---------- */
+    /* ---------- Parallel decoding ---------- */
 
-    uint8_t *out_frame;
-    uint32_t out_size;
+    /* The frames are decoded as they arrive by the workers, then go to
+     * msgq in order once decoded, waiting for their time to be displayed.
+     * Without workers they are decoded when it's time to display them. */
+    GThreadPool *workers;
+    GMutex jobs_mutex;
+    GQueue *jobs;
+    guint collect_id;
+    /* the MJpegJob of the frames in msgq */
+    GHashTable *decoded;
+
+    MJpegBufferPool *pool;
 } MJpegDecoder;
 
+typedef struct MJpegJob {
+    SpiceFrame *frame;
+    gboolean back_compat;
+    /* the queue was dropped, the frame is freed once collected.
+     * Protected by jobs_mutex */
+    gboolean discarded;
+
+    /* set by the worker, protected by jobs_mutex */
+    gboolean done;
+    GBytes *pixels;
+    uint32_t width;
+    uint32_t height;
+} MJpegJob;
+
+/* ---------- The builtin mjpeg decoder ---------- */
+
+/* One libjpeg instance per thread */
+typedef struct MJpegContext {
+    struct jpeg_source_mgr         mjpeg_src;
+    struct jpeg_decompress_struct  mjpeg_cinfo;
+    struct jpeg_error_mgr          mjpeg_jerr;
+
+    const uint8_t *data;
+    size_t size;
+} MJpegContext;
+
 
 /* ---------- The JPEG library callbacks ---------- */
 
 static void mjpeg_src_init(struct jpeg_decompress_struct *cinfo)
 {
-    MJpegDecoder *decoder = SPICE_CONTAINEROF(cinfo->src, MJpegDecoder, mjpeg_src);
-    cinfo->src->bytes_in_buffer = decoder->cur_frame->size;
-    cinfo->src->next_input_byte = decoder->cur_frame->data;
+    MJpegContext *ctx = SPICE_CONTAINEROF(cinfo->src, MJpegContext, mjpeg_src);
+    cinfo->src->bytes_in_buffer = ctx->size;
+    cinfo->src->next_input_byte = ctx->data;
 }
 
 static boolean mjpeg_src_fill(struct jpeg_decompress_struct *cinfo)
@@ -74,71 +122,166 @@ static void mjpeg_src_term(struct jpeg_decompress_struct *cinfo)
     /* nothing */
 }
 
+static void mjpeg_context_free(gpointer data)
+{
+    MJpegContext *ctx = data;
+
+    jpeg_destroy_decompress(&ctx->mjpeg_cinfo);
+    g_free(ctx);
+}
 
-/* ---------- A SpiceFrame helper ---------- */
+static GPrivate mjpeg_context = G_PRIVATE_INIT(mjpeg_context_free);
 
-static void free_spice_frame(SpiceFrame *frame)
+static MJpegContext *mjpeg_context_get(void)
 {
-    frame->unref_data(frame->data_opaque);
-    frame->free(frame);
+    MJpegContext *ctx = g_private_get(&mjpeg_context);
+
+    if (ctx != NULL) {
+        return ctx;
+    }
+
+    ctx = g_new0(MJpegContext, 1);
+    ctx->mjpeg_cinfo.err = jpeg_std_error(&ctx->mjpeg_jerr);
+    jpeg_create_decompress(&ctx->mjpeg_cinfo);
+
+    ctx->mjpeg_src.init_source         = mjpeg_src_init;
+    ctx->mjpeg_src.fill_input_buffer   = mjpeg_src_fill;
+    ctx->mjpeg_src.skip_input_data     = mjpeg_src_skip;
+    ctx->mjpeg_src.resync_to_restart   = jpeg_resync_to_restart;
+    ctx->mjpeg_src.term_source         = mjpeg_src_term;
+    ctx->mjpeg_cinfo.src               = &ctx->mjpeg_src;
+
+    g_private_set(&mjpeg_context, ctx);
+    return ctx;
 }
 
+/* ---------- The output buffers ---------- */
 
-/* ---------- Decoder proper ---------- */
+static MJpegBufferPool *mjpeg_buffer_pool_new(void)
+{
+    MJpegBufferPool *pool = g_new0(MJpegBufferPool, 1);
 
-static void mjpeg_decoder_schedule(MJpegDecoder *decoder);
+    pool->refs = 1;
+    g_mutex_init(&pool->lock);
+    g_queue_init(&pool->free);
+    return pool;
+}
 
-/* main context */
-static gboolean mjpeg_decoder_decode_frame(gpointer video_decoder)
+static void mjpeg_buffer_pool_unref(MJpegBufferPool *pool)
 {
-    MJpegDecoder *decoder = (MJpegDecoder*)video_decoder;
-    gboolean back_compat = decoder->base.stream->channel->priv->peer_hdr.major_version == 1;
+    if (!g_atomic_int_dec_and_test(&pool->refs)) {
+        return;
+    }
+    g_queue_foreach(&pool->free, (GFunc)g_free, NULL);
+    g_queue_clear(&pool->free);
+    g_mutex_clear(&pool->lock);
+    g_free(pool);
+}
+
+/* main context or decoding thread */
+static MJpegBuffer *mjpeg_buffer_get(MJpegBufferPool *pool, gsize size)
+{
+    MJpegBuffer *buffer;
+
+    g_mutex_lock(&pool->lock);
+    if (pool->size != size) {
+        /* the stream was resized */
+        g_queue_foreach(&pool->free, (GFunc)g_free, NULL);
+        g_queue_clear(&pool->free);
+        pool->size = size;
+    }
+    buffer = g_queue_pop_head(&pool->free);
+    g_mutex_unlock(&pool->lock);
+
+    if (buffer == NULL) {
+        buffer = g_malloc(sizeof(MJpegBuffer) + size);
+        buffer->size = size;
+    }
+    buffer->pool = pool;
+    g_atomic_int_inc(&pool->refs);
+    return buffer;
+}
+
+/* any thread, the free function of the decoded GBytes */
+static void mjpeg_buffer_release(gpointer data)
+{
+    MJpegBuffer *buffer = data;
+    MJpegBufferPool *pool = buffer->pool;
+
+    g_mutex_lock(&pool->lock);
+    if (buffer->size == pool->size && g_queue_get_length(&pool->free) < MJPEG_POOL_MAX) {
+        g_queue_push_head(&pool->free, buffer);
+        buffer = NULL;
+    }
+    g_mutex_unlock(&pool->lock);
+
+    g_free(buffer);
+    mjpeg_buffer_pool_unref(pool);
+}
+
+/* Decodes a JPEG image to 32 bit pixels, xRGB or, for the old protocol,
+ * xBGR, into a buffer of @pool if it is not NULL.
+ *
+ * main context or decoding thread */
+static GBytes *mjpeg_decode_pooled(MJpegBufferPool *pool,
+                                   const uint8_t *data, size_t size, gboolean back_compat,
+                                   uint32_t *out_width, uint32_t *out_height)
+{
+    MJpegContext *ctx = mjpeg_context_get();
+    struct jpeg_decompress_struct *cinfo = &ctx->mjpeg_cinfo;
     JDIMENSION width, height;
+    MJpegBuffer *buffer = NULL;
+    uint8_t *out_frame;
     uint8_t *dest;
     uint8_t *lines[4];
 
-    jpeg_read_header(&decoder->mjpeg_cinfo, 1);
-    width = decoder->mjpeg_cinfo.image_width;
-    height = decoder->mjpeg_cinfo.image_height;
-    if (decoder->out_size < width * height * 4) {
-        g_free(decoder->out_frame);
-        decoder->out_size = width * height * 4;
-        decoder->out_frame = g_malloc(decoder->out_size);
-    }
-    dest = decoder->out_frame;
+    ctx->data = data;
+    ctx->size = size;
+    jpeg_read_header(cinfo, 1);
+    width = cinfo->image_width;
+    height = cinfo->image_height;
 
 #ifdef JCS_EXTENSIONS
     // requires jpeg-turbo
     if (back_compat)
-        decoder->mjpeg_cinfo.out_color_space = JCS_EXT_RGBX;
+        cinfo->out_color_space = JCS_EXT_RGBX;
     else
-        decoder->mjpeg_cinfo.out_color_space = JCS_EXT_BGRX;
+        cinfo->out_color_space = JCS_EXT_BGRX;
 #else
 #warning "You should consider building with libjpeg-turbo"
-    decoder->mjpeg_cinfo.out_color_space = JCS_RGB;
+    cinfo->out_color_space = JCS_RGB;
 #endif
 
 #ifndef SPICE_QUALITY
-    decoder->mjpeg_cinfo.dct_method = JDCT_IFAST;
-    decoder->mjpeg_cinfo.do_fancy_upsampling = FALSE;
-    decoder->mjpeg_cinfo.do_block_smoothing = FALSE;
-    decoder->mjpeg_cinfo.dither_mode = JDITHER_ORDERED;
+    cinfo->dct_method = JDCT_IFAST;
+    cinfo->do_fancy_upsampling = FALSE;
+    cinfo->do_block_smoothing = FALSE;
+    cinfo->dither_mode = JDITHER_ORDERED;
 #endif
     // TODO: in theory should check cinfo.output_height match with our height
-    jpeg_start_decompress(&decoder->mjpeg_cinfo);
+    jpeg_start_decompress(cinfo);
     /* rec_outbuf_height is the recommended size of the output buffer we
      * pass to libjpeg for optimum performance
      */
-    if (decoder->mjpeg_cinfo.rec_outbuf_height > G_N_ELEMENTS(lines)) {
-        jpeg_abort_decompress(&decoder->mjpeg_cinfo);
-        g_return_val_if_reached(G_SOURCE_REMOVE);
+    if (cinfo->rec_outbuf_height > G_N_ELEMENTS(lines)) {
+        jpeg_abort_decompress(cinfo);
+        g_return_val_if_reached(NULL);
     }
 
-    while (decoder->mjpeg_cinfo.output_scanline < decoder->mjpeg_cinfo.output_height) {
+    /* the frame may be kept by the widgets, see stream_display_frame() */
+    if (pool != NULL) {
+        buffer = mjpeg_buffer_get(pool, width * height * 4);
+        out_frame = buffer->data;
+    } else {
+        out_frame = g_malloc(width * height * 4);
+    }
+    dest = out_frame;
+
+    while (cinfo->output_scanline < cinfo->output_height) {
         /* only used when JCS_EXTENSIONS is undefined */
         G_GNUC_UNUSED unsigned int lines_read;
 
-        for (unsigned int j = 0; j < decoder->mjpeg_cinfo.rec_outbuf_height; j++) {
+        for (unsigned int j = 0; j < cinfo->rec_outbuf_height; j++) {
             lines[j] = dest;
 #ifdef JCS_EXTENSIONS
             dest += 4 * width;
@@ -146,8 +289,8 @@ static gboolean mjpeg_decoder_decode_frame(gpointer video_decoder)
             dest += 3 * width;
 #endif
         }
-        lines_read = jpeg_read_scanlines(&decoder->mjpeg_cinfo, lines,
-                                decoder->mjpeg_cinfo.rec_outbuf_height);
+        lines_read = jpeg_read_scanlines(cinfo, lines,
+                                cinfo->rec_outbuf_height);
 #ifndef JCS_EXTENSIONS
         {
             uint8_t *s = lines[0];
@@ -170,14 +313,86 @@ static gboolean mjpeg_decoder_decode_frame(gpointer video_decoder)
             }
         }
 #endif
-        dest = &(decoder->out_frame[decoder->mjpeg_cinfo.output_scanline * width * 4]);
+        dest = &out_frame[cinfo->output_scanline * width * 4];
+    }
+    jpeg_finish_decompress(cinfo);
+
+    *out_width = width;
+    *out_height = height;
+    if (buffer != NULL) {
+        return g_bytes_new_with_free_func(out_frame, width * height * 4,
+                                          mjpeg_buffer_release, buffer);
+    }
+    return g_bytes_new_take(out_frame, width * height * 4);
+}
+
+/* main context or decoding thread */
+G_GNUC_INTERNAL
+GBytes *mjpeg_decode(const uint8_t *data, size_t size, gboolean back_compat,
+                     uint32_t *out_width, uint32_t *out_height)
+{
+    return mjpeg_decode_pooled(NULL, data, size, back_compat, out_width, out_height);
+}
+
+
+/* ---------- A SpiceFrame helper ---------- */
+
+static void free_spice_frame(SpiceFrame *frame)
+{
+    frame->unref_data(frame->data_opaque);
+    frame->free(frame);
+}
+
+static void mjpeg_job_free(MJpegJob *job)
+{
+    g_clear_pointer(&job->pixels, g_bytes_unref);
+    g_free(job);
+}
+
+static void mjpeg_decoder_free_frame(MJpegDecoder *decoder, SpiceFrame *frame)
+{
+    if (decoder->decoded) {
+        g_hash_table_remove(decoder->decoded, frame);
+    }
+    free_spice_frame(frame);
+}
+
+
+/* ---------- Decoder proper ---------- */
+
+static void mjpeg_decoder_schedule(MJpegDecoder *decoder);
+
+/* main context */
+static gboolean mjpeg_decoder_decode_frame(gpointer video_decoder)
+{
+    MJpegDecoder *decoder = (MJpegDecoder*)video_decoder;
+    gboolean back_compat = decoder->base.stream->channel->priv->peer_hdr.major_version == 1;
+    SpiceFrame *frame = decoder->cur_frame;
+    MJpegJob *job = decoder->decoded ? g_hash_table_lookup(decoder->decoded, frame) : NULL;
+    uint32_t width, height;
+    GBytes *pixels;
+
+    if (job != NULL) {
+        /* already decoded by a worker */
+        pixels = job->pixels ? g_bytes_ref(job->pixels) : NULL;
+        width = job->width;
+        height = job->height;
+    } else {
+        stream_timing_mark(decoder->base.stream, frame, SPICE_STREAM_TIMING_DECODE_START);
+        pixels = mjpeg_decode_pooled(decoder->pool, frame->data, frame->size, back_compat,
+                                     &width, &height);
+        stream_timing_mark(decoder->base.stream, frame, SPICE_STREAM_TIMING_DECODE_END);
     }
-    jpeg_finish_decompress(&decoder->mjpeg_cinfo);
 
     /* Display the frame and dispose of it */
-    stream_display_frame(decoder->base.stream, decoder->cur_frame,
-                         width, height, SPICE_UNKNOWN_STRIDE, decoder->out_frame);
-    free_spice_frame(decoder->cur_frame);
+    if (pixels != NULL) {
+        stream_display_frame(decoder->base.stream, frame,
+                             width, height, SPICE_UNKNOWN_STRIDE, pixels);
+        g_bytes_unref(pixels);
+    } else {
+        stream_dropped_frame_on_playback(decoder->base.stream, frame);
+    }
+    mjpeg_decoder_free_frame(decoder, frame);
     decoder->cur_frame = NULL;
     decoder->timer_id = 0;
 
@@ -187,6 +402,65 @@ static gboolean mjpeg_decoder_decode_frame(gpointer video_decoder)
     return G_SOURCE_REMOVE;
 }
 
+/* main context */
+static gboolean mjpeg_decoder_collect(gpointer video_decoder)
+{
+    MJpegDecoder *decoder = (MJpegDecoder*)video_decoder;
+    MJpegJob *job;
+
+    g_mutex_lock(&decoder->jobs_mutex);
+    decoder->collect_id = 0;
+    /* the frames are decoded concurrently, keep them in order */
+    while ((job = g_queue_peek_head(decoder->jobs)) != NULL && job->done) {
+        g_queue_pop_head(decoder->jobs);
+        if (job->discarded) {
+            free_spice_frame(job->frame);
+            mjpeg_job_free(job);
+            continue;
+        }
+        g_hash_table_insert(decoder->decoded, job->frame, job);
+        g_queue_push_tail(decoder->msgq, job->frame);
+    }
+    g_mutex_unlock(&decoder->jobs_mutex);
+
+    mjpeg_decoder_schedule(decoder);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* decoding thread */
+static void mjpeg_decoder_decode_job(gpointer data, gpointer video_decoder)
+{
+    MJpegDecoder *decoder = (MJpegDecoder*)video_decoder;
+    MJpegJob *job = data;
+    uint32_t width = 0, height = 0;
+    GBytes *pixels = NULL;
+    gboolean discarded;
+
+    g_mutex_lock(&decoder->jobs_mutex);
+    discarded = job->discarded;
+    g_mutex_unlock(&decoder->jobs_mutex);
+
+    /* the frame belongs to the job until it is collected */
+    if (!discarded) {
+        stream_timing_mark(decoder->base.stream, job->frame, SPICE_STREAM_TIMING_DECODE_START);
+        pixels = mjpeg_decode_pooled(decoder->pool, job->frame->data, job->frame->size,
+                                     job->back_compat, &width, &height);
+        stream_timing_mark(decoder->base.stream, job->frame, SPICE_STREAM_TIMING_DECODE_END);
+    }
+
+    g_mutex_lock(&decoder->jobs_mutex);
+    job->pixels = pixels;
+    job->width = width;
+    job->height = height;
+    job->done = TRUE;
+    if (decoder->collect_id == 0) {
+        decoder->collect_id = g_idle_add_full(G_PRIORITY_DEFAULT, mjpeg_decoder_collect,
+                                              decoder, NULL);
+    }
+    g_mutex_unlock(&decoder->jobs_mutex);
+}
+
 /* ---------- VideoDecoder's queue scheduling ---------- */
 
 static void mjpeg_decoder_schedule(MJpegDecoder *decoder)
@@ -195,11 +469,22 @@ static void mjpeg_decoder_schedule(MJpegDecoder *decoder)
         return;
     }
 
-    guint32 time = stream_get_time(decoder->base.stream);
+    guint32 time = stream_get_present_time(decoder->base.stream);
     SpiceFrame *frame = decoder->cur_frame;
     decoder->cur_frame = NULL;
     do {
-        if (frame) {
+        if (frame && decoder->base.stream->low_latency) {
+            /* MJPEG frames don't depend on each other, go to the newest */
+            if (g_queue_is_empty(decoder->msgq)) {
+                decoder->cur_frame = frame;
+                decoder->timer_id = g_timeout_add(0, mjpeg_decoder_decode_frame, decoder);
+                break;
+            }
+
+            SPICE_DEBUG("%s: low latency, dropping an outdated frame", __FUNCTION__);
+            stream_dropped_frame_on_playback(decoder->base.stream, frame);
+            mjpeg_decoder_free_frame(decoder, frame);
+        } else if (frame) {
             if (spice_mmtime_diff(time, frame->mm_time) <= 0) {
                 guint32 d = frame->mm_time - time;
                 decoder->cur_frame = frame;
@@ -210,8 +495,8 @@ static void mjpeg_decoder_schedule(MJpegDecoder *decoder)
             SPICE_DEBUG("%s: rendering too late by %u ms (ts: %u, mmtime: %u), dropping ",
                         __FUNCTION__, time - frame->mm_time,
                         frame->mm_time, time);
-            stream_dropped_frame_on_playback(decoder->base.stream);
-            free_spice_frame(frame);
+            stream_dropped_frame_on_playback(decoder->base.stream, frame);
+            mjpeg_decoder_free_frame(decoder, frame);
         }
         frame = g_queue_pop_head(decoder->msgq);
     } while (frame);
@@ -221,23 +506,53 @@ static void mjpeg_decoder_schedule(MJpegDecoder *decoder)
 /* mjpeg_decoder_drop_queue() helper */
 static void _msg_in_unref_func(gpointer data, gpointer user_data)
 {
-    free_spice_frame((SpiceFrame*)data);
+    mjpeg_decoder_free_frame((MJpegDecoder*)user_data, (SpiceFrame*)data);
 }
 
 static void mjpeg_decoder_drop_queue(MJpegDecoder *decoder)
 {
+    MJpegJob *job;
+    GList *l;
+
+    if (decoder->workers) {
+        /* the frames being decoded are not shown once collected */
+        g_mutex_lock(&decoder->jobs_mutex);
+        for (l = decoder->jobs->head; l != NULL; l = l->next) {
+            job = l->data;
+            job->discarded = TRUE;
+        }
+        g_mutex_unlock(&decoder->jobs_mutex);
+    }
     if (decoder->timer_id != 0) {
         g_source_remove(decoder->timer_id);
         decoder->timer_id = 0;
     }
     if (decoder->cur_frame) {
-        free_spice_frame(decoder->cur_frame);
+        mjpeg_decoder_free_frame(decoder, decoder->cur_frame);
         decoder->cur_frame = NULL;
     }
-    g_queue_foreach(decoder->msgq, _msg_in_unref_func, NULL);
+    g_queue_foreach(decoder->msgq, _msg_in_unref_func, decoder);
     g_queue_clear(decoder->msgq);
 }
 
+/* The most recent frame queued: the last one given to the workers, or
+ * the last one waiting to be displayed */
+static SpiceFrame *mjpeg_decoder_last_frame(MJpegDecoder *decoder)
+{
+    SpiceFrame *frame = NULL;
+    MJpegJob *job;
+
+    if (decoder->workers) {
+        g_mutex_lock(&decoder->jobs_mutex);
+        job = g_queue_peek_tail(decoder->jobs);
+        if (job != NULL && !job->discarded) {
+            frame = job->frame;
+        }
+        g_mutex_unlock(&decoder->jobs_mutex);
+    }
+    return frame ? frame : g_queue_peek_tail(decoder->msgq);
+}
+
 /* ---------- VideoDecoder's public API ---------- */
 
 static gboolean mjpeg_decoder_queue_frame(VideoDecoder *video_decoder,
@@ -246,7 +561,7 @@ static gboolean mjpeg_decoder_queue_frame(VideoDecoder *video_decoder,
     MJpegDecoder *decoder = (MJpegDecoder*)video_decoder;
     SpiceFrame *last_frame;
 
-    last_frame = g_queue_peek_tail(decoder->msgq);
+    last_frame = mjpeg_decoder_last_frame(decoder);
     if (last_frame) {
         if (spice_mmtime_diff(frame->mm_time, last_frame->mm_time) < 0) {
             /* This should really not happen */
@@ -268,6 +583,17 @@ static gboolean mjpeg_decoder_queue_frame(VideoDecoder *video_decoder,
     }
 
     frame->ref_data(frame->data_opaque);
+    if (decoder->workers) {
+        MJpegJob *job = g_new0(MJpegJob, 1);
+
+        job->frame = frame;
+        job->back_compat = decoder->base.stream->channel->priv->peer_hdr.major_version == 1;
+        g_mutex_lock(&decoder->jobs_mutex);
+        g_queue_push_tail(decoder->jobs, job);
+        g_mutex_unlock(&decoder->jobs_mutex);
+        g_thread_pool_push(decoder->workers, job, NULL);
+        return TRUE;
+    }
     g_queue_push_tail(decoder->msgq, frame);
     mjpeg_decoder_schedule(decoder);
     return TRUE;
@@ -288,11 +614,27 @@ static void mjpeg_decoder_reschedule(VideoDecoder *video_decoder)
 static void mjpeg_decoder_destroy(VideoDecoder* video_decoder)
 {
     MJpegDecoder *decoder = (MJpegDecoder*)video_decoder;
+    MJpegJob *job;
 
     mjpeg_decoder_drop_queue(decoder);
+    if (decoder->workers) {
+        /* wait for the frames being decoded and skip the others */
+        g_thread_pool_free(decoder->workers, TRUE, TRUE);
+        if (decoder->collect_id) {
+            g_source_remove(decoder->collect_id);
+        }
+        while ((job = g_queue_pop_head(decoder->jobs))) {
+            free_spice_frame(job->frame);
+            mjpeg_job_free(job);
+        }
+        g_queue_free(decoder->jobs);
+        g_mutex_clear(&decoder->jobs_mutex);
+    }
+
     g_queue_free(decoder->msgq);
-    jpeg_destroy_decompress(&decoder->mjpeg_cinfo);
-    g_free(decoder->out_frame);
+    g_clear_pointer(&decoder->decoded, g_hash_table_unref);
+    /* the widgets may still hold a frame */
+    mjpeg_buffer_pool_unref(decoder->pool);
     g_free(decoder);
 }
 
@@ -310,16 +652,20 @@ VideoDecoder* create_mjpeg_decoder(int codec_type, display_stream *stream)
     decoder->base.stream = stream;
 
     decoder->msgq = g_queue_new();
-
-    decoder->mjpeg_cinfo.err = jpeg_std_error(&decoder->mjpeg_jerr);
-    jpeg_create_decompress(&decoder->mjpeg_cinfo);
-
-    decoder->mjpeg_src.init_source         = mjpeg_src_init;
-    decoder->mjpeg_src.fill_input_buffer   = mjpeg_src_fill;
-    decoder->mjpeg_src.skip_input_data     = mjpeg_src_skip;
-    decoder->mjpeg_src.resync_to_restart   = jpeg_resync_to_restart;
-    decoder->mjpeg_src.term_source         = mjpeg_src_term;
-    decoder->mjpeg_cinfo.src               = &decoder->mjpeg_src;
+    decoder->pool = mjpeg_buffer_pool_new();
+
+    if (g_getenv("SPICE_MJPEG_THREADS")) {
+        gint threads = atoi(g_getenv("SPICE_MJPEG_THREADS"));
+
+        if (threads > 1) {
+            decoder->workers = g_thread_pool_new(mjpeg_decoder_decode_job, decoder,
+                                                 threads, FALSE, NULL);
+            g_mutex_init(&decoder->jobs_mutex);
+            decoder->jobs = g_queue_new();
+            decoder->decoded = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                                     (GDestroyNotify)mjpeg_job_free);
+        }
+    }
 
     /* All the other fields are initialized to zero by g_new0(). */
 
@@ -30,6 +30,8 @@
 #include "common/quic.h"
 #include "common/rop3.h"
 
+#include "channel-display-buffers.h"
+
 G_BEGIN_DECLS
 
 typedef struct display_stream display_stream;
@@ -38,6 +40,8 @@ typedef struct SpiceFrame SpiceFrame;
 struct SpiceFrame {
     uint32_t mm_time;
     SpiceRect dest;
+    /* number of the frame in the channel timings, see stream_timing_mark() */
+    gint timing;
 
     uint8_t *data;
     uint32_t size;
@@ -84,15 +88,25 @@ struct VideoDecoder {
  */
 #ifdef HAVE_BUILTIN_MJPEG
 VideoDecoder* create_mjpeg_decoder(int codec_type, display_stream *stream);
+GBytes *mjpeg_decode(const uint8_t *data, size_t size, gboolean back_compat,
+                     uint32_t *width, uint32_t *height);
 #endif
 #ifdef HAVE_GSTVIDEO
+typedef struct SpiceGstPipelinePool SpiceGstPipelinePool;
+SpiceGstPipelinePool *gstvideo_pipeline_pool_new(void);
+void gstvideo_pipeline_pool_free(SpiceGstPipelinePool *pool);
+SpiceGstPipelinePool *stream_get_pipeline_pool(display_stream *st);
+
 VideoDecoder* create_gstreamer_decoder(int codec_type, display_stream *stream);
 gboolean gstvideo_has_codec(int codec_type);
+void gstvideo_probe_codecs_async(gpointer source_object,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data);
+GArray *gstvideo_probe_codecs_finish(GAsyncResult *result, GError **error);
 #else
 # define gstvideo_has_codec(codec_type) FALSE
 #endif
 
-
 typedef struct display_surface {
     guint32                     surface_id;
     bool                        primary;
@@ -104,6 +118,7 @@ typedef struct display_surface {
     SpiceGlzDecoder             *glz_decoder;
     SpiceZlibDecoder            *zlib_decoder;
     SpiceJpegDecoder            *jpeg_decoder;
+    primary_buffers             *buffers;
 } display_surface;
 
 typedef struct drops_sequence_stats {
@@ -126,6 +141,19 @@ struct display_stream {
 
     SpiceChannel                *channel;
 
+    /* show the frames as soon as decoded, see SpiceSession:low-latency-video */
+    gboolean                    low_latency;
+
+    /* how late the last frame dropped for being late was, in ms, or 0;
+     * set from the decoders, see stream_dropped_frame_on_playback() */
+    guint                       dropped_av_offset;
+
+    /* last frame composited by the widgets instead of the canvas */
+    GBytes                      *overlay;
+    SpiceRect                   overlay_dest;
+    uint32_t                    overlay_width, overlay_height;
+    int                         overlay_stride;
+
     /* stats */
     uint32_t             first_frame_mm_time;
     uint32_t             arrive_late_count;
@@ -148,6 +176,7 @@ struct display_stream {
     uint32_t report_num_frames;
     uint32_t report_num_drops;
     uint32_t report_drops_seq_len;
+    uint32_t report_playback_drops;
 };
 
 static const struct {
@@ -196,10 +225,12 @@ static const struct {
 G_STATIC_ASSERT(G_N_ELEMENTS(gst_opts) <= SPICE_VIDEO_CODEC_TYPE_ENUM_END);
 
 guint32 stream_get_time(display_stream *st);
-void stream_dropped_frame_on_playback(display_stream *st);
+guint32 stream_get_present_time(display_stream *st);
+void stream_dropped_frame_on_playback(display_stream *st, SpiceFrame *frame);
 #define SPICE_UNKNOWN_STRIDE 0
-void stream_display_frame(display_stream *st, SpiceFrame *frame, uint32_t width, uint32_t height, int stride, uint8_t* data);
+void stream_display_frame(display_stream *st, SpiceFrame *frame, uint32_t width, uint32_t height, int stride, GBytes *pixels);
 guintptr get_window_handle(display_stream *st);
+void stream_timing_mark(display_stream *st, SpiceFrame *frame, SpiceStreamTimingStage stage);
 
 
 G_END_DECLS
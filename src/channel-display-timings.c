@@ -0,0 +1,161 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <string.h>
+
+#include "channel-display-timings.h"
+
+typedef struct stream_timing_slot {
+    /* even when the slot can be read, see stream_timings_write_begin() */
+    guint seq;
+    /* the frame recorded, or -1 */
+    gint frame;
+    SpiceStreamTiming timing;
+} stream_timing_slot;
+
+struct stream_timings {
+    stream_timing_slot slots[STREAM_TIMINGS_MAX];
+    /* the number of the next frame */
+    gint head;
+};
+
+stream_timings *stream_timings_new(void)
+{
+    stream_timings *t = g_new0(stream_timings, 1);
+    guint i;
+
+    for (i = 0; i < STREAM_TIMINGS_MAX; i++)
+        t->slots[i].frame = -1;
+
+    return t;
+}
+
+void stream_timings_free(stream_timings *t)
+{
+    g_free(t);
+}
+
+/* The writers of a slot take turns: the one that makes seq odd owns it
+ * until it makes it even again. They only hold it for a few stores. */
+static void stream_timings_write_begin(stream_timing_slot *slot)
+{
+    guint seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+    for (;;) {
+        if (seq & 1) {
+            g_thread_yield();
+            seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+            continue;
+        }
+        /* the writes that follow stay after it */
+        if (__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, FALSE,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+    }
+}
+
+static void stream_timings_write_end(stream_timing_slot *slot)
+{
+    /* the writes before it are seen with it */
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* the thread running the channel: records a new frame, whose number is
+ * returned */
+gint stream_timings_start(stream_timings *t, guint32 stream_id, guint32 mm_time)
+{
+    gint frame = __atomic_load_n(&t->head, __ATOMIC_RELAXED);
+    stream_timing_slot *slot = &t->slots[frame % STREAM_TIMINGS_MAX];
+
+    stream_timings_write_begin(slot);
+    slot->frame = frame;
+    memset(&slot->timing, 0, sizeof(slot->timing));
+    slot->timing.stream_id = stream_id;
+    slot->timing.mm_time = mm_time;
+    stream_timings_write_end(slot);
+
+    __atomic_store_n(&t->head, (frame + 1) & G_MAXINT, __ATOMIC_RELEASE);
+    return frame;
+}
+
+/* any thread: nothing is recorded if the ring went round since @frame */
+void stream_timings_mark(stream_timings *t, gint frame, SpiceStreamTimingStage stage,
+                         gint64 time, gint32 mm_delta)
+{
+    stream_timing_slot *slot;
+
+    g_return_if_fail(stage < SPICE_STREAM_TIMING_LAST);
+    if (frame < 0)
+        return;
+
+    slot = &t->slots[frame % STREAM_TIMINGS_MAX];
+    stream_timings_write_begin(slot);
+    if (slot->frame == frame) {
+        slot->timing.time[stage] = time;
+        slot->timing.mm_delta[stage] = mm_delta;
+    }
+    stream_timings_write_end(slot);
+}
+
+/* any thread: copies the timing of @frame, or returns FALSE if the ring
+ * went round since */
+gboolean stream_timings_get(stream_timings *t, gint frame, SpiceStreamTiming *timing)
+{
+    stream_timing_slot *slot;
+    guint seq;
+    gint owner;
+
+    if (frame < 0)
+        return FALSE;
+
+    slot = &t->slots[frame % STREAM_TIMINGS_MAX];
+    for (;;) {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            g_thread_yield();
+            continue;
+        }
+        owner = slot->frame;
+        *timing = slot->timing;
+        /* the copy is done before seq is checked again */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+            break;
+    }
+
+    return owner == frame;
+}
+
+/* any thread: copies the timings of the last @n frames, oldest first,
+ * and returns how many there were */
+guint stream_timings_get_last(stream_timings *t, SpiceStreamTiming *timings, guint n)
+{
+    gint head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    gint frame;
+    guint i = 0;
+
+    n = MIN(n, STREAM_TIMINGS_MAX);
+    n = MIN(n, (guint)head);
+    for (frame = head - n; frame < head; frame++) {
+        if (stream_timings_get(t, frame, &timings[i]))
+            i++;
+    }
+
+    return i;
+}
@@ -0,0 +1,49 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIENT_DISPLAY_TIMINGS_H__
+#define __SPICE_CLIENT_DISPLAY_TIMINGS_H__
+
+#include "spice-client.h"
+
+G_BEGIN_DECLS
+
+/* The timings of the last video frames, see
+ * spice_display_channel_get_stream_timings().
+ *
+ * The frames are numbered as they arrive, and recorded in a ring. A
+ * frame is started by the thread running the channel, then its stages
+ * are marked from whichever thread reaches them, the decoding threads
+ * included, while anyone may read them. Each slot of the ring is guarded
+ * by a sequence lock: it is odd while the slot is written, and a reader
+ * tries again when it was odd or changed during its copy. */
+typedef struct stream_timings stream_timings;
+
+#define STREAM_TIMINGS_MAX 512
+
+stream_timings *stream_timings_new(void);
+void stream_timings_free(stream_timings *t);
+
+gint stream_timings_start(stream_timings *t, guint32 stream_id, guint32 mm_time);
+void stream_timings_mark(stream_timings *t, gint frame, SpiceStreamTimingStage stage,
+                         gint64 time, gint32 mm_delta);
+gboolean stream_timings_get(stream_timings *t, gint frame, SpiceStreamTiming *timing);
+guint stream_timings_get_last(stream_timings *t, SpiceStreamTiming *timings, guint n);
+
+G_END_DECLS
+
+#endif /* __SPICE_CLIENT_DISPLAY_TIMINGS_H__ */
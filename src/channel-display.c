@@ -28,6 +28,9 @@
 #include "spice-channel-priv.h"
 #include "spice-session-priv.h"
 #include "channel-display-priv.h"
+#include "channel-display-controller.h"
+#include "channel-display-buffers.h"
+#include "channel-display-timings.h"
 #include "decode.h"
 
 /**
@@ -47,10 +50,18 @@
  *
  * The update of regions is notified by
  * #SpiceDisplayChannel::display-invalidate signals.
+ *
+ * When the SPICE_PIPELINE_POOL environment variable is set, the GStreamer
+ * pipelines of the destroyed video streams are kept for a while and
+ * reused by the next streams of the same codec, which then start
+ * without building a new pipeline.
  */
 
 #define MONITORS_MAX 256
 
+/* how often the main loop lag is sampled while streaming, in ms */
+#define STREAM_LOOP_LAG_INTERVAL 100
+
 struct _SpiceDisplayChannelPrivate {
     GHashTable                  *surfaces;
     display_surface             *primary;
@@ -67,6 +78,19 @@ struct _SpiceDisplayChannelPrivate {
     GArray                      *monitors;
     guint                       monitors_max;
     gboolean                    enable_adaptive_streaming;
+    guint                       primary_buffers;
+    stream_timings              *timings;
+    StreamController            *controller;
+    gboolean                    enable_stream_controller;
+    guint                       loop_lag_id;
+    gint64                      loop_lag_expected;
+    gboolean                    probe_video_codecs;
+    GArray                      *video_codecs;
+    gint                        preferred_video_codec;
+#ifdef HAVE_GSTVIDEO
+    gboolean                    enable_pipeline_pool;
+    SpiceGstPipelinePool        *pipeline_pool;
+#endif
     SpiceGlScanout scanout;
 };
 
@@ -89,6 +113,7 @@ enum {
     SPICE_DISPLAY_MARK,
     SPICE_DISPLAY_GL_DRAW,
     SPICE_DISPLAY_STREAMING_MODE,
+    SPICE_DISPLAY_STREAM_FRAME,
 
     SPICE_DISPLAY_LAST_SIGNAL,
 };
@@ -104,7 +129,13 @@ static display_surface *find_surface(SpiceDisplayChannelPrivate *c, guint32 surf
 static void spice_display_channel_reset(SpiceChannel *channel, gboolean migrating);
 static void spice_display_channel_reset_capabilities(SpiceChannel *channel);
 static void destroy_canvas(display_surface *surface);
+static void primary_buffers_publish(SpiceChannel *channel);
+static void stream_overlay_flush(display_stream *st);
+static void stream_overlays_flush(SpiceChannel *channel, const SpiceRect *rect);
 static void display_stream_destroy(gpointer st);
+static void display_update_stream_report(SpiceDisplayChannel *channel, uint32_t stream_id,
+                                         uint32_t frame_time, int32_t latency,
+                                         uint32_t skipped);
 static void display_session_mm_time_reset_cb(SpiceSession *session, gpointer data);
 static SpiceGlScanout* spice_gl_scanout_copy(const SpiceGlScanout *scanout);
 
@@ -141,6 +172,40 @@ spice_gl_scanout_free(SpiceGlScanout *scanout)
     g_free(scanout);
 }
 
+/* main or coroutine context */
+static void primary_buffers_publish(SpiceChannel *channel)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+    display_surface *surface = c->primary;
+    pixman_region32_t damage;
+    pixman_box32_t *boxes;
+    int n;
+
+    if (surface == NULL || surface->buffers == NULL)
+        return;
+
+    /* the handlers may run another batch while we are emitting */
+    if (!primary_buffers_swap(surface->buffers, surface->data, &damage))
+        return;
+
+    boxes = pixman_region32_rectangles(&damage, &n);
+    for (; n > 0; n--, boxes++) {
+        g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_INVALIDATE], 0,
+                                boxes->x1, boxes->y1,
+                                boxes->x2 - boxes->x1, boxes->y2 - boxes->y1);
+    }
+    pixman_region32_fini(&damage);
+}
+
+/* coroutine context */
+static void spice_display_channel_iterate_read(SpiceChannel *channel)
+{
+    SPICE_CHANNEL_CLASS(spice_display_channel_parent_class)->iterate_read(channel);
+
+    /* all the messages available were handled, show their result at once */
+    primary_buffers_publish(channel);
+}
+
 static void spice_display_channel_dispose(GObject *object)
 {
     SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(object)->priv;
@@ -150,6 +215,11 @@ static void spice_display_channel_dispose(GObject *object)
         c->mark_false_event_id = 0;
     }
 
+    if (c->loop_lag_id != 0) {
+        g_source_remove(c->loop_lag_id);
+        c->loop_lag_id = 0;
+    }
+
     if (c->scanout.fd >= 0) {
         close(c->scanout.fd);
         c->scanout.fd = -1;
@@ -168,6 +238,12 @@ static void spice_display_channel_finalize(GObject *object)
     g_hash_table_unref(c->surfaces);
     clear_streams(SPICE_CHANNEL(object));
     g_clear_pointer(&c->palettes, cache_free);
+    g_clear_pointer(&c->controller, stream_controller_free);
+    g_clear_pointer(&c->timings, stream_timings_free);
+    g_clear_pointer(&c->video_codecs, g_array_unref);
+#ifdef HAVE_GSTVIDEO
+    g_clear_pointer(&c->pipeline_pool, gstvideo_pipeline_pool_free);
+#endif
 
     if (G_OBJECT_CLASS(spice_display_channel_parent_class)->finalize)
         G_OBJECT_CLASS(spice_display_channel_parent_class)->finalize(object);
@@ -253,6 +329,19 @@ static void spice_display_channel_reset(SpiceChannel *channel, gboolean migratin
     SPICE_CHANNEL_CLASS(spice_display_channel_parent_class)->channel_reset(channel, migrating);
 }
 
+/* a frame can skip the canvas only if all the monitors composite it */
+static gboolean stream_frame_accumulator(GSignalInvocationHint *ihint,
+                                         GValue *return_accu,
+                                         const GValue *handler_return,
+                                         gpointer data)
+{
+    gboolean handled = g_value_get_boolean(handler_return);
+
+    g_value_set_boolean(return_accu, handled);
+
+    return handled;
+}
+
 static void spice_display_channel_class_init(SpiceDisplayChannelClass *klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
@@ -267,6 +356,7 @@ static void spice_display_channel_class_init(SpiceDisplayChannelClass *klass)
     channel_class->channel_up   = spice_display_channel_up;
     channel_class->channel_reset = spice_display_channel_reset;
     channel_class->channel_reset_capabilities = spice_display_channel_reset_capabilities;
+    channel_class->iterate_read = spice_display_channel_iterate_read;
 
     g_object_class_install_property
         (gobject_class, PROP_HEIGHT,
@@ -474,6 +564,34 @@ static void spice_display_channel_class_init(SpiceDisplayChannelClass *klass)
                      1,
                      G_TYPE_BOOLEAN);
 
+    /**
+     * SpiceDisplayChannel::stream-frame:
+     * @display: the #SpiceDisplayChannel that emitted the signal
+     * @id: the stream id
+     * @frame: the #SpiceDisplayStreamFrame
+     *
+     * The #SpiceDisplayChannel::stream-frame signal is emitted when a
+     * video frame of the primary surface is decoded. If all the
+     * handlers return %TRUE, they take care of compositing the frame
+     * over the primary surface and the frame isn't written to it. The
+     * handlers must take a reference on @frame->pixels to keep them.
+     *
+     * The frames are written back to the primary surface when the
+     * stream is destroyed or when a drawing overlaps them, and the
+     * signal is then emitted with %NULL pixels.
+     *
+     * Since: 0.36
+     **/
+    signals[SPICE_DISPLAY_STREAM_FRAME] =
+        g_signal_new("stream-frame",
+                     G_OBJECT_CLASS_TYPE(gobject_class),
+                     0, 0,
+                     stream_frame_accumulator, NULL,
+                     g_cclosure_user_marshal_BOOLEAN__UINT_POINTER,
+                     G_TYPE_BOOLEAN,
+                     2,
+                     G_TYPE_UINT, G_TYPE_POINTER);
+
     channel_set_handlers(SPICE_CHANNEL_CLASS(klass));
 }
 
@@ -528,13 +646,248 @@ gboolean spice_display_channel_get_primary(SpiceChannel *channel, guint32 surfac
     primary->height = surface->height;
     primary->stride = surface->stride;
     primary->shmid = -1;
-    primary->data = surface->data;
+    primary->data = spice_display_channel_get_primary_data(SPICE_DISPLAY_CHANNEL(channel));
     primary->marked = c->mark;
     CHANNEL_DEBUG(channel, "get primary %p", primary->data);
 
     return TRUE;
 }
 
+/**
+ * spice_display_channel_get_primary_data:
+ * @channel: a #SpiceDisplayChannel
+ *
+ * Retrieve the pixels of the primary surface that should be presented.
+ *
+ * When the client is configured with several presentation buffers
+ * (see the SPICE_PRIMARY_BUFFERS environment variable), the returned
+ * pointer changes as the server updates are published, and it must
+ * be queried again after each #SpiceDisplayChannel::display-invalidate
+ * signal. It is the same for every caller, and calling this function
+ * doesn't change it. The data isn't written again before the next
+ * update is published (with 3 buffers, the one after), and goes away
+ * with the primary surface.
+ *
+ * With several buffers, this can be called from any thread, such as a
+ * rendering thread: an update is published once its pixels are all
+ * written, so the data returned is never half-updated. The primary
+ * surface is still created and destroyed in the main context, where
+ * #SpiceDisplayChannel::display-primary-destroy is emitted, and the
+ * other threads must be done with the data before it returns.
+ *
+ * Returns: (transfer none): the primary surface data, or %NULL if
+ * there is no primary surface.
+ *
+ * Since: 0.36
+ */
+guint8 *spice_display_channel_get_primary_data(SpiceDisplayChannel *channel)
+{
+    SpiceDisplayChannelPrivate *c;
+    primary_buffers *b;
+
+    g_return_val_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel), NULL);
+
+    c = channel->priv;
+    if (c->primary == NULL)
+        return NULL;
+
+    b = c->primary->buffers;
+    if (b == NULL)
+        return c->primary->data;
+
+    return primary_buffers_get_front(b);
+}
+
+/* coroutine context */
+static void stream_timing_start(display_stream *st, SpiceFrame *frame)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(st->channel)->priv;
+
+    frame->timing = stream_timings_start(c->timings, st->id, frame->mm_time);
+    stream_timing_mark(st, frame, SPICE_STREAM_TIMING_ARRIVAL);
+}
+
+/* coroutine, main or decoding thread */
+G_GNUC_INTERNAL
+void stream_timing_mark(display_stream *st, SpiceFrame *frame, SpiceStreamTimingStage stage)
+{
+    SpiceDisplayChannelPrivate *c;
+
+    /* the decoders probing the codecs have no stream */
+    if (st == NULL)
+        return;
+
+    c = SPICE_DISPLAY_CHANNEL(st->channel)->priv;
+    stream_timings_mark(c->timings, frame->timing, stage, g_get_monotonic_time(),
+                        spice_mmtime_diff(frame->mm_time, stream_get_time(st)));
+}
+
+/**
+ * spice_display_channel_get_stream_timings:
+ * @channel: a #SpiceDisplayChannel
+ * @timings: (out caller-allocates) (array length=n_timings): where to
+ * store the timings
+ * @n_timings: the size of @timings
+ *
+ * Retrieve the timings of the last video frames received by @channel,
+ * oldest first. The most recent frames may not have reached all the
+ * stages yet. This can be called from any thread.
+ *
+ * Returns: the number of #SpiceStreamTiming stored in @timings.
+ *
+ * Since: 0.36
+ */
+guint spice_display_channel_get_stream_timings(SpiceDisplayChannel *channel,
+                                               SpiceStreamTiming *timings, guint n_timings)
+{
+    g_return_val_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel), 0);
+    g_return_val_if_fail(timings != NULL || n_timings == 0, 0);
+
+    return stream_timings_get_last(channel->priv->timings, timings, n_timings);
+}
+
+static gint compare_gint64(gconstpointer a, gconstpointer b)
+{
+    gint64 va = *(const gint64 *)a, vb = *(const gint64 *)b;
+
+    return va < vb ? -1 : va > vb;
+}
+
+static gint64 percentile(GArray *values, guint p)
+{
+    if (values->len == 0)
+        return 0;
+
+    return g_array_index(values, gint64, (values->len - 1) * p / 100);
+}
+
+/**
+ * spice_display_channel_get_stream_timing_stats:
+ * @channel: a #SpiceDisplayChannel
+ * @stats: (out caller-allocates): where to store the statistics
+ *
+ * Summarize the timings of the last video frames received by @channel,
+ * see spice_display_channel_get_stream_timings(). This can be called
+ * from any thread.
+ *
+ * Since: 0.36
+ */
+void spice_display_channel_get_stream_timing_stats(SpiceDisplayChannel *channel,
+                                                   SpiceStreamTimingStats *stats)
+{
+    SpiceStreamTiming *timings;
+    GArray *decode, *lag;
+    guint i, n;
+
+    g_return_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel));
+    g_return_if_fail(stats != NULL);
+
+    timings = g_new(SpiceStreamTiming, STREAM_TIMINGS_MAX);
+    n = spice_display_channel_get_stream_timings(channel, timings, STREAM_TIMINGS_MAX);
+    decode = g_array_sized_new(FALSE, FALSE, sizeof(gint64), n);
+    lag = g_array_sized_new(FALSE, FALSE, sizeof(gint64), n);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->frames = n;
+    for (i = 0; i < n; i++) {
+        gint64 *time = timings[i].time;
+
+        if (time[SPICE_STREAM_TIMING_DECODE_START] && time[SPICE_STREAM_TIMING_DECODE_END]) {
+            gint64 d = time[SPICE_STREAM_TIMING_DECODE_END] - time[SPICE_STREAM_TIMING_DECODE_START];
+            g_array_append_val(decode, d);
+        }
+        if (time[SPICE_STREAM_TIMING_PRESENTED]) {
+            gint64 d = time[SPICE_STREAM_TIMING_PRESENTED] - time[SPICE_STREAM_TIMING_ARRIVAL];
+            g_array_append_val(lag, d);
+            stats->presented++;
+        }
+    }
+
+    g_array_sort(decode, compare_gint64);
+    g_array_sort(lag, compare_gint64);
+    stats->decode_p50 = percentile(decode, 50);
+    stats->decode_p95 = percentile(decode, 95);
+    stats->decode_p99 = percentile(decode, 99);
+    stats->lag_p50 = percentile(lag, 50);
+    stats->lag_p95 = percentile(lag, 95);
+    stats->lag_p99 = percentile(lag, 99);
+
+    g_array_unref(decode);
+    g_array_unref(lag);
+    g_free(timings);
+}
+
+/* main context */
+static gint64 stream_timing_decode_time(display_stream *st, SpiceFrame *frame)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(st->channel)->priv;
+    SpiceStreamTiming timing;
+    gint64 *time = timing.time;
+
+    if (!stream_timings_get(c->timings, frame->timing, &timing) ||
+        !time[SPICE_STREAM_TIMING_DECODE_START] || !time[SPICE_STREAM_TIMING_DECODE_END])
+        return -1;
+
+    return time[SPICE_STREAM_TIMING_DECODE_END] - time[SPICE_STREAM_TIMING_DECODE_START];
+}
+
+/* main context */
+static gboolean display_loop_lag_sample(gpointer data)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(data)->priv;
+    gint64 now = g_get_monotonic_time();
+    int i;
+
+    stream_controller_add_loop_lag(c->controller, now - c->loop_lag_expected);
+
+    for (i = 0; i < c->nstreams; i++) {
+        if (c->streams[i] != NULL) {
+            c->loop_lag_expected = now + STREAM_LOOP_LAG_INTERVAL * 1000;
+            return G_SOURCE_CONTINUE;
+        }
+    }
+
+    c->loop_lag_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+/* coroutine context */
+static void display_loop_lag_start(SpiceDisplayChannel *channel)
+{
+    SpiceDisplayChannelPrivate *c = channel->priv;
+
+    if (c->loop_lag_id != 0)
+        return;
+
+    c->loop_lag_expected = g_get_monotonic_time() + STREAM_LOOP_LAG_INTERVAL * 1000;
+    c->loop_lag_id = g_timeout_add(STREAM_LOOP_LAG_INTERVAL, display_loop_lag_sample, channel);
+}
+
+/**
+ * spice_display_channel_get_streaming_state:
+ * @channel: a #SpiceDisplayChannel
+ * @state: (out caller-allocates): where to store the state
+ *
+ * Retrieve what the client measured of the video streams of @channel,
+ * and what it found to be holding them back. When the
+ * SPICE_STREAM_CONTROLLER environment variable is set, the client also
+ * acts on it: it lowers the latency it reports to the server so that
+ * the server lowers the bit rate, and it asks the server for the codec
+ * it decodes the fastest when decoding can't keep up.
+ *
+ * Returns: %TRUE if @channel received video frames, %FALSE otherwise.
+ *
+ * Since: 0.36
+ */
+gboolean spice_display_channel_get_streaming_state(SpiceDisplayChannel *channel,
+                                                   SpiceStreamingState *state)
+{
+    g_return_val_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel), FALSE);
+    g_return_val_if_fail(state != NULL, FALSE);
+
+    return stream_controller_get_state(channel->priv->controller, state);
+}
+
 /**
  * spice_display_change_preferred_compression:
  * @channel: a #SpiceDisplayChannel
@@ -603,6 +956,67 @@ static void spice_display_send_client_preferred_video_codecs(SpiceChannel *chann
     g_free(msg);
 }
 
+/* Sends the codec set by the application first, then the codecs this
+ * client was measured to decode, fastest first */
+static void display_send_preferred_video_codecs(SpiceChannel *channel)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+    GArray *codecs;
+    guint i;
+
+    if (!spice_channel_test_capability(channel, SPICE_DISPLAY_CAP_PREF_VIDEO_CODEC_TYPE)) {
+        CHANNEL_DEBUG(channel, "does not have capability to change the preferred video codec type");
+        return;
+    }
+
+    codecs = g_array_new(FALSE, FALSE, sizeof(gint));
+    if (c->preferred_video_codec != 0) {
+        g_array_append_val(codecs, c->preferred_video_codec);
+    }
+    for (i = 0; c->video_codecs != NULL && i < c->video_codecs->len; i++) {
+        gint codec_type = g_array_index(c->video_codecs, gint, i);
+
+        if (codec_type != c->preferred_video_codec) {
+            g_array_append_val(codecs, codec_type);
+        }
+    }
+    if (codecs->len > 0) {
+        spice_display_send_client_preferred_video_codecs(channel, codecs);
+    }
+    g_array_unref(codecs);
+}
+
+#ifdef HAVE_GSTVIDEO
+/* main context */
+static void display_probe_codecs_cb(GObject *source_object, GAsyncResult *res,
+                                    gpointer user_data G_GNUC_UNUSED)
+{
+    SpiceChannel *channel = SPICE_CHANNEL(source_object);
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+    GError *err = NULL;
+    GArray *codecs;
+    guint i;
+
+    codecs = gstvideo_probe_codecs_finish(res, &err);
+    if (codecs == NULL) {
+        CHANNEL_DEBUG(channel, "could not probe the video decoders: %s", err->message);
+        g_clear_error(&err);
+        return;
+    }
+
+    for (i = 0; i < codecs->len; i++) {
+        CHANNEL_DEBUG(channel, "video decoder %u: %s", i,
+                      gst_opts[g_array_index(codecs, gint, i)].name);
+    }
+    g_clear_pointer(&c->video_codecs, g_array_unref);
+    c->video_codecs = codecs;
+
+    if (spice_channel_get_state(channel) == SPICE_CHANNEL_STATE_READY) {
+        display_send_preferred_video_codecs(channel);
+    }
+}
+#endif
+
 /**
  * spice_display_change_preferred_video_codec_type:
  * @channel: a #SpiceDisplayChannel
@@ -633,26 +1047,14 @@ void spice_display_change_preferred_video_codec_type(SpiceChannel *channel, gint
  */
 void spice_display_channel_change_preferred_video_codec_type(SpiceChannel *channel, gint codec_type)
 {
-    GArray *codecs;
-
     g_return_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel));
     g_return_if_fail(codec_type >= SPICE_VIDEO_CODEC_TYPE_MJPEG &&
                      codec_type < SPICE_VIDEO_CODEC_TYPE_ENUM_END);
 
-    if (!spice_channel_test_capability(channel, SPICE_DISPLAY_CAP_PREF_VIDEO_CODEC_TYPE)) {
-        CHANNEL_DEBUG(channel, "does not have capability to change the preferred video codec type");
-        return;
-    }
-
-    /* FIXME: We should detect video codecs that client machine can do hw
-     * decoding, store this information (as GArray) and send it to the server.
-     * This array can be rearranged to have @codec_type in the front (which is
-     * the preferred for the client side) */
+    /* the codecs measured with SPICE_PROBE_VIDEO_CODECS follow @codec_type */
     CHANNEL_DEBUG(channel, "changing preferred video codec type to %s", gst_opts[codec_type].name);
-    codecs = g_array_new(FALSE, FALSE, sizeof(gint));
-    g_array_append_val(codecs, codec_type);
-    spice_display_send_client_preferred_video_codecs(channel, codecs);
-    g_array_unref(codecs);
+    SPICE_DISPLAY_CHANNEL(channel)->priv->preferred_video_codec = codec_type;
+    display_send_preferred_video_codecs(channel);
 }
 
 /**
@@ -880,6 +1282,7 @@ static void destroy_surface(gpointer data)
 static void spice_display_channel_init(SpiceDisplayChannel *channel)
 {
     SpiceDisplayChannelPrivate *c;
+    guint i;
 
     c = channel->priv = spice_display_channel_get_instance_private(channel);
 
@@ -889,6 +1292,8 @@ static void spice_display_channel_init(SpiceDisplayChannel *channel)
     c->image_surfaces.ops = &image_surfaces_ops;
     c->monitors_max = 1;
     c->scanout.fd = -1;
+    c->timings = stream_timings_new();
+    c->controller = stream_controller_new();
 
     if (g_getenv("SPICE_DISABLE_ADAPTIVE_STREAMING")) {
         SPICE_DEBUG("adaptive video disabled");
@@ -896,6 +1301,25 @@ static void spice_display_channel_init(SpiceDisplayChannel *channel)
     } else {
         c->enable_adaptive_streaming = TRUE;
     }
+    if (g_getenv("SPICE_PRIMARY_BUFFERS")) {
+        c->primary_buffers = CLAMP(atoi(g_getenv("SPICE_PRIMARY_BUFFERS")),
+                                   0, PRIMARY_BUFFERS_MAX);
+        SPICE_DEBUG("primary presented with %u buffers", c->primary_buffers);
+    }
+    if (g_getenv("SPICE_STREAM_CONTROLLER")) {
+        SPICE_DEBUG("client streaming controller enabled");
+        c->enable_stream_controller = TRUE;
+    }
+#ifdef HAVE_GSTVIDEO
+    if (g_getenv("SPICE_PROBE_VIDEO_CODECS")) {
+        SPICE_DEBUG("probing the video decoders speed");
+        c->probe_video_codecs = TRUE;
+    }
+    if (g_getenv("SPICE_PIPELINE_POOL")) {
+        SPICE_DEBUG("GStreamer pipelines pool enabled");
+        c->enable_pipeline_pool = TRUE;
+    }
+#endif
     spice_display_channel_reset_capabilities(SPICE_CHANNEL(channel));
 }
 
@@ -922,6 +1346,12 @@ static int create_canvas(SpiceChannel *channel, display_surface *surface)
     }
 
     surface->data = g_malloc0(surface->size);
+    if (surface->primary && c->primary_buffers >= 2)
+        surface->buffers = primary_buffers_new(surface->width, surface->height,
+                                               surface->stride,
+                                               (surface->format == SPICE_SURFACE_FMT_16_555 ||
+                                                surface->format == SPICE_SURFACE_FMT_16_565) ? 2 : 4,
+                                               c->primary_buffers);
 
     g_return_val_if_fail(c->glz_window, 0);
     g_warn_if_fail(surface->canvas == NULL);
@@ -953,7 +1383,9 @@ static int create_canvas(SpiceChannel *channel, display_surface *surface)
         c->primary = surface;
         g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_PRIMARY_CREATE], 0,
                                 surface->format, surface->width, surface->height,
-                                surface->stride, -1, surface->data);
+                                surface->stride, -1,
+                                surface->buffers ? primary_buffers_get_front(surface->buffers) :
+                                                   surface->data);
 
         if (!spice_channel_test_capability(channel, SPICE_DISPLAY_CAP_MONITORS_CONFIG)) {
             g_array_set_size(c->monitors, 1);
@@ -977,6 +1409,7 @@ static void destroy_canvas(display_surface *surface)
     zlib_decoder_destroy(surface->zlib_decoder);
     jpeg_decoder_destroy(surface->jpeg_decoder);
 
+    g_clear_pointer(&surface->buffers, primary_buffers_free);
     g_clear_pointer(&surface->data, g_free);
     g_clear_pointer(&surface->canvas, surface->canvas->ops->destroy);
 }
@@ -1016,6 +1449,15 @@ static void clear_surfaces(SpiceChannel *channel, gboolean keep_primary)
 /* coroutine context */
 static void emit_invalidate(SpiceChannel *channel, SpiceRect *bbox)
 {
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+
+    if (c->primary != NULL && c->primary->buffers != NULL) {
+        /* notified once the batch of messages is published */
+        primary_buffers_damage(c->primary->buffers, bbox->left, bbox->top,
+                               bbox->right - bbox->left, bbox->bottom - bbox->top);
+        return;
+    }
+
     g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_INVALIDATE], 0,
                             bbox->left, bbox->top,
                             bbox->right - bbox->left,
@@ -1052,9 +1494,23 @@ static void spice_display_channel_up(SpiceChannel *channel)
     /* notify of existence of this monitor */
     g_coroutine_object_notify(G_OBJECT(channel), "monitors");
 
+    /* nothing was shown before the channel was lost, nothing to wait for */
+    if (SPICE_DISPLAY_CHANNEL(channel)->priv->primary == NULL)
+        spice_session_channel_usable(s, channel);
+
     if (preferred_compression != SPICE_IMAGE_COMPRESSION_INVALID) {
         spice_display_channel_change_preferred_compression(channel, preferred_compression);
     }
+
+#ifdef HAVE_GSTVIDEO
+    if (SPICE_DISPLAY_CHANNEL(channel)->priv->probe_video_codecs) {
+        /* the preferences are sent once the decoders are measured */
+        SPICE_DISPLAY_CHANNEL(channel)->priv->probe_video_codecs = FALSE;
+        gstvideo_probe_codecs_async(channel, display_probe_codecs_cb, NULL);
+        return;
+    }
+#endif
+    display_send_preferred_video_codecs(channel);
 }
 
 #define DRAW(type) {                                                    \
@@ -1062,6 +1518,9 @@ static void spice_display_channel_up(SpiceChannel *channel)
             find_surface(SPICE_DISPLAY_CHANNEL(channel)->priv,          \
                 op->base.surface_id);                                   \
         g_return_if_fail(surface != NULL);                              \
+        if (surface->primary) {                                         \
+            stream_overlays_flush(channel, &op->base.box);              \
+        }                                                               \
         surface->canvas->ops->draw_##type(surface->canvas, &op->base.box, \
                                           &op->base.clip, &op->data);   \
         if (surface->primary) {                                         \
@@ -1100,8 +1559,10 @@ static void display_handle_mark(SpiceChannel *channel, SpiceMsgIn *in)
     g_warn_if_fail(c->mark == FALSE);
 #endif
 
+    primary_buffers_publish(channel);
     c->mark = TRUE;
     g_coroutine_signal_emit(channel, signals[SPICE_DISPLAY_MARK], 0, TRUE);
+    spice_session_channel_usable(spice_channel_get_session(channel), channel);
 }
 
 /* coroutine context */
@@ -1112,8 +1573,12 @@ static void display_handle_reset(SpiceChannel *channel, SpiceMsgIn *in)
 
     CHANNEL_DEBUG(channel, "%s: TODO detach_from_screen", __FUNCTION__);
 
-    if (surface != NULL)
+    if (surface != NULL) {
+        stream_overlays_flush(channel, NULL);
         surface->canvas->ops->clear(surface->canvas);
+        if (surface->buffers != NULL)
+            primary_buffers_damage(surface->buffers, 0, 0, surface->width, surface->height);
+    }
 
     cache_clear(c->palettes);
 
@@ -1129,6 +1594,10 @@ static void display_handle_copy_bits(SpiceChannel *channel, SpiceMsgIn *in)
     display_surface *surface = find_surface(c, op->base.surface_id);
 
     g_return_if_fail(surface != NULL);
+    if (surface->primary) {
+        /* the source may be anywhere */
+        stream_overlays_flush(channel, NULL);
+    }
     surface->canvas->ops->copy_bits(surface->canvas, &op->base.box,
                                     &op->base.clip, &op->src_pos);
     if (surface->primary) {
@@ -1286,6 +1755,10 @@ static void destroy_stream(SpiceChannel *channel, int id)
     g_return_if_fail(c->streams != NULL);
     g_return_if_fail(c->nstreams > id);
 
+    if (c->streams[id] != NULL) {
+        stream_overlay_flush(c->streams[id]);
+        stream_controller_remove_stream(c->controller, id);
+    }
     g_clear_pointer(&c->streams[id], display_stream_destroy);
 }
 
@@ -1316,7 +1789,9 @@ static void display_handle_stream_create(SpiceChannel *channel, SpiceMsgIn *in)
         g_warning("could not create the %u video stream", op->id);
         destroy_stream(channel, op->id);
         report_invalid_stream(channel, op->id);
+        return;
     }
+    display_loop_lag_start(SPICE_DISPLAY_CHANNEL(channel));
 }
 
 static const SpiceRect *stream_get_dest(display_stream *st, SpiceMsgIn *frame_msg)
@@ -1358,32 +1833,255 @@ guint32 stream_get_time(display_stream *st)
     return session ? spice_session_get_mm_time(session) : 0;
 }
 
+/* The mm-time the decoders schedule the frames against: a little ahead
+ * when the frames are seen to be presented after their audio */
+G_GNUC_INTERNAL
+guint32 stream_get_present_time(display_stream *st)
+{
+    SpiceSession *session = spice_channel_get_session(st->channel);
+    return session ?
+        spice_session_get_mm_time(session) + spice_session_get_video_advance(session) : 0;
+}
+
+#ifdef HAVE_GSTVIDEO
 /* coroutine or main context */
 G_GNUC_INTERNAL
-void stream_dropped_frame_on_playback(display_stream *st)
+SpiceGstPipelinePool *stream_get_pipeline_pool(display_stream *st)
 {
-    st->num_drops_on_playback++;
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(st->channel)->priv;
+
+    if (!c->enable_pipeline_pool)
+        return NULL;
+
+    if (c->pipeline_pool == NULL)
+        c->pipeline_pool = gstvideo_pipeline_pool_new();
+    return c->pipeline_pool;
 }
+#endif
 
-/* main context */
+/* coroutine, main or decoder thread context
+ *
+ * @frame is the dropped frame when known. A frame dropped for being late
+ * is never presented, so how late it was is kept for the coroutine to
+ * feed to the A/V sync, see display_handle_stream_data().
+ */
 G_GNUC_INTERNAL
-void stream_display_frame(display_stream *st, SpiceFrame *frame,
-                          uint32_t width, uint32_t height, int stride, uint8_t *data)
+void stream_dropped_frame_on_playback(display_stream *st, SpiceFrame *frame)
 {
-    if (stride == SPICE_UNKNOWN_STRIDE) {
-        stride = width * sizeof(uint32_t);
+    if (frame != NULL && !st->low_latency) {
+        gint32 offset = spice_mmtime_diff(stream_get_time(st), frame->mm_time);
+        if (offset > 0)
+            g_atomic_int_set(&st->dropped_av_offset, offset);
     }
+    st->num_drops_on_playback++;
+    stream_controller_add_drop(SPICE_DISPLAY_CHANNEL(st->channel)->priv->controller);
+}
+
+/* main or coroutine context */
+static void stream_put_image(display_stream *st, SpiceRect *dest,
+                             uint32_t width, uint32_t height, int stride,
+                             const uint8_t *data)
+{
     if (!(st->flags & SPICE_STREAM_FLAGS_TOP_DOWN)) {
         data += stride * (height - 1);
         stride = -stride;
     }
 
     st->surface->canvas->ops->put_image(st->surface->canvas,
-                                        &frame->dest, data,
+                                        dest, data,
                                         width, height, stride,
                                         st->have_region ? &st->region : NULL);
+}
+
+/* main or coroutine context */
+static void stream_overlay_flush(display_stream *st)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(st->channel)->priv;
+    SpiceDisplayStreamFrame frame = { 0, };
+    gboolean handled;
 
-    if (st->surface->primary) {
+    if (st->overlay == NULL)
+        return;
+
+    /* the primary may already be gone when the channel is disposed */
+    if (st->surface == c->primary) {
+        stream_put_image(st, &st->overlay_dest,
+                         st->overlay_width, st->overlay_height, st->overlay_stride,
+                         g_bytes_get_data(st->overlay, NULL));
+        emit_invalidate(st->channel, &st->overlay_dest);
+    }
+    g_clear_pointer(&st->overlay, g_bytes_unref);
+
+    g_coroutine_signal_emit(st->channel, signals[SPICE_DISPLAY_STREAM_FRAME], 0,
+                            st->id, &frame, &handled);
+}
+
+/* coroutine context */
+static void stream_overlays_flush(SpiceChannel *channel, const SpiceRect *rect)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+    int i;
+
+    for (i = 0; i < c->nstreams; i++) {
+        display_stream *st = c->streams[i];
+
+        if (st == NULL || st->overlay == NULL)
+            continue;
+
+        if (rect == NULL ||
+            (rect->left < st->overlay_dest.right && st->overlay_dest.left < rect->right &&
+             rect->top < st->overlay_dest.bottom && st->overlay_dest.top < rect->bottom))
+            stream_overlay_flush(st);
+    }
+}
+
+static gboolean image_is_primary(SpiceDisplayChannelPrivate *c, const SpiceImage *image)
+{
+    display_surface *surface;
+
+    if (image == NULL || image->descriptor.type != SPICE_IMAGE_TYPE_SURFACE)
+        return FALSE;
+
+    surface = find_surface(c, image->u.surface.surface_id);
+    return surface != NULL && surface->primary;
+}
+
+/* coroutine context: a draw reading the primary, through its source,
+ * mask or brush pattern, reads it with the overlays, wherever it draws */
+static void stream_overlays_flush_read(SpiceChannel *channel, const SpiceImage *src,
+                                       const SpiceImage *mask, const SpiceBrush *brush)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
+
+    if (image_is_primary(c, src) || image_is_primary(c, mask) ||
+        (brush != NULL && brush->type == SPICE_BRUSH_TYPE_PATTERN &&
+         image_is_primary(c, brush->u.pattern.pat)))
+        stream_overlays_flush(channel, NULL);
+}
+
+/* main context */
+static gboolean stream_overlay_frame(display_stream *st, SpiceFrame *frame,
+                                     uint32_t width, uint32_t height, int stride,
+                                     GBytes *pixels)
+{
+    SpiceDisplayStreamFrame overlay;
+    gboolean handled = FALSE;
+
+    /* clipped or bottom-up frames go through the canvas */
+    if (st->have_region || !(st->flags & SPICE_STREAM_FLAGS_TOP_DOWN) ||
+        st->surface->format != SPICE_SURFACE_FMT_32_xRGB ||
+        !g_signal_has_handler_pending(st->channel, signals[SPICE_DISPLAY_STREAM_FRAME], 0, FALSE)) {
+        stream_overlay_flush(st);
+        return FALSE;
+    }
+
+    overlay.x = frame->dest.left;
+    overlay.y = frame->dest.top;
+    overlay.width = frame->dest.right - frame->dest.left;
+    overlay.height = frame->dest.bottom - frame->dest.top;
+    overlay.frame_width = width;
+    overlay.frame_height = height;
+    overlay.stride = stride;
+    overlay.pixels = pixels;
+    g_signal_emit(st->channel, signals[SPICE_DISPLAY_STREAM_FRAME], 0,
+                  st->id, &overlay, &handled);
+    if (!handled) {
+        if (st->overlay == NULL) {
+            /* the monitors before the one that refused may keep it */
+            overlay.pixels = NULL;
+            g_signal_emit(st->channel, signals[SPICE_DISPLAY_STREAM_FRAME], 0,
+                          st->id, &overlay, &handled);
+        }
+        stream_overlay_flush(st);
+        return FALSE;
+    }
+
+    g_clear_pointer(&st->overlay, g_bytes_unref);
+    st->overlay = g_bytes_ref(pixels);
+    st->overlay_dest = frame->dest;
+    st->overlay_width = width;
+    st->overlay_height = height;
+    st->overlay_stride = stride;
+
+    return TRUE;
+}
+
+/* main context */
+static void stream_report_presented_frame(display_stream *st, SpiceFrame *frame)
+{
+    SpiceDisplayChannel *channel = SPICE_DISPLAY_CHANNEL(st->channel);
+    uint32_t skipped;
+
+    if (!channel->priv->enable_adaptive_streaming)
+        return;
+
+    /* the frames the decoder skipped to catch up go in the same report */
+    skipped = st->num_drops_on_playback - st->report_playback_drops;
+    st->report_playback_drops = st->num_drops_on_playback;
+
+    /* what is left of the server latency once the frame is on screen */
+    display_update_stream_report(channel, st->id, frame->mm_time,
+                                 spice_mmtime_diff(frame->mm_time, stream_get_time(st)),
+                                 skipped);
+}
+
+/* main context */
+static void stream_controller_frame_presented(display_stream *st, SpiceFrame *frame,
+                                              uint32_t width, uint32_t height)
+{
+    SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(st->channel)->priv;
+    gint codec_type;
+
+    stream_controller_add_decode(c->controller, st->video_decoder->codec_type,
+                                 width * height, stream_timing_decode_time(st, frame));
+    if (!c->enable_stream_controller)
+        return;
+
+    codec_type = stream_controller_pick_codec(c->controller, g_get_monotonic_time());
+    if (codec_type != 0) {
+        CHANNEL_DEBUG(st->channel, "stream %u is decoder bound, switching codec", st->id);
+        spice_display_channel_change_preferred_video_codec_type(st->channel, codec_type);
+    }
+}
+
+/* main context */
+G_GNUC_INTERNAL
+void stream_display_frame(display_stream *st, SpiceFrame *frame,
+                          uint32_t width, uint32_t height, int stride, GBytes *pixels)
+{
+    primary_buffers *b = st->surface->buffers;
+    /* don't publish a half-drawn batch of the coroutine */
+    gboolean batched = b != NULL && primary_buffers_has_damage(b);
+
+    if (stride == SPICE_UNKNOWN_STRIDE) {
+        stride = width * sizeof(uint32_t);
+    }
+
+    stream_timing_mark(st, frame, SPICE_STREAM_TIMING_PRESENTED);
+    stream_controller_frame_presented(st, frame, width, height);
+    if (st->low_latency) {
+        stream_report_presented_frame(st, frame);
+    } else {
+        SpiceSession *session = spice_channel_get_session(st->channel);
+        if (session != NULL)
+            spice_session_add_av_offset(session,
+                                        spice_mmtime_diff(stream_get_time(st), frame->mm_time));
+    }
+
+    if (st->surface->primary &&
+        stream_overlay_frame(st, frame, width, height, stride, pixels))
+        return;
+
+    stream_put_image(st, &frame->dest, width, height, stride,
+                     g_bytes_get_data(pixels, NULL));
+
+    if (st->surface->primary && b != NULL) {
+        primary_buffers_damage(b, frame->dest.left, frame->dest.top,
+                               frame->dest.right - frame->dest.left,
+                               frame->dest.bottom - frame->dest.top);
+        if (!batched)
+            primary_buffers_publish(st->channel);
+    } else if (st->surface->primary) {
         g_signal_emit(st->channel, signals[SPICE_DISPLAY_INVALIDATE], 0,
                       frame->dest.left, frame->dest.top,
                       frame->dest.right - frame->dest.left,
@@ -1404,34 +2102,49 @@ guintptr get_window_handle(display_stream *st)
  * if the report window is bigger */
 #define STREAM_REPORT_DROP_SEQ_LEN_LIMIT 3
 
+/* @skipped frames were dropped since the previous one reported */
 static void display_update_stream_report(SpiceDisplayChannel *channel, uint32_t stream_id,
-                                         uint32_t frame_time, int32_t latency)
+                                         uint32_t frame_time, int32_t latency,
+                                         uint32_t skipped)
 {
+    SpiceDisplayChannelPrivate *c = channel->priv;
     display_stream *st = get_stream_by_id(SPICE_CHANNEL(channel), stream_id);
+    gboolean congested = FALSE;
+    guint32 drops_seq_len;
+    gint32 adjusted;
     guint64 now;
 
     g_return_if_fail(st != NULL);
+    adjusted = stream_controller_adjust_latency(c->controller, latency);
     if (!st->report_is_active) {
         return;
     }
+    if (c->enable_stream_controller) {
+        latency = adjusted;
+        congested = stream_controller_congestion_started(c->controller);
+    }
     now = g_get_monotonic_time();
 
     if (st->report_num_frames == 0) {
         st->report_start_frame_time = frame_time;
         st->report_start_time = now;
     }
-    st->report_num_frames++;
+    st->report_num_frames += skipped + 1;
+    st->report_num_drops += skipped;
+    st->report_drops_seq_len += skipped;
+    drops_seq_len = st->report_drops_seq_len;
 
     if (latency < 0) { // drop
         st->report_num_drops++;
         st->report_drops_seq_len++;
+        drops_seq_len++;
     } else {
         st->report_drops_seq_len = 0;
     }
 
     if (st->report_num_frames >= st->report_max_window ||
         spice_mmtime_diff(now - st->report_start_time, st->report_timeout) >= 0 ||
-        st->report_drops_seq_len >= STREAM_REPORT_DROP_SEQ_LEN_LIMIT) {
+        drops_seq_len >= STREAM_REPORT_DROP_SEQ_LEN_LIMIT || congested) {
         SpiceMsgcDisplayStreamReport report;
         SpiceSession *session = spice_channel_get_session(SPICE_CHANNEL(channel));
         SpiceMsgOut *msg;
@@ -1524,13 +2237,28 @@ static void display_handle_stream_data(SpiceChannel *channel, SpiceMsgIn *in)
     SpiceDisplayChannelPrivate *c = SPICE_DISPLAY_CHANNEL(channel)->priv;
     SpiceStreamDataHeader *op = spice_msg_in_parsed(in);
     display_stream *st = get_stream_by_id(channel, op->id);
+    SpiceSession *session;
     guint32 mmtime;
     int32_t latency;
+    guint dropped_offset;
     SpiceFrame *frame;
 
     g_return_if_fail(st != NULL);
     mmtime = stream_get_time(st);
 
+    /* there is nothing to synchronize with without audio */
+    session = spice_channel_get_session(channel);
+    st->low_latency = spice_session_get_low_latency_video(session) &&
+                      !spice_session_is_playback_active(session);
+    if (!st->low_latency) {
+        st->report_playback_drops = st->num_drops_on_playback;
+    }
+
+    /* the presented frames are sampled in stream_display_frame() */
+    dropped_offset = g_atomic_int_and(&st->dropped_av_offset, 0);
+    if (dropped_offset != 0 && !st->low_latency)
+        spice_session_add_av_offset(session, dropped_offset);
+
     if (spice_msg_in_type(in) == SPICE_MSG_DISPLAY_STREAM_DATA_SIZED) {
         CHANNEL_DEBUG(channel, "stream %u contains sized data", op->id);
     }
@@ -1584,15 +2312,21 @@ static void display_handle_stream_data(SpiceChannel *channel, SpiceMsgIn *in)
     frame->ref_data = (void*)spice_msg_in_ref;
     frame->unref_data = (void*)spice_msg_in_unref;
     frame->free = (void*)g_free;
-    if (!st->video_decoder->queue_frame(st->video_decoder, frame, latency)) {
+    stream_timing_start(st, frame);
+    stream_controller_add_arrival(c->controller, op->id, g_get_monotonic_time(), frame->size,
+                                  spice_channel_get_pending_bytes(channel));
+    stream_timing_mark(st, frame, SPICE_STREAM_TIMING_QUEUED);
+    /* a low latency stream doesn't wait for, nor drops on, the mm_time */
+    if (!st->video_decoder->queue_frame(st->video_decoder, frame,
+                                        st->low_latency ? 0 : latency)) {
         destroy_stream(channel, op->id);
         report_invalid_stream(channel, op->id);
         return;
     }
 
-    if (c->enable_adaptive_streaming) {
+    if (c->enable_adaptive_streaming && !st->low_latency) {
         display_update_stream_report(SPICE_DISPLAY_CHANNEL(channel), op->id,
-                                     op->multi_media_time, latency);
+                                     op->multi_media_time, latency, 0);
         if (st->playback_sync_drops_seq_len >= STREAM_PLAYBACK_SYNC_DROP_SEQ_LEN_LIMIT) {
             spice_session_sync_playback_latency(spice_channel_get_session(channel));
             st->playback_sync_drops_seq_len = 0;
@@ -1610,6 +2344,7 @@ static void display_handle_stream_clip(SpiceChannel *channel, SpiceMsgIn *in)
 
     st->clip = op->clip;
     display_update_stream_region(st);
+    stream_overlay_flush(st);
 }
 
 static void display_stream_destroy(gpointer st_pointer)
@@ -1708,6 +2443,7 @@ static void display_handle_stream_activate_report(SpiceChannel *channel, SpiceMs
 static void display_handle_draw_fill(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawFill *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, NULL, op->data.mask.bitmap, &op->data.brush);
     DRAW(fill);
 }
 
@@ -1715,6 +2451,7 @@ static void display_handle_draw_fill(SpiceChannel *channel, SpiceMsgIn *in)
 static void display_handle_draw_opaque(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawOpaque *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, op->data.src_bitmap, op->data.mask.bitmap, &op->data.brush);
     DRAW(opaque);
 }
 
@@ -1722,6 +2459,7 @@ static void display_handle_draw_opaque(SpiceChannel *channel, SpiceMsgIn *in)
 static void display_handle_draw_copy(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawCopy *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, op->data.src_bitmap, op->data.mask.bitmap, NULL);
     DRAW(copy);
 }
 
@@ -1729,6 +2467,7 @@ static void display_handle_draw_copy(SpiceChannel *channel, SpiceMsgIn *in)
 static void display_handle_draw_blend(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawBlend *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, op->data.src_bitmap, op->data.mask.bitmap, NULL);
     DRAW(blend);
 }
 
@@ -1736,12 +2475,14 @@ static void display_handle_draw_blend(SpiceChannel *channel, SpiceMsgIn *in)
 static void display_handle_draw_blackness(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawBlackness *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, NULL, op->data.mask.bitmap, NULL);
     DRAW(blackness);
 }
 
 static void display_handle_draw_whiteness(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawWhiteness *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, NULL, op->data.mask.bitmap, NULL);
     DRAW(whiteness);
 }
 
@@ -1749,6 +2490,7 @@ static void display_handle_draw_whiteness(SpiceChannel *channel, SpiceMsgIn *in)
 static void display_handle_draw_invers(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawInvers *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, NULL, op->data.mask.bitmap, NULL);
     DRAW(invers);
 }
 
@@ -1756,6 +2498,7 @@ static void display_handle_draw_invers(SpiceChannel *channel, SpiceMsgIn *in)
 static void display_handle_draw_rop3(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawRop3 *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, op->data.src_bitmap, op->data.mask.bitmap, &op->data.brush);
     DRAW(rop3);
 }
 
@@ -1763,6 +2506,7 @@ static void display_handle_draw_rop3(SpiceChannel *channel, SpiceMsgIn *in)
 static void display_handle_draw_stroke(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawStroke *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, NULL, NULL, &op->data.brush);
     DRAW(stroke);
 }
 
@@ -1770,6 +2514,8 @@ static void display_handle_draw_stroke(SpiceChannel *channel, SpiceMsgIn *in)
 static void display_handle_draw_text(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawText *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, NULL, NULL, &op->data.fore_brush);
+    stream_overlays_flush_read(channel, NULL, NULL, &op->data.back_brush);
     DRAW(text);
 }
 
@@ -1777,6 +2523,7 @@ static void display_handle_draw_text(SpiceChannel *channel, SpiceMsgIn *in)
 static void display_handle_draw_transparent(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawTransparent *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, op->data.src_bitmap, NULL, NULL);
     DRAW(transparent);
 }
 
@@ -1784,6 +2531,7 @@ static void display_handle_draw_transparent(SpiceChannel *channel, SpiceMsgIn *i
 static void display_handle_draw_alpha_blend(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawAlphaBlend *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, op->data.src_bitmap, NULL, NULL);
     DRAW(alpha_blend);
 }
 
@@ -1791,6 +2539,7 @@ static void display_handle_draw_alpha_blend(SpiceChannel *channel, SpiceMsgIn *i
 static void display_handle_draw_composite(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpiceMsgDisplayDrawComposite *op = spice_msg_in_parsed(in);
+    stream_overlays_flush_read(channel, op->data.src_bitmap, op->data.mask_bitmap, NULL);
     DRAW(composite);
 }
 
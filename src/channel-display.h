@@ -105,6 +105,154 @@ struct _SpiceDisplayPrimary {
     gboolean marked;
 };
 
+/**
+ * SpiceDisplayStreamFrame:
+ * @x: x position of the frame in the primary surface
+ * @y: y position of the frame in the primary surface
+ * @width: width of the frame in the primary surface
+ * @height: height of the frame in the primary surface
+ * @frame_width: width of the decoded pixels
+ * @frame_height: height of the decoded pixels
+ * @stride: stride of the decoded pixels
+ * @pixels: (nullable): the decoded pixels, 32 bits xRGB and top-down,
+ * or %NULL when the stream must no longer be composited
+ *
+ * Holds a decoded video frame, see #SpiceDisplayChannel::stream-frame.
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpiceDisplayStreamFrame SpiceDisplayStreamFrame;
+struct _SpiceDisplayStreamFrame {
+    gint x;
+    gint y;
+    gint width;
+    gint height;
+    gint frame_width;
+    gint frame_height;
+    gint stride;
+    GBytes *pixels;
+};
+
+/**
+ * SpiceStreamTimingStage:
+ * @SPICE_STREAM_TIMING_ARRIVAL: the frame was received
+ * @SPICE_STREAM_TIMING_QUEUED: the frame was queued to the decoder
+ * @SPICE_STREAM_TIMING_DECODE_START: the decoding started
+ * @SPICE_STREAM_TIMING_DECODE_END: the decoding ended
+ * @SPICE_STREAM_TIMING_PRESENTED: the frame was handed to the display
+ * @SPICE_STREAM_TIMING_LAST: number of stages
+ *
+ * The stages of a video frame recorded in #SpiceStreamTiming.
+ *
+ * Since: 0.36
+ **/
+typedef enum {
+    SPICE_STREAM_TIMING_ARRIVAL,
+    SPICE_STREAM_TIMING_QUEUED,
+    SPICE_STREAM_TIMING_DECODE_START,
+    SPICE_STREAM_TIMING_DECODE_END,
+    SPICE_STREAM_TIMING_PRESENTED,
+
+    SPICE_STREAM_TIMING_LAST
+} SpiceStreamTimingStage;
+
+/**
+ * SpiceStreamTiming:
+ * @stream_id: the stream of the frame
+ * @mm_time: the multimedia time of the frame
+ * @time: the g_get_monotonic_time() at each #SpiceStreamTimingStage,
+ * or 0 if the frame didn't reach it
+ * @mm_delta: the frame @mm_time minus the session multimedia time at
+ * each #SpiceStreamTimingStage, in milliseconds; negative when late
+ *
+ * Holds the timing of a video frame.
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpiceStreamTiming SpiceStreamTiming;
+struct _SpiceStreamTiming {
+    guint32 stream_id;
+    guint32 mm_time;
+    gint64 time[SPICE_STREAM_TIMING_LAST];
+    gint32 mm_delta[SPICE_STREAM_TIMING_LAST];
+};
+
+/**
+ * SpiceStreamTimingStats:
+ * @frames: number of frames received
+ * @presented: number of frames presented
+ * @decode_p50: median decoding time, in microseconds
+ * @decode_p95: 95th percentile of the decoding time, in microseconds
+ * @decode_p99: 99th percentile of the decoding time, in microseconds
+ * @lag_p50: median time from arrival to presentation, in microseconds
+ * @lag_p95: 95th percentile of the time from arrival to presentation
+ * @lag_p99: 99th percentile of the time from arrival to presentation
+ *
+ * Summary of the recent #SpiceStreamTiming of a channel.
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpiceStreamTimingStats SpiceStreamTimingStats;
+struct _SpiceStreamTimingStats {
+    guint frames;
+    guint presented;
+    gint64 decode_p50;
+    gint64 decode_p95;
+    gint64 decode_p99;
+    gint64 lag_p50;
+    gint64 lag_p95;
+    gint64 lag_p99;
+};
+
+/**
+ * SpiceStreamingBottleneck:
+ * @SPICE_STREAMING_BOTTLENECK_NONE: the streams are displayed on time
+ * @SPICE_STREAMING_BOTTLENECK_DECODE: the client is too slow to decode the frames
+ * @SPICE_STREAMING_BOTTLENECK_MAIN_LOOP: the client main loop is too busy to
+ * present the frames on time
+ * @SPICE_STREAMING_BOTTLENECK_NETWORK: the frames are late or pile up on the
+ * socket before they are read
+ *
+ * What is holding back the video streams of a #SpiceDisplayChannel.
+ *
+ * Since: 0.36
+ **/
+typedef enum {
+    SPICE_STREAMING_BOTTLENECK_NONE,
+    SPICE_STREAMING_BOTTLENECK_DECODE,
+    SPICE_STREAMING_BOTTLENECK_MAIN_LOOP,
+    SPICE_STREAMING_BOTTLENECK_NETWORK,
+} SpiceStreamingBottleneck;
+
+/**
+ * SpiceStreamingState:
+ * @bottleneck: the current #SpiceStreamingBottleneck
+ * @frame_interval: average time between two frames, in microseconds
+ * @decode_time: average decoding time of a frame, in microseconds
+ * @loop_lag: average delay of the main loop, in microseconds
+ * @socket_queue: average number of bytes waiting on the socket
+ * @drops: number of frames dropped by the client
+ * @latency_adjustment: what is taken off the latency sent in the stream
+ * reports, in milliseconds
+ * @preferred_codec: the #SpiceVideoCodecType the client decodes the fastest,
+ * or 0 if it is not known yet
+ *
+ * The state of the client side streaming controller.
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpiceStreamingState SpiceStreamingState;
+struct _SpiceStreamingState {
+    SpiceStreamingBottleneck bottleneck;
+    gint64 frame_interval;
+    gint64 decode_time;
+    gint64 loop_lag;
+    guint64 socket_queue;
+    guint drops;
+    gint32 latency_adjustment;
+    gint preferred_codec;
+};
+
 /**
  * SpiceDisplayChannel:
  *
@@ -147,6 +295,7 @@ struct _SpiceDisplayChannelClass {
 GType	        spice_display_channel_get_type(void);
 gboolean        spice_display_channel_get_primary(SpiceChannel *channel, guint32 surface_id,
                                                   SpiceDisplayPrimary *primary);
+guint8         *spice_display_channel_get_primary_data(SpiceDisplayChannel *channel);
 
 void spice_display_channel_change_preferred_compression(SpiceChannel *channel, gint compression);
 void spice_display_channel_change_preferred_video_codec_type(SpiceChannel *channel, gint codec_type);
@@ -157,6 +306,13 @@ void            spice_gl_scanout_free         (SpiceGlScanout *scanout);
 const SpiceGlScanout* spice_display_channel_get_gl_scanout(SpiceDisplayChannel *channel);
 void spice_display_channel_gl_draw_done(SpiceDisplayChannel *channel);
 
+guint spice_display_channel_get_stream_timings(SpiceDisplayChannel *channel,
+                                               SpiceStreamTiming *timings, guint n_timings);
+void spice_display_channel_get_stream_timing_stats(SpiceDisplayChannel *channel,
+                                                   SpiceStreamTimingStats *stats);
+gboolean spice_display_channel_get_streaming_state(SpiceDisplayChannel *channel,
+                                                   SpiceStreamingState *state);
+
 #ifndef SPICE_DISABLE_DEPRECATED
 G_DEPRECATED_FOR(spice_display_channel_change_preferred_compression)
 void spice_display_change_preferred_compression(SpiceChannel *channel, gint compression);
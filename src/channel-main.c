@@ -46,7 +46,32 @@
  * communication initialization (channels list), migrations, mouse
  * modes, multimedia time, and agent communication.
  *
+ * File transfers read the next chunk of a file while the previous one is
+ * being sent to the agent, so that reading the file overlaps with sending
+ * it. SPICE_FILE_XFER_CHUNKS sets how many chunks may be read ahead, from
+ * 1, which waits for each chunk to be sent before reading the next one,
+ * to 4; it is 2 by default. When several files are transferred, they
+ * take turns to send a chunk, and the other agent messages go in between
+ * chunks.
  *
+ * The agent messages for control, such as the clipboard or the display
+ * configuration, are sent ahead of the bulk data of the file transfers
+ * and port forwarding, though never in the middle of another agent
+ * message. The forwarded connections take turns too, so that a bulk
+ * transfer leaves room for the interactive ones; their state can be
+ * followed with spice_main_channel_get_port_forward_stats().
+ *
+ * The display changes, such as the resizes of a window being dragged, are
+ * coalesced into one monitor config, sent once they stop for a moment.
+ * A config the guest has already got is not sent again, and the configs
+ * are sent no more than twice a second, since each one makes the guest
+ * change its mode and redraw the screen. See
+ * spice_main_channel_get_monitor_config_stats().
+ *
+ * Large clipboard data is streamed both ways: it is sent as it is
+ * produced, and handed over as it arrives through
+ * #SpiceMainChannel::main-clipboard-selection-data, so that it is never
+ * held or converted whole on the way.
  */
 
 #define MAX_DISPLAY 16 /* Note must fit in a guint32, see monitors_align */
@@ -83,6 +108,49 @@ typedef struct {
     } stats;
 } FileTransferOperation;
 
+/* the data of a file transfer waiting for agent tokens, as a queue of
+ * chunks, each one a complete agent message. The tasks with data take
+ * turns to send up to their weight in chunks. The forwarded connections
+ * take part in the turns too, as a queue without task or chunks. */
+typedef struct {
+    SpiceFileTransferTurn      turn; /* first, file_xfer_sched holds the queues */
+    SpiceFileTransferTask      *xfer_task;
+    GQueue                     chunks;
+    guint64                    sent;
+} FileTransferQueue;
+
+/* a monitor config is sent once the display changes stop for
+ * MONITOR_CONFIG_GAP_FACTOR times the usual gap between them, within
+ * MONITOR_CONFIG_MIN_DELAY and MONITOR_CONFIG_MAX_DELAY, and not sooner
+ * than MONITOR_CONFIG_MIN_INTERVAL after the previous one, in us */
+#define MONITOR_CONFIG_MIN_DELAY (200 * 1000)
+#define MONITOR_CONFIG_MAX_DELAY G_USEC_PER_SEC
+#define MONITOR_CONFIG_GAP_FACTOR 3
+#define MONITOR_CONFIG_MIN_INTERVAL (500 * 1000)
+
+/* clipboard data larger than that is sent as it is produced, that many
+ * SPICE messages ahead of the agent, rather than prepared whole */
+#define CLIPBOARD_STREAM_MIN (256 * 1024)
+#define CLIPBOARD_STREAM_WINDOW 64
+
+typedef struct {
+    SpiceMainChannel           *channel;
+    GBytes                     *data;
+    gsize                      pos;
+    gboolean                   crlf;
+    gchar                      last;
+    guint                      idle_id;
+} ClipboardStream;
+
+/* the messages making up one agent message, which can't be interleaved
+ * with others as the agent gets a byte stream */
+typedef struct {
+    GQueue                     msgs;
+    gsize                      size;
+    gboolean                   clipboard;
+    ClipboardStream            *stream; /* the rest is still to be produced */
+} AgentMsg;
+
 struct _SpiceMainChannelPrivate  {
     enum SpiceMouseMode         mouse_mode;
     enum SpiceMouseMode         requested_mouse_mode;
@@ -101,13 +169,32 @@ struct _SpiceMainChannelPrivate  {
     VDAgentMessage              agent_msg; /* partial msg reconstruction */
     guint8                      *agent_msg_data;
     guint                       agent_msg_pos;
+    guint                       agent_msg_keep; /* what is reassembled, the rest is streamed */
+    gboolean                    agent_msg_discard;
     uint8_t                     agent_msg_size;
     uint32_t                    agent_caps[VD_AGENT_CAPS_SIZE];
     SpiceDisplayConfig          display[MAX_DISPLAY];
     gint                        timer_id;
+    gint64                      display_change_time;
+    gint64                      display_change_gap;
+    gint64                      monitor_config_time;
+    GBytes                      *monitor_config_sent;
+    SpiceMonitorConfigStats     monitor_config_stats;
     GQueue                      *agent_msg_queue;
+    GQueue                      *agent_bulk_queue;
+    AgentMsg                    *agent_msg_sending;
+    guint                       agent_clipboard_bulk;
     GHashTable                  *file_xfer_tasks;
     GHashTable                  *flushing;
+    guint                       file_xfer_chunks;
+    GHashTable                  *file_xfer_queues;
+    GQueue                      *file_xfer_sched;
+    FileTransferQueue           *port_forward_turn;
+    struct {
+        gint64                  start;
+        guint64                 bytes;
+        guint64                 rate;
+    } file_xfer_rate;
     PortForwarder               *port_forwarder;
 
     guint                       switch_host_delayed_id;
@@ -164,6 +251,7 @@ enum {
     SPICE_MAIN_CLIPBOARD_SELECTION_GRAB,
     SPICE_MAIN_CLIPBOARD_SELECTION_REQUEST,
     SPICE_MAIN_CLIPBOARD_SELECTION_RELEASE,
+    SPICE_MAIN_CLIPBOARD_SELECTION_DATA,
     SPICE_MIGRATION_STARTED,
     SPICE_MAIN_NEW_FILE_TRANSFER,
     SPICE_MAIN_LAST_SIGNAL,
@@ -252,6 +340,14 @@ static void spice_main_channel_reset_capabilties(SpiceChannel *channel)
 
 static void port_forwarder_send_command(void *channel, uint32_t command,
                                         const uint8_t *data, uint32_t data_size);
+static void port_forwarder_data_ready(void *channel);
+static void file_xfer_queue_free(FileTransferQueue *queue);
+static void file_xfer_queues_clear(SpiceMainChannel *channel);
+static void agent_bulk_queue_clear(SpiceMainChannel *channel);
+static gboolean agent_clipboard_stream_fill(gpointer user_data);
+static AgentMsg *agent_msg_new_bytes(SpiceMainChannel *channel, int type,
+                                     const void *header, gsize header_size,
+                                     GBytes *bytes);
 
 static void spice_main_channel_init(SpiceMainChannel *channel)
 {
@@ -259,10 +355,20 @@ static void spice_main_channel_init(SpiceMainChannel *channel)
 
     c = channel->priv = spice_main_channel_get_instance_private(channel);
     c->agent_msg_queue = g_queue_new();
+    c->agent_bulk_queue = g_queue_new();
     c->file_xfer_tasks = g_hash_table_new(g_direct_hash, g_direct_equal);
     c->flushing = g_hash_table_new(g_direct_hash, g_direct_equal);
+    c->file_xfer_queues = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                                (GDestroyNotify)file_xfer_queue_free);
+    c->file_xfer_sched = g_queue_new();
+    c->port_forward_turn = g_new0(FileTransferQueue, 1);
+    c->file_xfer_chunks = FILE_XFER_DEFAULT_CHUNKS;
+    if (g_getenv("SPICE_FILE_XFER_CHUNKS"))
+        c->file_xfer_chunks = CLAMP(atoi(g_getenv("SPICE_FILE_XFER_CHUNKS")),
+                                    1, FILE_XFER_MAX_CHUNKS);
     c->cancellable_volume_info = g_cancellable_new();
-    c->port_forwarder = new_port_forwarder(channel, port_forwarder_send_command);
+    c->port_forwarder = new_port_forwarder(channel, port_forwarder_send_command,
+                                           port_forwarder_data_ready);
 
     spice_main_channel_reset_capabilties(SPICE_CHANNEL(channel));
     c->requested_mouse_mode = SPICE_MOUSE_MODE_CLIENT;
@@ -379,10 +485,16 @@ static void spice_main_channel_dispose(GObject *obj)
         c->migrate_delayed_id = 0;
     }
 
+    agent_bulk_queue_clear(SPICE_MAIN_CHANNEL(obj));
+    if (c->file_xfer_queues) {
+        file_xfer_queues_clear(SPICE_MAIN_CHANNEL(obj));
+        g_clear_pointer(&c->file_xfer_queues, g_hash_table_unref);
+        g_clear_pointer(&c->file_xfer_sched, g_queue_free);
+        g_clear_pointer(&c->port_forward_turn, g_free);
+    }
     g_clear_pointer(&c->file_xfer_tasks, g_hash_table_unref);
     g_clear_pointer (&c->flushing, g_hash_table_unref);
-    if (c->port_forwarder)
-        delete_port_forwarder(c->port_forwarder);
+    g_clear_pointer(&c->port_forwarder, delete_port_forwarder);
 
     g_cancellable_cancel(c->cancellable_volume_info);
     g_clear_object(&c->cancellable_volume_info);
@@ -397,6 +509,9 @@ static void spice_main_channel_finalize(GObject *obj)
 
     g_free(c->agent_msg_data);
     agent_free_msg_queue(SPICE_MAIN_CHANNEL(obj));
+    agent_bulk_queue_clear(SPICE_MAIN_CHANNEL(obj));
+    g_queue_free(c->agent_bulk_queue);
+    g_clear_pointer(&c->monitor_config_sent, g_bytes_unref);
 
     if (G_OBJECT_CLASS(spice_main_channel_parent_class)->finalize)
         G_OBJECT_CLASS(spice_main_channel_parent_class)->finalize(obj);
@@ -422,10 +537,13 @@ static void spice_main_channel_reset_agent(SpiceMainChannel *channel)
     c->agent_msg_pos = 0;
     g_clear_pointer(&c->agent_msg_data, g_free);
     c->agent_msg_size = 0;
+    /* a new agent needs the config again */
+    g_clear_pointer(&c->monitor_config_sent, g_bytes_unref);
 
     spice_main_channel_reset_all_xfer_operations(channel);
     file_xfer_flushed(channel, FALSE);
-    port_forwarder_agent_disconnected(c->port_forwarder);
+    if (c->port_forwarder)
+        port_forwarder_agent_disconnected(c->port_forwarder);
 }
 
 /* main or coroutine context */
@@ -440,6 +558,8 @@ static void spice_main_channel_reset(SpiceChannel *channel, gboolean migrating)
     c->agent_tokens = 0;
     agent_free_msg_queue(SPICE_MAIN_CHANNEL(channel));
     c->agent_msg_queue = g_queue_new();
+    agent_bulk_queue_clear(SPICE_MAIN_CHANNEL(channel));
+    file_xfer_queues_clear(SPICE_MAIN_CHANNEL(channel));
 
     c->agent_volume_playback_sync = FALSE;
     c->agent_volume_record_sync = FALSE;
@@ -815,6 +935,37 @@ static void spice_main_channel_class_init(SpiceMainChannelClass *klass)
                      1,
                      G_TYPE_UINT);
 
+    /**
+     * SpiceMainChannel::main-clipboard-selection-data:
+     * @main: the #SpiceMainChannel that emitted the signal
+     * @selection: a VD_AGENT_CLIPBOARD_SELECTION clipboard
+     * @type: the VD_AGENT_CLIPBOARD data type
+     * @data: a piece of the clipboard data
+     * @size: size of @data in bytes
+     * @offset: where @data goes in the clipboard data
+     * @total: size of the whole clipboard data in bytes
+     *
+     * Informs that a piece of clipboard selection data arrived: it is
+     * complete once @offset + @size reaches @total. Large clipboard data is
+     * handed over this way as it arrives, rather than held whole in
+     * memory, unless there are handlers for
+     * #SpiceMainChannel::main-clipboard-selection too. Data over
+     * #SpiceMainChannel:max-clipboard is dropped, and comes out empty.
+     *
+     * Since: 0.36
+     **/
+    signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA] =
+        g_signal_new("main-clipboard-selection-data",
+                     G_OBJECT_CLASS_TYPE(gobject_class),
+                     G_SIGNAL_RUN_LAST,
+                     0,
+                     NULL, NULL,
+                     g_cclosure_user_marshal_VOID__UINT_UINT_POINTER_UINT_UINT_UINT,
+                     G_TYPE_NONE,
+                     6,
+                     G_TYPE_UINT, G_TYPE_UINT, G_TYPE_POINTER,
+                     G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT);
+
     /**
      * SpiceMainChannel::migration-started:
      * @main: the #SpiceMainChannel that emitted the signal
@@ -905,7 +1056,8 @@ static void file_xfer_flush_async(SpiceFileTransferTask *xfer_task,
     GTask *task;
     SpiceMainChannel *channel;
     SpiceMainChannelPrivate *c;
-    gboolean was_empty;
+    FileTransferQueue *queue;
+    AgentMsg *chunk;
 
     channel = spice_file_transfer_task_get_channel(xfer_task);
     task = g_task_new(xfer_task,
@@ -914,15 +1066,17 @@ static void file_xfer_flush_async(SpiceFileTransferTask *xfer_task,
                       user_data);
 
     c = channel->priv;
-    was_empty = g_queue_is_empty(c->agent_msg_queue);
-    if (was_empty) {
+    queue = g_hash_table_lookup(c->file_xfer_queues,
+                                GUINT_TO_POINTER(spice_file_transfer_task_get_id(xfer_task)));
+    if (queue == NULL || g_queue_is_empty(&queue->chunks)) {
         g_task_return_boolean(task, TRUE);
         g_object_unref(task);
         return;
     }
 
-    /* wait until the last message currently in the queue has been sent */
-    g_hash_table_insert(c->flushing, g_queue_peek_tail(c->agent_msg_queue), task);
+    /* wait until the last chunk currently queued for the task has been sent */
+    chunk = g_queue_peek_tail(&queue->chunks);
+    g_hash_table_insert(c->flushing, g_queue_peek_tail(&chunk->msgs), task);
 }
 
 static gboolean file_xfer_flush_finish(SpiceFileTransferTask *xfer_task,
@@ -936,6 +1090,262 @@ static gboolean file_xfer_flush_finish(SpiceFileTransferTask *xfer_task,
     return g_task_propagate_boolean(task, error);
 }
 
+/* ---------- Agent queues ---------- */
+
+static FileTransferQueue *file_xfer_queue_new(SpiceFileTransferTask *xfer_task)
+{
+    FileTransferQueue *queue = g_new0(FileTransferQueue, 1);
+
+    queue->xfer_task = g_object_ref(xfer_task);
+    g_queue_init(&queue->chunks);
+    return queue;
+}
+
+/* drops a message which was never sent, failing whoever waits for it */
+static void agent_msg_drop(SpiceMainChannel *channel, SpiceMsgOut *out)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    GTask *task;
+
+    task = c->flushing ? g_hash_table_lookup(c->flushing, out) : NULL;
+    if (task) {
+        g_hash_table_remove(c->flushing, out);
+        g_task_return_boolean(task, FALSE);
+        g_object_unref(task);
+    }
+    spice_msg_out_unref(out);
+}
+
+static void clipboard_stream_free(ClipboardStream *stream)
+{
+    if (stream->idle_id)
+        g_source_remove(stream->idle_id);
+    g_bytes_unref(stream->data);
+    g_free(stream);
+}
+
+static void agent_msg_free(SpiceMainChannel *channel, AgentMsg *chunk)
+{
+    SpiceMsgOut *out;
+
+    while ((out = g_queue_pop_head(&chunk->msgs)) != NULL) {
+        agent_msg_drop(channel, out);
+    }
+    if (chunk->stream)
+        clipboard_stream_free(chunk->stream);
+    if (chunk->clipboard)
+        channel->priv->agent_clipboard_bulk--;
+    g_free(chunk);
+}
+
+static void file_xfer_queue_clear(FileTransferQueue *queue)
+{
+    SpiceMainChannel *channel = spice_file_transfer_task_get_channel(queue->xfer_task);
+    AgentMsg *chunk;
+
+    while ((chunk = g_queue_pop_head(&queue->chunks)) != NULL) {
+        agent_msg_free(channel, chunk);
+    }
+    spice_file_transfer_turns_unschedule(channel->priv->file_xfer_sched, &queue->turn);
+}
+
+static void file_xfer_queue_free(FileTransferQueue *queue)
+{
+    file_xfer_queue_clear(queue);
+    g_object_unref(queue->xfer_task);
+    g_free(queue);
+}
+
+/* drops the bulk messages not sent yet, including the rest of the one
+ * being sent, which is only fine once the channel is reset */
+static void agent_bulk_queue_clear(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    AgentMsg *msg;
+
+    while ((msg = g_queue_pop_head(c->agent_bulk_queue)) != NULL) {
+        agent_msg_free(channel, msg);
+    }
+
+    if (c->agent_msg_sending) {
+        agent_msg_free(channel, c->agent_msg_sending);
+        c->agent_msg_sending = NULL;
+    }
+}
+
+/* drops all the file data not sent yet */
+static void file_xfer_queues_clear(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    GHashTableIter iter;
+    gpointer value;
+
+    if (c->file_xfer_queues == NULL)
+        return;
+
+    g_hash_table_iter_init(&iter, c->file_xfer_queues);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        file_xfer_queue_clear(value);
+    }
+}
+
+/* any context */
+static void file_xfer_queue_chunk(SpiceMainChannel *channel,
+                                  SpiceFileTransferTask *xfer_task,
+                                  AgentMsg *chunk)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    FileTransferQueue *queue;
+
+    queue = g_hash_table_lookup(c->file_xfer_queues,
+                                GUINT_TO_POINTER(spice_file_transfer_task_get_id(xfer_task)));
+    if (queue == NULL) {
+        /* the task is over */
+        agent_msg_free(channel, chunk);
+        return;
+    }
+
+    g_queue_push_tail(&queue->chunks, chunk);
+    spice_file_transfer_turns_schedule(c->file_xfer_sched, &queue->turn);
+}
+
+#define FILE_XFER_RATE_PERIOD G_USEC_PER_SEC
+
+static void file_xfer_rate_update(SpiceMainChannelPrivate *c, gsize bytes)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 elapsed = now - c->file_xfer_rate.start;
+    guint64 rate;
+
+    c->file_xfer_rate.bytes += bytes;
+    if (elapsed < FILE_XFER_RATE_PERIOD) {
+        return;
+    }
+
+    /* after a pause, start over rather than average it in */
+    if (elapsed < 4 * FILE_XFER_RATE_PERIOD) {
+        rate = (c->file_xfer_rate.bytes - bytes) * G_USEC_PER_SEC / elapsed;
+        c->file_xfer_rate.rate = c->file_xfer_rate.rate == 0 ? rate :
+            (3 * c->file_xfer_rate.rate + rate) / 4;
+    } else {
+        c->file_xfer_rate.rate = 0;
+    }
+    c->file_xfer_rate.start = now;
+    c->file_xfer_rate.bytes = bytes;
+}
+
+/* coroutine context: picks the next data message of the forwarded
+ * connections */
+static AgentMsg *port_forwarder_next(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    VDAgentPortForwardDataMessage head;
+    gsize head_size;
+    AgentMsg *msg;
+    GBytes *bytes;
+    guint32 command;
+
+    if (c->port_forwarder == NULL) {
+        return NULL;
+    }
+    bytes = port_forwarder_pop_data(c->port_forwarder, &command, &head, &head_size);
+    if (bytes == NULL) {
+        return NULL;
+    }
+
+    msg = agent_msg_new_bytes(channel, command, &head, head_size, bytes);
+    g_bytes_unref(bytes);
+    return msg;
+}
+
+/* coroutine context: picks the next chunk to send. The tasks with data
+ * and the forwarded connections take turns, each sending up to its weight
+ * in chunks in a row. The weight of the forwarded connections is the sum
+ * of the weights of the ones with data, so that each one counts like a
+ * file transfer. */
+static AgentMsg *file_xfer_sched_next(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    FileTransferQueue *queue;
+    AgentMsg *chunk;
+    gboolean more;
+    guint weight;
+
+    while ((queue = g_queue_peek_head(c->file_xfer_sched)) != NULL) {
+        if (queue->xfer_task != NULL) {
+            weight = spice_file_transfer_task_get_weight(queue->xfer_task);
+            chunk = g_queue_pop_head(&queue->chunks);
+            more = !g_queue_is_empty(&queue->chunks);
+            file_xfer_rate_update(c, chunk->size);
+        } else {
+            weight = c->port_forwarder ? port_forwarder_get_weight(c->port_forwarder) : 1;
+            chunk = port_forwarder_next(channel);
+            more = c->port_forwarder != NULL &&
+                port_forwarder_get_weight(c->port_forwarder) > 0;
+        }
+
+        if (chunk != NULL) {
+            queue->sent += chunk->size;
+        }
+        spice_file_transfer_turns_next(c->file_xfer_sched, weight, chunk != NULL, more);
+        if (chunk != NULL) {
+            return chunk;
+        }
+    }
+
+    return NULL;
+}
+
+/* coroutine context: the agent messages come in two classes. The control
+ * messages go first; the bulk data, then the file transfers and the
+ * forwarded connections in turns, are only picked in between, one whole
+ * agent message at a time. The control queue
+ * only holds whole agent messages, so it is always left at a boundary. */
+static SpiceMsgOut *agent_msg_queue_pop(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    SpiceMsgOut *out;
+
+    if (c->agent_msg_sending == NULL) {
+        if (!g_queue_is_empty(c->agent_msg_queue)) {
+            return g_queue_pop_head(c->agent_msg_queue);
+        }
+        c->agent_msg_sending = g_queue_pop_head(c->agent_bulk_queue);
+        if (c->agent_msg_sending == NULL) {
+            c->agent_msg_sending = file_xfer_sched_next(channel);
+        }
+        if (c->agent_msg_sending == NULL) {
+            return NULL;
+        }
+    }
+
+    out = g_queue_pop_head(&c->agent_msg_sending->msgs);
+    if (c->agent_msg_sending->stream != NULL) {
+        /* wait for the rest of it, produced from the main loop */
+        ClipboardStream *stream = c->agent_msg_sending->stream;
+
+        if (stream->idle_id == 0 &&
+            g_queue_get_length(&c->agent_msg_sending->msgs) <= CLIPBOARD_STREAM_WINDOW / 2) {
+            stream->idle_id = g_idle_add(agent_clipboard_stream_fill, c->agent_msg_sending);
+        }
+    } else if (g_queue_is_empty(&c->agent_msg_sending->msgs)) {
+        agent_msg_free(channel, c->agent_msg_sending);
+        c->agent_msg_sending = NULL;
+    }
+    return out;
+}
+
+static gboolean agent_msg_queue_is_empty(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+
+    return g_queue_is_empty(c->agent_msg_queue) &&
+        c->agent_msg_sending == NULL &&
+        g_queue_is_empty(c->agent_bulk_queue) &&
+        (c->port_forwarder == NULL || port_forwarder_get_queued(c->port_forwarder) == 0) &&
+        g_queue_is_empty(c->file_xfer_sched);
+}
+
 /* coroutine context */
 static void agent_send_msg_queue(SpiceMainChannel *channel)
 {
@@ -943,10 +1353,9 @@ static void agent_send_msg_queue(SpiceMainChannel *channel)
     SpiceMsgOut *out;
 
     while (c->agent_tokens > 0 &&
-           !g_queue_is_empty(c->agent_msg_queue)) {
+           (out = agent_msg_queue_pop(channel)) != NULL) {
         GTask *task;
         c->agent_tokens--;
-        out = g_queue_pop_head(c->agent_msg_queue);
         spice_msg_out_send_internal(out);
 
         task = g_hash_table_lookup(c->flushing, out);
@@ -957,13 +1366,51 @@ static void agent_send_msg_queue(SpiceMainChannel *channel)
             g_hash_table_remove(c->flushing, out);
         }
     }
-    if (g_queue_is_empty(c->agent_msg_queue) &&
+    if (agent_msg_queue_is_empty(channel) &&
         g_hash_table_size(c->flushing) != 0) {
         g_warning("unexpected flush task in list, clearing");
         file_xfer_flushed(channel, TRUE);
     }
 }
 
+/* any context: queues an agent message with the bulk data, for
+   clipboard data which comes after it */
+static AgentMsg *agent_msg_queue_clipboard(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    AgentMsg *msg = g_new0(AgentMsg, 1);
+
+    g_queue_init(&msg->msgs);
+    msg->clipboard = TRUE;
+    c->agent_clipboard_bulk++;
+    g_queue_push_tail(c->agent_bulk_queue, msg);
+
+    return msg;
+}
+
+/* any context: returns where to queue the messages of an agent message of
+   @type. Large clipboard data goes with the bulk data, see
+   agent_clipboard_stream(), and while it waits there the other clipboard
+   messages follow it to keep their order. */
+static GQueue *agent_msg_queue_for(SpiceMainChannel *channel, int type)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+
+    switch (type) {
+    case VD_AGENT_CLIPBOARD:
+    case VD_AGENT_CLIPBOARD_GRAB:
+    case VD_AGENT_CLIPBOARD_REQUEST:
+    case VD_AGENT_CLIPBOARD_RELEASE:
+        if (c->agent_clipboard_bulk > 0)
+            return &agent_msg_queue_clipboard(channel)->msgs;
+        break;
+    default:
+        break;
+    }
+
+    return c->agent_msg_queue;
+}
+
 /* any context: the message is not flushed immediately,
    you can wakeup() the channel coroutine or send_msg_queue()
 
@@ -976,7 +1423,7 @@ G_GNUC_NULL_TERMINATED
 static void agent_msg_queue_many(SpiceMainChannel *channel, int type, const void *data, ...)
 {
     va_list args;
-    SpiceMainChannelPrivate *c = channel->priv;
+    GQueue *queue = agent_msg_queue_for(channel, type);
     SpiceMsgOut *out;
     VDAgentMessage msg;
     guint8 *payload;
@@ -1003,7 +1450,7 @@ static void agent_msg_queue_many(SpiceMainChannel *channel, int type, const void
     payload += sizeof(VDAgentMessage);
     paysize -= sizeof(VDAgentMessage);
     if (paysize == 0) {
-        g_queue_push_tail(c->agent_msg_queue, out);
+        g_queue_push_tail(queue, out);
         out = NULL;
     }
 
@@ -1024,7 +1471,7 @@ static void agent_msg_queue_many(SpiceMainChannel *channel, int type, const void
             size -= mins;
             paysize -= mins;
             if (paysize == 0) {
-                g_queue_push_tail(c->agent_msg_queue, out);
+                g_queue_push_tail(queue, out);
                 out = NULL;
             }
         }
@@ -1033,6 +1480,171 @@ static void agent_msg_queue_many(SpiceMainChannel *channel, int type, const void
     g_warn_if_fail(out == NULL);
 }
 
+static void agent_msg_bytes_free(uint8_t *data G_GNUC_UNUSED, void *opaque)
+{
+    g_bytes_unref(opaque);
+}
+
+/* any context: like agent_msg_queue_many(), except that the messages
+   reference @bytes rather than copying it, and release it once they are
+   written; the small @header is copied in front of it. The messages are
+   added to @queue. */
+static void agent_msg_build_bytes(SpiceMainChannel *channel, GQueue *queue, int type,
+                                  const void *header, gsize header_size,
+                                  GBytes *bytes)
+{
+    SpiceMsgOut *out;
+    VDAgentMessage msg;
+    guint8 *payload;
+    const guint8 *data;
+    gsize size, paysize, n;
+
+    g_return_if_fail(sizeof(VDAgentMessage) + header_size <= VD_AGENT_MAX_DATA_SIZE);
+
+    data = g_bytes_get_data(bytes, &size);
+
+    msg.protocol = VD_AGENT_PROTOCOL;
+    msg.type = type;
+    msg.opaque = 0;
+    msg.size = header_size + size;
+
+    out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+    payload = spice_marshaller_reserve_space(out->marshaller,
+                                             sizeof(VDAgentMessage) + header_size);
+    memcpy(payload, &msg, sizeof(VDAgentMessage));
+    if (header_size > 0)
+        memcpy(payload + sizeof(VDAgentMessage), header, header_size);
+    paysize = VD_AGENT_MAX_DATA_SIZE - sizeof(VDAgentMessage) - header_size;
+
+    for (;;) {
+        n = MIN(paysize, size);
+        if (n > 0) {
+            spice_marshaller_add_by_ref_full(out->marshaller, (uint8_t *)data, n,
+                                             agent_msg_bytes_free, g_bytes_ref(bytes));
+        }
+        g_queue_push_tail(queue, out);
+        data += n;
+        size -= n;
+        if (size == 0)
+            break;
+
+        out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+        paysize = VD_AGENT_MAX_DATA_SIZE;
+    }
+}
+
+/* any context */
+static void agent_msg_queue_bytes(SpiceMainChannel *channel, int type,
+                                  const void *header, gsize header_size,
+                                  GBytes *bytes)
+{
+    agent_msg_build_bytes(channel, agent_msg_queue_for(channel, type), type,
+                          header, header_size, bytes);
+}
+
+/* any context: a message holding @bytes as is, a piece of an agent
+   message started before */
+static SpiceMsgOut *agent_msg_out_new_bytes(SpiceMainChannel *channel, GBytes *bytes)
+{
+    SpiceMsgOut *out;
+    const guint8 *data;
+    gsize size;
+
+    data = g_bytes_get_data(bytes, &size);
+    out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+    spice_marshaller_add_by_ref_full(out->marshaller, (uint8_t *)data, size,
+                                     agent_msg_bytes_free, g_bytes_ref(bytes));
+
+    return out;
+}
+
+/* any context: queues clipboard data too large to be prepared at once,
+   @size bytes once its line endings are converted if @crlf. Only the
+   start of the agent message is queued: the rest of it is produced by
+   agent_clipboard_stream_fill() as it gets sent. */
+static void agent_clipboard_stream(SpiceMainChannel *channel,
+                                   const void *header, gsize header_size,
+                                   GBytes *data, gsize size, gboolean crlf)
+{
+    AgentMsg *msg = agent_msg_queue_clipboard(channel);
+    ClipboardStream *stream = g_new0(ClipboardStream, 1);
+    SpiceMsgOut *out;
+    VDAgentMessage vmsg;
+    guint8 *payload;
+
+    vmsg.protocol = VD_AGENT_PROTOCOL;
+    vmsg.type = VD_AGENT_CLIPBOARD;
+    vmsg.opaque = 0;
+    vmsg.size = header_size + size;
+
+    out = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_MAIN_AGENT_DATA);
+    payload = spice_marshaller_reserve_space(out->marshaller,
+                                             sizeof(VDAgentMessage) + header_size);
+    memcpy(payload, &vmsg, sizeof(VDAgentMessage));
+    memcpy(payload + sizeof(VDAgentMessage), header, header_size);
+    g_queue_push_tail(&msg->msgs, out);
+
+    stream->channel = channel;
+    stream->data = g_bytes_ref(data);
+    stream->crlf = crlf;
+    msg->stream = stream;
+    msg->size = vmsg.size;
+}
+
+/* main context: produces the next messages of the clipboard data being
+   sent, converting them on the way, up to CLIPBOARD_STREAM_WINDOW */
+static gboolean agent_clipboard_stream_fill(gpointer user_data)
+{
+    AgentMsg *msg = user_data;
+    ClipboardStream *stream = msg->stream;
+    SpiceMainChannel *channel = stream->channel;
+    const gchar *data;
+    GBytes *piece;
+    gsize size, n;
+
+    stream->idle_id = 0;
+    data = g_bytes_get_data(stream->data, &size);
+    while (stream->pos < size &&
+           g_queue_get_length(&msg->msgs) < CLIPBOARD_STREAM_WINDOW) {
+        if (stream->crlf) {
+            /* the line endings may double its size */
+            gchar *conv;
+
+            n = MIN(size - stream->pos, VD_AGENT_MAX_DATA_SIZE / 2);
+            conv = g_malloc(2 * n);
+            piece = g_bytes_new_take(conv, spice_unix2dos_chunk(data + stream->pos, n,
+                                                                &stream->last, conv));
+        } else {
+            n = MIN(size - stream->pos, VD_AGENT_MAX_DATA_SIZE);
+            piece = g_bytes_new_from_bytes(stream->data, stream->pos, n);
+        }
+        g_queue_push_tail(&msg->msgs, agent_msg_out_new_bytes(channel, piece));
+        g_bytes_unref(piece);
+        stream->pos += n;
+    }
+
+    if (stream->pos == size) {
+        clipboard_stream_free(stream);
+        msg->stream = NULL;
+    }
+    spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* any context: builds a message of bulk data */
+static AgentMsg *agent_msg_new_bytes(SpiceMainChannel *channel, int type,
+                                     const void *header, gsize header_size,
+                                     GBytes *bytes)
+{
+    AgentMsg *msg = g_new0(AgentMsg, 1);
+
+    g_queue_init(&msg->msgs);
+    msg->size = header_size + g_bytes_get_size(bytes);
+    agent_msg_build_bytes(channel, &msg->msgs, type, header, header_size, bytes);
+    return msg;
+}
+
 static int monitors_cmp(const void *p1, const void *p2, gpointer user_data)
 {
     const VDAgentMonConfig *m1 = p1;
@@ -1084,44 +1696,14 @@ static void monitors_align(VDAgentMonConfig *monitors, int nmonitors)
 #define agent_msg_queue(Channel, Type, Size, Data) \
     agent_msg_queue_many((Channel), (Type), (Data), (Size), NULL)
 
-/**
- * spice_main_send_monitor_config:
- * @channel: a #SpiceMainChannel
- *
- * Send monitors configuration previously set with
- * spice_main_set_display() and spice_main_set_display_enabled()
- *
- * Returns: %TRUE on success.
- *
- * Deprecated: 0.35: use spice_main_channel_send_monitor_config() instead.
- **/
-gboolean spice_main_send_monitor_config(SpiceMainChannel *channel)
+/* Builds the monitor config message from the display configs */
+static GBytes *monitor_config_build(SpiceMainChannel *channel)
 {
-    return spice_main_channel_send_monitor_config(channel);
-}
-
-/**
- * spice_main_channel_send_monitor_config:
- * @channel: a #SpiceMainChannel
- *
- * Send monitors configuration previously set with
- * spice_main_set_display() and spice_main_set_display_enabled()
- *
- * Returns: %TRUE on success.
- *
- * Since: 0.35
- **/
-gboolean spice_main_channel_send_monitor_config(SpiceMainChannel *channel)
-{
-    SpiceMainChannelPrivate *c;
+    SpiceMainChannelPrivate *c = channel->priv;
     VDAgentMonitorsConfig *mon;
     int i, j, monitors;
     size_t size;
 
-    g_return_val_if_fail(SPICE_IS_MAIN_CHANNEL(channel), FALSE);
-    c = channel->priv;
-    g_return_val_if_fail(c->agent_connected, FALSE);
-
     if (spice_main_channel_agent_test_capability(channel, VD_AGENT_CAP_SPARSE_MONITORS_CONFIG)) {
         monitors = SPICE_N_ELEMENTS(c->display);
     } else {
@@ -1140,7 +1722,7 @@ gboolean spice_main_channel_send_monitor_config(SpiceMainChannel *channel)
         c->disable_display_align == FALSE)
         mon->flags |= VD_AGENT_CONFIG_MONITORS_FLAG_USE_POS;
 
-    CHANNEL_DEBUG(channel, "sending new monitors config to guest");
+    CHANNEL_DEBUG(channel, "new monitors config");
     j = 0;
     for (i = 0; i < SPICE_N_ELEMENTS(c->display); i++) {
         if (c->display[i].display_state != DISPLAY_ENABLED) {
@@ -1164,14 +1746,64 @@ gboolean spice_main_channel_send_monitor_config(SpiceMainChannel *channel)
     if (c->disable_display_align == FALSE)
         monitors_align(mon->monitors, mon->num_of_monitors);
 
-    agent_msg_queue(channel, VD_AGENT_MONITORS_CONFIG, size, mon);
-    g_free(mon);
+    return g_bytes_new_take(mon, size);
+}
+
+static void monitor_config_send(SpiceMainChannel *channel, GBytes *config)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+
+    agent_msg_queue(channel, VD_AGENT_MONITORS_CONFIG,
+                    g_bytes_get_size(config), g_bytes_get_data(config, NULL));
+    g_clear_pointer(&c->monitor_config_sent, g_bytes_unref);
+    c->monitor_config_sent = g_bytes_ref(config);
+    c->monitor_config_time = g_get_monotonic_time();
+    c->monitor_config_stats.sent++;
+
+    spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
+    if (c->timer_id != 0) {
+        g_source_remove(c->timer_id);
+        c->timer_id = 0;
+    }
+}
+
+/**
+ * spice_main_send_monitor_config:
+ * @channel: a #SpiceMainChannel
+ *
+ * Send monitors configuration previously set with
+ * spice_main_set_display() and spice_main_set_display_enabled()
+ *
+ * Returns: %TRUE on success.
+ *
+ * Deprecated: 0.35: use spice_main_channel_send_monitor_config() instead.
+ **/
+gboolean spice_main_send_monitor_config(SpiceMainChannel *channel)
+{
+    return spice_main_channel_send_monitor_config(channel);
+}
+
+/**
+ * spice_main_channel_send_monitor_config:
+ * @channel: a #SpiceMainChannel
+ *
+ * Send monitors configuration previously set with
+ * spice_main_set_display() and spice_main_set_display_enabled()
+ *
+ * Returns: %TRUE on success.
+ *
+ * Since: 0.35
+ **/
+gboolean spice_main_channel_send_monitor_config(SpiceMainChannel *channel)
+{
+    GBytes *config;
+
+    g_return_val_if_fail(SPICE_IS_MAIN_CHANNEL(channel), FALSE);
+    g_return_val_if_fail(channel->priv->agent_connected, FALSE);
 
-    spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
-    if (c->timer_id != 0) {
-        g_source_remove(c->timer_id);
-        c->timer_id = 0;
-    }
+    config = monitor_config_build(channel);
+    monitor_config_send(channel, config);
+    g_bytes_unref(config);
 
     return TRUE;
 }
@@ -1396,14 +2028,18 @@ static void agent_clipboard_grab(SpiceMainChannel *channel, guint selection,
 /* any context: the message is not flushed immediately,
    you can wakeup() the channel coroutine or send_msg_queue() */
 static void agent_clipboard_notify(SpiceMainChannel *self, guint selection,
-                                   guint32 type, const guchar *data, size_t size)
+                                   guint32 type, GBytes *data, gboolean crlf)
 {
     SpiceMainChannelPrivate *c = self->priv;
     VDAgentClipboard *cb;
     guint8 *msg;
     size_t msgsize;
+    gsize size = g_bytes_get_size(data);
     gint max_clipboard = spice_main_get_max_clipboard(self);
 
+    if (crlf)
+        size = spice_unix2dos_len(g_bytes_get_data(data, NULL), size);
+
     g_return_if_fail(c->agent_connected);
     g_return_if_fail(test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_BY_DEMAND));
     g_return_if_fail(max_clipboard == -1 || size < max_clipboard);
@@ -1427,7 +2063,21 @@ static void agent_clipboard_notify(SpiceMainChannel *self, guint selection,
     }
 
     cb->type = type;
-    agent_msg_queue_many(self, VD_AGENT_CLIPBOARD, msg, msgsize, data, size, NULL);
+    if (size >= CLIPBOARD_STREAM_MIN) {
+        agent_clipboard_stream(self, msg, msgsize, data, size, crlf);
+    } else if (crlf) {
+        gchar *conv = g_malloc(size + 1);
+        gchar last = 0;
+        GBytes *bytes;
+
+        spice_unix2dos_chunk(g_bytes_get_data(data, NULL), g_bytes_get_size(data),
+                             &last, conv);
+        bytes = g_bytes_new_take(conv, size);
+        agent_msg_queue_bytes(self, VD_AGENT_CLIPBOARD, msg, msgsize, bytes);
+        g_bytes_unref(bytes);
+    } else {
+        agent_msg_queue_bytes(self, VD_AGENT_CLIPBOARD, msg, msgsize, data);
+    }
 }
 
 /* any context: the message is not flushed immediately,
@@ -1509,12 +2159,21 @@ static gboolean timer_set_display(gpointer data)
     SpiceMainChannel *channel = data;
     SpiceMainChannelPrivate *c = channel->priv;
     SpiceSession *session;
+    GBytes *config;
+    gint64 wait;
     gint i;
 
     c->timer_id = 0;
     if (!c->agent_connected)
         return FALSE;
 
+    wait = c->monitor_config_time + MONITOR_CONFIG_MIN_INTERVAL - g_get_monotonic_time();
+    if (c->monitor_config_time != 0 && wait > 0) {
+        /* too soon after the previous one */
+        c->timer_id = g_timeout_add(wait / 1000 + 1, timer_set_display, channel);
+        return FALSE;
+    }
+
     if (!any_display_has_dimensions(channel)) {
         SPICE_DEBUG("Not sending monitors config, at least one monitor must have dimensions");
         return FALSE;
@@ -1531,7 +2190,15 @@ static gboolean timer_set_display(gpointer data)
                 return FALSE;
             }
     }
-    spice_main_channel_send_monitor_config(channel);
+
+    config = monitor_config_build(channel);
+    if (c->monitor_config_sent != NULL && g_bytes_equal(config, c->monitor_config_sent)) {
+        SPICE_DEBUG("Not sending monitors config, the guest has it already");
+        c->monitor_config_stats.duplicates++;
+    } else {
+        monitor_config_send(channel, config);
+    }
+    g_bytes_unref(config);
 
     return FALSE;
 }
@@ -1556,6 +2223,33 @@ static void update_display_timer(SpiceMainChannel *channel, guint seconds)
 
 }
 
+/* any context: the display config changed, the new one is sent once
+ * the changes stop, see MONITOR_CONFIG_MIN_DELAY */
+static void monitor_config_changed(SpiceMainChannel *channel)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    gint64 now = g_get_monotonic_time();
+    gint64 gap = now - c->display_change_time;
+    gint64 delay;
+
+    if (c->display_change_time != 0 && gap < MONITOR_CONFIG_MAX_DELAY) {
+        /* more of the same burst, like a window being resized */
+        c->display_change_gap = c->display_change_gap == 0 ? gap :
+            (3 * c->display_change_gap + gap) / 4;
+    } else {
+        c->display_change_gap = 0;
+    }
+    c->display_change_time = now;
+
+    if (c->timer_id != 0) {
+        g_source_remove(c->timer_id);
+        c->monitor_config_stats.coalesced++;
+    }
+    delay = CLAMP(MONITOR_CONFIG_GAP_FACTOR * c->display_change_gap,
+                  MONITOR_CONFIG_MIN_DELAY, MONITOR_CONFIG_MAX_DELAY);
+    c->timer_id = g_timeout_add(delay / 1000, timer_set_display, channel);
+}
+
 /* coroutine context  */
 static void set_agent_connected(SpiceMainChannel *channel, gboolean connected)
 {
@@ -1679,6 +2373,7 @@ static void main_handle_init(SpiceChannel *channel, SpiceMsgIn *in)
 
     session = spice_channel_get_session(channel);
     spice_session_set_connection_id(session, init->session_id);
+    spice_session_channel_usable(session, channel);
 
     set_mouse_mode(SPICE_MAIN_CHANNEL(channel), init->supported_mouse_modes,
                    init->current_mouse_mode);
@@ -1741,7 +2436,9 @@ static gboolean _channel_new(channel_new_t *c)
 {
     g_return_val_if_fail(c != NULL, FALSE);
 
-    spice_channel_new(c->session, c->type, c->id);
+    /* kept from before a network outage, and reconnected already */
+    if (!spice_session_has_channel(c->session, c->id, c->type))
+        spice_channel_new(c->session, c->type, c->id);
 
     g_object_unref(c->session);
     g_free(c);
@@ -1805,6 +2502,17 @@ static void main_handle_agent_disconnected(SpiceChannel *channel, SpiceMsgIn *in
     agent_stopped(SPICE_MAIN_CHANNEL(channel));
 }
 
+/* any context */
+static void file_xfer_read_next(SpiceFileTransferTask *xfer_task,
+                                FileTransferOperation *xfer_op)
+{
+    /* a read might still be going on, or all the buffers be waiting for
+     * the agent: the next read starts when they are done */
+    if (spice_file_transfer_task_can_read(xfer_task)) {
+        spice_file_transfer_task_read_async(xfer_task, file_xfer_read_async_cb, xfer_op);
+    }
+}
+
 static void file_xfer_data_flushed_cb(GObject *source_object,
                                       GAsyncResult *res,
                                       gpointer user_data)
@@ -1822,24 +2530,46 @@ static void file_xfer_data_flushed_cb(GObject *source_object,
     if (!spice_file_transfer_task_is_completed(xfer_task)) {
         file_transfer_operation_send_progress(xfer_task);
         /* Read more data */
-        spice_file_transfer_task_read_async(xfer_task, file_xfer_read_async_cb, user_data);
+        file_xfer_read_next(xfer_task, user_data);
+    }
+}
+
+/* any context: the messages of a chunk were written (or dropped), its
+ * buffer can be read into again */
+static void file_xfer_chunk_written(gpointer user_data)
+{
+    SpiceFileTransferTask *xfer_task = user_data;
+    SpiceMainChannel *channel = spice_file_transfer_task_get_channel(xfer_task);
+    FileTransferOperation *xfer_op;
+
+    spice_file_transfer_task_release_chunk(xfer_task);
+    if (channel->priv->file_xfer_tasks != NULL &&
+        !spice_file_transfer_task_is_completed(xfer_task)) {
+        xfer_op = g_hash_table_lookup(channel->priv->file_xfer_tasks,
+                                      GUINT_TO_POINTER(spice_file_transfer_task_get_id(xfer_task)));
+        if (xfer_op != NULL)
+            file_xfer_read_next(xfer_task, xfer_op);
     }
+    g_object_unref(xfer_task);
 }
 
 static void file_xfer_queue_msg_to_agent(SpiceMainChannel *channel,
-                                         guint32 task_id,
-                                         gchar *buffer,
-                                         gint data_size)
+                                         SpiceFileTransferTask *xfer_task,
+                                         GBytes *data)
 {
     VDAgentFileXferDataMessage msg;
+    AgentMsg *chunk;
 
     g_return_if_fail(channel != NULL);
 
-    msg.id = task_id;
-    msg.size = data_size;
-    agent_msg_queue_many(channel, VD_AGENT_FILE_XFER_DATA,
-                         &msg, sizeof(msg),
-                         buffer, data_size, NULL);
+    msg.id = spice_file_transfer_task_get_id(xfer_task);
+    msg.size = g_bytes_get_size(data);
+    chunk = g_new0(AgentMsg, 1);
+    g_queue_init(&chunk->msgs);
+    chunk->size = msg.size;
+    agent_msg_build_bytes(channel, &chunk->msgs, VD_AGENT_FILE_XFER_DATA,
+                          &msg, sizeof(msg), data);
+    file_xfer_queue_chunk(channel, xfer_task, chunk);
     spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
 }
 
@@ -1853,6 +2583,7 @@ static void file_xfer_read_async_cb(GObject *source_object,
     SpiceMainChannel *channel;
     gssize count;
     char *buffer;
+    GBytes *chunk;
     GError *error = NULL;
 
     xfer_task = SPICE_FILE_TRANSFER_TASK(source_object);
@@ -1874,7 +2605,16 @@ static void file_xfer_read_async_cb(GObject *source_object,
         return;
     }
 
-    file_xfer_queue_msg_to_agent(channel, spice_file_transfer_task_get_id(xfer_task), buffer, count);
+    /* the messages reference the chunk buffer, which is held until they
+     * are written rather than until they are queued */
+    if (count > 0) {
+        chunk = g_bytes_new_with_free_func(buffer, count, file_xfer_chunk_written,
+                                           g_object_ref(xfer_task));
+    } else {
+        chunk = g_bytes_new(NULL, 0);
+    }
+    file_xfer_queue_msg_to_agent(channel, xfer_task, chunk);
+    g_bytes_unref(chunk);
     if (count == 0 || spice_file_transfer_task_is_completed(xfer_task)) {
         /* on EOF just wait for VD_AGENT_FILE_XFER_STATUS from agent
          * in case the task was completed, nothing to do. */
@@ -1884,6 +2624,8 @@ static void file_xfer_read_async_cb(GObject *source_object,
     xfer_op->stats.total_sent += count;
 
     file_xfer_flush_async(xfer_task, file_xfer_data_flushed_cb, xfer_op);
+    /* read ahead while this chunk is being sent */
+    file_xfer_read_next(xfer_task, xfer_op);
 }
 
 /* coroutine context */
@@ -1978,6 +2720,20 @@ static void spice_main_set_max_clipboard(SpiceMainChannel *self, gint max)
     spice_channel_wakeup(SPICE_CHANNEL(self), FALSE);
 }
 
+/* the agent is told the limit, see agent_max_clipboard() */
+static gboolean agent_clipboard_over_limit(SpiceMainChannel *self, gsize size)
+{
+    gint max_clipboard = spice_main_get_max_clipboard(self);
+
+    if (max_clipboard != -1 && size > max_clipboard) {
+        g_warning("discarded clipboard of size %" G_GSIZE_FORMAT " (max: %d)",
+                  size, max_clipboard);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 /* coroutine context */
 static void main_agent_handle_msg(SpiceChannel *channel,
                                   VDAgentMessage *msg, gpointer payload)
@@ -2046,12 +2802,18 @@ static void main_agent_handle_msg(SpiceChannel *channel,
     case VD_AGENT_CLIPBOARD:
     {
         VDAgentClipboard *cb = payload;
+        guint size = msg->size - sizeof(VDAgentClipboard);
+
+        if (agent_clipboard_over_limit(self, size))
+            size = 0;
+        g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA], 0, selection,
+                                cb->type, cb->data, size, 0, size);
         g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION], 0, selection,
-                                cb->type, cb->data, msg->size - sizeof(VDAgentClipboard));
+                                cb->type, cb->data, size);
 
        if (selection == VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD)
            g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD], 0,
-                              cb->type, cb->data, msg->size - sizeof(VDAgentClipboard));
+                              cb->type, cb->data, size);
         break;
     }
     case VD_AGENT_CLIPBOARD_GRAB:
@@ -2106,11 +2868,63 @@ static void main_agent_handle_msg(SpiceChannel *channel,
     }
 }
 
+/* Returns how much of the payload of @msg to reassemble before handling
+ * it. Clipboard data is handed over as it arrives instead when nobody
+ * waits for it whole, or dropped when over the limit: only the selection
+ * and type in front of it are kept. */
+static guint main_agent_msg_keep(SpiceMainChannel *self, VDAgentMessage *msg)
+{
+    SpiceMainChannelPrivate *c = self->priv;
+    guint prefix = sizeof(VDAgentClipboard);
+
+    c->agent_msg_discard = FALSE;
+    if (msg->type != VD_AGENT_CLIPBOARD)
+        return msg->size;
+
+    if (test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_SELECTION))
+        prefix += 4;
+    if (msg->size <= prefix)
+        return msg->size;
+
+    if (agent_clipboard_over_limit(self, msg->size - prefix)) {
+        c->agent_msg_discard = TRUE;
+        return prefix;
+    }
+    if (g_signal_has_handler_pending(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION], 0, FALSE) ||
+        g_signal_has_handler_pending(self, signals[SPICE_MAIN_CLIPBOARD], 0, FALSE))
+        return msg->size;
+
+    return prefix;
+}
+
+/* coroutine context: hands over a piece of the clipboard data being
+ * received, at @offset in it */
+static void main_agent_clipboard_data(SpiceMainChannel *self, const guint8 *data,
+                                      guint size, guint offset)
+{
+    SpiceMainChannelPrivate *c = self->priv;
+    guint8 selection = VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD;
+    guint8 *prefix = c->agent_msg_data;
+    VDAgentClipboard *cb;
+
+    if (test_agent_cap(self, VD_AGENT_CAP_CLIPBOARD_SELECTION)) {
+        selection = prefix[0];
+        prefix += 4;
+    }
+    cb = (VDAgentClipboard *)prefix;
+
+    g_coroutine_signal_emit(self, signals[SPICE_MAIN_CLIPBOARD_SELECTION_DATA], 0, selection,
+                            cb->type, data, size, offset,
+                            c->agent_msg.size - c->agent_msg_keep);
+}
+
 /* coroutine context */
 static void main_handle_agent_data_msg(SpiceChannel* channel, int* msg_size, guchar** msg_pos)
 {
-    SpiceMainChannelPrivate *c = SPICE_MAIN_CHANNEL(channel)->priv;
-    int n;
+    SpiceMainChannel *self = SPICE_MAIN_CHANNEL(channel);
+    SpiceMainChannelPrivate *c = self->priv;
+    int n, keep;
+    guint pos;
 
     if (c->agent_msg_pos < sizeof(VDAgentMessage)) {
         n = MIN(sizeof(VDAgentMessage) - c->agent_msg_pos, *msg_size);
@@ -2122,20 +2936,32 @@ static void main_handle_agent_data_msg(SpiceChannel* channel, int* msg_size, guc
             SPICE_DEBUG("agent msg start: msg_size=%u, protocol=%u, type=%u",
                         c->agent_msg.size, c->agent_msg.protocol, c->agent_msg.type);
             g_return_if_fail(c->agent_msg_data == NULL);
-            c->agent_msg_data = g_malloc0(c->agent_msg.size);
+            c->agent_msg_keep = main_agent_msg_keep(self, &c->agent_msg);
+            c->agent_msg_data = g_malloc0(c->agent_msg_keep);
         }
     }
 
     if (c->agent_msg_pos >= sizeof(VDAgentMessage)) {
-        n = MIN(sizeof(VDAgentMessage) + c->agent_msg.size - c->agent_msg_pos, *msg_size);
-        memcpy(c->agent_msg_data + c->agent_msg_pos - sizeof(VDAgentMessage), *msg_pos, n);
+        pos = c->agent_msg_pos - sizeof(VDAgentMessage);
+        n = MIN(c->agent_msg.size - pos, *msg_size);
+        keep = pos < c->agent_msg_keep ? MIN(n, c->agent_msg_keep - pos) : 0;
+        memcpy(c->agent_msg_data + pos, *msg_pos, keep);
+        if (keep < n && !c->agent_msg_discard) {
+            main_agent_clipboard_data(self, *msg_pos + keep, n - keep,
+                                      pos + keep - c->agent_msg_keep);
+        }
         c->agent_msg_pos += n;
         *msg_size -= n;
         *msg_pos += n;
     }
 
     if (c->agent_msg_pos == sizeof(VDAgentMessage) + c->agent_msg.size) {
-        main_agent_handle_msg(channel, &c->agent_msg, c->agent_msg_data);
+        if (c->agent_msg_discard) {
+            /* hand it over empty */
+            c->agent_msg.size = c->agent_msg_keep;
+        }
+        if (c->agent_msg_keep == c->agent_msg.size)
+            main_agent_handle_msg(channel, &c->agent_msg, c->agent_msg_data);
         g_free(c->agent_msg_data);
         c->agent_msg_data = NULL;
         c->agent_msg_pos = 0;
@@ -2650,12 +3476,14 @@ gboolean spice_main_channel_agent_test_capability(SpiceMainChannel *channel, gui
  * @y: y position
  * @width: display width
  * @height: display height
- * @update: if %TRUE, update guest resolution after 1sec.
+ * @update: if %TRUE, update guest resolution once the changes settle.
  *
  * Update the display @id resolution.
  *
  * If @update is %TRUE, the remote configuration will be updated too
- * after 1 second without further changes. You can send when you want
+ * once the changes settle, between 200ms and 1 second after the last one
+ * depending on how fast they come. A configuration the guest already has
+ * is not sent again. You can send when you want
  * without delay the new configuration to the remote with
  * spice_main_send_monitor_config()
  *
@@ -2676,12 +3504,14 @@ void spice_main_update_display(SpiceMainChannel *channel, int id,
  * @y: y position
  * @width: display width
  * @height: display height
- * @update: if %TRUE, update guest resolution after 1sec.
+ * @update: if %TRUE, update guest resolution once the changes settle.
  *
  * Update the display @id resolution.
  *
  * If @update is %TRUE, the remote configuration will be updated too
- * after 1 second without further changes. You can send when you want
+ * once the changes settle, between 200ms and 1 second after the last one
+ * depending on how fast they come. A configuration the guest already has
+ * is not sent again. You can send when you want
  * without delay the new configuration to the remote with
  * spice_main_send_monitor_config()
  *
@@ -2714,7 +3544,7 @@ void spice_main_channel_update_display(SpiceMainChannel *channel, int id, int x,
     c->display[id] = display;
 
     if (update)
-        update_display_timer(channel, 1);
+        monitor_config_changed(channel);
 }
 
 /**
@@ -2727,7 +3557,7 @@ void spice_main_channel_update_display(SpiceMainChannel *channel, int id, int x,
  * @height: display height
  *
  * Notify the guest of screen resolution change. The notification is
- * sent 1 second later, if no further changes happen.
+ * sent once the changes settle, see spice_main_channel_update_display().
  *
  * Deprecated: 0.35: use spice_main_channel_update_display() instead.
  **/
@@ -2898,10 +3728,78 @@ void spice_main_clipboard_selection_notify(SpiceMainChannel *channel, guint sele
 void spice_main_channel_clipboard_selection_notify(SpiceMainChannel *channel, guint selection,
                                            guint32 type, const guchar *data, size_t size)
 {
+    GBytes *bytes;
+
+    g_return_if_fail(channel != NULL);
+    g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+
+    bytes = g_bytes_new(data, size);
+    spice_main_channel_clipboard_selection_notify_bytes(channel, selection, type, bytes);
+    g_bytes_unref(bytes);
+}
+
+/**
+ * spice_main_channel_clipboard_selection_notify_bytes:
+ * @channel: a #SpiceMainChannel
+ * @selection: one of the clipboard #VD_AGENT_CLIPBOARD_SELECTION_*
+ * @type: a #VD_AGENT_CLIPBOARD type
+ * @data: clipboard data
+ *
+ * Send the clipboard data to the guest. Unlike
+ * spice_main_channel_clipboard_selection_notify(), the data is not copied:
+ * a reference to @data is kept until it has been sent.
+ *
+ * Since: 0.36
+ **/
+void spice_main_channel_clipboard_selection_notify_bytes(SpiceMainChannel *channel,
+                                                         guint selection, guint32 type,
+                                                         GBytes *data)
+{
+    g_return_if_fail(channel != NULL);
+    g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+    g_return_if_fail(data != NULL);
+
+    agent_clipboard_notify(channel, selection, type, data, FALSE);
+    spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
+}
+
+/**
+ * spice_main_channel_clipboard_selection_notify_text:
+ * @channel: a #SpiceMainChannel
+ * @selection: one of the clipboard #VD_AGENT_CLIPBOARD_SELECTION_*
+ * @text: UTF-8 text, with LF line endings and no trailing NUL
+ *
+ * Send clipboard text to the guest, converting its line endings to those
+ * of the guest. Like spice_main_channel_clipboard_selection_notify_bytes(),
+ * the text is not copied, and large text is converted and sent piece by
+ * piece. Text over #SpiceMainChannel:max-clipboard once converted is not
+ * sent, the guest gets an empty clipboard instead.
+ *
+ * Since: 0.36
+ **/
+void spice_main_channel_clipboard_selection_notify_text(SpiceMainChannel *channel,
+                                                        guint selection, GBytes *text)
+{
+    gboolean crlf;
+    gsize size;
+
     g_return_if_fail(channel != NULL);
     g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+    g_return_if_fail(text != NULL);
+
+    crlf = test_agent_cap(channel, VD_AGENT_CAP_GUEST_LINEEND_CRLF);
+    size = g_bytes_get_size(text);
+    if (crlf)
+        size = spice_unix2dos_len(g_bytes_get_data(text, NULL), size);
+
+    if (agent_clipboard_over_limit(channel, size)) {
+        GBytes *empty = g_bytes_new(NULL, 0);
 
-    agent_clipboard_notify(channel, selection, type, data, size);
+        agent_clipboard_notify(channel, selection, VD_AGENT_CLIPBOARD_UTF8_TEXT, empty, FALSE);
+        g_bytes_unref(empty);
+    } else {
+        agent_clipboard_notify(channel, selection, VD_AGENT_CLIPBOARD_UTF8_TEXT, text, crlf);
+    }
     spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
 }
 
@@ -2964,7 +3862,7 @@ void spice_main_channel_clipboard_selection_request(SpiceMainChannel *channel, g
  * @channel: a #SpiceMainChannel
  * @id: display ID (if -1: set all displays)
  * @enabled: wether display @id is enabled
- * @update: if %TRUE, update guest display state after 1sec.
+ * @update: if %TRUE, update guest display state once the changes settle.
  *
  * When sending monitor configuration to agent guest, if @enabled is %FALSE,
  * don't set display @id, which the agent translates to disabling the display
@@ -2989,7 +3887,7 @@ void spice_main_update_display_enabled(SpiceMainChannel *channel, int id, gboole
  * @channel: a #SpiceMainChannel
  * @id: display ID (if -1: set all displays)
  * @enabled: wether display @id is enabled
- * @update: if %TRUE, update guest display state after 1sec.
+ * @update: if %TRUE, update guest display state once the changes settle.
  *
  * When sending monitor configuration to agent guest, if @enabled is %FALSE,
  * don't set display @id, which the agent translates to disabling the display
@@ -3025,7 +3923,7 @@ void spice_main_channel_update_display_enabled(SpiceMainChannel *channel, int id
     }
 
     if (update)
-        update_display_timer(channel, 1);
+        monitor_config_changed(channel);
 }
 
 /**
@@ -3199,6 +4097,9 @@ static void file_transfer_operation_task_finished(SpiceFileTransferTask *xfer_ta
                              &msg, sizeof(msg), NULL);
     }
 
+    /* the chunks which didn't start to be sent are dropped */
+    g_hash_table_remove(channel->priv->file_xfer_queues, GUINT_TO_POINTER(task_id));
+
     xfer_op = g_hash_table_lookup(channel->priv->file_xfer_tasks, GUINT_TO_POINTER(task_id));
     if (xfer_op == NULL) {
         /* Likely the operation has ended before the remove-task was called. One
@@ -3364,6 +4265,8 @@ void spice_main_channel_file_copy_async(SpiceMainChannel *channel,
         SpiceFileTransferTask *xfer_task = g_hash_table_lookup(xfer_op->xfer_task, it->data);
 
         task_id = spice_file_transfer_task_get_id(xfer_task);
+        spice_file_transfer_task_set_max_chunks(xfer_task, c->file_xfer_chunks);
+        g_hash_table_insert(c->file_xfer_queues, it->data, file_xfer_queue_new(xfer_task));
 
         SPICE_DEBUG("Insert a xfer task:%u to task list", task_id);
 
@@ -3424,9 +4327,105 @@ gboolean spice_main_channel_file_copy_finish(SpiceMainChannel *channel,
     return g_task_propagate_boolean(task, error);
 }
 
+/**
+ * spice_main_channel_get_file_transfer_stats:
+ * @channel: a #SpiceMainChannel
+ * @stats: (out): where to store the state of the file transfers
+ *
+ * Gets the progress of all the file transfers going on together, and how
+ * fast they go. When several files are transferred at the same time,
+ * they take turns to send their data, according to their
+ * #SpiceFileTransferTask:weight.
+ *
+ * Since: 0.36
+ **/
+void spice_main_channel_get_file_transfer_stats(SpiceMainChannel *channel,
+                                                SpiceFileTransferStats *stats)
+{
+    SpiceMainChannelPrivate *c;
+    GHashTableIter iter;
+    gpointer value;
+
+    g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+    g_return_if_fail(stats != NULL);
+
+    c = channel->priv;
+    memset(stats, 0, sizeof(*stats));
+    g_hash_table_iter_init(&iter, c->file_xfer_queues);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        FileTransferQueue *queue = value;
+
+        stats->tasks++;
+        stats->total_bytes += spice_file_transfer_task_get_total_bytes(queue->xfer_task);
+        stats->sent_bytes += queue->sent;
+    }
+
+    file_xfer_rate_update(c, 0);
+    stats->throughput = stats->tasks > 0 ? c->file_xfer_rate.rate : 0;
+    if (stats->throughput > 0) {
+        stats->eta = (stats->total_bytes - MIN(stats->sent_bytes, stats->total_bytes)) /
+            stats->throughput;
+    } else {
+        stats->eta = -1;
+    }
+}
+
+/**
+ * spice_main_channel_get_agent_queue_stats:
+ * @channel: a #SpiceMainChannel
+ * @stats: (out): where to store the state of the agent queues
+ *
+ * Gets how many messages are waiting to be sent to the agent, for control
+ * and for bulk data, which can tell whether the agent keeps up.
+ *
+ * Since: 0.36
+ **/
+void spice_main_channel_get_agent_queue_stats(SpiceMainChannel *channel,
+                                              SpiceAgentQueueStats *stats)
+{
+    SpiceMainChannelPrivate *c;
+    GHashTableIter iter;
+    gpointer value;
+    GList *l;
+
+    g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+    g_return_if_fail(stats != NULL);
+
+    c = channel->priv;
+    memset(stats, 0, sizeof(*stats));
+    stats->control = g_queue_get_length(c->agent_msg_queue);
+    stats->tokens = c->agent_tokens;
+
+    if (c->agent_msg_sending) {
+        stats->bulk += g_queue_get_length(&c->agent_msg_sending->msgs);
+    }
+    for (l = c->agent_bulk_queue->head; l != NULL; l = l->next) {
+        AgentMsg *msg = l->data;
+
+        stats->bulk += g_queue_get_length(&msg->msgs);
+    }
+    g_hash_table_iter_init(&iter, c->file_xfer_queues);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        FileTransferQueue *queue = value;
+
+        for (l = queue->chunks.head; l != NULL; l = l->next) {
+            AgentMsg *msg = l->data;
+
+            stats->bulk += g_queue_get_length(&msg->msgs);
+        }
+    }
+    if (c->port_forwarder) {
+        /* each fits in a SPICE message */
+        stats->bulk += port_forwarder_get_queued(c->port_forwarder);
+    }
+}
+
 static void port_forwarder_send_command(void *channel, uint32_t command,
                                         const uint8_t *data, uint32_t data_size)
 {
+    /* the control commands go to the control queue; the data of the
+     * connections waits in the forwarder for its turn, and is picked in
+     * port_forwarder_next() */
     agent_msg_queue((SpiceMainChannel *)channel, command, data_size, data);
     if (&SPICE_CHANNEL(channel)->priv->coroutine != g_coroutine_self())
         spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
@@ -3434,6 +4433,89 @@ static void port_forwarder_send_command(void *channel, uint32_t command,
         agent_send_msg_queue((SpiceMainChannel *)channel);
 }
 
+static void port_forwarder_data_ready(void *channel)
+{
+    SpiceMainChannelPrivate *c = SPICE_MAIN_CHANNEL(channel)->priv;
+
+    /* the forwarded connections wait for their turn */
+    if (c->port_forward_turn != NULL) {
+        spice_file_transfer_turns_schedule(c->file_xfer_sched, &c->port_forward_turn->turn);
+    }
+
+    if (&SPICE_CHANNEL(channel)->priv->coroutine != g_coroutine_self())
+        spice_channel_wakeup(SPICE_CHANNEL(channel), FALSE);
+    else
+        agent_send_msg_queue((SpiceMainChannel *)channel);
+}
+
+/**
+ * spice_main_channel_get_monitor_config_stats:
+ * @channel: a #SpiceMainChannel
+ * @stats: (out): where to store the monitor configuration counters
+ *
+ * Gets how many monitor configurations were sent to the agent, and how
+ * many updates were merged into a later one or dropped because the guest
+ * had them already.
+ *
+ * Since: 0.36
+ **/
+void spice_main_channel_get_monitor_config_stats(SpiceMainChannel *channel,
+                                                 SpiceMonitorConfigStats *stats)
+{
+    g_return_if_fail(SPICE_IS_MAIN_CHANNEL(channel));
+    g_return_if_fail(stats != NULL);
+
+    *stats = channel->priv->monitor_config_stats;
+}
+
+/**
+ * spice_main_channel_get_port_forward_stats:
+ * @channel: a #SpiceMainChannel
+ *
+ * Gets the state of each connection forwarded through the agent.
+ *
+ * Returns: (transfer full) (element-type SpicePortForwardStats): the
+ * state of the connections, to free with g_array_unref()
+ *
+ * Since: 0.36
+ **/
+GArray *spice_main_channel_get_port_forward_stats(SpiceMainChannel *channel)
+{
+    g_return_val_if_fail(SPICE_IS_MAIN_CHANNEL(channel), NULL);
+
+    if (channel->priv->port_forwarder == NULL) {
+        return g_array_new(FALSE, TRUE, sizeof(SpicePortForwardStats));
+    }
+    return port_forwarder_get_stats(channel->priv->port_forwarder);
+}
+
+/**
+ * spice_main_channel_set_port_forward_weight:
+ * @channel: a #SpiceMainChannel
+ * @id: the identifier of a forwarded connection, see #SpicePortForwardStats
+ * @weight: the share of the link of the connection, from 1 to 16
+ *
+ * Sets the share of the link a forwarded connection gets when several
+ * connections, or file transfers, have data to send: it sends @weight
+ * times as much as a connection, or a #SpiceFileTransferTask, of
+ * weight 1. The connections start with a weight of 1.
+ *
+ * Returns: %TRUE if the connection exists
+ *
+ * Since: 0.36
+ **/
+gboolean spice_main_channel_set_port_forward_weight(SpiceMainChannel *channel,
+                                                    guint32 id, guint weight)
+{
+    g_return_val_if_fail(SPICE_IS_MAIN_CHANNEL(channel), FALSE);
+    g_return_val_if_fail(weight >= 1 && weight <= 16, FALSE);
+
+    if (channel->priv->port_forwarder == NULL) {
+        return FALSE;
+    }
+    return port_forwarder_set_weight(channel->priv->port_forwarder, id, weight);
+}
+
 
 static gboolean tokenize_redirection(gchar *redir, gchar **bind_address, gchar **port,
                                      gchar **host, gchar **host_port)
@@ -3509,6 +4591,32 @@ gboolean spice_main_port_forward_remote(SpiceMainChannel *channel,
                                            rport, host, lport);
 }
 
+/**
+ * spice_main_port_forward_remote_unix:
+ * @bind_address: the address to bind to in the agent side.
+ * @rport: the port forwarded in the agent side.
+ * @path: the Unix socket to connect to in the local side.
+ *
+ * Instructs the agent to start forwarding a port, and associate it with a
+ * local Unix socket, which saves the local connections going through TCP.
+ * Only available on Unix.
+ *
+ * Returns: a %TRUE on success, %FALSE on error.
+ *
+ * Since: 0.36
+ **/
+gboolean spice_main_port_forward_remote_unix(SpiceMainChannel *channel,
+                                             const char *bind_address, uint16_t rport,
+                                             const char *path)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    g_return_val_if_fail(c->agent_connected, FALSE);
+    g_return_val_if_fail(path != NULL, FALSE);
+    if (!test_agent_cap(channel, VD_AGENT_CAP_PORT_FORWARDING)) return FALSE;
+    return port_forwarder_associate_remote_unix(c->port_forwarder, bind_address,
+                                                rport, path);
+}
+
 /**
  * spice_main_port_forward_disassociate_remote:
  * @rport: the port forwarded in the agent side.
@@ -3549,6 +4657,74 @@ gboolean spice_main_port_forward_local(SpiceMainChannel *channel,
                                           lport, host, rport);
 }
 
+/**
+ * spice_main_port_forward_local_unix:
+ * @path: the Unix socket to listen on in the local side.
+ * @host: the address to connect to in the agent side.
+ * @rport: the port to connect to in the agent side.
+ *
+ * Instructs the agent to start forwarding the connections made to a local
+ * Unix socket, which saves them going through TCP. Only available on Unix.
+ *
+ * Returns: a %TRUE on success, %FALSE on error.
+ *
+ * Since: 0.36
+ **/
+gboolean spice_main_port_forward_local_unix(SpiceMainChannel *channel, const char *path,
+                                            const char *host, uint16_t rport)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    g_return_val_if_fail(c->agent_connected, FALSE);
+    g_return_val_if_fail(path != NULL && host != NULL, FALSE);
+    if (!test_agent_cap(channel, VD_AGENT_CAP_PORT_FORWARDING)) return FALSE;
+    return port_forwarder_associate_local_unix(c->port_forwarder, path, host, rport);
+}
+
+/**
+ * spice_main_port_forward_disassociate_local_unix:
+ * @path: the Unix socket forwarded in the local side.
+ *
+ * Stops listening on a Unix socket forwarded with
+ * spice_main_port_forward_local_unix(), and removes it. The connections
+ * already forwarded go on.
+ *
+ * Returns: a %TRUE on success, %FALSE on error.
+ *
+ * Since: 0.36
+ **/
+gboolean spice_main_port_forward_disassociate_local_unix(SpiceMainChannel *channel,
+                                                         const char *path)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    g_return_val_if_fail(path != NULL, FALSE);
+    return port_forwarder_disassociate_local_unix(c->port_forwarder, path);
+}
+
+/**
+ * spice_main_port_forward_fd:
+ * @fd: a connected socket.
+ * @host: the address to connect to in the agent side.
+ * @rport: the port to connect to in the agent side.
+ *
+ * Instructs the agent to connect to a port, and forwards the connection
+ * with the socket @fd, which was connected by the caller, such as one end
+ * of a socketpair(). On success, the socket belongs to the channel and is
+ * closed with the connection.
+ *
+ * Returns: a %TRUE on success, %FALSE on error.
+ *
+ * Since: 0.36
+ **/
+gboolean spice_main_port_forward_fd(SpiceMainChannel *channel, int fd,
+                                    const char *host, uint16_t rport)
+{
+    SpiceMainChannelPrivate *c = channel->priv;
+    g_return_val_if_fail(c->agent_connected, FALSE);
+    g_return_val_if_fail(fd >= 0 && host != NULL, FALSE);
+    if (!test_agent_cap(channel, VD_AGENT_CAP_PORT_FORWARDING)) return FALSE;
+    return port_forwarder_connect_fd(c->port_forwarder, fd, host, rport);
+}
+
 /**
  * spice_main_port_forward_disassociate_local:
  * @lport: the port forwarded in the local side.
@@ -69,6 +69,105 @@ struct _SpiceMainChannelClass {
     /* Do not add fields to this struct */
 };
 
+/**
+ * SpiceFileTransferStats:
+ * @tasks: number of files being transferred
+ * @total_bytes: total size of these files
+ * @sent_bytes: how much of them was sent to the agent
+ * @throughput: how fast the files are sent, in bytes per second
+ * @eta: how long the transfers should still take, in seconds, or -1 if
+ * unknown
+ *
+ * The state of the file transfers going on, all tasks together.
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpiceFileTransferStats SpiceFileTransferStats;
+struct _SpiceFileTransferStats {
+    guint tasks;
+    guint64 total_bytes;
+    guint64 sent_bytes;
+    guint64 throughput;
+    gint64 eta;
+};
+
+/**
+ * SpiceAgentQueueStats:
+ * @control: number of messages waiting to be sent to the agent for
+ * control, such as clipboard, display configuration and capabilities
+ * @bulk: number of messages of bulk data waiting to be sent, from file
+ * transfers and port forwarding
+ * @tokens: how many more messages the agent is ready to receive
+ *
+ * The state of the queues of messages to the agent. The control messages
+ * are sent ahead of the bulk data. The counts are in SPICE messages, an
+ * agent message being split in as many as needed.
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpiceAgentQueueStats SpiceAgentQueueStats;
+struct _SpiceAgentQueueStats {
+    guint control;
+    guint bulk;
+    gint tokens;
+};
+
+/**
+ * SpicePortForwardStats:
+ * @id: the identifier of the connection, shared with the agent
+ * @port: the local port the connection was accepted on, or the guest
+ * port for the connections made in the guest
+ * @sent_bytes: bytes read from the local end and sent to the agent
+ * @received_bytes: bytes received from the agent and written to the
+ * local end
+ * @queued_bytes: bytes read from the local end, waiting for the turn of
+ * the connection to be sent
+ * @window: how many bytes may be sent ahead of the acknowledgements of
+ * the agent
+ * @rtt: how long the agent takes to acknowledge the data, smoothed, in
+ * microseconds, or 0 if not measured yet
+ * @blocked_time: how long the connection waited for acknowledgements
+ * with a full window, in microseconds
+ * @weight: the share of the link of the connection, see
+ * spice_main_channel_set_port_forward_weight()
+ *
+ * The state of a connection forwarded through the agent, see
+ * spice_main_channel_get_port_forward_stats().
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpicePortForwardStats SpicePortForwardStats;
+struct _SpicePortForwardStats {
+    guint32 id;
+    guint16 port;
+    guint64 sent_bytes;
+    guint64 received_bytes;
+    guint64 queued_bytes;
+    guint32 window;
+    gint64 rtt;
+    gint64 blocked_time;
+    guint weight;
+};
+
+/**
+ * SpiceMonitorConfigStats:
+ * @sent: monitor configurations sent to the agent
+ * @coalesced: updates merged into a later one while the changes kept
+ * coming
+ * @duplicates: configurations not sent since the guest had them already
+ *
+ * The monitor configuration counters, see
+ * spice_main_channel_get_monitor_config_stats().
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpiceMonitorConfigStats SpiceMonitorConfigStats;
+struct _SpiceMonitorConfigStats {
+    guint sent;
+    guint coalesced;
+    guint duplicates;
+};
+
 GType spice_main_channel_get_type(void);
 
 void spice_main_channel_update_display(SpiceMainChannel *channel, int id, int x, int y, int width,
@@ -82,6 +181,11 @@ void spice_main_channel_clipboard_selection_grab(SpiceMainChannel *channel, guin
 void spice_main_channel_clipboard_selection_release(SpiceMainChannel *channel, guint selection);
 void spice_main_channel_clipboard_selection_notify(SpiceMainChannel *channel, guint selection,
                                                    guint32 type, const guchar *data, size_t size);
+void spice_main_channel_clipboard_selection_notify_bytes(SpiceMainChannel *channel,
+                                                         guint selection, guint32 type,
+                                                         GBytes *data);
+void spice_main_channel_clipboard_selection_notify_text(SpiceMainChannel *channel,
+                                                        guint selection, GBytes *text);
 void spice_main_channel_clipboard_selection_request(SpiceMainChannel *channel, guint selection,
                                                     guint32 type);
 
@@ -98,6 +202,24 @@ void spice_main_channel_file_copy_async(SpiceMainChannel *channel,
 gboolean spice_main_channel_file_copy_finish(SpiceMainChannel *channel,
                                              GAsyncResult *result,
                                              GError **error);
+void spice_main_channel_get_file_transfer_stats(SpiceMainChannel *channel,
+                                                SpiceFileTransferStats *stats);
+void spice_main_channel_get_agent_queue_stats(SpiceMainChannel *channel,
+                                              SpiceAgentQueueStats *stats);
+void spice_main_channel_get_monitor_config_stats(SpiceMainChannel *channel,
+                                                 SpiceMonitorConfigStats *stats);
+GArray *spice_main_channel_get_port_forward_stats(SpiceMainChannel *channel);
+gboolean spice_main_channel_set_port_forward_weight(SpiceMainChannel *channel,
+                                                    guint32 id, guint weight);
+gboolean spice_main_port_forward_remote_unix(SpiceMainChannel *channel,
+                                             const char *bind_address, uint16_t rport,
+                                             const char *path);
+gboolean spice_main_port_forward_local_unix(SpiceMainChannel *channel, const char *path,
+                                            const char *host, uint16_t rport);
+gboolean spice_main_port_forward_disassociate_local_unix(SpiceMainChannel *channel,
+                                                         const char *path);
+gboolean spice_main_port_forward_fd(SpiceMainChannel *channel, int fd,
+                                    const char *host, uint16_t rport);
 
 void spice_main_channel_request_mouse_mode(SpiceMainChannel *channel, int mode);
 
@@ -0,0 +1,299 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <string.h>
+
+#include "channel-playback-jitter.h"
+
+/* the target latency bounds, and what is kept on top of the jitter, in ms */
+#define JITTER_MIN_LATENCY 40
+#define JITTER_MAX_LATENCY 500
+#define JITTER_MARGIN 20
+
+/* how long the largest jitter seen is held before the target latency
+ * shrinks back, and how long the base transit time is kept */
+#define JITTER_HOLD (5 * G_USEC_PER_SEC)
+#define JITTER_BASE_WINDOW (10 * G_USEC_PER_SEC)
+/* weight of a new sample when the jitter shrinks back, as a shift */
+#define JITTER_DECAY_SHIFT 4
+/* how much an underrun raises the target latency, in ms */
+#define JITTER_UNDERRUN_STEP 20
+
+/* more missing packets than that are a pause of the stream, not a loss */
+#define JITTER_MAX_CONCEAL 5
+
+/* the buffered audio is brought to the target latency by resampling it by
+ * that many ppm per ms away from it, up to JITTER_MAX_DRIFT ppm, which is
+ * hardly audible; differences below JITTER_DEADBAND ms are left alone */
+#define JITTER_DRIFT_GAIN 100
+#define JITTER_MAX_DRIFT 5000
+#define JITTER_DEADBAND 10
+
+struct PlaybackJitter {
+    guint frequency;
+    guint channels;
+
+    /* ---------- Arrival ---------- */
+
+    gboolean started;
+    guint32 last_time;
+    guint packet_frames;
+    /* time between the mm-time of a packet and its arrival, in ms: only
+     * the variation of the transit matters, so the clocks needn't match */
+    gint64 base_transit;
+    gint64 window_transit;
+    gint64 window_end;
+    gint64 spread;
+    gint64 hold_end;
+    gint64 now;
+
+    /* ---------- Backend ---------- */
+
+    guint32 target;
+    guint32 extra_latency;
+    guint32 delay;
+    gint32 drift;
+
+    /* ---------- Resampler ---------- */
+
+    /* position of the next output frame, in 1/65536 of input frames,
+     * from the last frame of the previous chunk */
+    guint64 position;
+    gint16 *last_frame;
+
+    /* ---------- Stats ---------- */
+
+    guint underruns;
+    guint lost;
+    guint concealed;
+};
+
+G_GNUC_INTERNAL
+PlaybackJitter *playback_jitter_new(guint frequency, guint channels)
+{
+    PlaybackJitter *jb;
+
+    g_return_val_if_fail(frequency > 0 && channels > 0, NULL);
+
+    jb = g_new0(PlaybackJitter, 1);
+    jb->frequency = frequency;
+    jb->channels = channels;
+    jb->last_frame = g_new0(gint16, channels);
+    jb->position = 1 << 16;
+
+    return jb;
+}
+
+G_GNUC_INTERNAL
+void playback_jitter_free(PlaybackJitter *jb)
+{
+    g_free(jb->last_frame);
+    g_free(jb);
+}
+
+static guint32 jitter_packet_duration(PlaybackJitter *jb)
+{
+    return (guint64)playback_jitter_get_packet_frames(jb) * 1000 / jb->frequency;
+}
+
+static void jitter_add_transit(PlaybackJitter *jb, gint64 transit, gint64 now)
+{
+    gint64 sample;
+
+    if (!jb->started || transit < jb->base_transit) {
+        jb->base_transit = transit;
+    }
+    if (!jb->started || now >= jb->window_end) {
+        /* follow the drift of the clocks */
+        if (jb->started) {
+            jb->base_transit = jb->window_transit;
+        }
+        jb->window_transit = transit;
+        jb->window_end = now + JITTER_BASE_WINDOW;
+    } else {
+        jb->window_transit = MIN(jb->window_transit, transit);
+    }
+
+    sample = MAX(transit - jb->base_transit, 0);
+    if (sample >= jb->spread) {
+        jb->spread = sample;
+        jb->hold_end = now + JITTER_HOLD;
+    } else if (now >= jb->hold_end) {
+        /* the network calmed down, shrink back slowly */
+        jb->spread -= (jb->spread - sample + (1 << JITTER_DECAY_SHIFT) - 1) >> JITTER_DECAY_SHIFT;
+    }
+}
+
+/* A packet for the mm-time @time arrived at @now, in us. Returns the
+ * number of packets missing before it, which should be concealed. */
+G_GNUC_INTERNAL
+guint playback_jitter_add_packet(PlaybackJitter *jb, guint32 time, gint64 now)
+{
+    guint32 duration = jitter_packet_duration(jb);
+    guint lost = 0;
+
+    if (jb->started && duration > 0) {
+        gint32 gap = (gint32)(time - (jb->last_time + duration));
+
+        if (gap >= (gint32)duration) {
+            lost = gap / duration;
+            if (lost > JITTER_MAX_CONCEAL) {
+                lost = 0;
+            }
+        }
+    }
+
+    jitter_add_transit(jb, now / 1000 - time, now);
+    jb->started = TRUE;
+    jb->last_time = time;
+    jb->now = now;
+    jb->lost += lost;
+
+    return lost;
+}
+
+/* The packets are @frames long, as decoded */
+G_GNUC_INTERNAL
+void playback_jitter_set_packet_frames(PlaybackJitter *jb, guint frames)
+{
+    g_atomic_int_set(&jb->packet_frames, frames);
+}
+
+G_GNUC_INTERNAL
+guint playback_jitter_get_packet_frames(PlaybackJitter *jb)
+{
+    return g_atomic_int_get(&jb->packet_frames);
+}
+
+G_GNUC_INTERNAL
+void playback_jitter_add_concealed(PlaybackJitter *jb, guint packets)
+{
+    g_atomic_int_add(&jb->concealed, packets);
+}
+
+/* The audio backend holds @delay ms of audio */
+G_GNUC_INTERNAL
+void playback_jitter_set_delay(PlaybackJitter *jb, guint32 delay)
+{
+    gint32 error;
+
+    jb->delay = delay;
+    if (jb->target == 0) {
+        return;
+    }
+
+    error = (gint32)delay - (gint32)jb->target;
+    if (ABS(error) < JITTER_DEADBAND) {
+        g_atomic_int_set(&jb->drift, 0);
+    } else {
+        g_atomic_int_set(&jb->drift, CLAMP(error * JITTER_DRIFT_GAIN,
+                                           -JITTER_MAX_DRIFT, JITTER_MAX_DRIFT));
+    }
+}
+
+/* The audio backend ran out of audio */
+G_GNUC_INTERNAL
+void playback_jitter_add_underrun(PlaybackJitter *jb)
+{
+    jb->underruns++;
+    jb->spread += JITTER_UNDERRUN_STEP;
+    jb->hold_end = jb->now + JITTER_HOLD;
+}
+
+/* Adds @latency ms to the target latency, to delay the audio on purpose */
+G_GNUC_INTERNAL
+void playback_jitter_set_extra_latency(PlaybackJitter *jb, guint32 latency)
+{
+    jb->extra_latency = latency;
+}
+
+/* Returns the latency to buffer, in ms, not below @min_latency which is
+ * what the server asked for */
+G_GNUC_INTERNAL
+guint32 playback_jitter_get_target(PlaybackJitter *jb, guint32 min_latency)
+{
+    guint32 target = jb->spread + jitter_packet_duration(jb) + JITTER_MARGIN;
+
+    target = CLAMP(target, JITTER_MIN_LATENCY, JITTER_MAX_LATENCY);
+    jb->target = MAX(target, min_latency) + jb->extra_latency;
+
+    return jb->target;
+}
+
+/* Returns how many frames playback_jitter_resample() may output for
+ * @frames input frames */
+G_GNUC_INTERNAL
+gsize playback_jitter_resample_max(PlaybackJitter *jb, gsize frames)
+{
+    return frames + frames * JITTER_MAX_DRIFT / 1000000 + 2;
+}
+
+/* Resamples @frames frames of interleaved S16 audio to speed up or slow
+ * down the playback by the current drift, with a linear interpolation.
+ * The output lags one frame behind. Returns the number of frames written
+ * to @out. */
+G_GNUC_INTERNAL
+gsize playback_jitter_resample(PlaybackJitter *jb, const gint16 *in, gsize frames,
+                               gint16 *out, gsize out_frames)
+{
+    guint64 step = (1 << 16) + (gint64)g_atomic_int_get(&jb->drift) * (1 << 16) / 1000000;
+    guint channels = jb->channels;
+    gsize n = 0;
+    guint c;
+
+    if (frames == 0) {
+        return 0;
+    }
+
+    while ((jb->position >> 16) < frames && n < out_frames) {
+        gsize i = jb->position >> 16;
+        gint64 frac = jb->position & 0xffff;
+        const gint16 *a = i == 0 ? jb->last_frame : &in[(i - 1) * channels];
+        const gint16 *b = &in[i * channels];
+
+        for (c = 0; c < channels; c++) {
+            out[n * channels + c] = a[c] + (((gint64)b[c] - a[c]) * frac >> 16);
+        }
+        n++;
+        jb->position += step;
+    }
+
+    if ((jb->position >> 16) < frames) {
+        /* out of room, skip the rest */
+        g_warn_if_reached();
+        jb->position = 0;
+    } else {
+        jb->position -= (guint64)frames << 16;
+    }
+    memcpy(jb->last_frame, &in[(frames - 1) * channels], channels * sizeof(gint16));
+
+    return n;
+}
+
+G_GNUC_INTERNAL
+void playback_jitter_get_stats(PlaybackJitter *jb, SpicePlaybackStats *stats)
+{
+    stats->buffer_fill = jb->delay;
+    stats->target_latency = jb->target;
+    stats->jitter = jb->spread;
+    stats->drift = g_atomic_int_get(&jb->drift);
+    stats->underruns = jb->underruns;
+    stats->lost = jb->lost;
+    stats->concealed = g_atomic_int_get(&jb->concealed);
+}
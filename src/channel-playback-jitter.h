@@ -0,0 +1,56 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIENT_PLAYBACK_JITTER_H__
+#define __SPICE_CLIENT_PLAYBACK_JITTER_H__
+
+#include "spice-client.h"
+
+G_BEGIN_DECLS
+
+/* Playback jitter buffer: it follows how irregularly the audio packets
+ * arrive to pick the smallest latency that absorbs it, spots the lost
+ * packets, and resamples the audio a little to bring the amount buffered
+ * by the audio backend to that latency, which also compensates the drift
+ * between the server and sound card clocks. Like the stream controller
+ * it only works on the samples it is given.
+ *
+ * The packet length, concealment and resampling may be used from the
+ * decoding thread, the rest from the main context. */
+typedef struct PlaybackJitter PlaybackJitter;
+
+PlaybackJitter *playback_jitter_new(guint frequency, guint channels);
+void playback_jitter_free(PlaybackJitter *jb);
+
+guint playback_jitter_add_packet(PlaybackJitter *jb, guint32 time, gint64 now);
+void playback_jitter_set_packet_frames(PlaybackJitter *jb, guint frames);
+guint playback_jitter_get_packet_frames(PlaybackJitter *jb);
+void playback_jitter_add_concealed(PlaybackJitter *jb, guint packets);
+void playback_jitter_set_delay(PlaybackJitter *jb, guint32 delay);
+void playback_jitter_add_underrun(PlaybackJitter *jb);
+
+void playback_jitter_set_extra_latency(PlaybackJitter *jb, guint32 latency);
+guint32 playback_jitter_get_target(PlaybackJitter *jb, guint32 min_latency);
+gsize playback_jitter_resample(PlaybackJitter *jb, const gint16 *in, gsize frames,
+                               gint16 *out, gsize out_frames);
+gsize playback_jitter_resample_max(PlaybackJitter *jb, gsize frames);
+
+void playback_jitter_get_stats(PlaybackJitter *jb, SpicePlaybackStats *stats);
+
+G_END_DECLS
+
+#endif /* __SPICE_CLIENT_PLAYBACK_JITTER_H__ */
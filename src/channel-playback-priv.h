@@ -18,7 +18,24 @@
 #ifndef __SPICE_CLIENT_PLAYBACK_CHANNEL_PRIV_H__
 #define __SPICE_CLIENT_PLAYBACK_CHANNEL_PRIV_H__
 
+/* Where SpiceAudio plays the audio of a playback channel, instead of
+ * connecting to the playback-data signal */
+typedef struct SpicePlaybackSink SpicePlaybackSink;
+struct SpicePlaybackSink {
+    /* whether the functions below can be called from the decoding thread */
+    gboolean thread_safe;
+
+    /* Returns a buffer for at least @size bytes of audio, which @data
+     * points to, or NULL if the audio can't be played now */
+    gpointer (*begin_write)(SpicePlaybackSink *sink, gsize size, guint8 **data);
+    /* Plays the first @size bytes of @buffer, or drops it if @size is 0 */
+    void (*write)(SpicePlaybackSink *sink, gpointer buffer, gsize size);
+};
+
+void spice_playback_channel_set_sink(SpicePlaybackChannel *channel, SpicePlaybackSink *sink);
 gboolean spice_playback_channel_is_active(SpicePlaybackChannel *channel);
 guint32 spice_playback_channel_get_latency(SpicePlaybackChannel *channel);
 void spice_playback_channel_sync_latency(SpicePlaybackChannel *channel);
+void spice_playback_channel_add_underrun(SpicePlaybackChannel *channel);
+void spice_playback_channel_set_sync_delay(SpicePlaybackChannel *channel, guint32 delay);
 #endif
@@ -26,6 +26,7 @@
 
 #include "common/snd_codec.h"
 #include "channel-playback-priv.h"
+#include "channel-playback-jitter.h"
 
 /**
  * SECTION:channel-playback
@@ -46,6 +47,19 @@
  * record audio channels for your application.
  */
 
+/* number of packets waiting for the decoding thread, a power of 2 */
+#define PLAYBACK_RING_SIZE 64
+
+/* A slot of the ring. The message the packet came in belongs to the
+ * coroutine, so the encoded data is copied, into a buffer kept from one
+ * packet to the next. */
+typedef struct PlaybackPacket {
+    guint lost;
+    int size;
+    uint8_t *data;
+    gsize allocated;
+} PlaybackPacket;
+
 struct _SpicePlaybackChannelPrivate {
     int                         mode;
     SndCodec                    codec;
@@ -57,6 +71,37 @@ struct _SpicePlaybackChannelPrivate {
     gboolean                    is_active;
     guint32                     latency;
     guint32                     min_latency;
+
+    gboolean                    enable_jitter_buffer;
+    PlaybackJitter              *jitter;
+    /* the latency asked by the server, 0 if it didn't */
+    guint32                     server_latency;
+    /* how much the audio is delayed to be in sync with the video */
+    guint32                     sync_delay;
+    guint                       frame_size;
+    /* length of the last decoded packet, in bytes */
+    int                         packet_size;
+    gint16                      *resample_buf;
+    gsize                       resample_buf_frames;
+
+    /* ---------- Output ---------- */
+
+    SpicePlaybackSink           *sink;
+    /* whether the playback-data signal is emitted */
+    gboolean                    emit_data;
+    gboolean                    enable_audio_thread;
+    gboolean                    use_thread;
+
+    /* Decoding thread, fed by the coroutine through a single producer,
+     * single consumer ring. It owns the codec, the resampler and the
+     * sink while it runs. */
+    GThread                     *thread;
+    GMutex                      thread_mutex;
+    GCond                       thread_cond;
+    gboolean                    thread_quit;
+    PlaybackPacket              ring[PLAYBACK_RING_SIZE];
+    guint                       ring_head;
+    guint                       ring_tail;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(SpicePlaybackChannel, spice_playback_channel, SPICE_TYPE_CHANNEL)
@@ -82,10 +127,13 @@ enum {
 
 static guint signals[SPICE_PLAYBACK_LAST_SIGNAL];
 static void channel_set_handlers(SpiceChannelClass *klass);
+static void playback_thread_stop(SpiceChannel *channel);
 
 /* ------------------------------------------------------------------ */
 
 #define SPICE_PLAYBACK_DEFAULT_LATENCY_MS 200
+/* the jitter buffer lowers the latency by steps of at least that many ms */
+#define SPICE_PLAYBACK_LATENCY_STEP_MS 10
 
 static void spice_playback_channel_reset_capabilities(SpiceChannel *channel)
 {
@@ -102,6 +150,11 @@ static void spice_playback_channel_reset_capabilities(SpiceChannel *channel)
 static void spice_playback_channel_init(SpicePlaybackChannel *channel)
 {
     channel->priv = spice_playback_channel_get_instance_private(channel);
+    channel->priv->enable_jitter_buffer = g_getenv("SPICE_AUDIO_JITTER_BUFFER") != NULL;
+    channel->priv->enable_audio_thread = g_getenv("SPICE_DISABLE_AUDIO_THREAD") == NULL;
+    channel->priv->emit_data = TRUE;
+    g_mutex_init(&channel->priv->thread_mutex);
+    g_cond_init(&channel->priv->thread_cond);
 
     spice_playback_channel_reset_capabilities(SPICE_CHANNEL(channel));
 }
@@ -109,10 +162,19 @@ static void spice_playback_channel_init(SpicePlaybackChannel *channel)
 static void spice_playback_channel_finalize(GObject *obj)
 {
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(obj)->priv;
+    guint i;
 
+    playback_thread_stop(SPICE_CHANNEL(obj));
+    for (i = 0; i < PLAYBACK_RING_SIZE; i++) {
+        g_free(c->ring[i].data);
+    }
+    g_mutex_clear(&c->thread_mutex);
+    g_cond_clear(&c->thread_cond);
     snd_codec_destroy(&c->codec);
 
     g_clear_pointer(&c->volume, g_free);
+    g_clear_pointer(&c->jitter, playback_jitter_free);
+    g_clear_pointer(&c->resample_buf, g_free);
 
     if (G_OBJECT_CLASS(spice_playback_channel_parent_class)->finalize)
         G_OBJECT_CLASS(spice_playback_channel_parent_class)->finalize(obj);
@@ -168,9 +230,11 @@ static void spice_playback_channel_reset(SpiceChannel *channel, gboolean migrati
 {
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
 
+    playback_thread_stop(channel);
     snd_codec_destroy(&c->codec);
     g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_STOP], 0);
     c->is_active = FALSE;
+    g_clear_pointer(&c->jitter, playback_jitter_free);
 
     SPICE_CHANNEL_CLASS(spice_playback_channel_parent_class)->channel_reset(channel, migrating);
 }
@@ -249,6 +313,10 @@ static void spice_playback_channel_class_init(SpicePlaybackChannelClass *klass)
      * @data_size: size in byte of @data
      *
      * Provide audio data to be played.
+     *
+     * When the channel is played by #SpiceAudio, the audio is only emitted
+     * if there were handlers connected at the last
+     * #SpicePlaybackChannel::playback-start.
      **/
     signals[SPICE_PLAYBACK_DATA] =
         g_signal_new("playback-data",
@@ -298,6 +366,257 @@ static void spice_playback_channel_class_init(SpicePlaybackChannelClass *klass)
 
 /* ------------------------------------------------------------------ */
 
+/* coroutine context or decoding thread */
+static void playback_write(SpiceChannel *channel, uint8_t *data, int size)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+
+    if (c->jitter != NULL) {
+        gsize frames = size / c->frame_size;
+        gsize max = playback_jitter_resample_max(c->jitter, frames);
+
+        if (max > c->resample_buf_frames) {
+            c->resample_buf = g_renew(gint16, c->resample_buf, max * c->frame_size / 2);
+            c->resample_buf_frames = max;
+        }
+        frames = playback_jitter_resample(c->jitter, SPICE_ALIGNED_CAST(gint16 *, data),
+                                          frames, c->resample_buf, max);
+        data = (uint8_t *)c->resample_buf;
+        size = frames * c->frame_size;
+    }
+
+    if (c->sink != NULL) {
+        guint8 *dest;
+        gpointer buffer = c->sink->begin_write(c->sink, size, &dest);
+
+        if (buffer != NULL) {
+            memcpy(dest, data, size);
+            c->sink->write(c->sink, buffer, size);
+        }
+    }
+
+    if (c->emit_data) {
+        g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_DATA], 0, data, size);
+    }
+}
+
+/* coroutine context or decoding thread */
+static void playback_conceal(SpiceChannel *channel, guint lost)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    uint8_t pcm[SND_CODEC_MAX_FRAME_SIZE * 2 * 2];
+    int n = playback_jitter_get_packet_frames(c->jitter) * c->frame_size;
+    guint i;
+
+    if (n == 0 || n > sizeof(pcm)) {
+        return;
+    }
+
+    for (i = 0; i < lost; i++) {
+        int size = n;
+
+        /* Opus makes the missing audio up from the previous packets,
+         * otherwise play silence to keep the timing */
+        if (c->mode != SPICE_AUDIO_DATA_MODE_OPUS ||
+            snd_codec_decode(c->codec, NULL, 0, pcm, &size) != SND_CODEC_OK ||
+            size != n) {
+            memset(pcm, 0, n);
+        }
+        playback_write(channel, pcm, n);
+    }
+    playback_jitter_add_concealed(c->jitter, lost);
+    CHANNEL_DEBUG(channel, "%s: concealed %u lost packets", __FUNCTION__, lost);
+}
+
+/* coroutine context or decoding thread */
+static void playback_play(SpiceChannel *channel, guint lost, uint8_t *data, int size)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    uint8_t pcm[SND_CODEC_MAX_FRAME_SIZE * 2 * 2];
+    int n = sizeof(pcm);
+
+    if (lost > 0) {
+        playback_conceal(channel, lost);
+    }
+
+    if (c->mode == SPICE_AUDIO_DATA_MODE_RAW) {
+        if (c->jitter != NULL) {
+            playback_jitter_set_packet_frames(c->jitter, size / c->frame_size);
+        }
+        playback_write(channel, data, size);
+        return;
+    }
+
+    /* when the audio goes nowhere else, decode it straight into the
+     * buffer of the audio backend, expecting it to be as long as the
+     * previous packet */
+    if (c->sink != NULL && c->jitter == NULL && !c->emit_data && c->packet_size > 0) {
+        guint8 *dest;
+        gpointer buffer = c->sink->begin_write(c->sink, c->packet_size, &dest);
+
+        if (buffer != NULL) {
+            n = c->packet_size;
+            if (snd_codec_decode(c->codec, data, size, dest, &n) == SND_CODEC_OK) {
+                c->sink->write(c->sink, buffer, n);
+                return;
+            }
+            c->sink->write(c->sink, buffer, 0);
+            n = sizeof(pcm);
+        }
+        /* otherwise keep the decoder state going even if the audio is dropped */
+    }
+
+    if (snd_codec_decode(c->codec, data, size, pcm, &n) != SND_CODEC_OK) {
+        g_warning("snd_codec_decode() error");
+        return;
+    }
+    c->packet_size = n;
+
+    if (c->jitter != NULL) {
+        playback_jitter_set_packet_frames(c->jitter, n / c->frame_size);
+    }
+    playback_write(channel, pcm, n);
+}
+
+/* Returns the next packet, which stays in the ring until
+ * playback_ring_release().
+ *
+ * decoding thread */
+static PlaybackPacket *playback_ring_peek(SpicePlaybackChannelPrivate *c)
+{
+    guint tail = c->ring_tail;
+
+    if (__atomic_load_n(&c->ring_head, __ATOMIC_ACQUIRE) == tail) {
+        g_mutex_lock(&c->thread_mutex);
+        while (__atomic_load_n(&c->ring_head, __ATOMIC_ACQUIRE) == tail && !c->thread_quit) {
+            g_cond_wait(&c->thread_cond, &c->thread_mutex);
+        }
+        g_mutex_unlock(&c->thread_mutex);
+
+        /* stopped, and every packet was played */
+        if (__atomic_load_n(&c->ring_head, __ATOMIC_ACQUIRE) == tail) {
+            return NULL;
+        }
+    }
+
+    return &c->ring[tail % PLAYBACK_RING_SIZE];
+}
+
+/* Hands the slot of the packet played back to the coroutine.
+ *
+ * decoding thread */
+static void playback_ring_release(SpicePlaybackChannelPrivate *c)
+{
+    __atomic_store_n(&c->ring_tail, c->ring_tail + 1, __ATOMIC_RELEASE);
+}
+
+/* decoding thread */
+static gpointer playback_thread(gpointer data)
+{
+    SpiceChannel *channel = data;
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    PlaybackPacket *packet;
+
+    while ((packet = playback_ring_peek(c)) != NULL) {
+        playback_play(channel, packet->lost, packet->data, packet->size);
+        playback_ring_release(c);
+    }
+
+    return NULL;
+}
+
+/* coroutine context */
+static void playback_thread_push(SpiceChannel *channel, guint lost, uint8_t *data, int size)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    guint head = c->ring_head;
+    PlaybackPacket *packet;
+
+    if (c->thread == NULL) {
+        c->thread = g_thread_new("spice-playback", playback_thread, channel);
+    }
+
+    if (head - __atomic_load_n(&c->ring_tail, __ATOMIC_ACQUIRE) == PLAYBACK_RING_SIZE) {
+        CHANNEL_DEBUG(channel, "%s: decoding thread is late, dropping a packet", __FUNCTION__);
+        return;
+    }
+
+    /* the thread is done with the slot, it was released */
+    packet = &c->ring[head % PLAYBACK_RING_SIZE];
+    if (packet->allocated < (gsize)size) {
+        g_free(packet->data);
+        packet->data = g_malloc(size);
+        packet->allocated = size;
+    }
+    packet->lost = lost;
+    packet->size = size;
+    memcpy(packet->data, data, size);
+
+    __atomic_store_n(&c->ring_head, head + 1, __ATOMIC_RELEASE);
+
+    /* the lock is only taken to wake the thread up */
+    g_mutex_lock(&c->thread_mutex);
+    g_cond_signal(&c->thread_cond);
+    g_mutex_unlock(&c->thread_mutex);
+}
+
+/* Plays the packets left, and joins the decoding thread.
+ *
+ * main or coroutine context */
+static void playback_thread_stop(SpiceChannel *channel)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+
+    if (c->thread == NULL) {
+        return;
+    }
+
+    g_mutex_lock(&c->thread_mutex);
+    c->thread_quit = TRUE;
+    g_cond_signal(&c->thread_cond);
+    g_mutex_unlock(&c->thread_mutex);
+
+    g_thread_join(c->thread);
+    c->thread = NULL;
+    c->thread_quit = FALSE;
+}
+
+/* Decides where the audio goes: applications listening to playback-data
+ * keep getting it in the main context, otherwise SpiceAudio gets it
+ * directly, from the decoding thread if it can.
+ *
+ * main or coroutine context */
+static void playback_update_output(SpiceChannel *channel)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+
+    playback_thread_stop(channel);
+    c->emit_data = c->sink == NULL ||
+        g_signal_has_handler_pending(channel, signals[SPICE_PLAYBACK_DATA], 0, FALSE);
+    c->use_thread = c->sink != NULL && c->sink->thread_safe &&
+        c->enable_audio_thread && !c->emit_data;
+}
+
+/* main or coroutine context */
+static void playback_update_latency(SpiceChannel *channel, gboolean underrun)
+{
+    SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
+    guint32 target = playback_jitter_get_target(c->jitter, c->server_latency);
+
+    /* the backends stop playing to buffer more when the latency goes up,
+     * which is only fine when they already ran out of audio, otherwise
+     * the jitter buffer slows the audio down to get there */
+    if (target == c->min_latency ||
+        (target > c->min_latency && !underrun) ||
+        (target < c->min_latency && c->min_latency - target < SPICE_PLAYBACK_LATENCY_STEP_MS)) {
+        return;
+    }
+
+    c->min_latency = target;
+    SPICE_DEBUG("%s: notify latency update %u", __FUNCTION__, c->min_latency);
+    g_coroutine_object_notify(G_OBJECT(channel), "min-latency");
+}
+
 /* coroutine context */
 static void playback_handle_data(SpiceChannel *channel, SpiceMsgIn *in)
 {
@@ -314,22 +633,21 @@ static void playback_handle_data(SpiceChannel *channel, SpiceMsgIn *in)
 
     c->last_time = packet->time;
 
-    uint8_t *data = packet->data;
-    int n = packet->data_size;
-    uint8_t pcm[SND_CODEC_MAX_FRAME_SIZE * 2 * 2];
+    guint lost = 0;
 
-    if (c->mode != SPICE_AUDIO_DATA_MODE_RAW) {
-        n = sizeof(pcm);
-        data = pcm;
+    if (c->jitter != NULL) {
+        lost = playback_jitter_add_packet(c->jitter, packet->time, g_get_monotonic_time());
+    }
 
-        if (snd_codec_decode(c->codec, packet->data, packet->data_size,
-                    pcm, &n) != SND_CODEC_OK) {
-            g_warning("snd_codec_decode() error");
-            return;
-        }
+    if (c->use_thread) {
+        playback_thread_push(channel, lost, packet->data, packet->data_size);
+    } else {
+        playback_play(channel, lost, packet->data, packet->data_size);
     }
 
-    g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_DATA], 0, data, n);
+    if (c->jitter != NULL) {
+        playback_update_latency(channel, FALSE);
+    }
 
     if ((c->frame_count++ % 100) == 0) {
         g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_GET_DELAY], 0);
@@ -345,6 +663,7 @@ static void playback_handle_mode(SpiceChannel *channel, SpiceMsgIn *in)
     CHANNEL_DEBUG(channel, "%s: time %u mode %u data %p size %u", __FUNCTION__,
                   mode->time, mode->mode, mode->data, mode->data_size);
 
+    playback_thread_stop(channel);
     c->mode = mode->mode;
     switch (c->mode) {
     case SPICE_AUDIO_DATA_MODE_RAW:
@@ -370,9 +689,21 @@ static void playback_handle_start(SpiceChannel *channel, SpiceMsgIn *in)
     c->frame_count = 0;
     c->last_time = start->time;
     c->is_active = TRUE;
-    c->min_latency = SPICE_PLAYBACK_DEFAULT_LATENCY_MS;
+    c->min_latency = SPICE_PLAYBACK_DEFAULT_LATENCY_MS + c->sync_delay;
+    c->server_latency = 0;
+    c->frame_size = start->channels * 2;
+    c->packet_size = 0;
+    playback_update_output(channel);
     snd_codec_destroy(&c->codec);
 
+    /* the jitter buffer starts at the default latency, and lowers it as
+     * it learns how regularly the packets arrive */
+    g_clear_pointer(&c->jitter, playback_jitter_free);
+    if (c->enable_jitter_buffer && start->format == SPICE_AUDIO_FMT_S16 && start->channels > 0) {
+        c->jitter = playback_jitter_new(start->frequency, start->channels);
+        playback_jitter_set_extra_latency(c->jitter, c->sync_delay);
+    }
+
     if (c->mode != SPICE_AUDIO_DATA_MODE_RAW) {
         if (snd_codec_create(&c->codec, c->mode, start->frequency, SND_CODEC_DECODE) != SND_CODEC_OK) {
             g_warning("create decoder failed");
@@ -388,6 +719,7 @@ static void playback_handle_stop(SpiceChannel *channel, SpiceMsgIn *in)
 {
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
 
+    playback_thread_stop(channel);
     g_coroutine_signal_emit(channel, signals[SPICE_PLAYBACK_STOP], 0);
     c->is_active = FALSE;
 }
@@ -426,7 +758,12 @@ static void playback_handle_set_latency(SpiceChannel *channel, SpiceMsgIn *in)
     SpicePlaybackChannelPrivate *c = SPICE_PLAYBACK_CHANNEL(channel)->priv;
     SpiceMsgPlaybackLatency *msg = spice_msg_in_parsed(in);
 
-    c->min_latency = msg->latency_ms;
+    c->server_latency = msg->latency_ms;
+    if (c->jitter != NULL) {
+        c->min_latency = playback_jitter_get_target(c->jitter, c->server_latency);
+    } else {
+        c->min_latency = msg->latency_ms + c->sync_delay;
+    }
     SPICE_DEBUG("%s: notify latency update %u", __FUNCTION__, c->min_latency);
     g_coroutine_object_notify(G_OBJECT(channel), "min-latency");
 }
@@ -464,6 +801,9 @@ void spice_playback_channel_set_delay(SpicePlaybackChannel *channel, guint32 del
 
     c = channel->priv;
     c->latency = delay_ms;
+    if (c->jitter != NULL) {
+        playback_jitter_set_delay(c->jitter, delay_ms);
+    }
 
     session = spice_channel_get_session(SPICE_CHANNEL(channel));
     if (session) {
@@ -498,3 +838,86 @@ void spice_playback_channel_sync_latency(SpicePlaybackChannel *channel)
     SPICE_DEBUG("%s: notify latency update %u", __FUNCTION__, channel->priv->min_latency);
     g_coroutine_object_notify(G_OBJECT(SPICE_CHANNEL(channel)), "min-latency");
 }
+
+/* Delays the audio by @delay ms on top of the latency it needs. With the
+ * jitter buffer the audio gets there by playing a little slower or faster,
+ * otherwise the backends buffer more, or less, audio.
+ * main or coroutine context */
+G_GNUC_INTERNAL
+void spice_playback_channel_set_sync_delay(SpicePlaybackChannel *channel, guint32 delay)
+{
+    SpicePlaybackChannelPrivate *c;
+
+    g_return_if_fail(SPICE_IS_PLAYBACK_CHANNEL(channel));
+
+    c = channel->priv;
+    if (c->sync_delay == delay)
+        return;
+
+    if (c->jitter != NULL) {
+        c->sync_delay = delay;
+        playback_jitter_set_extra_latency(c->jitter, delay);
+        playback_update_latency(SPICE_CHANNEL(channel), FALSE);
+        return;
+    }
+
+    c->min_latency = c->min_latency - MIN(c->min_latency, c->sync_delay) + delay;
+    c->sync_delay = delay;
+    if (!c->is_active)
+        return;
+    SPICE_DEBUG("%s: notify latency update %u", __FUNCTION__, c->min_latency);
+    g_coroutine_object_notify(G_OBJECT(channel), "min-latency");
+}
+
+/* Lets @sink play the audio instead of the playback-data signal handlers,
+ * or stops doing so when @sink is NULL.
+ *
+ * main context */
+G_GNUC_INTERNAL
+void spice_playback_channel_set_sink(SpicePlaybackChannel *channel, SpicePlaybackSink *sink)
+{
+    g_return_if_fail(SPICE_IS_PLAYBACK_CHANNEL(channel));
+
+    playback_thread_stop(SPICE_CHANNEL(channel));
+    channel->priv->sink = sink;
+    playback_update_output(SPICE_CHANNEL(channel));
+}
+
+/* main context */
+G_GNUC_INTERNAL
+void spice_playback_channel_add_underrun(SpicePlaybackChannel *channel)
+{
+    g_return_if_fail(SPICE_IS_PLAYBACK_CHANNEL(channel));
+
+    if (channel->priv->jitter == NULL) {
+        return;
+    }
+    playback_jitter_add_underrun(channel->priv->jitter);
+    playback_update_latency(SPICE_CHANNEL(channel), TRUE);
+}
+
+/**
+ * spice_playback_channel_get_stats:
+ * @channel: a #SpicePlaybackChannel
+ * @stats: (out): where to store the state of the jitter buffer
+ *
+ * Gets the state of the playback jitter buffer, which is used when the
+ * SPICE_AUDIO_JITTER_BUFFER environment variable is set.
+ *
+ * Returns: %TRUE if @stats was filled, %FALSE if the channel doesn't use
+ * a jitter buffer
+ *
+ * Since: 0.36
+ **/
+gboolean spice_playback_channel_get_stats(SpicePlaybackChannel *channel,
+                                          SpicePlaybackStats *stats)
+{
+    g_return_val_if_fail(SPICE_IS_PLAYBACK_CHANNEL(channel), FALSE);
+    g_return_val_if_fail(stats != NULL, FALSE);
+
+    if (channel->priv->jitter == NULL) {
+        return FALSE;
+    }
+    playback_jitter_get_stats(channel->priv->jitter, stats);
+    return TRUE;
+}
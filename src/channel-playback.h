@@ -72,8 +72,36 @@ struct _SpicePlaybackChannelClass {
     /* Do not add fields to this struct */
 };
 
+/**
+ * SpicePlaybackStats:
+ * @buffer_fill: audio buffered by the audio backend, in milliseconds
+ * @target_latency: the latency the jitter buffer aims for, in milliseconds
+ * @jitter: how late the packets arrive at worst, in milliseconds
+ * @drift: how much the audio is sped up, or slowed down when negative, to
+ * reach the target latency, in parts per million
+ * @underruns: number of times the audio backend ran out of audio
+ * @lost: number of packets which never arrived
+ * @concealed: number of lost packets which were replaced
+ *
+ * The state of the playback jitter buffer.
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpicePlaybackStats SpicePlaybackStats;
+struct _SpicePlaybackStats {
+    guint32 buffer_fill;
+    guint32 target_latency;
+    guint32 jitter;
+    gint32 drift;
+    guint underruns;
+    guint lost;
+    guint concealed;
+};
+
 GType           spice_playback_channel_get_type(void);
 void            spice_playback_channel_set_delay(SpicePlaybackChannel *channel, guint32 delay_ms);
+gboolean        spice_playback_channel_get_stats(SpicePlaybackChannel *channel,
+                                                 SpicePlaybackStats *stats);
 
 G_END_DECLS
 
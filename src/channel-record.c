@@ -25,6 +25,7 @@
 #include "spice-session-priv.h"
 
 #include "common/snd_codec.h"
+#include "channel-record-priv.h"
 
 /**
  * SECTION:channel-record
@@ -43,6 +44,16 @@
  * The audio is sent to the guest by calling spice_record_send_data()
  * with the recorded PCM data.
  *
+ * The audio is encoded in a thread, unless the SPICE_DISABLE_AUDIO_THREAD
+ * environment variable is set. SpiceAudio captures it by fragments of
+ * SPICE_RECORD_FRAGMENT_MS milliseconds, 20 by default, which may be
+ * lowered down to 5 for a lower latency. When the SPICE_RECORD_COALESCE
+ * environment variable is set and the round trip time to the server is
+ * high, several encoded frames are held and sent together, which saves
+ * packets at the expense of some latency. The variable may give the round
+ * trip time to assume, in milliseconds, when it can't be measured, as
+ * through a proxy.
+ *
  * Note: You may be interested to let the #SpiceAudio class play and
  * record audio channels for your application.
  */
@@ -57,8 +68,34 @@ struct _SpiceRecordChannelPrivate {
     guint8                      nchannels;
     guint16                     *volume;
     guint8                      mute;
+
+    guint                       fragment;
+    guint                       frame_duration;
+    gint64                      last_frame_time;
+    gboolean                    enable_encode_thread;
+    gboolean                    enable_coalesce;
+    guint32                     coalesce_rtt;
+    GThreadPool                 *encoder;
+    GMutex                      encoded_mutex;
+    GQueue                      encoded;
+    guint                       collect_id;
+    GQueue                      pending;
+    guint                       flush_id;
+    SpiceRecordStats            stats;
 };
 
+/* A codec frame of audio, and its encoding */
+typedef struct RecordFrame {
+    /* when the first samples were handed to the channel */
+    gint64 capture_time;
+    guint32 time;
+    guint8 *pcm;
+    gsize pcm_size;
+    /* 0 if the encoding failed */
+    guint8 *data;
+    gsize size;
+} RecordFrame;
+
 G_DEFINE_TYPE_WITH_PRIVATE(SpiceRecordChannel, spice_record_channel, SPICE_TYPE_CHANNEL)
 
 /* Properties */
@@ -79,7 +116,18 @@ enum {
 
 static guint signals[SPICE_RECORD_LAST_SIGNAL];
 
+/* the capture fragment bounds, in ms */
+#define RECORD_MIN_FRAGMENT 5
+#define RECORD_MAX_FRAGMENT 20
+#define RECORD_DEFAULT_FRAGMENT 20
+
+/* the frames are coalesced from that round trip time, in ms, and held for
+ * at most a quarter of it, up to RECORD_COALESCE_MAX_FRAMES frames */
+#define RECORD_COALESCE_MIN_RTT 100
+#define RECORD_COALESCE_MAX_FRAMES 4
+
 static void channel_set_handlers(SpiceChannelClass *klass);
+static void record_encoder_stop(SpiceRecordChannel *channel, gboolean flush);
 
 /* ------------------------------------------------------------------ */
 
@@ -96,15 +144,32 @@ static void spice_record_channel_reset_capabilities(SpiceChannel *channel)
 
 static void spice_record_channel_init(SpiceRecordChannel *channel)
 {
+    const gchar *fragment = g_getenv("SPICE_RECORD_FRAGMENT_MS");
+    const gchar *coalesce = g_getenv("SPICE_RECORD_COALESCE");
+
     channel->priv = spice_record_channel_get_instance_private(channel);
 
     spice_record_channel_reset_capabilities(SPICE_CHANNEL(channel));
+
+    channel->priv->fragment = fragment != NULL ?
+        CLAMP(atoi(fragment), RECORD_MIN_FRAGMENT, RECORD_MAX_FRAGMENT) :
+        RECORD_DEFAULT_FRAGMENT;
+    channel->priv->enable_encode_thread = g_getenv("SPICE_DISABLE_AUDIO_THREAD") == NULL;
+    channel->priv->enable_coalesce = coalesce != NULL;
+    if (coalesce != NULL)
+        channel->priv->coalesce_rtt = MAX(atoi(coalesce), 0);
+    g_mutex_init(&channel->priv->encoded_mutex);
+    g_queue_init(&channel->priv->encoded);
+    g_queue_init(&channel->priv->pending);
 }
 
 static void spice_record_channel_finalize(GObject *obj)
 {
     SpiceRecordChannelPrivate *c = SPICE_RECORD_CHANNEL(obj)->priv;
 
+    record_encoder_stop(SPICE_RECORD_CHANNEL(obj), FALSE);
+    g_mutex_clear(&c->encoded_mutex);
+
     g_clear_pointer(&c->last_frame, g_free);
 
     snd_codec_destroy(&c->codec);
@@ -161,6 +226,7 @@ static void channel_reset(SpiceChannel *channel, gboolean migrating)
 {
     SpiceRecordChannelPrivate *c = SPICE_RECORD_CHANNEL(channel)->priv;
 
+    record_encoder_stop(SPICE_RECORD_CHANNEL(channel), FALSE);
     g_clear_pointer(&c->last_frame, g_free);
 
     g_coroutine_signal_emit(channel, signals[SPICE_RECORD_STOP], 0);
@@ -300,6 +366,226 @@ static void spice_record_start_mark(SpiceRecordChannel *channel, uint32_t time)
     spice_msg_out_send(msg);
 }
 
+/* ---------- Encoding ---------- */
+
+static RecordFrame *record_frame_new(SpiceRecordChannel *channel, const guint8 *pcm,
+                                     gsize size, guint32 time, gint64 capture_time)
+{
+    gsize encoded_size = channel->priv->mode != SPICE_AUDIO_DATA_MODE_RAW ?
+        SND_CODEC_MAX_COMPRESSED_BYTES : 0;
+    RecordFrame *frame = g_malloc(sizeof(RecordFrame) + size + encoded_size);
+
+    frame->capture_time = capture_time;
+    frame->time = time;
+    frame->pcm = (guint8 *)(frame + 1);
+    frame->pcm_size = size;
+    memcpy(frame->pcm, pcm, size);
+    frame->data = frame->pcm + size;
+    frame->size = 0;
+
+    return frame;
+}
+
+/* encoding thread, or main context */
+static void record_encode_frame(SpiceRecordChannelPrivate *rc, RecordFrame *frame)
+{
+    int len = SND_CODEC_MAX_COMPRESSED_BYTES;
+
+    if (rc->mode == SPICE_AUDIO_DATA_MODE_RAW) {
+        frame->data = frame->pcm;
+        frame->size = frame->pcm_size;
+        return;
+    }
+
+    if (snd_codec_encode(rc->codec, frame->pcm, frame->pcm_size,
+                         frame->data, &len) != SND_CODEC_OK) {
+        g_warning("encode failed");
+        return;
+    }
+    frame->size = len;
+}
+
+/* Returns how many encoded frames should be sent together */
+static guint record_batch_frames(SpiceRecordChannel *channel)
+{
+    SpiceRecordChannelPrivate *rc = channel->priv;
+    guint32 rtt = spice_channel_get_rtt(SPICE_CHANNEL(channel));
+
+    if (rtt == 0)
+        rtt = rc->coalesce_rtt;
+    rc->stats.rtt = rtt;
+    if (!rc->enable_coalesce || rtt < RECORD_COALESCE_MIN_RTT || rc->frame_duration == 0)
+        return 1;
+
+    return CLAMP(rtt / 4 / rc->frame_duration, 1, RECORD_COALESCE_MAX_FRAMES);
+}
+
+/* main context */
+static void record_send_frame(SpiceRecordChannel *channel, RecordFrame *frame, gint64 now)
+{
+    SpiceRecordStats *stats = &channel->priv->stats;
+    SpiceMsgcRecordPacket p = {0, };
+    SpiceMsgOut *msg;
+    guint32 latency;
+
+    if (frame->size == 0) {
+        stats->dropped++;
+        return;
+    }
+
+    p.time = frame->time;
+    msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_RECORD_DATA);
+    msg->marshallers->msgc_record_data(msg->marshaller, &p);
+    spice_marshaller_add(msg->marshaller, frame->data, frame->size);
+    spice_msg_out_send(msg);
+
+    latency = MAX(now - frame->capture_time, 0);
+    stats->latency = stats->frames == 0 ? latency : (stats->latency * 7 + latency) / 8;
+    stats->max_latency = MAX(stats->max_latency, latency);
+    stats->frames++;
+}
+
+/* Sends the encoded frames held so far.
+ * main context */
+static void record_send_pending(SpiceRecordChannel *channel)
+{
+    SpiceRecordChannelPrivate *rc = channel->priv;
+    RecordFrame *frame;
+    gint64 now = g_get_monotonic_time();
+
+    if (rc->flush_id != 0) {
+        g_source_remove(rc->flush_id);
+        rc->flush_id = 0;
+    }
+
+    /* queued together, they are written at once */
+    while ((frame = g_queue_pop_head(&rc->pending)) != NULL) {
+        record_send_frame(channel, frame, now);
+        g_free(frame);
+    }
+}
+
+/* main context */
+static gboolean record_flush_timeout(gpointer user_data)
+{
+    SpiceRecordChannel *channel = user_data;
+
+    channel->priv->flush_id = 0;
+    record_send_pending(channel);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Sends the encoded frames once there are enough of them, or once the
+ * first of them waited for a quarter of the round trip time.
+ * main context */
+static void record_flush(SpiceRecordChannel *channel)
+{
+    SpiceRecordChannelPrivate *rc = channel->priv;
+
+    rc->stats.batch = record_batch_frames(channel);
+    if (g_queue_get_length(&rc->pending) >= rc->stats.batch) {
+        record_send_pending(channel);
+        return;
+    }
+
+    if (rc->flush_id == 0 && !g_queue_is_empty(&rc->pending))
+        rc->flush_id = g_timeout_add(MAX(rc->stats.rtt / 4, 1),
+                                     record_flush_timeout, channel);
+}
+
+/* main context */
+static gboolean record_collect(gpointer user_data)
+{
+    SpiceRecordChannel *channel = user_data;
+    SpiceRecordChannelPrivate *rc = channel->priv;
+    RecordFrame *frame;
+
+    g_mutex_lock(&rc->encoded_mutex);
+    while ((frame = g_queue_pop_head(&rc->encoded)) != NULL)
+        g_queue_push_tail(&rc->pending, frame);
+    rc->collect_id = 0;
+    g_mutex_unlock(&rc->encoded_mutex);
+
+    record_flush(channel);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* encoding thread */
+static void record_encode_job(gpointer data, gpointer user_data)
+{
+    SpiceRecordChannel *channel = user_data;
+    SpiceRecordChannelPrivate *rc = channel->priv;
+    RecordFrame *frame = data;
+
+    record_encode_frame(rc, frame);
+
+    g_mutex_lock(&rc->encoded_mutex);
+    g_queue_push_tail(&rc->encoded, frame);
+    if (rc->collect_id == 0)
+        /* as soon as possible, like the sending of the messages */
+        rc->collect_id = g_idle_add_full(G_PRIORITY_HIGH, record_collect, channel, NULL);
+    g_mutex_unlock(&rc->encoded_mutex);
+}
+
+/* main context */
+static void record_queue_frame(SpiceRecordChannel *channel, const guint8 *pcm,
+                               gsize size, guint32 time, gint64 capture_time)
+{
+    SpiceRecordChannelPrivate *rc = channel->priv;
+    RecordFrame *frame = record_frame_new(channel, pcm, size, time, capture_time);
+
+    if (rc->mode != SPICE_AUDIO_DATA_MODE_RAW && rc->enable_encode_thread) {
+        if (rc->encoder == NULL)
+            /* a single thread keeps the frames in order */
+            rc->encoder = g_thread_pool_new(record_encode_job, channel, 1, FALSE, NULL);
+        g_thread_pool_push(rc->encoder, frame, NULL);
+        return;
+    }
+
+    record_encode_frame(rc, frame);
+    g_queue_push_tail(&rc->pending, frame);
+    record_flush(channel);
+}
+
+/* Waits for the encoding thread before the codec goes away. The frames not
+ * sent yet, held to be coalesced, are sent if @flush, dropped otherwise.
+ * coroutine context */
+static void record_encoder_stop(SpiceRecordChannel *channel, gboolean flush)
+{
+    SpiceRecordChannelPrivate *rc = channel->priv;
+    RecordFrame *frame;
+
+    if (rc->encoder != NULL) {
+        g_thread_pool_free(rc->encoder, FALSE, TRUE);
+        rc->encoder = NULL;
+    }
+
+    g_mutex_lock(&rc->encoded_mutex);
+    if (rc->collect_id != 0) {
+        g_source_remove(rc->collect_id);
+        rc->collect_id = 0;
+    }
+    while ((frame = g_queue_pop_head(&rc->encoded)) != NULL)
+        g_queue_push_tail(&rc->pending, frame);
+    g_mutex_unlock(&rc->encoded_mutex);
+
+    if (flush) {
+        record_send_pending(channel);
+        return;
+    }
+
+    if (rc->flush_id != 0) {
+        g_source_remove(rc->flush_id);
+        rc->flush_id = 0;
+    }
+    while ((frame = g_queue_pop_head(&rc->pending)) != NULL)
+        g_free(frame);
+}
+
+/* ------------------------------------------------------------------ */
+
 /**
  * spice_record_send_data:
  * @channel: a #SpiceRecordChannel
@@ -326,13 +612,16 @@ void spice_record_send_data(SpiceRecordChannel *channel, gpointer data,
  *
  * Send recorded PCM data to the guest.
  *
+ * The data is cut into codec frames, encoded in a thread and sent from
+ * the main context: it may still be on its way when this function returns.
+ *
  * Since: 0.35
  **/
 void spice_record_channel_send_data(SpiceRecordChannel *channel, gpointer data,
                                     gsize bytes, uint32_t time)
 {
     SpiceRecordChannelPrivate *rc;
-    SpiceMsgcRecordPacket p = {0, };
+    gint64 now = g_get_monotonic_time();
 
     g_return_if_fail(SPICE_IS_RECORD_CHANNEL(channel));
     rc = channel->priv;
@@ -343,24 +632,17 @@ void spice_record_channel_send_data(SpiceRecordChannel *channel, gpointer data,
 
     g_return_if_fail(spice_channel_get_read_only(SPICE_CHANNEL(channel)) == FALSE);
 
-    uint8_t *encode_buf = NULL;
-
     if (!rc->started) {
         spice_record_mode(channel, time, rc->mode, NULL, 0);
         spice_record_start_mark(channel, time);
         rc->started = TRUE;
     }
 
-    if (rc->mode != SPICE_AUDIO_DATA_MODE_RAW)
-        encode_buf = g_alloca(SND_CODEC_MAX_COMPRESSED_BYTES);
-
-    p.time = time;
-
     while (bytes > 0) {
         gsize n;
         int frame_size;
-        SpiceMsgOut *msg;
         uint8_t *frame;
+        gint64 capture_time;
 
         if (rc->last_frame_current > 0) {
             /* complete previous frame */
@@ -372,10 +654,12 @@ void spice_record_channel_send_data(SpiceRecordChannel *channel, gpointer data,
                 break;
             frame = rc->last_frame;
             frame_size = rc->frame_bytes;
+            capture_time = rc->last_frame_time;
         } else {
             n = MIN(bytes, rc->frame_bytes);
             frame_size = n;
             frame = data;
+            capture_time = now;
         }
 
         if (rc->last_frame_current == 0 &&
@@ -383,23 +667,11 @@ void spice_record_channel_send_data(SpiceRecordChannel *channel, gpointer data,
             /* start a new frame */
             memcpy(rc->last_frame, data, n);
             rc->last_frame_current = n;
+            rc->last_frame_time = now;
             break;
         }
 
-        if (rc->mode != SPICE_AUDIO_DATA_MODE_RAW) {
-            int len = SND_CODEC_MAX_COMPRESSED_BYTES;
-            if (snd_codec_encode(rc->codec, frame, frame_size, encode_buf, &len) != SND_CODEC_OK) {
-                g_warning("encode failed");
-                return;
-            }
-            frame = encode_buf;
-            frame_size = len;
-        }
-
-        msg = spice_msg_out_new(SPICE_CHANNEL(channel), SPICE_MSGC_RECORD_DATA);
-        msg->marshallers->msgc_record_data(msg->marshaller, &p);
-        spice_marshaller_add(msg->marshaller, frame, frame_size);
-        spice_msg_out_send(msg);
+        record_queue_frame(channel, frame, frame_size, time, capture_time);
 
         if (rc->last_frame_current == rc->frame_bytes)
             rc->last_frame_current = 0;
@@ -426,6 +698,7 @@ static void record_handle_start(SpiceChannel *channel, SpiceMsgIn *in)
 
     g_return_if_fail(start->format == SPICE_AUDIO_FMT_S16);
 
+    record_encoder_stop(SPICE_RECORD_CHANNEL(channel), FALSE);
     snd_codec_destroy(&c->codec);
 
     if (c->mode != SPICE_AUDIO_DATA_MODE_RAW) {
@@ -440,6 +713,9 @@ static void record_handle_start(SpiceChannel *channel, SpiceMsgIn *in)
     c->frame_bytes = frame_size * 16 * start->channels / 8;
     c->last_frame = g_malloc0(c->frame_bytes);
     c->last_frame_current = 0;
+    c->frame_duration = frame_size * 1000 / start->frequency;
+    memset(&c->stats, 0, sizeof(c->stats));
+    c->stats.fragment = c->fragment;
 
     g_coroutine_signal_emit(channel, signals[SPICE_RECORD_START], 0,
                             start->format, start->channels, start->frequency);
@@ -452,6 +728,7 @@ static void record_handle_stop(SpiceChannel *channel, SpiceMsgIn *in)
 
     g_coroutine_signal_emit(channel, signals[SPICE_RECORD_STOP], 0);
     rc->started = FALSE;
+    record_encoder_stop(SPICE_RECORD_CHANNEL(channel), TRUE);
 }
 
 /* coroutine context */
@@ -493,3 +770,37 @@ static void channel_set_handlers(SpiceChannelClass *klass)
 
     spice_channel_set_handlers(klass, handlers, G_N_ELEMENTS(handlers));
 }
+
+/* main context */
+G_GNUC_INTERNAL
+guint spice_record_channel_get_fragment(SpiceRecordChannel *channel)
+{
+    g_return_val_if_fail(SPICE_IS_RECORD_CHANNEL(channel), RECORD_DEFAULT_FRAGMENT);
+
+    return channel->priv->fragment;
+}
+
+/**
+ * spice_record_channel_get_stats:
+ * @channel: a #SpiceRecordChannel
+ * @stats: (out): where to store the state of the recording
+ *
+ * Gets how long the recorded audio takes to be sent, and how it is sent.
+ *
+ * Returns: %TRUE if @stats was filled, %FALSE if the recording didn't
+ * start
+ *
+ * Since: 0.36
+ **/
+gboolean spice_record_channel_get_stats(SpiceRecordChannel *channel,
+                                        SpiceRecordStats *stats)
+{
+    g_return_val_if_fail(SPICE_IS_RECORD_CHANNEL(channel), FALSE);
+    g_return_val_if_fail(stats != NULL, FALSE);
+
+    if (channel->priv->last_frame == NULL) {
+        return FALSE;
+    }
+    *stats = channel->priv->stats;
+    return TRUE;
+}
@@ -72,9 +72,37 @@ struct _SpiceRecordChannelClass {
     /* Do not add fields to this struct */
 };
 
+/**
+ * SpiceRecordStats:
+ * @fragment: how much audio the audio backend captures at once, in milliseconds
+ * @latency: average time between the capture of a frame of audio and its
+ * sending, in microseconds
+ * @max_latency: the longest of these times, in microseconds
+ * @rtt: round trip time to the server, in milliseconds, or 0 if unknown
+ * @batch: number of encoded frames sent together
+ * @frames: number of frames sent
+ * @dropped: number of frames which failed to encode
+ *
+ * The state of the recording.
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpiceRecordStats SpiceRecordStats;
+struct _SpiceRecordStats {
+    guint32 fragment;
+    guint32 latency;
+    guint32 max_latency;
+    guint32 rtt;
+    guint batch;
+    guint frames;
+    guint dropped;
+};
+
 GType	        spice_record_channel_get_type(void);
 void            spice_record_channel_send_data(SpiceRecordChannel *channel, gpointer data,
                                                gsize bytes, guint32 time);
+gboolean        spice_record_channel_get_stats(SpiceRecordChannel *channel,
+                                               SpiceRecordStats *stats);
 
 #ifndef SPICE_DISABLE_DEPRECATED
 G_DEPRECATED_FOR(spice_record_channel_send_data)
@@ -5,17 +5,29 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include <string.h>
+#include <glib/gstdio.h>
 #include <spice/vd_agent.h>
+#ifdef G_OS_UNIX
+#include <gio/gunixsocketaddress.h>
+#endif
 #include "spice-util.h"
 #include "port-forward.h"
 
 struct PortForwarder {
     void *channel;
     port_forwarder_send_command_cb send_command;
+    port_forwarder_data_ready_cb data_ready;
     GHashTable *remote_assocs;
     GHashTable *connections;
-    GSocketListener *listener;
-    GCancellable *listener_cancellable;
+    /* the LocalListener of the local ports, and of the Unix sockets */
+    GHashTable *local_ports;
+    GHashTable *local_paths;
+    /* the connections with data to send, see port_forwarder_pop_data() */
+    GQueue sched;
+    guint64 vtime;
+    guint queued;
+    /* the sum of the weights of the connections in sched */
+    guint sched_weight;
 };
 
 static void send_command(PortForwarder *pf, guint32 command,
@@ -24,8 +36,64 @@ static void send_command(PortForwarder *pf, guint32 command,
     pf->send_command(pf->channel, command, data, data_size);
 }
 
-#define WINDOW_SIZE 10*1024*1024
 #define MAX_MSG_SIZE VD_AGENT_MAX_DATA_SIZE - sizeof(VDAgentMessage)
+#define DATA_HEAD_SIZE sizeof(VDAgentPortForwardDataMessage)
+#define BUFFER_SIZE MAX_MSG_SIZE - DATA_HEAD_SIZE
+
+/* The data sent to the agent and not acknowledged yet is limited to a
+ * window, sized to twice the bandwidth-delay product measured from the
+ * ACKs, so that it is large enough to fill the link but doesn't pile up
+ * in the queues on the way. The agent is asked to acknowledge the data
+ * every ACK_INTERVAL bytes, which is how often it can be measured. */
+#define INITIAL_WINDOW (10 * 1024 * 1024)
+#define ACK_INTERVAL (256 * 1024)
+#define MIN_WINDOW (4 * ACK_INTERVAL)
+#define MAX_WINDOW (64 * 1024 * 1024)
+/* how long the smallest round trip time seen is trusted */
+#define MIN_RTT_LIFETIME (10 * G_USEC_PER_SEC)
+
+/* The data is read and written in blocks, kept for reuse: a read is
+ * split in as many agent messages as needed, which refer to the block
+ * until they are sent, and the data messages of the agent are gathered to
+ * be written together. Everything here runs in the main context. */
+#define BLOCK_SIZE (64 * 1024)
+#define BLOCK_POOL_SIZE 32
+
+static GQueue block_pool = G_QUEUE_INIT;
+
+static guint8 *block_new(void)
+{
+    guint8 *block = g_queue_pop_head(&block_pool);
+    return block ? block : g_malloc(BLOCK_SIZE);
+}
+
+static void block_free(guint8 *block)
+{
+    if (g_queue_get_length(&block_pool) < BLOCK_POOL_SIZE) {
+        g_queue_push_head(&block_pool, block);
+    } else {
+        g_free(block);
+    }
+}
+
+/* data waiting to be written, from start to end */
+typedef struct WriteBlock {
+    guint8 *data;
+    gsize start, end;
+} WriteBlock;
+
+static WriteBlock *write_block_new(void)
+{
+    WriteBlock *block = g_slice_new0(WriteBlock);
+    block->data = block_new();
+    return block;
+}
+
+static void write_block_free(WriteBlock *block)
+{
+    block_free(block->data);
+    g_slice_free(WriteBlock, block);
+}
 
 typedef struct Connection {
     GSocketClient *socket;
@@ -34,10 +102,27 @@ typedef struct Connection {
     GQueue *write_buffer;
     guint8 *read_buffer;
     guint32 data_sent, data_received, ack_interval;
-    gboolean connecting;
+    gboolean connecting, reading, writing;
     PortForwarder *pf;
     int refs;
     guint32 id;
+    guint16 port;
+    /* flow control, see INITIAL_WINDOW */
+    guint32 window;
+    guint64 total_sent, total_acked;
+    guint64 probe_bytes;
+    gint64 probe_time;
+    gint64 min_rtt, min_rtt_time, rtt;
+    gint64 last_ack_time;
+    guint64 rate;
+    gint64 blocked_since, blocked_time;
+    /* the data messages waiting for their turn, and the close which goes
+       after them, see port_forwarder_pop_data() */
+    GQueue pending;
+    gboolean scheduled, closing;
+    guint64 finish;
+    guint weight;
+    guint64 total_popped, total_received;
 } Connection;
 
 static Connection *new_connection(PortForwarder *pf, int id, guint32 ack_int)
@@ -50,8 +135,11 @@ static Connection *new_connection(PortForwarder *pf, int id, guint32 ack_int)
         conn->pf = pf;
         conn->ack_interval = ack_int;
         conn->connecting = TRUE;
+        conn->window = INITIAL_WINDOW;
+        conn->weight = 1;
         conn->write_buffer = g_queue_new();
-        conn->read_buffer = (guint8 *)g_malloc(MAX_MSG_SIZE);
+        conn->read_buffer = block_new();
+        g_queue_init(&conn->pending);
     }
     return conn;
 }
@@ -68,8 +156,8 @@ static void unref_connection(gpointer value)
         if (conn->socket) {
             g_object_unref(conn->socket);
         }
-        g_queue_free_full(conn->write_buffer, (GDestroyNotify)g_bytes_unref);
-        g_free(conn->read_buffer);
+        g_queue_free_full(conn->write_buffer, (GDestroyNotify)write_block_free);
+        block_free(conn->read_buffer);
         g_free(conn);
     }
 }
@@ -104,7 +192,144 @@ static void close_agent_connection(PortForwarder *pf, int id)
     send_command(pf, VD_AGENT_PORT_FORWARD_CLOSE, (const guint8 *)&closeMsg, sizeof(closeMsg));
 }
 
-static void close_connection_no_notify(Connection * conn)
+/* ---------- Scheduling ---------- */
+
+/* The data messages of the connections are sent in turns, with fair
+ * queuing: each message gets a virtual finish time, the one of the
+ * previous message of its connection, or the current virtual time if
+ * the connection was idle, plus its size divided by the weight of the
+ * connection. The message with the earliest finish time goes first, so
+ * that the few bytes of an interactive connection don't wait behind the
+ * backlog of a bulk one. */
+static guint64 sched_cost(Connection *conn, GBytes *msg)
+{
+    return g_bytes_get_size(msg) / conn->weight;
+}
+
+static void sched_push(Connection *conn, GBytes *msg)
+{
+    PortForwarder *pf = conn->pf;
+
+    g_queue_push_tail(&conn->pending, msg);
+    pf->queued++;
+    if (!conn->scheduled) {
+        conn->finish = MAX(conn->finish, pf->vtime) + sched_cost(conn, msg);
+        conn->scheduled = TRUE;
+        conn->refs++;
+        g_queue_push_tail(&pf->sched, conn);
+        pf->sched_weight += conn->weight;
+    }
+}
+
+/* drops the messages not sent yet */
+static void sched_remove(Connection *conn)
+{
+    PortForwarder *pf = conn->pf;
+    GBytes *msg;
+
+    if (!conn->scheduled)
+        return;
+
+    while ((msg = g_queue_pop_head(&conn->pending)) != NULL) {
+        g_bytes_unref(msg);
+        pf->queued--;
+    }
+    g_queue_remove(&pf->sched, conn);
+    pf->sched_weight -= conn->weight;
+    conn->scheduled = FALSE;
+    conn->closing = FALSE;
+    unref_connection(conn);
+}
+
+static void sched_clear(PortForwarder *pf)
+{
+    Connection *conn;
+
+    while ((conn = g_queue_peek_head(&pf->sched)) != NULL) {
+        sched_remove(conn);
+    }
+}
+
+GBytes *port_forwarder_pop_data(PortForwarder *pf, guint32 *command,
+                                VDAgentPortForwardDataMessage *head, gsize *head_size)
+{
+    Connection *conn = NULL, *next;
+    VDAgentPortForwardCloseMessage close_msg;
+    GBytes *msg;
+    GList *l;
+
+    for (l = pf->sched.head; l != NULL; l = l->next) {
+        next = l->data;
+        if (conn == NULL || next->finish < conn->finish) {
+            conn = next;
+        }
+    }
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    pf->vtime = conn->finish;
+    msg = g_queue_pop_head(&conn->pending);
+    if (msg != NULL) {
+        *command = VD_AGENT_PORT_FORWARD_DATA;
+        pf->queued--;
+        head->id = conn->id;
+        head->size = g_bytes_get_size(msg);
+        *head_size = DATA_HEAD_SIZE;
+        conn->total_popped += head->size;
+        if (conn->probe_time == 0) {
+            /* time how long it takes to get acknowledged */
+            conn->probe_time = g_get_monotonic_time();
+            conn->probe_bytes = conn->total_popped;
+        }
+        if (!g_queue_is_empty(&conn->pending)) {
+            conn->finish += sched_cost(conn, g_queue_peek_head(&conn->pending));
+            return msg;
+        }
+        if (conn->closing) {
+            return msg;
+        }
+    } else {
+        /* only the close was left */
+        *command = VD_AGENT_PORT_FORWARD_CLOSE;
+        *head_size = 0;
+        close_msg.id = conn->id;
+        msg = g_bytes_new(&close_msg, sizeof(close_msg));
+    }
+
+    sched_remove(conn);
+    return msg;
+}
+
+guint port_forwarder_get_queued(PortForwarder *pf)
+{
+    return pf->queued;
+}
+
+guint port_forwarder_get_weight(PortForwarder *pf)
+{
+    return pf->sched_weight;
+}
+
+gboolean port_forwarder_set_weight(PortForwarder *pf, guint32 id, guint weight)
+{
+    Connection *conn;
+
+    g_return_val_if_fail(weight > 0, FALSE);
+
+    conn = g_hash_table_lookup(pf->connections, GUINT_TO_POINTER(id));
+    if (conn == NULL) {
+        return FALSE;
+    }
+
+    if (conn->scheduled) {
+        pf->sched_weight += weight - conn->weight;
+    }
+    conn->weight = weight;
+    return TRUE;
+}
+
+static void forget_connection(Connection *conn)
 {
     SPICE_DEBUG("Start closing connection %u with %d refs", conn->id, conn->refs);
     if (!g_cancellable_is_cancelled(conn->cancellable))
@@ -113,10 +338,21 @@ static void close_connection_no_notify(Connection * conn)
         SPICE_DEBUG("Connection not found in hash table with id %p???", GUINT_TO_POINTER(conn->id));
 }
 
+static void close_connection_no_notify(Connection * conn)
+{
+    sched_remove(conn);
+    forget_connection(conn);
+}
+
 static void close_connection(Connection * conn)
 {
-    close_agent_connection(conn->pf, conn->id);
-    close_connection_no_notify(conn);
+    if (conn->scheduled) {
+        /* after the data still queued */
+        conn->closing = TRUE;
+    } else {
+        close_agent_connection(conn->pf, conn->id);
+    }
+    forget_connection(conn);
 }
 
 #define TYPE_ADDRESS_PORT            (address_port_get_type ())
@@ -126,11 +362,13 @@ static void close_connection(Connection * conn)
 #define IS_ADDRESS_PORT_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), TYPE_ADDRESS_PORT))
 #define ADDRESS_PORT_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), TYPE_ADDRESS_PORT, AddressPortClass))
 
+/* A host and port, or the path of a Unix socket */
 typedef struct _AddressPort
 {
     GObject parent_instance;
     guint16 port;
     gchar *address;
+    gchar *path;
 } AddressPort;
 
 typedef struct _AddressPortClass
@@ -151,6 +389,7 @@ static void address_port_finalize(GObject *gobject)
 {
     AddressPort *self = ADDRESS_PORT(gobject);
     g_free(self->address);
+    g_free(self->path);
     G_OBJECT_CLASS(address_port_parent_class)->finalize(gobject);
 }
 
@@ -173,24 +412,93 @@ static gpointer address_port_new(guint16 port, const char * address)
     return p;
 }
 
+static gpointer address_port_new_path(const char *path)
+{
+    AddressPort * p = g_object_new(TYPE_ADDRESS_PORT, NULL);
+    p->path = g_strdup(path);
+    return p;
+}
+
 static void listener_accept_callback(GObject *source_object, GAsyncResult *res,
                                      gpointer user_data);
 
-PortForwarder *new_port_forwarder(void *channel, port_forwarder_send_command_cb cb)
+/* A local port, or Unix socket, forwarded to the guest. It has its own
+ * GSocketListener, so that it can be closed alone. */
+typedef struct LocalListener {
+    int refs;
+    PortForwarder *pf;
+    GSocketListener *listener;
+    GCancellable *cancellable;
+    /* the Unix socket, removed when the listener is closed */
+    gchar *path;
+} LocalListener;
+
+static LocalListener *local_listener_new(PortForwarder *pf)
+{
+    LocalListener *l = g_new0(LocalListener, 1);
+
+    l->refs = 1;
+    l->pf = pf;
+    l->listener = g_socket_listener_new();
+    l->cancellable = g_cancellable_new();
+    return l;
+}
+
+static void local_listener_unref(LocalListener *l)
+{
+    if (--l->refs) {
+        return;
+    }
+    g_object_unref(l->cancellable);
+    g_object_unref(l->listener);
+    g_free(l->path);
+    g_free(l);
+}
+
+static void local_listener_accept(LocalListener *l)
+{
+    l->refs++;
+    g_socket_listener_accept_async(l->listener, l->cancellable,
+                                   listener_accept_callback, l);
+}
+
+/* Stops accepting connections; those accepted already go on */
+static void local_listener_close(gpointer data)
+{
+    LocalListener *l = data;
+
+    SPICE_DEBUG("Closing listener %s", l->path ? l->path : "");
+    l->pf = NULL;
+    g_cancellable_cancel(l->cancellable);
+    g_socket_listener_close(l->listener);
+    if (l->path) {
+        g_unlink(l->path);
+    }
+    local_listener_unref(l);
+}
+
+PortForwarder *new_port_forwarder(void *channel, port_forwarder_send_command_cb cb,
+                                  port_forwarder_data_ready_cb ready_cb)
 {
     PortForwarder *pf = g_malloc(sizeof(PortForwarder));
     if (pf) {
         SPICE_DEBUG("Created new port forwarder");
         pf->channel = channel;
         pf->send_command = cb;
+        pf->data_ready = ready_cb;
+        g_queue_init(&pf->sched);
+        pf->vtime = 0;
+        pf->queued = 0;
         pf->remote_assocs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
                                                   NULL, g_object_unref);
         pf->connections = g_hash_table_new_full(g_direct_hash, g_direct_equal,
                                                 NULL, unref_connection);
-        pf->listener = g_socket_listener_new();
-        pf->listener_cancellable = g_cancellable_new();
+        pf->local_ports = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                NULL, local_listener_close);
+        pf->local_paths = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                NULL, local_listener_close);
         if (!pf->remote_assocs || !pf->connections ||
-                !pf->listener || !pf->listener_cancellable) {
+                !pf->local_ports || !pf->local_paths) {
             delete_port_forwarder(pf);
             pf = NULL;
         }
@@ -202,17 +510,18 @@ void delete_port_forwarder(PortForwarder *pf)
 {
     if (pf) {
         SPICE_DEBUG("Deleting port forwarder");
+        sched_clear(pf);
         if (pf->remote_assocs) {
             g_hash_table_destroy(pf->remote_assocs);
         }
         if (pf->connections) {
             g_hash_table_destroy(pf->connections);
         }
-        if (pf->listener_cancellable) {
-            g_object_unref(pf->listener_cancellable);
+        if (pf->local_ports) {
+            g_hash_table_destroy(pf->local_ports);
         }
-        if (pf->listener) {
-            g_socket_listener_close(pf->listener);
+        if (pf->local_paths) {
+            g_hash_table_destroy(pf->local_paths);
         }
         g_free(pf);
     }
@@ -221,19 +530,18 @@ void delete_port_forwarder(PortForwarder *pf)
 void port_forwarder_agent_disconnected(PortForwarder *pf)
 {
     SPICE_DEBUG("Agent disconnected, close all connections");
+    sched_clear(pf);
     g_hash_table_remove_all(pf->remote_assocs);
     g_hash_table_remove_all(pf->connections);
 }
 
-gboolean port_forwarder_associate_remote(PortForwarder *pf, const gchar * bind_address,
-                                         guint16 rport, const gchar * host, guint16 lport)
+static gboolean associate_remote(PortForwarder *pf, const gchar *bind_address,
+                                 guint16 rport, AddressPort *local)
 {
-    SPICE_DEBUG("Associate guest %s, port %d -> %s port %d", bind_address, rport, host, lport);
     if (g_hash_table_lookup(pf->remote_assocs, GUINT_TO_POINTER(rport))) {
         port_forwarder_disassociate_remote(pf, rport);
     }
-    g_hash_table_insert(pf->remote_assocs, GUINT_TO_POINTER(rport),
-                        address_port_new(lport, host));
+    g_hash_table_insert(pf->remote_assocs, GUINT_TO_POINTER(rport), local);
 
     if (!bind_address) {
         bind_address = "localhost";
@@ -247,6 +555,25 @@ gboolean port_forwarder_associate_remote(PortForwarder *pf, const gchar * bind_a
     return TRUE;
 }
 
+gboolean port_forwarder_associate_remote(PortForwarder *pf, const gchar * bind_address,
+                                         guint16 rport, const gchar * host, guint16 lport)
+{
+    SPICE_DEBUG("Associate guest %s, port %d -> %s port %d", bind_address, rport, host, lport);
+    return associate_remote(pf, bind_address, rport, address_port_new(lport, host));
+}
+
+gboolean port_forwarder_associate_remote_unix(PortForwarder *pf, const gchar *bind_address,
+                                              guint16 rport, const gchar *path)
+{
+#ifdef G_OS_UNIX
+    SPICE_DEBUG("Associate guest %s, port %d -> %s", bind_address, rport, path);
+    return associate_remote(pf, bind_address, rport, address_port_new_path(path));
+#else
+    g_warning("Unix sockets are not supported on this platform");
+    return FALSE;
+#endif
+}
+
 gboolean port_forwarder_disassociate_remote(PortForwarder *pf, guint16 rport) {
     VDAgentPortForwardShutdownMessage msg;
 
@@ -265,32 +592,89 @@ gboolean port_forwarder_associate_local(PortForwarder *pf, const gchar *bind_add
                                         guint16 lport, const gchar *host, guint16 rport)
 {
     // Listen and wait for a connection
+    LocalListener *l;
+    GObject *target = address_port_new(rport, host);
     gboolean res;
+
+    /* a new association replaces the previous one */
+    g_hash_table_remove(pf->local_ports, GUINT_TO_POINTER(lport));
+    l = local_listener_new(pf);
     if (bind_address) {
         GInetAddress *inet_address = g_inet_address_new_from_string(bind_address);
         GSocketAddress *socket_address = g_inet_socket_address_new(inet_address, lport);
-        res = g_socket_listener_add_address(pf->listener, socket_address,
+        res = g_socket_listener_add_address(l->listener, socket_address,
                                             G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
-                                            address_port_new(rport, host), NULL, NULL);
+                                            target, NULL, NULL);
+        g_object_unref(socket_address);
+        g_object_unref(inet_address);
     } else {
-        res = g_socket_listener_add_inet_port(pf->listener, lport,
-                                              address_port_new(rport, host), NULL);
+        res = g_socket_listener_add_inet_port(l->listener, lport, target, NULL);
+    }
+    g_object_unref(target);
+    if (!res) {
+        local_listener_close(l);
+        return FALSE;
     }
-    g_cancellable_cancel(pf->listener_cancellable);
-    g_object_unref(pf->listener_cancellable);
-    pf->listener_cancellable = g_cancellable_new();
-    g_socket_listener_accept_async(pf->listener, pf->listener_cancellable,
-                                   listener_accept_callback, pf);
-    return res;
+    local_listener_accept(l);
+    g_hash_table_insert(pf->local_ports, GUINT_TO_POINTER(lport), l);
+    return TRUE;
+}
+
+gboolean port_forwarder_associate_local_unix(PortForwarder *pf, const gchar *path,
+                                             const gchar *host, guint16 rport)
+{
+#ifdef G_OS_UNIX
+    GSocketAddress *address = g_unix_socket_address_new(path);
+    GObject *target = address_port_new(rport, host);
+    GError *error = NULL;
+    LocalListener *l;
+    gboolean res;
+
+    SPICE_DEBUG("Associate %s -> guest %s port %d", path, host, rport);
+    /* a new association replaces the previous one, and its socket */
+    g_hash_table_remove(pf->local_paths, path);
+    l = local_listener_new(pf);
+    res = g_socket_listener_add_address(l->listener, address,
+                                        G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                        target, NULL, &error);
+    g_object_unref(address);
+    g_object_unref(target);
+    if (!res) {
+        g_warning("Could not listen on %s: %s", path, error->message);
+        g_error_free(error);
+        /* the socket that was there is not ours */
+        local_listener_close(l);
+        return FALSE;
+    }
+    l->path = g_strdup(path);
+    local_listener_accept(l);
+    g_hash_table_insert(pf->local_paths, l->path, l);
+    return TRUE;
+#else
+    g_warning("Unix sockets are not supported on this platform");
+    return FALSE;
+#endif
 }
 
 gboolean port_forwarder_disassociate_local(PortForwarder *pf, guint16 lport)
 {
+    if (!g_hash_table_remove(pf->local_ports, GUINT_TO_POINTER(lport))) {
+        g_warning("Local port %d is not forwarded.", lport);
+        return FALSE;
+    }
+    SPICE_DEBUG("Disassociate local port %d", lport);
     return TRUE;
 }
 
-#define DATA_HEAD_SIZE sizeof(VDAgentPortForwardDataMessage)
-#define BUFFER_SIZE MAX_MSG_SIZE - DATA_HEAD_SIZE
+gboolean port_forwarder_disassociate_local_unix(PortForwarder *pf, const gchar *path)
+{
+    if (!g_hash_table_remove(pf->local_paths, path)) {
+        g_warning("Local socket %s is not forwarded.", path);
+        return FALSE;
+    }
+    SPICE_DEBUG("Disassociate local socket %s", path);
+    return TRUE;
+}
 
 static guint32 generate_connection_id(void)
 {
@@ -298,56 +682,154 @@ static guint32 generate_connection_id(void)
     return --seq;
 }
 
+/* Asks the agent to connect to @host:@rport in the guest, to forward
+ * the local connection @sc, accepted on @port */
+static gboolean open_local_connection(PortForwarder *pf, GSocketConnection *sc, guint16 port,
+                                      const gchar *host, guint16 rport)
+{
+    Connection *conn = new_open_connection(pf, generate_connection_id(),
+                                           ACK_INTERVAL, sc);
+    if (conn) {
+        conn->port = port;
+        int msg_len = sizeof(VDAgentPortForwardConnectMessage) + strlen(host) + 1;
+        VDAgentPortForwardConnectMessage *msg = g_malloc0(msg_len);
+        msg->id = conn->id;
+        msg->ack_interval = conn->ack_interval;
+        msg->port = rport;
+        strcpy(msg->host, host);
+        send_command(pf, VD_AGENT_PORT_FORWARD_CONNECT, (const guint8 *)msg, msg_len);
+        g_hash_table_insert(pf->connections, GUINT_TO_POINTER(msg->id), conn);
+        SPICE_DEBUG("Inserted connection in table with id %p", GUINT_TO_POINTER(msg->id));
+        g_free(msg);
+        return TRUE;
+    }
+    g_object_unref(sc);
+    return FALSE;
+}
+
+gboolean port_forwarder_connect_fd(PortForwarder *pf, gint fd,
+                                   const gchar *host, guint16 rport)
+{
+    GError *error = NULL;
+    GSocket *socket = g_socket_new_from_fd(fd, &error);
+    GSocketConnection *sc;
+
+    if (socket == NULL) {
+        g_warning("Could not use fd %d: %s", fd, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    SPICE_DEBUG("Forwarding fd %d to guest %s port %d", fd, host, rport);
+    sc = g_socket_connection_factory_create_connection(socket);
+    g_object_unref(socket);
+    return open_local_connection(pf, sc, 0, host, rport);
+}
+
 static void listener_accept_callback(GObject *source_object, GAsyncResult *res,
                                      gpointer user_data)
 {
-    PortForwarder *pf = (PortForwarder *)user_data;
+    LocalListener *l = user_data;
+    PortForwarder *pf = l->pf;
     GError *error = NULL;
-    GSocketConnection *sc = g_socket_listener_accept_finish(pf->listener, res,
+    GSocketConnection *sc = g_socket_listener_accept_finish(l->listener, res,
                                                             &source_object, &error);
     if (error) {
         if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
             g_warning("Could not accept connection");
+        g_error_free(error);
+    } else if (pf == NULL) {
+        /* closed meanwhile */
+        g_object_unref(sc);
     } else {
-        GInetSocketAddress * local_address =
-                (GInetSocketAddress *)g_socket_connection_get_local_address(sc, NULL);
-        guint16 port = g_inet_socket_address_get_port(local_address);
+        GSocketAddress *local_address = g_socket_connection_get_local_address(sc, NULL);
+        guint16 port = 0;
         AddressPort * host = ADDRESS_PORT(source_object);
-        SPICE_DEBUG("Accepted connection on port %d to %s:%d",
-                    port, host->address, host->port);
 
-        Connection *conn = new_open_connection(pf, generate_connection_id(),
-                                               WINDOW_SIZE / 2, sc);
-        if (conn) {
-            int msg_len = sizeof(VDAgentPortForwardConnectMessage)
-                          + strlen(host->address) + 1;
-            VDAgentPortForwardConnectMessage *msg = g_malloc0(msg_len);
-            msg->id = conn->id;
-            msg->ack_interval = conn->ack_interval;
-            msg->port = host->port;
-            strcpy(msg->host, host->address);
-            send_command(pf, VD_AGENT_PORT_FORWARD_CONNECT, (const guint8 *)msg, msg_len);
-            g_hash_table_insert(pf->connections, GUINT_TO_POINTER(msg->id), conn);
-            SPICE_DEBUG("Inserted connection in table with id %p", GUINT_TO_POINTER(msg->id));
-            g_free(msg);
+        /* no port for the Unix sockets */
+        if (G_IS_INET_SOCKET_ADDRESS(local_address)) {
+            port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(local_address));
         }
+        g_clear_object(&local_address);
+        SPICE_DEBUG("Accepted connection on port %d to %s:%d",
+                    port, host->address, host->port);
+        open_local_connection(pf, sc, port, host->address, host->port);
 
-        g_socket_listener_accept_async(pf->listener, pf->listener_cancellable,
-                                       listener_accept_callback, pf);
+        local_listener_accept(l);
     }
+    local_listener_unref(l);
 }
 
 static void connection_read_callback(GObject *source_object, GAsyncResult *res,
                                      gpointer user_data);
+static void connection_write_callback(GObject *source_object, GAsyncResult *res,
+                                      gpointer user_data);
 
 static void program_read(Connection *conn)
 {
     GInputStream *stream = g_io_stream_get_input_stream((GIOStream *)conn->conn);
-    guint8 *data = conn->read_buffer + DATA_HEAD_SIZE;
-    g_input_stream_read_async(stream, data, BUFFER_SIZE, G_PRIORITY_DEFAULT,
+    conn->reading = TRUE;
+    g_input_stream_read_async(stream, conn->read_buffer, BLOCK_SIZE, G_PRIORITY_DEFAULT,
                               conn->cancellable, connection_read_callback, conn);
 }
 
+/* Queues the @size bytes read, as many data messages as needed */
+static void send_data(Connection *conn, gsize size)
+{
+    GBytes *block;
+    gsize pos, n;
+
+    if (size <= BUFFER_SIZE) {
+        /* a few bytes, as typed, don't hold a whole block */
+        sched_push(conn, g_bytes_new(conn->read_buffer, size));
+    } else {
+        /* the messages refer to the block, which goes back to the pool
+           once they are all sent */
+        block = g_bytes_new_with_free_func(conn->read_buffer, size,
+                                           (GDestroyNotify)block_free, conn->read_buffer);
+        conn->read_buffer = block_new();
+        for (pos = 0; pos < size; pos += n) {
+            n = MIN(size - pos, BUFFER_SIZE);
+            sched_push(conn, g_bytes_new_from_bytes(block, pos, n));
+        }
+        g_bytes_unref(block);
+    }
+
+    conn->data_sent += size;
+    conn->total_sent += size;
+    conn->pf->data_ready(conn->pf->channel);
+}
+
+/* Adapts the window to @size more bytes acknowledged */
+static void update_window(Connection *conn, guint32 size, gint64 now)
+{
+    guint64 bdp;
+
+    conn->total_acked += size;
+    if (conn->last_ack_time != 0 && now > conn->last_ack_time) {
+        guint64 rate = (guint64)size * G_USEC_PER_SEC / (now - conn->last_ack_time);
+        conn->rate = conn->rate ? (3 * conn->rate + rate) / 4 : rate;
+    }
+    conn->last_ack_time = now;
+
+    if (conn->probe_time != 0 && conn->total_acked >= conn->probe_bytes) {
+        gint64 rtt = MAX(now - conn->probe_time, 1);
+
+        conn->rtt = conn->rtt ? (7 * conn->rtt + rtt) / 8 : rtt;
+        /* the smallest is the one without queueing delay */
+        if (conn->min_rtt == 0 || rtt <= conn->min_rtt ||
+            now - conn->min_rtt_time > MIN_RTT_LIFETIME) {
+            conn->min_rtt = rtt;
+            conn->min_rtt_time = now;
+        }
+        conn->probe_time = 0;
+    }
+
+    if (conn->min_rtt != 0 && conn->rate != 0) {
+        bdp = conn->rate * conn->min_rtt / G_USEC_PER_SEC;
+        conn->window = CLAMP(2 * bdp, MIN_WINDOW, MAX_WINDOW);
+    }
+}
+
 static void connection_read_callback(GObject *source_object, GAsyncResult *res,
                                      gpointer user_data)
 {
@@ -356,8 +838,8 @@ static void connection_read_callback(GObject *source_object, GAsyncResult *res,
     GError *error = NULL;
     GInputStream *stream = (GInputStream *)source_object;
     gssize bytes = g_input_stream_read_finish(stream, res, &error);
-    VDAgentPortForwardDataMessage *msg = (VDAgentPortForwardDataMessage *)conn->read_buffer;
 
+    conn->reading = FALSE;
     if (g_cancellable_is_cancelled(conn->cancellable)) {
         unref_connection(conn);
         return;
@@ -372,55 +854,76 @@ static void connection_read_callback(GObject *source_object, GAsyncResult *res,
         close_connection(conn);
         unref_connection(conn);
     } else {
-        msg->id = conn->id;
-        msg->size = bytes;
-        send_command(pf, VD_AGENT_PORT_FORWARD_DATA,
-                     conn->read_buffer, DATA_HEAD_SIZE + msg->size);
-        conn->data_sent += msg->size;
-        if (conn->data_sent < WINDOW_SIZE) {
+        send_data(conn, bytes);
+        if (conn->data_sent < conn->window) {
             program_read(conn);
         } else {
+            conn->blocked_since = g_get_monotonic_time();
             unref_connection(conn);
         }
     }
 }
 
+static void program_write(Connection *conn)
+{
+    GOutputStream *stream = g_io_stream_get_output_stream((GIOStream *)conn->conn);
+    WriteBlock *block = g_queue_peek_head(conn->write_buffer);
+    conn->writing = TRUE;
+    g_output_stream_write_async(stream, block->data + block->start, block->end - block->start,
+                                G_PRIORITY_DEFAULT, NULL, connection_write_callback, conn);
+}
+
+/* Queues @size bytes of @data to be written, after the data already
+ * waiting, which is written with it */
+static void queue_write(Connection *conn, const guint8 *data, gsize size)
+{
+    WriteBlock *block = g_queue_peek_tail(conn->write_buffer);
+    gsize n;
+
+    while (size > 0) {
+        if (block == NULL || block->end == BLOCK_SIZE) {
+            block = write_block_new();
+            g_queue_push_tail(conn->write_buffer, block);
+        }
+        n = MIN(size, BLOCK_SIZE - block->end);
+        memcpy(block->data + block->end, data, n);
+        block->end += n;
+        data += n;
+        size -= n;
+    }
+}
+
 static void connection_write_callback(GObject *source_object, GAsyncResult *res,
                                       gpointer user_data)
 {
     Connection *conn = (Connection *)user_data;
     GOutputStream *stream = (GOutputStream *)source_object;
-    GBytes *bytes, *new_bytes;
+    WriteBlock *block;
     GError *error = NULL;
-    int num_written = g_output_stream_write_finish(stream, res, &error);
-    int remaining;
+    gssize num_written = g_output_stream_write_finish(stream, res, &error);
     VDAgentPortForwardAckMessage msg;
 
+    conn->writing = FALSE;
     if (error != NULL) {
         /* Error or connection closed by peer */
         SPICE_DEBUG("Write error on connection %u: %s", conn->id, error->message);
+        g_error_free(error);
         close_connection(conn);
         unref_connection(conn);
     } else {
-        bytes = (GBytes *)g_queue_pop_head(conn->write_buffer);
-        SPICE_DEBUG("Written %d bytes on connection %u", num_written, conn->id);
-        remaining = g_bytes_get_size(bytes) - num_written;
-        if (remaining) {
-            SPICE_DEBUG("Still %d bytes to go on connection %u", remaining, conn->id);
-            new_bytes = g_bytes_new_from_bytes(bytes, num_written, remaining);
-            g_queue_push_head(conn->write_buffer, new_bytes);
-        }
-        if(!g_queue_is_empty(conn->write_buffer)) {
-            new_bytes = g_queue_peek_head(conn->write_buffer);
-            g_output_stream_write_async(stream, g_bytes_get_data(new_bytes, NULL),
-                                        g_bytes_get_size(new_bytes), G_PRIORITY_DEFAULT,
-                                        NULL, connection_write_callback, conn);
-        } else {
-            unref_connection(conn);
+        SPICE_DEBUG("Written %" G_GSSIZE_FORMAT " bytes on connection %u", num_written, conn->id);
+        block = g_queue_peek_head(conn->write_buffer);
+        block->start += num_written;
+        if (block->start == block->end) {
+            if (g_queue_get_length(conn->write_buffer) > 1) {
+                write_block_free(g_queue_pop_head(conn->write_buffer));
+            } else {
+                block->start = block->end = 0;
+            }
         }
-        g_bytes_unref(bytes);
 
         conn->data_received += num_written;
+        conn->total_received += num_written;
         if (conn->data_received >= conn->ack_interval) {
             msg.id = conn->id;
             msg.size = conn->data_received;
@@ -428,6 +931,13 @@ static void connection_write_callback(GObject *source_object, GAsyncResult *res,
             send_command(conn->pf, VD_AGENT_PORT_FORWARD_ACK,
                          (const guint8 *)&msg, sizeof(msg));
         }
+
+        block = g_queue_peek_head(conn->write_buffer);
+        if (block->end > block->start) {
+            program_write(conn);
+        } else {
+            unref_connection(conn);
+        }
     }
 }
 
@@ -435,14 +945,14 @@ static void connection_connect_callback(GObject *source_object, GAsyncResult *re
                                         gpointer user_data)
 {
     Connection *conn = (Connection *)user_data;
-    VDAgentPortForwardAckMessage msg = {.id = conn->id, .size = WINDOW_SIZE/2};
+    VDAgentPortForwardAckMessage msg = {.id = conn->id, .size = ACK_INTERVAL};
 
     if (g_cancellable_is_cancelled(conn->cancellable)) {
         unref_connection(conn);
         return;
     }
 
-    conn->conn = g_socket_client_connect_to_host_finish((GSocketClient *)source_object, res, NULL);
+    conn->conn = g_socket_client_connect_finish((GSocketClient *)source_object, res, NULL);
     if (!conn->conn) {
         /* Error */
         SPICE_DEBUG("Connection %u could not connect", conn->id);
@@ -466,14 +976,28 @@ static void handle_accepted(PortForwarder *pf, VDAgentPortForwardAcceptedMessage
         close_connection_no_notify(conn);
     }
 
-    local = ADDRESS_PORT(g_hash_table_lookup(pf->remote_assocs, rport));
-    SPICE_DEBUG("Connection command, id %u on remote port %d -> %s port %d",
-                msg->id, msg->port, local->address, local->port);
+    local = g_hash_table_lookup(pf->remote_assocs, rport);
     if (local) {
         conn = new_connection_with_socket(pf, msg->id, msg->ack_interval);
         if (conn) {
+            conn->port = msg->port;
             g_hash_table_insert(pf->connections, id, conn);
             conn->refs++;
+#ifdef G_OS_UNIX
+            if (local->path) {
+                GSocketAddress *address = g_unix_socket_address_new(local->path);
+
+                SPICE_DEBUG("Connection command, id %u on remote port %d -> %s",
+                            msg->id, msg->port, local->path);
+                g_socket_client_connect_async(conn->socket, G_SOCKET_CONNECTABLE(address),
+                                              conn->cancellable,
+                                              connection_connect_callback, conn);
+                g_object_unref(address);
+                return;
+            }
+#endif
+            SPICE_DEBUG("Connection command, id %u on remote port %d -> %s port %d",
+                        msg->id, msg->port, local->address, local->port);
             g_socket_client_connect_to_host_async(conn->socket, local->address,
                                                   local->port, conn->cancellable,
                                                   connection_connect_callback, conn);
@@ -490,8 +1014,6 @@ static void handle_accepted(PortForwarder *pf, VDAgentPortForwardAcceptedMessage
 static void handle_data(PortForwarder *pf, VDAgentPortForwardDataMessage *msg)
 {
     Connection *conn = g_hash_table_lookup(pf->connections, GUINT_TO_POINTER(msg->id));
-    GBytes *chunk;
-    GOutputStream *stream;
 
     if (!conn) {
         /* Ignore, this is usually an already closed connection */
@@ -499,14 +1021,10 @@ static void handle_data(PortForwarder *pf, VDAgentPortForwardDataMessage *msg)
     } else if (conn->connecting) {
         g_warning("Connection %u is still not connected!", conn->id);
     } else {
-        chunk = g_bytes_new(msg->data, msg->size);
-        g_queue_push_tail(conn->write_buffer, chunk);
-        if (g_queue_get_length(conn->write_buffer) == 1) {
+        queue_write(conn, msg->data, msg->size);
+        if (!conn->writing) {
             conn->refs++;
-            stream = g_io_stream_get_output_stream((GIOStream *)conn->conn);
-            g_output_stream_write_async(stream, g_bytes_get_data(chunk, NULL),
-                                        g_bytes_get_size(chunk), G_PRIORITY_DEFAULT,
-                                        NULL, connection_write_callback, conn);
+            program_write(conn);
         }
     }
 }
@@ -535,9 +1053,15 @@ static void handle_ack(PortForwarder *pf, VDAgentPortForwardAckMessage *msg)
             conn->refs++;
             program_read(conn);
         } else {
-            guint32 data_sent_before = conn->data_sent;
-            conn->data_sent -= msg->size;
-            if (conn->data_sent < WINDOW_SIZE && data_sent_before >= WINDOW_SIZE) {
+            gint64 now = g_get_monotonic_time();
+
+            conn->data_sent -= MIN(msg->size, conn->data_sent);
+            update_window(conn, msg->size, now);
+            if (!conn->reading && conn->data_sent < conn->window) {
+                if (conn->blocked_since != 0) {
+                    conn->blocked_time += now - conn->blocked_since;
+                    conn->blocked_since = 0;
+                }
                 conn->refs++;
                 program_read(conn);
             }
@@ -567,3 +1091,34 @@ void port_forwarder_handle_message(PortForwarder* pf, guint32 command, gpointer
             break;
     }
 }
+
+GArray *port_forwarder_get_stats(PortForwarder *pf)
+{
+    GArray *array = g_array_new(FALSE, TRUE, sizeof(SpicePortForwardStats));
+    gint64 now = g_get_monotonic_time();
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, pf->connections);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        Connection *conn = value;
+        SpicePortForwardStats stats = {
+            .id = conn->id,
+            .port = conn->port,
+            .sent_bytes = conn->total_popped,
+            .received_bytes = conn->total_received,
+            .queued_bytes = conn->total_sent - conn->total_popped,
+            .window = conn->window,
+            .rtt = conn->rtt,
+            .blocked_time = conn->blocked_time,
+            .weight = conn->weight,
+        };
+
+        if (conn->blocked_since != 0) {
+            stats.blocked_time += now - conn->blocked_since;
+        }
+        g_array_append_val(array, stats);
+    }
+
+    return array;
+}
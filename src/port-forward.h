@@ -5,7 +5,9 @@
 #ifndef __PORT_FORWARD_H
 #define __PORT_FORWARD_H
 
-#include <glib.h>
+#include <spice/vd_agent.h>
+
+#include "spice-client.h"
 
 typedef struct PortForwarder PortForwarder;
 
@@ -16,7 +18,13 @@ typedef void (*port_forwarder_send_command_cb)(
     void *channel, guint32 command,
     const guint8 *data, guint32 data_size);
 
-PortForwarder *new_port_forwarder(void *channel, port_forwarder_send_command_cb cb);
+/*
+ * Callback to tell that data is waiting to be sent, see port_forwarder_pop_data().
+ */
+typedef void (*port_forwarder_data_ready_cb)(void *channel);
+
+PortForwarder *new_port_forwarder(void *channel, port_forwarder_send_command_cb cb,
+                                  port_forwarder_data_ready_cb ready_cb);
 
 void delete_port_forwarder(PortForwarder *pf);
 
@@ -28,6 +36,12 @@ void port_forwarder_agent_disconnected(PortForwarder *pf);
 gboolean port_forwarder_associate_remote(PortForwarder *pf, const gchar *bind_address,
                                          guint16 rport, const gchar *host, guint16 lport);
 
+/*
+ * Associate a remote port with a local Unix socket.
+ */
+gboolean port_forwarder_associate_remote_unix(PortForwarder *pf, const gchar *bind_address,
+                                              guint16 rport, const gchar *path);
+
 /*
  * Disassociate a remote port.
  */
@@ -39,14 +53,63 @@ gboolean port_forwarder_disassociate_remote(PortForwarder *pf, guint16 rport);
 gboolean port_forwarder_associate_local(PortForwarder *pf, const gchar *bind_address,
                                         guint16 lport, const gchar *host, guint16 rport);
 
+/*
+ * Associate a local Unix socket with a remote endpoint.
+ */
+gboolean port_forwarder_associate_local_unix(PortForwarder *pf, const gchar *path,
+                                             const gchar *host, guint16 rport);
+
+/*
+ * Forward a connected socket to a remote endpoint. The socket is closed
+ * with the connection.
+ */
+gboolean port_forwarder_connect_fd(PortForwarder *pf, gint fd,
+                                   const gchar *host, guint16 rport);
+
 /*
  * Disassociate a local port.
  */
 gboolean port_forwarder_disassociate_local(PortForwarder *pf, guint16 lport);
 
+/*
+ * Disassociate a local Unix socket, and remove it.
+ */
+gboolean port_forwarder_disassociate_local_unix(PortForwarder *pf, const gchar *path);
+
 /*
  * Handle a message received from the agent.
  */
 void port_forwarder_handle_message(PortForwarder *pf, guint32 command, gpointer msg);
 
+/*
+ * Get the next data message to send to the agent, in turns between the
+ * connections, with its command, or NULL. The message is made of the
+ * first head_size bytes of head, followed by the returned data, which
+ * is not copied from what was read. The data of the connections is not
+ * given to port_forwarder_send_command_cb, only the control messages.
+ */
+GBytes *port_forwarder_pop_data(PortForwarder *pf, guint32 *command,
+                                VDAgentPortForwardDataMessage *head, gsize *head_size);
+
+/*
+ * Get the number of data messages waiting to be sent.
+ */
+guint port_forwarder_get_queued(PortForwarder *pf);
+
+/*
+ * Get the sum of the weights of the connections with data to send, 0 if
+ * there is nothing to send.
+ */
+guint port_forwarder_get_weight(PortForwarder *pf);
+
+/*
+ * Set the share of the link of a connection, see SpicePortForwardStats.
+ */
+gboolean port_forwarder_set_weight(PortForwarder *pf, guint32 id, guint weight);
+
+/*
+ * Get the state of the open connections, as an array of SpicePortForwardStats.
+ */
+GArray *port_forwarder_get_stats(PortForwarder *pf);
+
 #endif /* __PORT_FORWARD_H */
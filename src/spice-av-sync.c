@@ -0,0 +1,149 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include "spice-av-sync.h"
+
+/* offsets within that many ms are left alone: the lip-sync errors below
+ * it can't be noticed */
+#define AV_SYNC_DEADBAND 15
+
+/* how the video is moved, and how often, in ms */
+#define AV_SYNC_VIDEO_STEP 5
+#define AV_SYNC_MAX_VIDEO_ADVANCE 40
+#define AV_SYNC_VIDEO_INTERVAL (G_USEC_PER_SEC / 2)
+
+/* how the audio is delayed, and how often, in ms: the audio backend
+ * takes a while to play at the new latency */
+#define AV_SYNC_AUDIO_STEP 10
+#define AV_SYNC_MAX_AUDIO_DELAY 200
+#define AV_SYNC_AUDIO_INTERVAL (3 * G_USEC_PER_SEC)
+
+/* the offset is averaged over that many frames at least before acting */
+#define AV_SYNC_MIN_SAMPLES 8
+/* weight of a new offset sample, as a shift */
+#define AV_SYNC_SMOOTH_SHIFT 3
+
+struct AVSync {
+    gboolean started;
+    /* how late the video is presented compared to the audio, in ms */
+    gint32 offset;
+    guint samples;
+
+    gint64 next_video_step;
+    gint64 next_audio_step;
+    guint32 video_advance;
+    guint32 audio_delay;
+};
+
+G_GNUC_INTERNAL
+AVSync *av_sync_new(void)
+{
+    return g_new0(AVSync, 1);
+}
+
+G_GNUC_INTERNAL
+void av_sync_free(AVSync *sync)
+{
+    g_free(sync);
+}
+
+/* The clocks jumped: measure afresh, keeping the corrections */
+G_GNUC_INTERNAL
+void av_sync_reset(AVSync *sync)
+{
+    sync->started = FALSE;
+    sync->samples = 0;
+}
+
+static gboolean av_sync_step(AVSync *sync, gint64 now)
+{
+    if (sync->offset > AV_SYNC_DEADBAND) {
+        /* the video is late: present it earlier, up to a point, then
+         * wait for it by delaying the audio */
+        if (sync->video_advance < AV_SYNC_MAX_VIDEO_ADVANCE) {
+            sync->video_advance = MIN(sync->video_advance + AV_SYNC_VIDEO_STEP,
+                                      AV_SYNC_MAX_VIDEO_ADVANCE);
+        } else if (sync->audio_delay < AV_SYNC_MAX_AUDIO_DELAY && now >= sync->next_audio_step) {
+            sync->audio_delay = MIN(sync->audio_delay + AV_SYNC_AUDIO_STEP,
+                                    AV_SYNC_MAX_AUDIO_DELAY);
+            sync->next_audio_step = now + AV_SYNC_AUDIO_INTERVAL;
+        } else {
+            return FALSE;
+        }
+    } else if (sync->offset < -AV_SYNC_DEADBAND) {
+        /* the video is early: give back the audio latency first */
+        if (sync->audio_delay > 0 && now >= sync->next_audio_step) {
+            sync->audio_delay -= MIN(sync->audio_delay, AV_SYNC_AUDIO_STEP);
+            sync->next_audio_step = now + AV_SYNC_AUDIO_INTERVAL;
+        } else if (sync->audio_delay == 0 && sync->video_advance > 0) {
+            sync->video_advance -= MIN(sync->video_advance, AV_SYNC_VIDEO_STEP);
+        } else {
+            return FALSE;
+        }
+    } else {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* A video frame was presented @offset ms after the audio played for the
+ * same time, or before if negative, at @now in us. Returns TRUE if the
+ * corrections changed. */
+G_GNUC_INTERNAL
+gboolean av_sync_add_offset(AVSync *sync, gint32 offset, gint64 now)
+{
+    if (!sync->started) {
+        sync->started = TRUE;
+        sync->offset = offset;
+        sync->next_video_step = now + AV_SYNC_VIDEO_INTERVAL;
+    } else {
+        sync->offset += (offset - sync->offset) / (1 << AV_SYNC_SMOOTH_SHIFT);
+    }
+    sync->samples++;
+
+    if (now < sync->next_video_step || sync->samples < AV_SYNC_MIN_SAMPLES) {
+        return FALSE;
+    }
+    sync->next_video_step = now + AV_SYNC_VIDEO_INTERVAL;
+
+    return av_sync_step(sync, now);
+}
+
+/* Returns FALSE if nothing was measured yet */
+G_GNUC_INTERNAL
+gboolean av_sync_get_offset(AVSync *sync, gint32 *offset)
+{
+    *offset = sync->offset;
+    return sync->started;
+}
+
+/* Returns how much earlier the video should be presented, in ms */
+G_GNUC_INTERNAL
+guint32 av_sync_get_video_advance(AVSync *sync)
+{
+    return sync->video_advance;
+}
+
+/* Returns how much the audio should be delayed, in ms */
+G_GNUC_INTERNAL
+guint32 av_sync_get_audio_delay(AVSync *sync)
+{
+    return sync->audio_delay;
+}
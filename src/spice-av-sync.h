@@ -0,0 +1,43 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIENT_AV_SYNC_H__
+#define __SPICE_CLIENT_AV_SYNC_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Audio/video synchronization controller: it follows how far behind the
+ * audio the video frames are presented, and corrects it in small steps,
+ * first by presenting the video a little earlier, then by delaying the
+ * audio. Like the stream controller it only works on the samples it is
+ * given. */
+typedef struct AVSync AVSync;
+
+AVSync *av_sync_new(void);
+void av_sync_free(AVSync *sync);
+void av_sync_reset(AVSync *sync);
+
+gboolean av_sync_add_offset(AVSync *sync, gint32 offset, gint64 now);
+gboolean av_sync_get_offset(AVSync *sync, gint32 *offset);
+guint32 av_sync_get_video_advance(AVSync *sync);
+guint32 av_sync_get_audio_delay(AVSync *sync);
+
+G_END_DECLS
+
+#endif /* __SPICE_CLIENT_AV_SYNC_H__ */
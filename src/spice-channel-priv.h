@@ -74,6 +74,8 @@ enum spice_channel_state {
     SPICE_CHANNEL_STATE_SWITCHING,
     SPICE_CHANNEL_STATE_MIGRATING,
     SPICE_CHANNEL_STATE_MIGRATION_HANDSHAKE,
+    /* lost to a network error, the session reconnects it */
+    SPICE_CHANNEL_STATE_RESUMING,
 };
 
 struct _SpiceChannelClassPrivate
@@ -175,6 +177,8 @@ void spice_channel_wakeup(SpiceChannel *channel, gboolean cancel);
 SpiceSession* spice_channel_get_session(SpiceChannel *channel);
 enum spice_channel_state spice_channel_get_state(SpiceChannel *channel);
 guint64 spice_channel_get_queue_size (SpiceChannel *channel);
+guint32 spice_channel_get_rtt(SpiceChannel *channel);
+guint64 spice_channel_get_pending_bytes(SpiceChannel *channel);
 
 /* coroutine context */
 typedef void (*handler_msg_in)(SpiceChannel *channel, SpiceMsgIn *msg, gpointer data);
@@ -190,6 +194,8 @@ gint spice_channel_get_channel_type(SpiceChannel *channel);
 void spice_channel_swap(SpiceChannel *channel, SpiceChannel *swap, gboolean swap_msgs);
 gboolean spice_channel_get_read_only(SpiceChannel *channel);
 void spice_channel_reset(SpiceChannel *channel, gboolean migrating);
+void spice_channel_resume(SpiceChannel *channel);
+void spice_channel_resume_failed(SpiceChannel *channel);
 
 void spice_caps_set(GArray *caps, guint32 cap, const gchar *desc);
 #define spice_channel_set_common_capability(channel, cap)               \
@@ -887,28 +887,39 @@ static void spice_channel_write(SpiceChannel *channel, const void *data, size_t
     spice_channel_flush_wire(channel, data, len);
 }
 
-/* coroutine context */
-static void spice_channel_write_msg(SpiceChannel *channel, SpiceMsgOut *out)
+/* coroutine context: sets the size in the header of @out, returns FALSE
+ * if it can't be sent */
+static gboolean spice_channel_prepare_msg(SpiceChannel *channel, SpiceMsgOut *out)
 {
-    uint8_t *data;
-    int free_data;
-    size_t len;
     uint32_t msg_size;
 
-    g_return_if_fail(channel != NULL);
-    g_return_if_fail(out != NULL);
-    g_return_if_fail(channel == out->channel);
+    g_return_val_if_fail(channel != NULL, FALSE);
+    g_return_val_if_fail(out != NULL, FALSE);
+    g_return_val_if_fail(channel == out->channel, FALSE);
 
     if (out->ro_check &&
         spice_channel_get_read_only(channel)) {
         g_warning("Try to send message while read-only. Please report a bug.");
-        return;
+        return FALSE;
     }
 
     spice_marshaller_flush(out->marshaller);
     msg_size = spice_marshaller_get_total_size(out->marshaller) -
                spice_header_get_header_size(channel->priv->use_mini_header);
     spice_header_set_msg_size(out->header, channel->priv->use_mini_header, msg_size);
+    return TRUE;
+}
+
+/* coroutine context */
+static void spice_channel_write_msg(SpiceChannel *channel, SpiceMsgOut *out)
+{
+    uint8_t *data;
+    int free_data;
+    size_t len;
+
+    if (!spice_channel_prepare_msg(channel, out))
+        return;
+
     data = spice_marshaller_linearize(out->marshaller, 0, &len, &free_data);
     /* spice_msg_out_hexdump(out, data, len); */
     spice_channel_write(channel, data, len);
@@ -919,6 +930,134 @@ static void spice_channel_write_msg(SpiceChannel *channel, SpiceMsgOut *out)
     spice_msg_out_unref(out);
 }
 
+#ifdef G_OS_UNIX
+/* The messages queued together are written with as few vectored writes
+ * as possible, straight from the data their marshallers reference: they
+ * don't go out in as many packets with TCP_NODELAY, and the payloads
+ * added by reference are not copied */
+#define WRITE_VEC_MAX 64
+
+typedef struct {
+    GOutputVector vec[WRITE_VEC_MAX];
+    guint n_vec;
+    GSList *msgs; /* the messages @vec points into */
+} SpiceWriteVec;
+
+/* coroutine context */
+static gboolean spice_channel_can_write_vec(SpiceChannel *channel)
+{
+    SpiceChannelPrivate *c = channel->priv;
+
+#ifdef HAVE_SASL
+    if (c->sasl_conn)
+        return FALSE;
+#endif
+    /* TLS and SASL encode a linear buffer */
+    if (c->tls || c->sock == NULL || c->conn == NULL)
+        return FALSE;
+
+    /* the vectors are written straight to @sock: only when the
+     * connection streams write to it as they are, not through a proxy
+     * which wraps them */
+    return !G_IS_TCP_WRAPPER_CONNECTION(c->conn) &&
+           g_socket_connection_get_socket(c->conn) == c->sock;
+}
+
+/*
+ * Write all the @n_vec vectors of @vec out to the wire, like
+ * spice_channel_flush_wire(). @vec is modified.
+ */
+/* coroutine context */
+static void spice_channel_flush_wire_vec(SpiceChannel *channel,
+                                         GOutputVector *vec,
+                                         guint n_vec)
+{
+    SpiceChannelPrivate *c = channel->priv;
+
+    while (n_vec > 0) {
+        GError *error = NULL;
+        gssize ret;
+
+        if (c->has_error) return;
+
+        ret = g_socket_send_message(c->sock, NULL, vec, n_vec,
+                                    NULL, 0, 0, NULL, &error);
+        if (ret < 0) {
+            if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)
+                || g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED)) {
+                g_clear_error(&error);
+                g_coroutine_socket_wait(&c->coroutine, c->sock, G_IO_OUT);
+                continue;
+            }
+            CHANNEL_DEBUG(channel, "Closing the channel: spice_channel_flush %s",
+                          error->message);
+            g_clear_error(&error);
+            c->has_error = TRUE;
+            return;
+        }
+        if (ret == 0) {
+            CHANNEL_DEBUG(channel, "Closing the connection: spice_channel_flush");
+            c->has_error = TRUE;
+            return;
+        }
+
+        /* skip what was written */
+        while (n_vec > 0 && (gsize)ret >= vec->size) {
+            ret -= vec->size;
+            vec++;
+            n_vec--;
+        }
+        if (n_vec > 0) {
+            vec->buffer = (const guint8 *)vec->buffer + ret;
+            vec->size -= ret;
+        }
+    }
+}
+
+/* coroutine context */
+static void spice_channel_write_vec_flush(SpiceChannel *channel, SpiceWriteVec *w)
+{
+    if (w->n_vec > 0)
+        spice_channel_flush_wire_vec(channel, w->vec, w->n_vec);
+    w->n_vec = 0;
+    g_slist_free_full(w->msgs, (GDestroyNotify)spice_msg_out_unref);
+    w->msgs = NULL;
+}
+
+/* coroutine context: adds the data of @out to @w, writing @w out whenever
+ * it is full. Takes the reference on @out */
+static void spice_channel_write_vec_append(SpiceChannel *channel, SpiceWriteVec *w,
+                                           SpiceMsgOut *out)
+{
+    struct iovec iov[WRITE_VEC_MAX];
+    size_t skip = 0, total;
+    int i, n;
+
+    if (!spice_channel_prepare_msg(channel, out))
+        return;
+
+    total = spice_marshaller_get_total_size(out->marshaller);
+    while (skip < total) {
+        if (w->n_vec == WRITE_VEC_MAX)
+            spice_channel_write_vec_flush(channel, w);
+        n = spice_marshaller_fill_iovec(out->marshaller, iov,
+                                        WRITE_VEC_MAX - w->n_vec, skip);
+        if (n <= 0) {
+            g_warn_if_reached();
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            w->vec[w->n_vec].buffer = iov[i].iov_base;
+            w->vec[w->n_vec].size = iov[i].iov_len;
+            w->n_vec++;
+            skip += iov[i].iov_len;
+        }
+    }
+    /* unreferenced once its last vectors are written */
+    w->msgs = g_slist_prepend(w->msgs, out);
+}
+#endif
+
 #ifdef G_OS_UNIX
 static ssize_t read_fd(int fd, int *msgfd)
 {
@@ -1278,6 +1417,7 @@ static gboolean spice_channel_recv_auth(SpiceChannel *channel)
     }
 
     c->state = SPICE_CHANNEL_STATE_READY;
+    spice_session_channel_ready(c->session, channel);
 
     g_coroutine_signal_emit(channel, signals[SPICE_CHANNEL_EVENT], 0, SPICE_CHANNEL_OPENED);
 
@@ -2313,6 +2453,10 @@ static void spice_channel_iterate_write(SpiceChannel *channel)
 {
     SpiceChannelPrivate *c = channel->priv;
     SpiceMsgOut *out;
+#ifdef G_OS_UNIX
+    SpiceWriteVec w = { .n_vec = 0, .msgs = NULL };
+    gboolean vectored = spice_channel_can_write_vec(channel);
+#endif
 
     do {
         g_mutex_lock(&c->xmit_queue_lock);
@@ -2321,10 +2465,20 @@ static void spice_channel_iterate_write(SpiceChannel *channel)
         if (out) {
             guint32 size = spice_marshaller_get_total_size(out->marshaller);
             c->xmit_queue_size = (c->xmit_queue_size < size) ? 0 : c->xmit_queue_size - size;
+#ifdef G_OS_UNIX
+            if (vectored) {
+                spice_channel_write_vec_append(channel, &w, out);
+                continue;
+            }
+#endif
             spice_channel_write_msg(channel, out);
         }
     } while (out);
 
+#ifdef G_OS_UNIX
+    spice_channel_write_vec_flush(channel, &w);
+#endif
+
     spice_channel_flushed(channel, TRUE);
 }
 
@@ -2442,6 +2596,18 @@ static gboolean spice_channel_delayed_unref(gpointer data)
     return FALSE;
 }
 
+/* like spice_channel_delayed_unref(), for a channel being resumed: it
+ * keeps its state and reports nothing */
+static gboolean spice_channel_delayed_resume(gpointer data)
+{
+    SpiceChannel *channel = SPICE_CHANNEL(data);
+
+    CHANNEL_DEBUG(channel, "Delayed unref resumed channel %p", channel);
+    g_object_unref(channel);
+
+    return FALSE;
+}
+
 static int spice_channel_load_ca(SpiceChannel *channel)
 {
     SpiceChannelPrivate *c = channel->priv;
@@ -2679,6 +2845,12 @@ cleanup:
         g_warn_if_fail(c->event == SPICE_CHANNEL_NONE);
         channel_connect(channel, c->tls);
         g_object_unref(channel);
+    } else if (c->session != NULL &&
+               spice_session_channel_lost(c->session, channel, c->event)) {
+        c->event = SPICE_CHANNEL_NONE;
+        g_clear_error(&c->error);
+        c->state = SPICE_CHANNEL_STATE_RESUMING;
+        g_idle_add(spice_channel_delayed_resume, data);
     } else
         g_idle_add(spice_channel_delayed_unref, data);
 
@@ -2867,6 +3039,47 @@ void spice_channel_reset(SpiceChannel *channel, gboolean migrating)
     SPICE_CHANNEL_GET_CLASS(channel)->channel_reset(channel, migrating);
 }
 
+/* main context: reconnects a channel lost to a network error */
+G_GNUC_INTERNAL
+void spice_channel_resume(SpiceChannel *channel)
+{
+    SpiceChannelPrivate *c = channel->priv;
+
+    g_return_if_fail(c->state == SPICE_CHANNEL_STATE_RESUMING);
+
+    channel_connect(channel, c->tls);
+}
+
+/* main context: the session gave up reconnecting the channel, report the
+ * error it was lost to */
+G_GNUC_INTERNAL
+void spice_channel_resume_failed(SpiceChannel *channel)
+{
+    SpiceChannelPrivate *c = channel->priv;
+
+    if (c->state == SPICE_CHANNEL_STATE_CONNECTING && c->coroutine.coroutine.exited) {
+        /* the coroutine didn't start: the socket of the application
+         * didn't come, or it is to connect in idle */
+        if (c->connect_delayed_id != 0) {
+            g_source_remove(c->connect_delayed_id);
+            c->connect_delayed_id = 0;
+            g_object_unref(channel);
+        }
+        c->state = SPICE_CHANNEL_STATE_RESUMING;
+    }
+
+    if (c->state != SPICE_CHANNEL_STATE_RESUMING &&
+        c->state != SPICE_CHANNEL_STATE_UNCONNECTED) {
+        /* still trying */
+        spice_channel_disconnect(channel, SPICE_CHANNEL_ERROR_IO);
+        return;
+    }
+
+    c->state = SPICE_CHANNEL_STATE_UNCONNECTED;
+    g_signal_emit(channel, signals[SPICE_CHANNEL_EVENT], 0, SPICE_CHANNEL_ERROR_IO);
+    g_signal_emit(channel, signals[SPICE_CHANNEL_EVENT], 0, SPICE_CHANNEL_CLOSED);
+}
+
 /**
  * spice_channel_disconnect:
  * @channel: a #SpiceChannel
@@ -2887,6 +3100,8 @@ void spice_channel_disconnect(SpiceChannel *channel, SpiceChannelEvent reason)
 
     c = channel->priv;
 
+    if (c->state == SPICE_CHANNEL_STATE_RESUMING)
+        c->state = SPICE_CHANNEL_STATE_UNCONNECTED;
     if (c->state == SPICE_CHANNEL_STATE_UNCONNECTED)
         return;
 
@@ -3032,6 +3247,36 @@ guint64 spice_channel_get_queue_size (SpiceChannel *channel)
     return size;
 }
 
+/* Returns the smoothed round trip time of the connection as measured by
+ * TCP, in ms, or 0 if it isn't known */
+G_GNUC_INTERNAL
+guint32 spice_channel_get_rtt(SpiceChannel *channel)
+{
+#ifdef TCP_INFO
+    GSocket *sock = channel->priv->sock;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (sock == NULL || g_socket_get_family(sock) == G_SOCKET_FAMILY_UNIX)
+        return 0;
+
+    if (getsockopt(g_socket_get_fd(sock), IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+        return info.tcpi_rtt / 1000;
+#endif
+    return 0;
+}
+
+/* Returns the number of bytes received on the socket of the channel and
+ * not read yet */
+G_GNUC_INTERNAL
+guint64 spice_channel_get_pending_bytes(SpiceChannel *channel)
+{
+    GSocket *sock = channel->priv->sock;
+    gssize available = sock != NULL ? g_socket_get_available_bytes(sock) : -1;
+
+    return MAX(available, 0);
+}
+
 G_GNUC_INTERNAL
 void spice_channel_swap(SpiceChannel *channel, SpiceChannel *swap, gboolean swap_msgs)
 {
@@ -29,6 +29,18 @@
 
 G_BEGIN_DECLS
 
+/* how many chunks a transfer may read ahead of the agent, at most, and
+ * unless SPICE_FILE_XFER_CHUNKS says otherwise */
+#define FILE_XFER_MAX_CHUNKS 4
+#define FILE_XFER_DEFAULT_CHUNKS 2
+
+/* the place of a sender of agent data in the weighted round robin of the
+ * file transfers, see spice_file_transfer_turns_next() */
+typedef struct SpiceFileTransferTurn {
+    guint       credit;
+    gboolean    scheduled;
+} SpiceFileTransferTurn;
+
 void spice_file_transfer_task_completed(SpiceFileTransferTask *self, GError *error);
 guint32 spice_file_transfer_task_get_id(SpiceFileTransferTask *self);
 SpiceMainChannel *spice_file_transfer_task_get_channel(SpiceFileTransferTask *self);
@@ -51,6 +63,16 @@ gssize spice_file_transfer_task_read_finish(SpiceFileTransferTask *self,
                                             char **buffer,
                                             GError **error);
 gboolean spice_file_transfer_task_is_completed(SpiceFileTransferTask *self);
+void spice_file_transfer_task_set_max_chunks(SpiceFileTransferTask *self,
+                                             guint max_chunks);
+void spice_file_transfer_task_release_chunk(SpiceFileTransferTask *self);
+gboolean spice_file_transfer_task_can_read(SpiceFileTransferTask *self);
+guint spice_file_transfer_task_get_weight(SpiceFileTransferTask *self);
+
+void spice_file_transfer_turns_schedule(GQueue *turns, SpiceFileTransferTurn *turn);
+void spice_file_transfer_turns_unschedule(GQueue *turns, SpiceFileTransferTurn *turn);
+void spice_file_transfer_turns_next(GQueue *turns, guint weight,
+                                    gboolean sent, gboolean more);
 
 G_END_DECLS
 
@@ -51,7 +51,14 @@ struct _SpiceFileTransferTask
     GCancellable                   *cancellable;
     GAsyncReadyCallback            callback;
     gpointer                       user_data;
-    char                           *buffer;
+    /* ring of chunk buffers: a chunk read may still be queued to the agent
+     * while the next ones are read into the other buffers */
+    char                           *buffers[FILE_XFER_MAX_CHUNKS];
+    guint                          max_chunks;
+    guint                          next_buffer;
+    guint                          read_buffer;
+    guint                          held_chunks;
+    guint                          weight;
     uint64_t                       read_bytes;
     uint64_t                       file_size;
     gint64                         start_time;
@@ -76,6 +83,7 @@ enum {
     PROP_TASK_TOTAL_BYTES,
     PROP_TASK_TRANSFERRED_BYTES,
     PROP_TASK_PROGRESS,
+    PROP_TASK_WEIGHT,
 };
 
 enum {
@@ -448,9 +456,16 @@ void spice_file_transfer_task_read_async(SpiceFileTransferTask *self,
         return;
     }
 
+    /* the other buffers are only allocated once needed */
+    self->read_buffer = self->next_buffer;
+    self->next_buffer = (self->next_buffer + 1) % self->max_chunks;
+    if (self->buffers[self->read_buffer] == NULL) {
+        self->buffers[self->read_buffer] = g_malloc0(FILE_XFER_CHUNK_SIZE);
+    }
+
     self->pending = TRUE;
     g_input_stream_read_async(G_INPUT_STREAM(self->file_stream),
-                              self->buffer,
+                              self->buffers[self->read_buffer],
                               FILE_XFER_CHUNK_SIZE,
                               G_PRIORITY_DEFAULT,
                               self->cancellable,
@@ -470,12 +485,57 @@ gssize spice_file_transfer_task_read_finish(SpiceFileTransferTask *self,
     g_return_val_if_fail(self != NULL, -1);
 
     nbytes = g_task_propagate_int(task, error);
+    if (nbytes > 0)
+        self->held_chunks++;
     if (nbytes >= 0 && buffer != NULL)
-        *buffer = self->buffer;
+        *buffer = self->buffers[self->read_buffer];
 
     return nbytes;
 }
 
+/* Sets how many chunks may be read ahead of the agent: with more than one,
+ * the next chunk is read into another buffer while the previous ones are
+ * still being sent. Must be called before the first read. */
+G_GNUC_INTERNAL
+void spice_file_transfer_task_set_max_chunks(SpiceFileTransferTask *self,
+                                             guint max_chunks)
+{
+    g_return_if_fail(self != NULL);
+    g_return_if_fail(self->read_bytes == 0 && !self->pending);
+
+    self->max_chunks = CLAMP(max_chunks, 1, FILE_XFER_MAX_CHUNKS);
+    self->next_buffer = 0;
+}
+
+/* The data of the oldest chunk returned by read_finish() was sent, its
+ * buffer can be read into again */
+G_GNUC_INTERNAL
+void spice_file_transfer_task_release_chunk(SpiceFileTransferTask *self)
+{
+    g_return_if_fail(self != NULL);
+    g_return_if_fail(self->held_chunks > 0);
+
+    self->held_chunks--;
+}
+
+G_GNUC_INTERNAL
+guint spice_file_transfer_task_get_weight(SpiceFileTransferTask *self)
+{
+    g_return_val_if_fail(self != NULL, 1);
+    return self->weight;
+}
+
+/* Whether the next chunk can be read right away: no read is in progress
+ * and there is a buffer free for it */
+G_GNUC_INTERNAL
+gboolean spice_file_transfer_task_can_read(SpiceFileTransferTask *self)
+{
+    g_return_val_if_fail(self != NULL, FALSE);
+
+    return !self->completed && !self->pending &&
+        self->held_chunks < self->max_chunks;
+}
+
 G_GNUC_INTERNAL
 gboolean spice_file_transfer_task_is_completed(SpiceFileTransferTask *self)
 {
@@ -486,6 +546,53 @@ gboolean spice_file_transfer_task_is_completed(SpiceFileTransferTask *self)
     return self->completed;
 }
 
+/* Queues @turn at the end of @turns, unless it already waits there */
+G_GNUC_INTERNAL
+void spice_file_transfer_turns_schedule(GQueue *turns, SpiceFileTransferTurn *turn)
+{
+    if (!turn->scheduled) {
+        g_queue_push_tail(turns, turn);
+        turn->scheduled = TRUE;
+    }
+}
+
+G_GNUC_INTERNAL
+void spice_file_transfer_turns_unschedule(GQueue *turns, SpiceFileTransferTurn *turn)
+{
+    if (turn->scheduled) {
+        g_queue_remove(turns, turn);
+        turn->scheduled = FALSE;
+    }
+    turn->credit = 0;
+}
+
+/* Accounts for a message picked from the turn at the head of @turns,
+ * which has @weight: the head sends up to @weight messages in a row, then
+ * goes back to the end of the queue, or leaves it once it has no @more
+ * data. */
+G_GNUC_INTERNAL
+void spice_file_transfer_turns_next(GQueue *turns, guint weight,
+                                    gboolean sent, gboolean more)
+{
+    SpiceFileTransferTurn *turn = g_queue_peek_head(turns);
+
+    g_return_if_fail(turn != NULL);
+
+    if (turn->credit == 0) {
+        turn->credit = MAX(weight, 1);
+    }
+    if (sent) {
+        turn->credit--;
+    }
+    if (!more) {
+        g_queue_pop_head(turns);
+        turn->scheduled = FALSE;
+        turn->credit = 0;
+    } else if (turn->credit == 0) {
+        g_queue_push_tail(turns, g_queue_pop_head(turns));
+    }
+}
+
 /*******************************************************************************
  * External API
  ******************************************************************************/
@@ -608,6 +715,9 @@ spice_file_transfer_task_get_property(GObject *object,
         case PROP_TASK_PROGRESS:
             g_value_set_double(value, spice_file_transfer_task_get_progress(self));
             break;
+        case PROP_TASK_WEIGHT:
+            g_value_set_uint(value, self->weight);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
     }
@@ -635,6 +745,9 @@ spice_file_transfer_task_set_property(GObject *object,
         case PROP_TASK_CANCELLABLE:
             self->cancellable = g_value_dup_object(value);
             break;
+        case PROP_TASK_WEIGHT:
+            self->weight = g_value_get_uint(value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
     }
@@ -656,8 +769,11 @@ static void
 spice_file_transfer_task_finalize(GObject *object)
 {
     SpiceFileTransferTask *self = SPICE_FILE_TRANSFER_TASK(object);
+    guint i;
 
-    g_free(self->buffer);
+    for (i = 0; i < FILE_XFER_MAX_CHUNKS; i++) {
+        g_free(self->buffers[i]);
+    }
 
     G_OBJECT_CLASS(spice_file_transfer_task_parent_class)->finalize(object);
 }
@@ -797,6 +913,23 @@ spice_file_transfer_task_class_init(SpiceFileTransferTaskClass *klass)
                                                         G_PARAM_READABLE |
                                                         G_PARAM_STATIC_STRINGS));
 
+    /**
+     * SpiceFileTransferTask:weight:
+     *
+     * The share of the link this transfer gets when several files are
+     * transferred at the same time: the transfers take turns to send their
+     * data, each one sending up to its weight in chunks in a row.
+     *
+     * Since: 0.36
+     **/
+    g_object_class_install_property(object_class, PROP_TASK_WEIGHT,
+                                    g_param_spec_uint("weight",
+                                                      "Weight",
+                                                      "The share of the link of the transfer",
+                                                      1, 16, 1,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
     /**
      * SpiceFileTransferTask::finished:
      * @task: the file transfer task that emitted the signal
@@ -819,5 +952,7 @@ spice_file_transfer_task_class_init(SpiceFileTransferTaskClass *klass)
 static void
 spice_file_transfer_task_init(SpiceFileTransferTask *self)
 {
-    self->buffer = g_malloc0(FILE_XFER_CHUNK_SIZE);
+    self->buffers[0] = g_malloc0(FILE_XFER_CHUNK_SIZE);
+    self->max_chunks = 1;
+    self->weight = 1;
 }
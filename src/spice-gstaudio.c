@@ -26,6 +26,8 @@
 #include "spice-common.h"
 #include "spice-session.h"
 #include "spice-util.h"
+#include "channel-playback-priv.h"
+#include "channel-record-priv.h"
 
 struct stream {
     GstElement              *pipe;
@@ -34,6 +36,10 @@ struct stream {
     guint                   rate;
     guint                   channels;
     gboolean                fake; /* fake channel just for getting info about audio (volume) */
+    /* playback buffers, and the one being written */
+    GstBufferPool           *pool;
+    gsize                   pool_size;
+    GstMapInfo              map;
 };
 
 struct _SpiceGstaudioPrivate {
@@ -42,11 +48,14 @@ struct _SpiceGstaudioPrivate {
     struct stream           playback;
     struct stream           record;
     guint                   mmtime_id;
+    SpicePlaybackSink       playback_sink;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(SpiceGstaudio, spice_gstaudio, SPICE_TYPE_AUDIO)
 
 static gboolean connect_channel(SpiceAudio *audio, SpiceChannel *channel);
+static gpointer playback_begin_write(SpicePlaybackSink *sink, gsize size, guint8 **data);
+static void playback_write(SpicePlaybackSink *sink, gpointer buffer, gsize size);
 static void channel_weak_notified(gpointer data, GObject *where_the_object_was);
 static void spice_gstaudio_get_playback_volume_info_async(SpiceAudio *audio,
         GCancellable *cancellable, SpiceMainChannel *main_channel,
@@ -73,6 +82,11 @@ static void stream_dispose(struct stream *s)
 
     g_clear_pointer(&s->src, gst_object_unref);
     g_clear_pointer(&s->sink, gst_object_unref);
+
+    if (s->pool) {
+        gst_buffer_pool_set_active(s->pool, FALSE);
+        g_clear_pointer(&s->pool, gst_object_unref);
+    }
 }
 
 static void spice_gstaudio_dispose(GObject *obj)
@@ -82,6 +96,10 @@ static void spice_gstaudio_dispose(GObject *obj)
     SPICE_DEBUG("%s", __FUNCTION__);
     p = gstaudio->priv;
 
+    /* stops the decoding thread before the pipeline goes away */
+    if (p->pchannel)
+        spice_playback_channel_set_sink(SPICE_PLAYBACK_CHANNEL(p->pchannel), NULL);
+
     stream_dispose(&p->playback);
     stream_dispose(&p->record);
 
@@ -100,6 +118,9 @@ static void spice_gstaudio_dispose(GObject *obj)
 static void spice_gstaudio_init(SpiceGstaudio *gstaudio)
 {
     gstaudio->priv = spice_gstaudio_get_instance_private(gstaudio);
+    gstaudio->priv->playback_sink.thread_safe = TRUE;
+    gstaudio->priv->playback_sink.begin_write = playback_begin_write;
+    gstaudio->priv->playback_sink.write = playback_write;
 }
 
 static void spice_gstaudio_class_init(SpiceGstaudioClass *klass)
@@ -131,6 +152,23 @@ static GstFlowReturn record_new_buffer(GstAppSink *appsink, gpointer data)
     return GST_FLOW_OK;
 }
 
+/* Asks the audio source picked by autoaudiosrc to capture by fragments of
+ * the length the channel wants */
+static void record_src_added(GstBin *bin, GstElement *element, gpointer data)
+{
+    SpiceGstaudio *gstaudio = data;
+    SpiceGstaudioPrivate *p = gstaudio->priv;
+    guint fragment;
+
+    if (p->rchannel == NULL ||
+        g_object_class_find_property(G_OBJECT_GET_CLASS(element), "latency-time") == NULL)
+        return;
+
+    fragment = spice_record_channel_get_fragment(SPICE_RECORD_CHANNEL(p->rchannel));
+    SPICE_DEBUG("record fragment of %u ms", fragment);
+    g_object_set(element, "latency-time", (gint64)fragment * 1000, NULL);
+}
+
 static void record_stop(SpiceGstaudio *gstaudio)
 {
     SpiceGstaudioPrivate *p = gstaudio->priv;
@@ -228,6 +266,10 @@ static void record_start(SpiceRecordChannel *channel, gint format, gint channels
         p->record.rate = frequency;
         p->record.channels = channels;
 
+        if (GST_IS_BIN(p->record.src))
+            spice_g_signal_connect_object(p->record.src, "element-added",
+                                          G_CALLBACK(record_src_added), gstaudio, 0);
+
         gst_app_sink_set_emit_signals(GST_APP_SINK(p->record.sink), TRUE);
         spice_g_signal_connect_object(p->record.sink, "new-sample",
                                       G_CALLBACK(record_new_buffer), gstaudio, 0);
@@ -292,7 +334,7 @@ static void playback_start(SpicePlaybackChannel *channel, gint format, gint chan
         (p->playback.rate != frequency ||
          p->playback.channels != channels)) {
         playback_stop(gstaudio);
-        g_clear_pointer(&p->playback.pipe, gst_object_unref);
+        stream_dispose(&p->playback);
     }
 
     if (!p->playback.pipe) {
@@ -315,6 +357,16 @@ static void playback_start(SpicePlaybackChannel *channel, gint format, gint chan
         p->playback.rate = frequency;
         p->playback.channels = channels;
 
+        /* 20ms of audio, the longest packets */
+        p->playback.pool = gst_buffer_pool_new();
+        p->playback.pool_size = frequency * channels * 2 / 50;
+        GstStructure *config = gst_buffer_pool_get_config(p->playback.pool);
+        gst_buffer_pool_config_set_params(config, NULL, p->playback.pool_size, 4, 0);
+        if (!gst_buffer_pool_set_config(p->playback.pool, config) ||
+            !gst_buffer_pool_set_active(p->playback.pool, TRUE)) {
+            g_clear_pointer(&p->playback.pool, gst_object_unref);
+        }
+
 cleanup:
         if (error != NULL)
             g_clear_pointer(&p->playback.pipe, gst_object_unref);
@@ -332,19 +384,43 @@ cleanup:
     }
 }
 
-static void playback_data(SpicePlaybackChannel *channel,
-                          gpointer *audio, gint size,
-                          gpointer data)
+/* The playback channel decodes the audio straight into pooled buffers,
+ * from its decoding thread: appsrc can be pushed to from any thread. */
+static gpointer playback_begin_write(SpicePlaybackSink *sink, gsize size, guint8 **data)
 {
-    SpiceGstaudio *gstaudio = data;
-    SpiceGstaudioPrivate *p = gstaudio->priv;
-    GstBuffer *buf;
+    SpiceGstaudioPrivate *p = SPICE_CONTAINEROF(sink, SpiceGstaudioPrivate, playback_sink);
+    GstBuffer *buffer = NULL;
 
-    g_return_if_fail(p != NULL);
+    if (p->playback.src == NULL)
+        return NULL;
+
+    if (p->playback.pool != NULL && size <= p->playback.pool_size)
+        gst_buffer_pool_acquire_buffer(p->playback.pool, &buffer, NULL);
+    if (buffer == NULL)
+        buffer = gst_buffer_new_allocate(NULL, size, NULL);
+
+    if (!gst_buffer_map(buffer, &p->playback.map, GST_MAP_WRITE)) {
+        gst_buffer_unref(buffer);
+        return NULL;
+    }
+
+    *data = p->playback.map.data;
+    return buffer;
+}
+
+static void playback_write(SpicePlaybackSink *sink, gpointer data, gsize size)
+{
+    SpiceGstaudioPrivate *p = SPICE_CONTAINEROF(sink, SpiceGstaudioPrivate, playback_sink);
+    GstBuffer *buffer = data;
+
+    gst_buffer_unmap(buffer, &p->playback.map);
+    if (size == 0) {
+        gst_buffer_unref(buffer);
+        return;
+    }
 
-    audio = g_memdup(audio, size); /* TODO: try to avoid memory copy */
-    buf = gst_buffer_new_wrapped(audio, size);
-    gst_app_src_push_buffer(GST_APP_SRC(p->playback.src), buf);
+    gst_buffer_set_size(buffer, size);
+    gst_app_src_push_buffer(GST_APP_SRC(p->playback.src), buffer);
 }
 
 #define VOLUME_NORMAL 65535
@@ -499,8 +575,7 @@ static gboolean connect_channel(SpiceAudio *audio, SpiceChannel *channel)
         g_object_weak_ref(G_OBJECT(p->pchannel), channel_weak_notified, audio);
         spice_g_signal_connect_object(channel, "playback-start",
                                       G_CALLBACK(playback_start), gstaudio, 0);
-        spice_g_signal_connect_object(channel, "playback-data",
-                                      G_CALLBACK(playback_data), gstaudio, 0);
+        spice_playback_channel_set_sink(SPICE_PLAYBACK_CHANNEL(channel), &p->playback_sink);
         spice_g_signal_connect_object(channel, "playback-stop",
                                       G_CALLBACK(playback_stop), gstaudio, G_CONNECT_SWAPPED);
         spice_g_signal_connect_object(channel, "notify::volume",
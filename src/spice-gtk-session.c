@@ -664,39 +664,61 @@ typedef struct
     GtkSelectionData *selection_data;
     guint info;
     guint selection;
+    GString *data;
+    gboolean crlf;
+    gboolean cr;
 } RunInfo;
 
+/* the data comes in pieces, converted as they arrive, so that a large
+ * clipboard is neither held twice nor converted in one go */
 static void clipboard_got_from_guest(SpiceMainChannel *main, guint selection,
                                      guint type, const guchar *data, guint size,
+                                     guint offset, guint total,
                                      gpointer user_data)
 {
     RunInfo *ri = user_data;
     SpiceGtkSessionPrivate *s = ri->self->priv;
-    gchar *conv = NULL;
+    gboolean text = atom2agent[ri->info].vdagent == VD_AGENT_CLIPBOARD_UTF8_TEXT;
 
     g_return_if_fail(selection == ri->selection);
 
-    SPICE_DEBUG("clipboard got data");
-
-    if (atom2agent[ri->info].vdagent == VD_AGENT_CLIPBOARD_UTF8_TEXT) {
+    if (ri->data == NULL) {
+        ri->data = g_string_sized_new(total + 1);
         /* on windows, gtk+ would already convert to LF endings, but
            not on unix */
-        if (spice_main_channel_agent_test_capability(s->main, VD_AGENT_CAP_GUEST_LINEEND_CRLF)) {
-            conv = spice_dos2unix((gchar*)data, size);
-            size = strlen(conv);
-        }
+        ri->crlf = text &&
+            spice_main_channel_agent_test_capability(s->main, VD_AGENT_CAP_GUEST_LINEEND_CRLF);
+    }
+    g_return_if_fail(offset == ri->data->len || ri->crlf);
+
+    if (ri->crlf) {
+        spice_dos2unix_chunk((const gchar *)data, size, &ri->cr, ri->data);
+    } else {
+        g_string_append_len(ri->data, (const gchar *)data, size);
+    }
+    if (offset + size < total)
+        return;
+
+    SPICE_DEBUG("clipboard got data");
+
+    if (text) {
+        gsize len = ri->data->len;
 
-        gtk_selection_data_set_text(ri->selection_data, conv ?: (gchar*)data, size);
+        if (ri->crlf) {
+            spice_dos2unix_chunk(NULL, 0, &ri->cr, ri->data);
+            len = strlen(ri->data->str);
+        }
+        gtk_selection_data_set_text(ri->selection_data, ri->data->str, len);
     } else {
         gtk_selection_data_set(ri->selection_data,
             gdk_atom_intern_static_string(atom2agent[ri->info].xatom),
-            8, data, size);
+            8, (const guchar *)ri->data->str, ri->data->len);
     }
+    g_string_free(ri->data, TRUE);
+    ri->data = NULL;
 
     if (g_main_loop_is_running (ri->loop))
         g_main_loop_quit (ri->loop);
-
-    g_free(conv);
 }
 
 static void clipboard_agent_connected(RunInfo *ri)
@@ -734,7 +756,7 @@ static void clipboard_get(GtkClipboard *clipboard,
     ri.selection = selection;
     ri.self = self;
 
-    clipboard_handler = g_signal_connect(s->main, "main-clipboard-selection",
+    clipboard_handler = g_signal_connect(s->main, "main-clipboard-selection-data",
                                          G_CALLBACK(clipboard_got_from_guest),
                                          &ri);
     agent_handler = g_signal_connect_swapped(s->main, "notify::agent-connected",
@@ -763,6 +785,8 @@ static void clipboard_get(GtkClipboard *clipboard,
 
 cleanup:
     g_clear_pointer(&ri.loop, g_main_loop_unref);
+    if (ri.data)
+        g_string_free(ri.data, TRUE);
     g_signal_handler_disconnect(s->main, clipboard_handler);
     g_signal_handler_disconnect(s->main, agent_handler);
 }
@@ -851,43 +875,14 @@ static gboolean check_clipboard_size_limits(SpiceGtkSession *session,
     return TRUE;
 }
 
-/* This will convert line endings if needed (between Windows/Unix conventions),
- * and will make sure 'len' does not take into account any trailing \0 as this could
- * cause some confusion guest side.
- * The 'len' argument will be modified by this function to the length of the modified
- * string
- */
-static char *fixup_clipboard_text(SpiceGtkSession *self, const char *text, int *len)
-{
-    char *conv = NULL;
-
-    if (spice_main_channel_agent_test_capability(self->priv->main,
-                                                 VD_AGENT_CAP_GUEST_LINEEND_CRLF)) {
-        conv = spice_unix2dos(text, *len);
-        *len = strlen(conv);
-    } else {
-        /* On Windows, with some versions of gtk+, GtkSelectionData::length
-         * will include the final '\0'. When a string with this trailing '\0'
-         * is pasted in some linux applications, it will be pasted as <NIL> or
-         * as an invisible character, which is unwanted. Ensure the length we
-         * send to the agent does not include any trailing '\0'
-         * This is gtk+ bug https://bugzilla.gnome.org/show_bug.cgi?id=734670
-         */
-        *len = strlen(text);
-    }
-
-    return conv;
-}
-
 static void clipboard_received_text_cb(GtkClipboard *clipboard,
                                        const gchar *text,
                                        gpointer user_data)
 {
     SpiceGtkSession *self = free_weak_ref(user_data);
-    char *conv = NULL;
+    GBytes *bytes;
     int len = 0;
     int selection;
-    const guchar *data = NULL;
 
     if (self == NULL)
         return;
@@ -902,26 +897,26 @@ static void clipboard_received_text_cb(GtkClipboard *clipboard,
 
     g_return_if_fail(SPICE_IS_GTK_SESSION(self));
 
+    /* On Windows, with some versions of gtk+, GtkSelectionData::length
+     * will include the final '\0'. When a string with this trailing '\0'
+     * is pasted in some linux applications, it will be pasted as <NIL> or
+     * as an invisible character, which is unwanted. Ensure the length we
+     * send to the agent does not include any trailing '\0'
+     * This is gtk+ bug https://bugzilla.gnome.org/show_bug.cgi?id=734670
+     */
     len = strlen(text);
     if (!check_clipboard_size_limits(self, len)) {
         SPICE_DEBUG("Failed size limits of clipboard text (%d bytes)", len);
-        goto notify_agent;
-    }
-
-    /* gtk+ internal utf8 newline is always LF, even on windows */
-    conv = fixup_clipboard_text(self, text, &len);
-    if (!check_clipboard_size_limits(self, len)) {
-        SPICE_DEBUG("Failed size limits of clipboard text (%d bytes)", len);
-        goto notify_agent;
+        len = 0;
     }
 
-    data = (const guchar *) (conv != NULL ? conv : text);
 notify_agent:
-    spice_main_channel_clipboard_selection_notify(self->priv->main, selection,
-                                                  VD_AGENT_CLIPBOARD_UTF8_TEXT,
-                                                  data,
-                                                  (data != NULL) ? len : 0);
-    g_free(conv);
+    /* gtk+ internal utf8 newline is always LF, even on windows: the
+     * channel converts it for the guest as it sends it, and checks the
+     * size limit once converted */
+    bytes = g_bytes_new(text, len);
+    spice_main_channel_clipboard_selection_notify_text(self->priv->main, selection, bytes);
+    g_bytes_unref(bytes);
 }
 
 static void clipboard_received_cb(GtkClipboard *clipboard,
@@ -36,6 +36,8 @@ static char *usbredir_redirect_on_connect = NULL;
 static gboolean smartcard = FALSE;
 static gboolean disable_audio = FALSE;
 static gboolean disable_usbredir = FALSE;
+static gboolean low_latency_video = FALSE;
+static gint resume_timeout = 0;
 static gint cache_size = 0;
 static gint glz_window_size = 0;
 static gchar *secure_channels = NULL;
@@ -231,6 +233,10 @@ GOptionGroup* spice_get_option_group(void)
 #else
           "<auto-glz,auto-lz,quic,glz,lz,off>" },
 #endif
+        { "spice-low-latency-video", '\0', 0, G_OPTION_ARG_NONE, &low_latency_video,
+          N_("Show video frames as soon as they are decoded"), NULL },
+        { "spice-resume-timeout", '\0', 0, G_OPTION_ARG_INT, &resume_timeout,
+          N_("How long to try to reconnect after a network error"), N_("<seconds>") },
 
         { "spice-debug", '\0', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, option_debug,
           N_("Enable Spice-GTK debugging"), NULL },
@@ -320,4 +326,8 @@ void spice_set_session_option(SpiceSession *session)
         g_object_set(session, "shared-dir", shared_dir, NULL);
     if (preferred_compression != SPICE_IMAGE_COMPRESSION_INVALID)
         g_object_set(session, "preferred-compression", preferred_compression, NULL);
+    if (low_latency_video)
+        g_object_set(session, "low-latency-video", TRUE, NULL);
+    if (resume_timeout > 0)
+        g_object_set(session, "resume-timeout", (guint)resume_timeout, NULL);
 }
@@ -22,6 +22,8 @@
 #include "spice-session-priv.h"
 #include "spice-channel-priv.h"
 #include "spice-util-priv.h"
+#include "channel-playback-priv.h"
+#include "channel-record-priv.h"
 
 #include <pulse/glib-mainloop.h>
 #include <pulse/pulseaudio.h>
@@ -64,6 +66,9 @@ struct _SpicePulsePrivate {
     guint                   target_delay;
     struct async_task       *pending_restore_task;
     GList                   *results;
+    SpicePlaybackSink       playback_sink;
+    /* whether the buffer being written comes from pa_stream_begin_write() */
+    gboolean                playback_pa_buffer;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(SpicePulse, spice_pulse, SPICE_TYPE_AUDIO)
@@ -89,6 +94,8 @@ static const char *context_state_names[] = {
     ((state < G_N_ELEMENTS(array)) ? array[state] : NULL)
 
 static void stream_stop(SpicePulse *pulse, struct stream *s);
+static gpointer playback_begin_write(SpicePlaybackSink *sink, gsize size, guint8 **data);
+static void playback_write(SpicePlaybackSink *sink, gpointer buffer, gsize size);
 static gboolean connect_channel(SpiceAudio *audio, SpiceChannel *channel);
 static void channel_weak_notified(gpointer data, GObject *where_the_object_was);
 static void spice_pulse_get_playback_volume_info_async(SpiceAudio *audio, GCancellable *cancellable,
@@ -139,8 +146,10 @@ static void spice_pulse_dispose(GObject *obj)
     g_clear_pointer(&p->playback.name, g_free);
     g_clear_pointer(&p->record.name, g_free);
 
-    if (p->pchannel)
+    if (p->pchannel) {
+        spice_playback_channel_set_sink(SPICE_PLAYBACK_CHANNEL(p->pchannel), NULL);
         g_object_weak_unref(G_OBJECT(p->pchannel), channel_weak_notified, pulse);
+    }
     p->pchannel = NULL;
 
     if (p->rchannel)
@@ -153,6 +162,9 @@ static void spice_pulse_dispose(GObject *obj)
 static void spice_pulse_init(SpicePulse *pulse)
 {
     pulse->priv = spice_pulse_get_instance_private(pulse);
+    pulse->priv->playback_sink.thread_safe = FALSE;
+    pulse->priv->playback_sink.begin_write = playback_begin_write;
+    pulse->priv->playback_sink.write = playback_write;
 }
 
 static void spice_pulse_class_init(SpicePulseClass *klass)
@@ -301,6 +313,8 @@ static void stream_underflow_cb(pa_stream *s, void *userdata)
     p = pulse->priv;
     g_return_if_fail(p != NULL);
     p->playback.num_underflow++;
+    if (p->pchannel != NULL)
+        spice_playback_channel_add_underrun(SPICE_PLAYBACK_CHANNEL(p->pchannel));
 #ifdef PULSE_ADJUST_LATENCY
     const pa_buffer_attr *buffer_attr;
     pa_buffer_attr new_buffer_attr;
@@ -430,39 +444,75 @@ static void playback_start(SpicePlaybackChannel *channel, gint format, gint chan
     p->state = state;
 }
 
-static void playback_data(SpicePlaybackChannel *channel,
-                          gpointer *audio, gint size,
-                          gpointer data)
+/* The playback channel decodes the audio straight into the stream buffers.
+ * The PulseAudio GLib main loop isn't thread safe, so this happens in
+ * the main context. */
+static gpointer playback_begin_write(SpicePlaybackSink *sink, gsize size, guint8 **data)
 {
-    SpicePulse *pulse = data;
-    SpicePulsePrivate *p = pulse->priv;
+    SpicePulsePrivate *p = SPICE_CONTAINEROF(sink, SpicePulsePrivate, playback_sink);
     pa_stream_state_t state;
+    void *buffer = NULL;
+    size_t nbytes = size;
 
     if (!p->playback.stream)
-        return;
+        return NULL;
 
     state = pa_stream_get_state(p->playback.stream);
     switch (state) {
     case PA_STREAM_CREATING:
         SPICE_DEBUG("stream creating, dropping data");
-        break;
+        p->playback.state = state;
+        return NULL;
     case PA_STREAM_READY:
         if (p->playback.state != state) {
             SPICE_DEBUG("%s: pulse playback stream ready", __FUNCTION__);
         }
-        if (pa_stream_write(p->playback.stream, audio, size, NULL, 0, PA_SEEK_RELATIVE) < 0) {
-            g_warning("pa_stream_write() failed: %s",
-                      pa_strerror(pa_context_errno(p->context)));
-        }
+        p->playback.state = state;
         break;
     default:
         if (p->playback.state != state) {
             SPICE_DEBUG("%s: pulse playback stream not ready (%s)",
                         __FUNCTION__, STATE_NAME(stream_state_names, state));
         }
-        break;
+        p->playback.state = state;
+        return NULL;
+    }
+
+    if (pa_stream_begin_write(p->playback.stream, &buffer, &nbytes) < 0 ||
+        buffer == NULL || nbytes < size) {
+        /* the stream can't offer that much in one go, hand it a buffer
+         * it will take over */
+        if (buffer != NULL)
+            pa_stream_cancel_write(p->playback.stream);
+        buffer = g_malloc(size);
+        p->playback_pa_buffer = FALSE;
+    } else {
+        p->playback_pa_buffer = TRUE;
+    }
+
+    *data = buffer;
+    return buffer;
+}
+
+static void playback_write(SpicePlaybackSink *sink, gpointer buffer, gsize size)
+{
+    SpicePulsePrivate *p = SPICE_CONTAINEROF(sink, SpicePulsePrivate, playback_sink);
+
+    if (size == 0) {
+        if (p->playback_pa_buffer)
+            pa_stream_cancel_write(p->playback.stream);
+        else
+            g_free(buffer);
+        return;
+    }
+
+    if (pa_stream_write(p->playback.stream, buffer, size,
+                        p->playback_pa_buffer ? NULL : g_free, 0, PA_SEEK_RELATIVE) < 0) {
+        g_warning("pa_stream_write() failed: %s",
+                  pa_strerror(pa_context_errno(p->context)));
+        if (!p->playback_pa_buffer)
+            g_free(buffer);
     }
-    p->playback.state = state;
 }
 
 static void playback_stop(SpicePulse *pulse)
@@ -516,6 +566,7 @@ static void create_record(SpicePulse *pulse)
     SpicePulsePrivate *p = pulse->priv;
     pa_buffer_attr buffer_attr = { 0, };
     pa_stream_flags_t flags;
+    guint fragment = 20;
 
     g_return_if_fail(p != NULL);
     g_return_if_fail(p->context != NULL);
@@ -528,10 +579,13 @@ static void create_record(SpicePulse *pulse)
     pa_stream_set_read_callback(p->record.stream, stream_read_callback, pulse);
     pa_stream_set_state_callback(p->record.stream, stream_state_callback, pulse);
 
-    /* FIXME: we might want customizable latency */
+    if (p->rchannel != NULL)
+        fragment = spice_record_channel_get_fragment(SPICE_RECORD_CHANNEL(p->rchannel));
+
     buffer_attr.maxlength = -1;
     buffer_attr.prebuf = -1;
-    buffer_attr.fragsize = buffer_attr.tlength = pa_usec_to_bytes(20 * PA_USEC_PER_MSEC, &p->record.spec);
+    buffer_attr.fragsize = buffer_attr.tlength = pa_usec_to_bytes(fragment * PA_USEC_PER_MSEC,
+                                                                  &p->record.spec);
     buffer_attr.minreq = (uint32_t) -1;
     flags = PA_STREAM_ADJUST_LATENCY;
 
@@ -774,8 +828,7 @@ static gboolean connect_channel(SpiceAudio *audio, SpiceChannel *channel)
         g_object_weak_ref(G_OBJECT(p->pchannel), channel_weak_notified, audio);
         spice_g_signal_connect_object(channel, "playback-start",
                                       G_CALLBACK(playback_start), pulse, 0);
-        spice_g_signal_connect_object(channel, "playback-data",
-                                      G_CALLBACK(playback_data), pulse, 0);
+        spice_playback_channel_set_sink(SPICE_PLAYBACK_CHANNEL(channel), &p->playback_sink);
         spice_g_signal_connect_object(channel, "playback-stop",
                                       G_CALLBACK(playback_stop), pulse, G_CONNECT_SWAPPED);
         spice_g_signal_connect_object(channel, "notify::volume",
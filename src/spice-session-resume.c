@@ -0,0 +1,169 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <string.h>
+
+#include "spice-session-resume.h"
+
+/* the reconnection attempts are made at once, then after that many ms,
+ * doubling up to RESUME_RETRY_MAX */
+#define RESUME_RETRY_MIN 100
+#define RESUME_RETRY_MAX 2000
+
+struct SessionResume {
+    /* the channels not usable yet, in the order they were lost */
+    GQueue lost;
+    gint64 start;
+    guint retry;
+    gboolean caches_reset;
+
+    SpiceSessionResumeStats stats;
+};
+
+G_GNUC_INTERNAL
+SessionResume *session_resume_new(void)
+{
+    return g_new0(SessionResume, 1);
+}
+
+G_GNUC_INTERNAL
+void session_resume_free(SessionResume *resume)
+{
+    g_queue_clear(&resume->lost);
+    g_free(resume);
+}
+
+/* @channel was lost at @now, in us: it starts an outage if it is the
+ * first one */
+G_GNUC_INTERNAL
+void session_resume_channel_lost(SessionResume *resume, gpointer channel, gint64 now)
+{
+    if (g_queue_find(&resume->lost, channel) != NULL) {
+        return;
+    }
+
+    if (g_queue_is_empty(&resume->lost)) {
+        resume->start = now;
+        resume->retry = 0;
+        resume->caches_reset = FALSE;
+    }
+    g_queue_push_tail(&resume->lost, channel);
+}
+
+/* @channel is usable again at @now. Returns %TRUE when it was the last
+ * one, which ends the outage. */
+G_GNUC_INTERNAL
+gboolean session_resume_channel_usable(SessionResume *resume, gpointer channel, gint64 now)
+{
+    if (!g_queue_remove(&resume->lost, channel)) {
+        return FALSE;
+    }
+    if (!g_queue_is_empty(&resume->lost)) {
+        return FALSE;
+    }
+
+    resume->stats.resumed++;
+    resume->stats.last_usable_time = now - resume->start;
+    resume->stats.max_usable_time = MAX(resume->stats.max_usable_time,
+                                        resume->stats.last_usable_time);
+    return TRUE;
+}
+
+/* @channel is gone for good, it is not waited for anymore */
+G_GNUC_INTERNAL
+void session_resume_forget(SessionResume *resume, gpointer channel)
+{
+    g_queue_remove(&resume->lost, channel);
+}
+
+G_GNUC_INTERNAL
+gboolean session_resume_is_lost(SessionResume *resume, gpointer channel)
+{
+    return g_queue_find(&resume->lost, channel) != NULL;
+}
+
+G_GNUC_INTERNAL
+gboolean session_resume_is_active(SessionResume *resume)
+{
+    return !g_queue_is_empty(&resume->lost);
+}
+
+/* Returns the channels lost, to be freed with g_list_free() */
+G_GNUC_INTERNAL
+GList *session_resume_get_lost(SessionResume *resume)
+{
+    return g_list_copy(resume->lost.head);
+}
+
+/* Returns how long to wait before the next reconnection attempt, in ms */
+G_GNUC_INTERNAL
+guint session_resume_next_retry(SessionResume *resume)
+{
+    guint delay = resume->retry;
+
+    resume->retry = CLAMP(resume->retry * 2, RESUME_RETRY_MIN, RESUME_RETRY_MAX);
+
+    return delay;
+}
+
+/* A channel is being reconnected */
+G_GNUC_INTERNAL
+void session_resume_add_attempt(SessionResume *resume)
+{
+    resume->stats.attempts++;
+}
+
+/* The caches the server dropped must be reset, once per outage. Returns
+ * %TRUE if they weren't yet. */
+G_GNUC_INTERNAL
+gboolean session_resume_reset_caches(SessionResume *resume)
+{
+    if (resume->caches_reset) {
+        return FALSE;
+    }
+
+    resume->caches_reset = TRUE;
+    resume->stats.cache_resets++;
+    return TRUE;
+}
+
+/* The outage lasted longer than the grace period */
+G_GNUC_INTERNAL
+void session_resume_expire(SessionResume *resume)
+{
+    if (g_queue_is_empty(&resume->lost)) {
+        return;
+    }
+
+    resume->stats.expired++;
+    g_queue_clear(&resume->lost);
+}
+
+/* The session is disconnected, the outage doesn't count */
+G_GNUC_INTERNAL
+void session_resume_cancel(SessionResume *resume)
+{
+    g_queue_clear(&resume->lost);
+}
+
+G_GNUC_INTERNAL
+void session_resume_get_stats(SessionResume *resume, SpiceSessionResumeStats *stats)
+{
+    *stats = resume->stats;
+}
@@ -0,0 +1,52 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_CLIENT_SESSION_RESUME_H__
+#define __SPICE_CLIENT_SESSION_RESUME_H__
+
+#include "spice-client.h"
+
+G_BEGIN_DECLS
+
+/* Session resume tracker: it follows the channels lost to a network
+ * outage until they are usable again, paces the reconnection attempts,
+ * and measures how long the desktop was unusable. Like the stream
+ * controller it only works on what it is given: the channels are opaque
+ * pointers, and the session does the reconnecting. */
+typedef struct SessionResume SessionResume;
+
+SessionResume *session_resume_new(void);
+void session_resume_free(SessionResume *resume);
+
+void session_resume_channel_lost(SessionResume *resume, gpointer channel, gint64 now);
+gboolean session_resume_channel_usable(SessionResume *resume, gpointer channel, gint64 now);
+void session_resume_forget(SessionResume *resume, gpointer channel);
+gboolean session_resume_is_lost(SessionResume *resume, gpointer channel);
+gboolean session_resume_is_active(SessionResume *resume);
+GList *session_resume_get_lost(SessionResume *resume);
+
+guint session_resume_next_retry(SessionResume *resume);
+void session_resume_add_attempt(SessionResume *resume);
+gboolean session_resume_reset_caches(SessionResume *resume);
+void session_resume_expire(SessionResume *resume);
+void session_resume_cancel(SessionResume *resume);
+
+void session_resume_get_stats(SessionResume *resume, SpiceSessionResumeStats *stats);
+
+G_END_DECLS
+
+#endif /* __SPICE_CLIENT_SESSION_RESUME_H__ */
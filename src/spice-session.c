@@ -33,6 +33,8 @@
 #include "spice-uri-priv.h"
 #include "channel-playback-priv.h"
 #include "spice-audio-priv.h"
+#include "spice-av-sync.h"
+#include "spice-session-resume.h"
 
 struct channel {
     SpiceChannel      *channel;
@@ -116,6 +118,19 @@ struct _SpiceSessionPrivate {
     guint8            uuid[16];
     gchar             *name;
     SpiceImageCompression preferred_compression;
+    gboolean          low_latency_video;
+
+    /* audio/video synchronization */
+    AVSync            *av_sync;
+    gboolean          enable_av_sync;
+    gint32            av_sync_offset;
+    gint64            av_sync_notify_time;
+
+    /* resume after a network outage */
+    guint             resume_timeout;
+    SessionResume     *resume;
+    guint             resume_expire_id;
+    guint             resume_retry_id;
 
     /* associated objects */
     SpiceAudio        *audio_manager;
@@ -203,6 +218,10 @@ enum {
     PROP_PREF_COMPRESSION,
     PROP_REDIR_RPORTS,
     PROP_REDIR_LPORTS,
+    PROP_LOW_LATENCY_VIDEO,
+    PROP_AV_SYNC_OFFSET,
+    PROP_RESUME_TIMEOUT,
+    PROP_RESUMING,
 };
 
 /* signals */
@@ -293,8 +312,14 @@ static void spice_session_init(SpiceSession *session)
     s->images = cache_image_new((GDestroyNotify)pixman_image_unref);
     s->glz_window = glz_decoder_window_new();
     update_proxy(session, NULL);
+
+    s->av_sync = av_sync_new();
+    s->enable_av_sync = g_getenv("SPICE_AV_SYNC_CONTROLLER") != NULL;
+    s->resume = session_resume_new();
 }
 
+static void resume_stop(SpiceSession *self);
+
 static void
 session_disconnect(SpiceSession *self, gboolean keep_main)
 {
@@ -304,6 +329,11 @@ session_disconnect(SpiceSession *self, gboolean keep_main)
 
     s = self->priv;
 
+    if (session_resume_is_active(s->resume)) {
+        session_resume_cancel(s->resume);
+        resume_stop(self);
+    }
+
     for (ring = ring_get_head(&s->channels); ring != NULL; ring = next) {
         next = ring_next(&s->channels, ring);
         item = SPICE_CONTAINEROF(ring, struct channel, link);
@@ -376,6 +406,8 @@ spice_session_finalize(GObject *gobject)
 
     g_clear_pointer(&s->images, cache_free);
     glz_decoder_window_destroy(s->glz_window);
+    av_sync_free(s->av_sync);
+    session_resume_free(s->resume);
 
     g_clear_pointer(&s->pubkey, g_byte_array_unref);
     g_clear_pointer(&s->ca, g_byte_array_unref);
@@ -719,6 +751,18 @@ static void spice_session_get_property(GObject    *gobject,
     case PROP_REDIR_LPORTS:
         g_value_set_boxed(value, s->redirected_lports);
         break;
+    case PROP_LOW_LATENCY_VIDEO:
+        g_value_set_boolean(value, s->low_latency_video);
+        break;
+    case PROP_AV_SYNC_OFFSET:
+        g_value_set_int(value, s->av_sync_offset);
+        break;
+    case PROP_RESUME_TIMEOUT:
+        g_value_set_uint(value, s->resume_timeout);
+        break;
+    case PROP_RESUMING:
+        g_value_set_boolean(value, session_resume_is_active(s->resume));
+        break;
     default:
 	G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
 	break;
@@ -866,6 +910,12 @@ static void spice_session_set_property(GObject      *gobject,
         g_strfreev(s->redirected_lports);
         s->redirected_lports = g_value_dup_boxed(value);
         break;
+    case PROP_LOW_LATENCY_VIDEO:
+        s->low_latency_video = g_value_get_boolean(value);
+        break;
+    case PROP_RESUME_TIMEOUT:
+        s->resume_timeout = g_value_get_uint(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(gobject, prop_id, pspec);
         break;
@@ -1546,6 +1596,88 @@ static void spice_session_class_init(SpiceSessionClass *klass)
                            SPICE_IMAGE_COMPRESSION_INVALID,
                            G_PARAM_READWRITE |
                            G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:low-latency-video:
+     *
+     * Whether to show the video frames as soon as they are decoded,
+     * instead of at the time given by the server, when there is no
+     * audio playback to synchronize with. Frames are dropped when the
+     * decoding falls behind.
+     *
+     * Since: 0.36
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_LOW_LATENCY_VIDEO,
+         g_param_spec_boolean("low-latency-video",
+                              "Low latency video",
+                              "Show the video frames as soon as they are decoded",
+                              FALSE,
+                              G_PARAM_READWRITE |
+                              G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:av-sync-offset:
+     *
+     * How late the video frames are presented compared to the audio
+     * played at the same time, in milliseconds, averaged over the last
+     * frames. It is negative when the video is early, and 0 when there
+     * is no audio playback to compare with. It is updated at most twice
+     * a second.
+     *
+     * When the SPICE_AV_SYNC_CONTROLLER environment variable is set, the
+     * offset is corrected in small steps, by presenting the video a little
+     * earlier and by raising the audio latency, instead of resetting the
+     * audio latency when video frames keep arriving too late.
+     *
+     * Since: 0.36
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_AV_SYNC_OFFSET,
+         g_param_spec_int("av-sync-offset",
+                          "A/V sync offset",
+                          "How late the video is compared to the audio, in ms",
+                          G_MININT32, G_MAXINT32, 0,
+                          G_PARAM_READABLE |
+                          G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:resume-timeout:
+     *
+     * How long to try to reconnect the channels lost to a network error,
+     * in seconds, or 0 not to. Meanwhile the channels stay around and keep
+     * their state: the displays keep showing the last frame, and the image
+     * cache and GLZ window are kept as long as the server keeps its own
+     * copies. The channels lost report their error only once that time is
+     * over. See also #SpiceSession:resuming.
+     *
+     * Since: 0.36
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_RESUME_TIMEOUT,
+         g_param_spec_uint("resume-timeout",
+                           "Resume timeout",
+                           "How long to try to reconnect the lost channels, in seconds",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE |
+                           G_PARAM_STATIC_STRINGS));
+
+    /**
+     * SpiceSession:resuming:
+     *
+     * Whether some channels lost to a network error are being reconnected,
+     * see #SpiceSession:resume-timeout.
+     *
+     * Since: 0.36
+     **/
+    g_object_class_install_property
+        (gobject_class, PROP_RESUMING,
+         g_param_spec_boolean("resuming",
+                              "Resuming",
+                              "Whether lost channels are being reconnected",
+                              FALSE,
+                              G_PARAM_READABLE |
+                              G_PARAM_STATIC_STRINGS));
 }
 
 /* ------------------------------------------------------------------ */
@@ -1786,6 +1918,28 @@ void spice_session_start_migrating(SpiceSession *session,
 }
 #undef SWAP_STR
 
+/* Returns whether @session has a channel of @type and @id, without
+ * complaining when it doesn't */
+G_GNUC_INTERNAL
+gboolean spice_session_has_channel(SpiceSession *session, gint id, gint type)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), FALSE);
+
+    RingItem *ring;
+    SpiceSessionPrivate *s = session->priv;
+    struct channel *c;
+
+    for (ring = ring_get_head(&s->channels);
+         ring != NULL; ring = ring_next(&s->channels, ring)) {
+        c = SPICE_CONTAINEROF(ring, struct channel, link);
+        if (id == spice_channel_get_channel_id(c->channel) &&
+            type == spice_channel_get_channel_type(c->channel))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
 G_GNUC_INTERNAL
 SpiceChannel* spice_session_lookup_channel(SpiceSession *session, gint id, gint type)
 {
@@ -2373,6 +2527,12 @@ static void spice_session_channel_destroy(SpiceSession *session, SpiceChannel *c
         s->cmain = NULL;
     }
 
+    if (session_resume_is_lost(s->resume, channel)) {
+        session_resume_forget(s->resume, channel);
+        if (!session_resume_is_active(s->resume))
+            resume_stop(session);
+    }
+
     ring_remove(&item->link);
     g_free(item);
 
@@ -2389,6 +2549,234 @@ static void spice_session_channel_destroy(SpiceSession *session, SpiceChannel *c
     g_object_unref(channel);
 }
 
+/* stop the timers once the outage is over */
+static void resume_stop(SpiceSession *self)
+{
+    SpiceSessionPrivate *s = self->priv;
+
+    if (s->resume_expire_id != 0) {
+        g_source_remove(s->resume_expire_id);
+        s->resume_expire_id = 0;
+    }
+    if (s->resume_retry_id != 0) {
+        g_source_remove(s->resume_retry_id);
+        s->resume_retry_id = 0;
+    }
+    g_coroutine_object_notify(G_OBJECT(self), "resuming");
+}
+
+static gboolean any_display_ready(SpiceSession *self)
+{
+    SpiceSessionPrivate *s = self->priv;
+    RingItem *ring;
+
+    for (ring = ring_get_head(&s->channels); ring != NULL;
+         ring = ring_next(&s->channels, ring)) {
+        struct channel *item = SPICE_CONTAINEROF(ring, struct channel, link);
+
+        if (SPICE_IS_DISPLAY_CHANNEL(item->channel) &&
+            item->channel->priv->state == SPICE_CHANNEL_STATE_READY)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* main context */
+static gboolean resume_retry(gpointer data)
+{
+    SpiceSession *self = data;
+    SpiceSessionPrivate *s = self->priv;
+    gboolean main_lost = s->cmain != NULL && session_resume_is_lost(s->resume, s->cmain);
+    GList *lost, *l;
+
+    s->resume_retry_id = 0;
+
+    lost = session_resume_get_lost(s->resume);
+    for (l = lost; l != NULL; l = l->next) {
+        SpiceChannel *channel = l->data;
+
+        if (channel->priv->state != SPICE_CHANNEL_STATE_RESUMING)
+            continue;
+        /* the others need the connection id the new main gets */
+        if (main_lost && channel != s->cmain)
+            continue;
+
+        if (SPICE_IS_DISPLAY_CHANNEL(channel) && !any_display_ready(self) &&
+            session_resume_reset_caches(s->resume)) {
+            /* the server keeps the images and the GLZ dictionary of a
+             * client only while one of its display channels uses them */
+            CHANNEL_DEBUG(channel, "resume: the server dropped its caches");
+            cache_clear_all(self);
+        }
+
+        CHANNEL_DEBUG(channel, "resume: reconnecting");
+        session_resume_add_attempt(s->resume);
+        spice_channel_resume(channel);
+    }
+    g_list_free(lost);
+
+    return FALSE;
+}
+
+/* any context: retry after a delay growing with the failed attempts, or
+ * at once if @now */
+static void resume_schedule(SpiceSession *self, gboolean now)
+{
+    SpiceSessionPrivate *s = self->priv;
+
+    if (now && s->resume_retry_id != 0) {
+        g_source_remove(s->resume_retry_id);
+        s->resume_retry_id = 0;
+    }
+    if (s->resume_retry_id == 0) {
+        guint delay = now ? 0 : session_resume_next_retry(s->resume);
+
+        s->resume_retry_id = g_timeout_add(delay, resume_retry, self);
+    }
+}
+
+/* main context */
+static gboolean resume_expired(gpointer data)
+{
+    SpiceSession *self = data;
+    SpiceSessionPrivate *s = self->priv;
+    GList *lost, *l;
+
+    s->resume_expire_id = 0;
+
+    lost = session_resume_get_lost(s->resume);
+    for (l = lost; l != NULL; l = l->next) {
+        SpiceChannel *channel = l->data;
+
+        /* connected, but with nothing drawn to wait for */
+        if (channel->priv->state == SPICE_CHANNEL_STATE_READY)
+            session_resume_forget(s->resume, channel);
+    }
+    g_list_free(lost);
+
+    lost = session_resume_get_lost(s->resume);
+    if (lost != NULL)
+        SPICE_DEBUG("resume: the channels couldn't be reconnected in time");
+    session_resume_expire(s->resume);
+    resume_stop(self);
+
+    /* the handlers may disconnect the session */
+    g_list_foreach(lost, (GFunc)g_object_ref, NULL);
+    for (l = lost; l != NULL; l = l->next) {
+        spice_channel_resume_failed(l->data);
+    }
+    g_list_free_full(lost, g_object_unref);
+
+    return FALSE;
+}
+
+/* coroutine context: @channel closed with @event. Returns %TRUE if the
+ * session reconnects it, in which case the event is not reported. */
+G_GNUC_INTERNAL
+gboolean spice_session_channel_lost(SpiceSession *session, SpiceChannel *channel,
+                                    SpiceChannelEvent event)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), FALSE);
+
+    SpiceSessionPrivate *s = session->priv;
+    gboolean active;
+
+    if (session_resume_is_lost(s->resume, channel)) {
+        if (event == SPICE_CHANNEL_ERROR_AUTH || event == SPICE_CHANNEL_ERROR_TLS) {
+            /* the server is back, but doesn't want us */
+            session_resume_forget(s->resume, channel);
+            if (!session_resume_is_active(s->resume))
+                resume_stop(session);
+            return FALSE;
+        }
+        resume_schedule(session, FALSE);
+        return TRUE;
+    }
+
+    if (event != SPICE_CHANNEL_ERROR_IO || s->resume_timeout == 0 ||
+        s->disconnecting != 0 || s->for_migration || s->migration != NULL ||
+        s->migration_state != SPICE_SESSION_MIGRATION_NONE)
+        return FALSE;
+
+    /* its reset is asynchronous while a device is redirected, and the
+     * device has to be redirected again anyway */
+    if (SPICE_IS_USBREDIR_CHANNEL(channel))
+        return FALSE;
+
+    CHANNEL_DEBUG(channel, "resume: channel lost");
+    active = session_resume_is_active(s->resume);
+    session_resume_channel_lost(s->resume, channel, g_get_monotonic_time());
+    if (!active) {
+        s->resume_expire_id = g_timeout_add_seconds(s->resume_timeout, resume_expired, session);
+        g_coroutine_object_notify(G_OBJECT(session), "resuming");
+    }
+    if (channel == s->cmain) {
+        /* the server forgot about us, the new main gets a new id */
+        s->connection_id = 0;
+    }
+    resume_schedule(session, FALSE);
+
+    return TRUE;
+}
+
+/* coroutine context: @channel can be used again, which is once it got
+ * the connection id for the main channel, and once it has drawn for the
+ * display channels */
+G_GNUC_INTERNAL
+void spice_session_channel_usable(SpiceSession *session, SpiceChannel *channel)
+{
+    g_return_if_fail(SPICE_IS_SESSION(session));
+
+    SpiceSessionPrivate *s = session->priv;
+    SpiceSessionResumeStats stats;
+
+    if (!session_resume_is_lost(s->resume, channel))
+        return;
+
+    if (session_resume_channel_usable(s->resume, channel, g_get_monotonic_time())) {
+        session_resume_get_stats(s->resume, &stats);
+        SPICE_DEBUG("resume: usable again after %" G_GINT64_FORMAT " ms",
+                    stats.last_usable_time / 1000);
+        resume_stop(session);
+    } else if (channel == s->cmain) {
+        /* the others can link now, all at once */
+        resume_schedule(session, TRUE);
+    }
+}
+
+/* coroutine context */
+G_GNUC_INTERNAL
+void spice_session_channel_ready(SpiceSession *session, SpiceChannel *channel)
+{
+    g_return_if_fail(SPICE_IS_SESSION(session));
+
+    /* see spice_session_channel_usable() */
+    if (SPICE_IS_MAIN_CHANNEL(channel) || SPICE_IS_DISPLAY_CHANNEL(channel))
+        return;
+
+    spice_session_channel_usable(session, channel);
+}
+
+/**
+ * spice_session_get_resume_stats:
+ * @session: a #SpiceSession
+ * @stats: (out): where to store the resume counters
+ *
+ * Gets how many network outages @session recovered from, and how long
+ * the desktop took to be usable again, see #SpiceSession:resume-timeout.
+ *
+ * Since: 0.36
+ **/
+void spice_session_get_resume_stats(SpiceSession *session,
+                                    SpiceSessionResumeStats *stats)
+{
+    g_return_if_fail(SPICE_IS_SESSION(session));
+    g_return_if_fail(stats != NULL);
+
+    session_resume_get_stats(session->priv->resume, stats);
+}
+
 G_GNUC_INTERNAL
 void spice_session_set_connection_id(SpiceSession *session, int id)
 {
@@ -2438,6 +2826,7 @@ void spice_session_set_mm_time(SpiceSession *session, guint32 time)
     if (spice_mmtime_diff(time, old_time + MM_TIME_DIFF_RESET_THRESH) > 0 ||
         spice_mmtime_diff(time, old_time) < 0) {
         SPICE_DEBUG("%s: mm-time-reset, old %u, new %u", __FUNCTION__, old_time, time);
+        av_sync_reset(s->av_sync);
         g_coroutine_signal_emit(session, signals[SPICE_SESSION_MM_TIME_RESET], 0);
     }
 }
@@ -2645,6 +3034,11 @@ void spice_session_sync_playback_latency(SpiceSession *session)
 
     SpiceSessionPrivate *s = session->priv;
 
+    if (s->enable_av_sync) {
+        SPICE_DEBUG("%s: the A/V sync controller raises the latency in steps", __FUNCTION__);
+        return;
+    }
+
     if (s->playback_channel &&
         spice_playback_channel_is_active(s->playback_channel)) {
         spice_playback_channel_sync_latency(s->playback_channel);
@@ -2653,6 +3047,59 @@ void spice_session_sync_playback_latency(SpiceSession *session)
     }
 }
 
+/* A video frame was presented @offset ms after the audio played for the
+ * same mm-time, or before if negative.
+ * main or coroutine context */
+G_GNUC_INTERNAL
+void spice_session_add_av_offset(SpiceSession *session, gint32 offset)
+{
+    g_return_if_fail(SPICE_IS_SESSION(session));
+
+    SpiceSessionPrivate *s = session->priv;
+    gint64 now = g_get_monotonic_time();
+    gint32 average;
+
+    if (!spice_session_is_playback_active(session)) {
+        /* nothing to be in sync with */
+        av_sync_reset(s->av_sync);
+        if (s->av_sync_offset != 0) {
+            s->av_sync_offset = 0;
+            g_coroutine_object_notify(G_OBJECT(session), "av-sync-offset");
+        }
+        return;
+    }
+
+    if (av_sync_add_offset(s->av_sync, offset, now) && s->enable_av_sync) {
+        SPICE_DEBUG("%s: video advance %u ms, audio delay %u ms", __FUNCTION__,
+                    av_sync_get_video_advance(s->av_sync),
+                    av_sync_get_audio_delay(s->av_sync));
+        spice_playback_channel_set_sync_delay(s->playback_channel,
+                                              av_sync_get_audio_delay(s->av_sync));
+    }
+
+    if (av_sync_get_offset(s->av_sync, &average) && average != s->av_sync_offset &&
+        now >= s->av_sync_notify_time) {
+        s->av_sync_offset = average;
+        s->av_sync_notify_time = now + G_USEC_PER_SEC / 2;
+        g_coroutine_object_notify(G_OBJECT(session), "av-sync-offset");
+    }
+}
+
+/* Returns how many ms ahead of the mm-time the video frames should be
+ * presented to be in sync with the audio */
+G_GNUC_INTERNAL
+guint32 spice_session_get_video_advance(SpiceSession *session)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), 0);
+
+    SpiceSessionPrivate *s = session->priv;
+
+    if (!s->enable_av_sync || !spice_session_is_playback_active(session))
+        return 0;
+
+    return av_sync_get_video_advance(s->av_sync);
+}
+
 G_GNUC_INTERNAL
 gboolean spice_session_is_playback_active(SpiceSession *session)
 {
@@ -2811,6 +3258,14 @@ gboolean spice_session_get_audio_enabled(SpiceSession *session)
     return session->priv->audio;
 }
 
+G_GNUC_INTERNAL
+gboolean spice_session_get_low_latency_video(SpiceSession *session)
+{
+    g_return_val_if_fail(SPICE_IS_SESSION(session), FALSE);
+
+    return session->priv->low_latency_video;
+}
+
 G_GNUC_INTERNAL
 gboolean spice_session_get_usbredir_enabled(SpiceSession *session)
 {
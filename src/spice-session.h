@@ -67,6 +67,32 @@ typedef enum {
     SPICE_SESSION_MIGRATION_CONNECTING,
 } SpiceSessionMigration;
 
+/**
+ * SpiceSessionResumeStats:
+ * @resumed: network outages the session recovered from
+ * @expired: outages that lasted longer than #SpiceSession:resume-timeout
+ * @attempts: reconnection attempts made
+ * @cache_resets: times the image cache and GLZ window were dropped since
+ * the server dropped its own copies
+ * @last_usable_time: how long the last outage recovered from lasted, from
+ * the first channel lost until they are all usable again and the displays
+ * are drawn, in microseconds
+ * @max_usable_time: the longest of those, in microseconds
+ *
+ * The counters of the session resume, see spice_session_get_resume_stats().
+ *
+ * Since: 0.36
+ **/
+typedef struct _SpiceSessionResumeStats SpiceSessionResumeStats;
+struct _SpiceSessionResumeStats {
+    guint resumed;
+    guint expired;
+    guint attempts;
+    guint cache_resets;
+    gint64 last_usable_time;
+    gint64 max_usable_time;
+};
+
 /**
  * SpiceSession:
  *
@@ -114,6 +140,8 @@ gboolean spice_session_has_channel_type(SpiceSession *session, gint type);
 gboolean spice_session_get_read_only(SpiceSession *session);
 SpiceURI *spice_session_get_proxy_uri(SpiceSession *session);
 gboolean spice_session_is_for_migration(SpiceSession *session);
+void spice_session_get_resume_stats(SpiceSession *session,
+                                    SpiceSessionResumeStats *stats);
 
 G_END_DECLS
 
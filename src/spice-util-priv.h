@@ -30,6 +30,9 @@ const gchar* spice_yes_no(gboolean value);
 guint16 spice_make_scancode(guint scancode, gboolean release);
 gchar* spice_unix2dos(const gchar *str, gssize len);
 gchar* spice_dos2unix(const gchar *str, gssize len);
+gsize spice_unix2dos_len(const gchar *str, gsize len);
+gsize spice_unix2dos_chunk(const gchar *str, gsize len, gchar *last, gchar *out);
+void spice_dos2unix_chunk(const gchar *str, gsize len, gboolean *cr, GString *out);
 void spice_mono_edge_highlight(unsigned width, unsigned hight,
                                const guint8 *and, const guint8 *xor, guint8 *dest);
 
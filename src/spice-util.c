@@ -366,6 +366,94 @@ gchar* spice_unix2dos(const gchar *str, gssize len)
                                   NEWLINE_TYPE_CR_LF);
 }
 
+/* The text may also be converted piece by piece, as it is sent or
+ * received, with the same result as converting it whole. */
+
+/* Returns the length of @str once converted by spice_unix2dos() */
+G_GNUC_INTERNAL
+gsize spice_unix2dos_len(const gchar *str, gsize len)
+{
+    const gchar *end = str + len, *p;
+    gsize n = len;
+
+    for (p = str; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+        if (p == str || p[-1] != '\r')
+            n++;
+    }
+
+    return n;
+}
+
+/* Converts @len bytes of @str like spice_unix2dos() into @out, which must
+ * have room for twice as many. @last is the last character of the
+ * previous piece, 0 at first, and is updated. Returns the length written
+ * to @out. */
+G_GNUC_INTERNAL
+gsize spice_unix2dos_chunk(const gchar *str, gsize len, gchar *last, gchar *out)
+{
+    const gchar *end = str + len, *p;
+    gchar *o = out;
+
+    while (str < end) {
+        p = memchr(str, '\n', end - str);
+        if (p == NULL)
+            p = end;
+        memcpy(o, str, p - str);
+        o += p - str;
+        if (p > str)
+            *last = p[-1];
+        if (p == end)
+            break;
+
+        if (*last != '\r')
+            *o++ = '\r';
+        *o++ = '\n';
+        *last = '\n';
+        str = p + 1;
+    }
+
+    return o - out;
+}
+
+/* Converts @len bytes of @str like spice_dos2unix(), appending them to
+ * @out. A '\r' ending a piece is held back until the next one, @cr tells
+ * whether there is one and is updated: pass a %NULL @str at the end of
+ * the text to flush it. */
+G_GNUC_INTERNAL
+void spice_dos2unix_chunk(const gchar *str, gsize len, gboolean *cr, GString *out)
+{
+    const gchar *end = str + len, *p;
+
+    if (str == NULL) {
+        if (*cr)
+            g_string_append_c(out, '\r');
+        *cr = FALSE;
+        return;
+    }
+
+    if (*cr && len > 0) {
+        if (str[0] != '\n')
+            g_string_append_c(out, '\r');
+        *cr = FALSE;
+    }
+
+    while (str < end) {
+        p = memchr(str, '\r', end - str);
+        if (p == NULL) {
+            g_string_append_len(out, str, end - str);
+            break;
+        }
+        g_string_append_len(out, str, p - str);
+        if (p + 1 == end) {
+            *cr = TRUE;
+            break;
+        }
+        if (p[1] != '\n')
+            g_string_append_c(out, '\r');
+        str = p + 1;
+    }
+}
+
 static bool buf_is_ones(unsigned size, const guint8 *data)
 {
     int i;
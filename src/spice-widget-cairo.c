@@ -32,12 +32,14 @@ int spice_cairo_image_create(SpiceDisplay *display)
 
     if (d->canvas.format == SPICE_SURFACE_FMT_16_555 ||
         d->canvas.format == SPICE_SURFACE_FMT_16_565) {
+        d->canvas.data = spice_display_widget_acquire_converted(display);
+        if (d->canvas.data == NULL)
+            return -1;
         d->canvas.convert = TRUE;
-        d->canvas.data = g_malloc0(d->area.width * d->area.height * 4);
 
         d->canvas.surface = cairo_image_surface_create_for_data
             (d->canvas.data, CAIRO_FORMAT_RGB24,
-             d->area.width, d->area.height, d->area.width * 4);
+             d->canvas.width, d->canvas.height, d->canvas.width * 4);
 
     } else {
         d->canvas.convert = FALSE;
@@ -56,11 +58,42 @@ void spice_cairo_image_destroy(SpiceDisplay *display)
     SpiceDisplayPrivate *d = display->priv;
 
     g_clear_pointer(&d->canvas.surface, cairo_surface_destroy);
-    if (d->canvas.convert)
-        g_clear_pointer(&d->canvas.data, g_free);
+    if (d->canvas.convert) {
+        spice_display_widget_release_converted(display, d->canvas.data);
+        d->canvas.data = NULL;
+    }
     d->canvas.convert = FALSE;
 }
 
+/* paints the video frames that were not written to the canvas, @cr
+ * being in the coordinates of the primary */
+G_GNUC_INTERNAL
+void spice_cairo_paint_overlays(SpiceDisplay *display, cairo_t *cr)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    SpiceStreamOverlay *overlay;
+    GHashTableIter iter;
+
+    g_hash_table_iter_init(&iter, d->stream_overlays);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&overlay)) {
+        GdkRectangle dest;
+
+        if (!gdk_rectangle_intersect(&overlay->dest, &d->area, &dest))
+            continue;
+
+        cairo_save(cr);
+        cairo_rectangle(cr, dest.x, dest.y, dest.width, dest.height);
+        cairo_clip(cr);
+        cairo_translate(cr, overlay->dest.x, overlay->dest.y);
+        cairo_scale(cr,
+                    (double)overlay->dest.width / overlay->width,
+                    (double)overlay->dest.height / overlay->height);
+        cairo_set_source_surface(cr, overlay->surface, 0, 0);
+        cairo_paint(cr);
+        cairo_restore(cr);
+    }
+}
+
 G_GNUC_INTERNAL
 void spice_cairo_draw_event(SpiceDisplay *display, cairo_t *cr)
 {
@@ -109,20 +142,21 @@ void spice_cairo_draw_event(SpiceDisplay *display, cairo_t *cr)
         cairo_translate(cr, x, y);
         cairo_rectangle(cr, 0, 0, w, h);
         cairo_scale(cr, s, s);
-        if (!d->canvas.convert)
-            cairo_translate(cr, -d->area.x, -d->area.y);
+        cairo_translate(cr, -d->area.x, -d->area.y);
         cairo_set_source_surface(cr, d->canvas.surface, 0, 0);
         cairo_fill(cr);
 
+        spice_cairo_paint_overlays(display, cr);
+
         if (d->mouse_mode == SPICE_MOUSE_MODE_SERVER &&
             d->mouse_guest_x != -1 && d->mouse_guest_y != -1 &&
             !d->show_cursor &&
             spice_gtk_session_get_pointer_grabbed(d->gtk_session)) {
-            GdkPixbuf *image = d->mouse_pixbuf;
+            cairo_surface_t *image = d->mouse_surface;
             if (image != NULL) {
-                gdk_cairo_set_source_pixbuf(cr, image,
-                                            d->mouse_guest_x - d->mouse_hotspot.x,
-                                            d->mouse_guest_y - d->mouse_hotspot.y);
+                cairo_set_source_surface(cr, image,
+                                         d->mouse_guest_x - d->mouse_hotspot.x,
+                                         d->mouse_guest_y - d->mouse_hotspot.y);
                 cairo_paint(cr);
             }
         }
@@ -0,0 +1,161 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include "config.h"
+
+#include <string.h>
+#include <epoxy/gl.h>
+
+#include "spice-widget-egl-canvas.h"
+
+/*
+ * Only the damaged rectangles of the canvas are transferred at each
+ * draw: the large ones through a ring of pixel buffers, the small ones
+ * straight from the canvas.
+ */
+
+/* Larger rectangles go through the pixel buffer ring */
+#define EGL_CANVAS_PBO_MIN_SIZE (64 * 1024)
+/* Past this many rectangles, upload the damage extents at once */
+#define EGL_CANVAS_MAX_RECTS 16
+
+G_GNUC_INTERNAL
+void egl_canvas_init(EglCanvas *canvas)
+{
+    glGenTextures(1, &canvas->tex_id);
+    glGenBuffers(EGL_CANVAS_PBOS, canvas->pbo_ids);
+    canvas->pbo_index = 0;
+    egl_canvas_reset(canvas);
+}
+
+G_GNUC_INTERNAL
+void egl_canvas_cleanup(EglCanvas *canvas)
+{
+    if (canvas->tex_id) {
+        glDeleteTextures(1, &canvas->tex_id);
+        canvas->tex_id = 0;
+    }
+
+    if (canvas->pbo_ids[0]) {
+        glDeleteBuffers(EGL_CANVAS_PBOS, canvas->pbo_ids);
+        memset(canvas->pbo_ids, 0, sizeof(canvas->pbo_ids));
+    }
+    egl_canvas_reset(canvas);
+}
+
+G_GNUC_INTERNAL
+void egl_canvas_invalidate(EglCanvas *canvas, const cairo_rectangle_int_t *rect)
+{
+    if (canvas->damage == NULL)
+        canvas->damage = cairo_region_create();
+
+    cairo_region_union_rectangle(canvas->damage, rect);
+}
+
+G_GNUC_INTERNAL
+void egl_canvas_reset(EglCanvas *canvas)
+{
+    canvas->tex_width = 0;
+    canvas->tex_height = 0;
+    g_clear_pointer(&canvas->damage, cairo_region_destroy);
+}
+
+static void upload_rect(EglCanvas *canvas, const guint8 *data, gint stride,
+                        const cairo_rectangle_int_t *area,
+                        const cairo_rectangle_int_t *r)
+{
+    const guint8 *src = data + r->y * stride + r->x * 4;
+    gsize row = r->width * 4;
+    gsize size = row * r->height;
+    guint8 *dst = NULL;
+    gint i;
+
+    if (size >= EGL_CANVAS_PBO_MIN_SIZE) {
+        /* the ring lets the driver transfer a buffer while the next
+         * one is filled, orphaning avoids waiting for the GPU */
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, canvas->pbo_ids[canvas->pbo_index]);
+        canvas->pbo_index = (canvas->pbo_index + 1) % EGL_CANVAS_PBOS;
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                               GL_MAP_WRITE_BIT |
+                               GL_MAP_INVALIDATE_BUFFER_BIT |
+                               GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+
+    if (dst != NULL) {
+        for (i = 0; i < r->height; i++)
+            memcpy(dst + i * row, src + i * stride, row);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        src = NULL; /* offset in the bound buffer */
+    } else {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / 4);
+    }
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0,
+                    r->x - area->x, r->y - area->y,
+                    r->width, r->height,
+                    GL_BGRA, GL_UNSIGNED_BYTE, src);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+G_GNUC_INTERNAL
+void egl_canvas_upload(EglCanvas *canvas, const guint8 *data, gint stride,
+                       const cairo_rectangle_int_t *area)
+{
+    cairo_rectangle_int_t r;
+    int i, n;
+
+    glBindTexture(GL_TEXTURE_2D, canvas->tex_id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (canvas->tex_width != area->width ||
+        canvas->tex_height != area->height) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+                     area->width, area->height, 0,
+                     GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+        canvas->tex_width = area->width;
+        canvas->tex_height = area->height;
+
+        g_clear_pointer(&canvas->damage, cairo_region_destroy);
+        canvas->damage = cairo_region_create_rectangle(area);
+    }
+
+    if (canvas->damage == NULL)
+        return;
+
+    cairo_region_intersect_rectangle(canvas->damage, area);
+    n = cairo_region_num_rectangles(canvas->damage);
+    if (n > EGL_CANVAS_MAX_RECTS) {
+        cairo_region_get_extents(canvas->damage, &r);
+        upload_rect(canvas, data, stride, area, &r);
+    } else {
+        for (i = 0; i < n; i++) {
+            cairo_region_get_rectangle(canvas->damage, i, &r);
+            upload_rect(canvas, data, stride, area, &r);
+        }
+    }
+
+    g_clear_pointer(&canvas->damage, cairo_region_destroy);
+}
@@ -0,0 +1,55 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2018 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SPICE_WIDGET_EGL_CANVAS_H__
+#define __SPICE_WIDGET_EGL_CANVAS_H__
+
+#include <glib.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+#define EGL_CANVAS_PBOS 3
+
+/* The texture the software canvas is uploaded to, see
+ * spice_egl_canvas_draw(). It only needs a current GL context, not the
+ * widget, so that it can be tested on its own. */
+typedef struct EglCanvas {
+    guint               tex_id;
+    gint                tex_width, tex_height;
+    guint               pbo_ids[EGL_CANVAS_PBOS];
+    guint               pbo_index;
+    cairo_region_t      *damage;
+} EglCanvas;
+
+/* GL context: creates the texture and the pixel buffers */
+void egl_canvas_init(EglCanvas *canvas);
+/* GL context: deletes them */
+void egl_canvas_cleanup(EglCanvas *canvas);
+/* @rect of the canvas changed since the last upload */
+void egl_canvas_invalidate(EglCanvas *canvas, const cairo_rectangle_int_t *rect);
+/* the whole texture is to be uploaded again */
+void egl_canvas_reset(EglCanvas *canvas);
+/* GL context: uploads what changed of the @area of the canvas, whose
+ * BGRA pixels are at @data, @stride bytes apart. The texture is left
+ * bound, its first row is the top of @area. */
+void egl_canvas_upload(EglCanvas *canvas, const guint8 *data, gint stride,
+                       const cairo_rectangle_int_t *area);
+
+G_END_DECLS
+
+#endif /* __SPICE_WIDGET_EGL_CANVAS_H__ */
@@ -164,6 +164,7 @@ static gboolean spice_egl_init_shaders(SpiceDisplay *display, GError **err)
 
     glGenTextures(1, &d->egl.tex_id);
     glGenTextures(1, &d->egl.tex_pointer_id);
+    egl_canvas_init(&d->egl.canvas_tex);
 
     success = TRUE;
 
@@ -395,6 +396,8 @@ void spice_egl_unrealize_display(SpiceDisplay *display)
         d->egl.tex_pointer_id = 0;
     }
 
+    egl_canvas_cleanup(&d->egl.canvas_tex);
+
     if (d->egl.vbuf_id) {
         glDeleteBuffers(1, &d->egl.vbuf_id);
         d->egl.vbuf_id = 0;
@@ -528,7 +531,7 @@ void spice_egl_cursor_set(SpiceDisplay *display)
     SpiceDisplayPrivate *d = display->priv;
     GdkPixbuf *image = d->mouse_pixbuf;
 
-    g_return_if_fail(d->egl.enabled);
+    g_return_if_fail(d->egl.enabled || d->egl.canvas);
 
     if (image == NULL)
         return;
@@ -547,6 +550,32 @@ void spice_egl_cursor_set(SpiceDisplay *display)
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+static void draw_cursor(SpiceDisplay *display, double s, int x, int y, int h)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    GdkPixbuf *image = d->mouse_pixbuf;
+    int width, height;
+
+    if (d->mouse_mode != SPICE_MOUSE_MODE_SERVER ||
+        d->mouse_guest_x == -1 || d->mouse_guest_y == -1 ||
+        d->show_cursor ||
+        !spice_gtk_session_get_pointer_grabbed(d->gtk_session) ||
+        image == NULL)
+        return;
+
+    width = gdk_pixbuf_get_width(image);
+    height = gdk_pixbuf_get_height(image);
+
+    glBindTexture(GL_TEXTURE_2D, d->egl.tex_pointer_id);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    client_draw_rect_tex(display,
+                         x + (d->mouse_guest_x - d->mouse_hotspot.x) * s,
+                         y + h - (d->mouse_guest_y - d->mouse_hotspot.y) * s,
+                         width, -height,
+                         0, 0, 1, 1);
+}
+
 G_GNUC_INTERNAL
 void spice_egl_update_display(SpiceDisplay *display)
 {
@@ -603,24 +632,69 @@ void spice_egl_update_display(SpiceDisplay *display)
     client_draw_rect_tex(display, x, y, w, h,
                          tx, ty, tw, th);
 
-    if (d->mouse_mode == SPICE_MOUSE_MODE_SERVER &&
-        d->mouse_guest_x != -1 && d->mouse_guest_y != -1 &&
-        !d->show_cursor &&
-        spice_gtk_session_get_pointer_grabbed(d->gtk_session) &&
-        d->mouse_pixbuf != NULL) {
-        GdkPixbuf *image = d->mouse_pixbuf;
-        int width = gdk_pixbuf_get_width(image);
-        int height = gdk_pixbuf_get_height(image);
-
-        glBindTexture(GL_TEXTURE_2D, d->egl.tex_pointer_id);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        client_draw_rect_tex(display,
-                             x + (d->mouse_guest_x - d->mouse_hotspot.x) * s,
-                             y + h - (d->mouse_guest_y - d->mouse_hotspot.y) * s,
-                             width, -height,
-                             0, 0, 1, 1);
+    draw_cursor(display, s, x, y, h);
+
+#ifdef GDK_WINDOWING_X11
+    if (GDK_IS_X11_DISPLAY(gdk_display_get_default())) {
+        /* gtk+ does the swap with gtkglarea */
+        eglSwapBuffers(d->egl.display, d->egl.surface);
     }
+#endif
+
+    glUseProgram(prog);
+}
+
+/*
+ * Software canvas rendering: the primary surface drawn by the channel
+ * is uploaded to a texture covering the widget area, only the damaged
+ * rectangles being transferred at each draw, and scaling and cursor
+ * compositing are then done by the GL pipeline.
+ */
+
+G_GNUC_INTERNAL
+void spice_egl_canvas_invalidate(SpiceDisplay *display, const GdkRectangle *rect)
+{
+    egl_canvas_invalidate(&display->priv->egl.canvas_tex, rect);
+}
+
+/* the texture must be fully uploaded again at next draw */
+G_GNUC_INTERNAL
+void spice_egl_canvas_reset(SpiceDisplay *display)
+{
+    egl_canvas_reset(&display->priv->egl.canvas_tex);
+}
+
+G_GNUC_INTERNAL
+void spice_egl_canvas_draw(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    double s;
+    int x, y, w, h;
+    int prog;
+
+    g_return_if_fail(d->egl.canvas);
+    if (d->canvas.data == NULL || d->area.width == 0 || d->area.height == 0)
+        return;
+    if (!gl_make_current(display, NULL))
+        return;
+
+    spice_display_get_scaling(display, &s, &x, &y, &w, &h);
+
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    egl_canvas_upload(&d->egl.canvas_tex, d->canvas.data,
+                      d->canvas.convert ? d->canvas.width * 4 : d->canvas.stride,
+                      &d->area);
+
+    glDisable(GL_BLEND);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &prog);
+    glUseProgram(d->egl.prog);
+    /* the first texture row is the top of the area */
+    client_draw_rect_tex(display, x, y, w, h,
+                         0, 1, 1, -1);
+
+    draw_cursor(display, s, x, y, h);
 
 #ifdef GDK_WINDOWING_X11
     if (GDK_IS_X11_DISPLAY(gdk_display_get_default())) {
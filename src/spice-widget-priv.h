@@ -27,6 +27,9 @@
 #ifdef HAVE_EPOXY_EGL_H
 #include <epoxy/egl.h>
 #endif
+#if HAVE_EGL
+#include "spice-widget-egl-canvas.h"
+#endif
 
 #include "spice-widget.h"
 #include "spice-common.h"
@@ -55,6 +58,13 @@ struct _SpiceDisplayClass {
     void (*keyboard_grab)(SpiceChannel *channel, gint grabbed);
 };
 
+/* a video frame composited over the canvas */
+typedef struct SpiceStreamOverlay {
+    GdkRectangle            dest;
+    gint                    width, height;
+    cairo_surface_t         *surface;
+} SpiceStreamOverlay;
+
 struct _SpiceDisplayPrivate {
     GtkStack                *stack;
     gint                    channel_id;
@@ -65,6 +75,7 @@ struct _SpiceDisplayPrivate {
     gboolean                keyboard_grab_inhibit;
     bool                    mouse_grab_enable;
     bool                    resize_guest_enable;
+    bool                    stream_overlay_enable;
 
     /* state */
     gboolean                ready;
@@ -73,10 +84,13 @@ struct _SpiceDisplayPrivate {
         enum SpiceSurfaceFmt    format;
         gint                    width, height, stride;
         gpointer                data_origin; /* the original display image data */
-        gpointer                data; /* converted if necessary to 32 bits */
+        gpointer                data; /* converted if necessary to 32 bits,
+                                         * shared by the monitors of the channel */
         bool                    convert;
         cairo_surface_t         *surface;
     } canvas;
+    /* stream id -> SpiceStreamOverlay */
+    GHashTable              *stream_overlays;
     GdkRectangle            area;
     /* window border */
     gint                    ww, wh, mx, my;
@@ -98,12 +112,17 @@ struct _SpiceDisplayPrivate {
     bool                    mouse_have_pointer;
     GdkCursor               *mouse_cursor;
     GdkPixbuf               *mouse_pixbuf;
+    cairo_surface_t         *mouse_surface; /* mouse_pixbuf, ready to paint */
     GdkPoint                mouse_hotspot;
     GdkCursor               *show_cursor;
     int                     mouse_last_x;
     int                     mouse_last_y;
     int                     mouse_guest_x;
     int                     mouse_guest_y;
+    /* cursor moves are applied once per frame */
+    guint                   mouse_move_tick_id;
+    int                     mouse_move_x;
+    int                     mouse_move_y;
 
     bool                    keyboard_grab_active;
     bool                    keyboard_have_focus;
@@ -146,6 +165,9 @@ struct _SpiceDisplayPrivate {
         EGLImageKHR         image;
         gboolean            call_draw_done;
         SpiceGlScanout      scanout;
+        /* software canvas rendered with GL, see spice_egl_canvas_draw() */
+        gboolean            canvas;
+        EglCanvas           canvas_tex;
     } egl;
 #endif // HAVE_EGL
     double scroll_delta_y;
@@ -154,6 +176,7 @@ struct _SpiceDisplayPrivate {
 int      spice_cairo_image_create                 (SpiceDisplay *display);
 void     spice_cairo_image_destroy                (SpiceDisplay *display);
 void     spice_cairo_draw_event                   (SpiceDisplay *display, cairo_t *cr);
+void     spice_cairo_paint_overlays               (SpiceDisplay *display, cairo_t *cr);
 gboolean spice_cairo_is_scaled                    (SpiceDisplay *display);
 void     spice_display_get_scaling           (SpiceDisplay *display, double *s, int *x, int *y, int *w, int *h);
 gboolean spice_egl_init                      (SpiceDisplay *display, GError **err);
@@ -166,11 +189,17 @@ gboolean spice_egl_update_scanout            (SpiceDisplay *display,
                                               const SpiceGlScanout *scanout,
                                               GError **err);
 void     spice_egl_cursor_set                (SpiceDisplay *display);
+void     spice_egl_canvas_invalidate         (SpiceDisplay *display,
+                                              const GdkRectangle *rect);
+void     spice_egl_canvas_reset              (SpiceDisplay *display);
+void     spice_egl_canvas_draw               (SpiceDisplay *display);
 
 #ifdef HAVE_EGL
 void     spice_display_widget_gl_scanout     (SpiceDisplay *display);
 #endif
 void     spice_display_widget_update_monitor_area(SpiceDisplay *display);
+gpointer spice_display_widget_acquire_converted  (SpiceDisplay *display);
+void     spice_display_widget_release_converted  (SpiceDisplay *display, gpointer data);
 
 G_END_DECLS
 
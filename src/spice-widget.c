@@ -114,6 +114,7 @@ static void recalc_geometry(GtkWidget *widget);
 static void channel_new(SpiceSession *s, SpiceChannel *channel, SpiceDisplay *display);
 static void channel_destroy(SpiceSession *s, SpiceChannel *channel, SpiceDisplay *display);
 static void cursor_invalidate(SpiceDisplay *display);
+static void cursor_move_flush(SpiceDisplay *display);
 static void update_area(SpiceDisplay *display, gint x, gint y, gint width, gint height);
 static void release_keys(SpiceDisplay *display);
 static void size_allocate(GtkWidget *widget, GtkAllocation *conf, gpointer data);
@@ -242,6 +243,31 @@ static bool egl_enabled(SpiceDisplayPrivate *d)
 #endif
 }
 
+#if HAVE_EGL
+/* Render the software canvas with GL instead of cairo */
+static bool egl_canvas_requested(void)
+{
+    return g_getenv("SPICE_GL_CANVAS") != NULL;
+}
+
+/* Schedule a GL render of the canvas, when it is drawn with GtkGLArea */
+static bool egl_canvas_queue_render(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    GtkWidget *gl;
+
+    if (!d->egl.canvas || egl_enabled(d))
+        return false;
+
+    gl = gtk_stack_get_child_by_name(d->stack, "gl-area");
+    if (gtk_stack_get_visible_child(d->stack) != gl)
+        return false;
+
+    gtk_gl_area_queue_render(GTK_GL_AREA(gl));
+    return true;
+}
+#endif
+
 static void update_ready(SpiceDisplay *display)
 {
     SpiceDisplayPrivate *d = display->priv;
@@ -262,8 +288,12 @@ static void update_ready(SpiceDisplay *display)
     if (d->ready == ready)
         return;
 
-    if (ready && gtk_widget_get_window(GTK_WIDGET(display)))
+    if (ready && gtk_widget_get_window(GTK_WIDGET(display))) {
+#if HAVE_EGL
+        egl_canvas_queue_render(display);
+#endif
         gtk_widget_queue_draw(GTK_WIDGET(display));
+    }
 
     d->ready = ready;
     g_object_notify(G_OBJECT(display), "ready");
@@ -433,6 +463,7 @@ static void spice_display_dispose(GObject *obj)
     DISPLAY_DEBUG(display, "spice display dispose");
 
     spice_cairo_image_destroy(display);
+    dispatcher_remove(display);
     g_clear_object(&d->session);
     d->gtk_session = NULL;
 
@@ -457,6 +488,8 @@ static void spice_display_finalize(GObject *obj)
     g_clear_object(&d->show_cursor);
     g_clear_object(&d->mouse_cursor);
     g_clear_object(&d->mouse_pixbuf);
+    g_clear_pointer(&d->mouse_surface, cairo_surface_destroy);
+    g_clear_pointer(&d->stream_overlays, g_hash_table_unref);
 
     G_OBJECT_CLASS(spice_display_parent_class)->finalize(obj);
 }
@@ -573,6 +606,39 @@ static void grab_notify(SpiceDisplay *display, gboolean was_grabbed)
         release_keys(display);
 }
 
+static void stream_overlay_free(gpointer data)
+{
+    SpiceStreamOverlay *overlay = data;
+
+    cairo_surface_destroy(overlay->surface);
+    g_free(overlay);
+}
+
+/* the channel may present the primary through several buffers,
+ * follow the latest one before reading it */
+static void update_primary_data(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    gpointer data;
+
+    if (d->display == NULL || d->canvas.data_origin == NULL)
+        return;
+
+    data = spice_display_channel_get_primary_data(d->display);
+    if (data == NULL || data == d->canvas.data_origin)
+        return;
+
+    d->canvas.data_origin = data;
+    if (d->canvas.convert)
+        return;
+
+    d->canvas.data = data;
+    if (d->canvas.surface != NULL) {
+        spice_cairo_image_destroy(display);
+        spice_cairo_image_create(display);
+    }
+}
+
 #if HAVE_EGL
 static gboolean
 gl_area_render(GtkGLArea *area, GdkGLContext *context, gpointer user_data)
@@ -580,7 +646,12 @@ gl_area_render(GtkGLArea *area, GdkGLContext *context, gpointer user_data)
     SpiceDisplay *display = SPICE_DISPLAY(user_data);
     SpiceDisplayPrivate *d = display->priv;
 
-    spice_egl_update_display(display);
+    if (egl_enabled(d)) {
+        spice_egl_update_display(display);
+    } else if (d->egl.canvas && d->mark != 0) {
+        update_primary_data(display);
+        spice_egl_canvas_draw(display);
+    }
     glFlush();
     if (d->egl.call_draw_done) {
         spice_display_channel_gl_draw_done(d->display);
@@ -590,6 +661,8 @@ gl_area_render(GtkGLArea *area, GdkGLContext *context, gpointer user_data)
     return TRUE;
 }
 
+static void set_egl_canvas(SpiceDisplay *display, bool enabled);
+
 static void
 gl_area_realize(GtkGLArea *area, gpointer user_data)
 {
@@ -598,14 +671,44 @@ gl_area_realize(GtkGLArea *area, gpointer user_data)
 
     gtk_gl_area_make_current(area);
     if (gtk_gl_area_get_error(area) != NULL)
+        goto canvas;
+
+    if (!spice_egl_init(display, &err)) {
+        g_critical("egl init failed: %s", err->message);
+        g_clear_error(&err);
+    }
+
+canvas:
+    if (egl_canvas_requested())
+        set_egl_canvas(display, display->priv->egl.context_ready);
+}
+
+#ifdef GDK_WINDOWING_X11
+static void egl_realize_x11(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    GtkWidget *area = gtk_stack_get_child_by_name(d->stack, "draw-area");
+    GError *err = NULL;
+
+    if (!GDK_IS_X11_DISPLAY(gdk_display_get_default()) ||
+        d->egl.context_ready ||
+        !gtk_widget_get_realized(area))
         return;
 
     if (!spice_egl_init(display, &err)) {
         g_critical("egl init failed: %s", err->message);
         g_clear_error(&err);
     }
+
+    if (!spice_egl_realize_display(display, gtk_widget_get_window(area), &err)) {
+        g_critical("egl realize failed: %s", err->message);
+        g_clear_error(&err);
+    }
+
+    spice_egl_resize_display(display, d->ww, d->wh);
 }
 #endif
+#endif
 
 static void
 drawing_area_realize(GtkWidget *area, gpointer user_data)
@@ -613,9 +716,14 @@ drawing_area_realize(GtkWidget *area, gpointer user_data)
 #if defined(GDK_WINDOWING_X11) && defined(HAVE_EGL)
     SpiceDisplay *display = SPICE_DISPLAY(user_data);
 
-    if (GDK_IS_X11_DISPLAY(gdk_display_get_default()) &&
-        spice_display_channel_get_gl_scanout(display->priv->display) != NULL) {
+    if (!GDK_IS_X11_DISPLAY(gdk_display_get_default()))
+        return;
+
+    if (spice_display_channel_get_gl_scanout(display->priv->display) != NULL) {
         spice_display_widget_gl_scanout(display);
+    } else if (egl_canvas_requested()) {
+        egl_realize_x11(display);
+        set_egl_canvas(display, display->priv->egl.context_ready);
     }
 #endif
 }
@@ -628,6 +736,9 @@ static void spice_display_init(SpiceDisplay *display)
     GtkTargetEntry targets = { "text/uri-list", 0, 0 };
 
     d = display->priv = spice_display_get_instance_private(display);
+    d->stream_overlays = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                               NULL, stream_overlay_free);
+    d->stream_overlay_enable = g_getenv("SPICE_STREAM_OVERLAY") != NULL;
     d->stack = GTK_STACK(gtk_stack_new());
     gtk_container_add(GTK_CONTAINER(display), GTK_WIDGET(d->stack));
     area = gtk_drawing_area_new();
@@ -654,6 +765,18 @@ static void spice_display_init(SpiceDisplay *display)
 
     gtk_widget_show_all(widget);
 
+#if HAVE_EGL
+    /* without X11, the GL canvas is drawn with GtkGLArea, which has to
+     * be visible to be realized */
+#ifdef GDK_WINDOWING_X11
+    if (!GDK_IS_X11_DISPLAY(gdk_display_get_default()))
+#endif
+    {
+        if (egl_canvas_requested())
+            gtk_stack_set_visible_child_name(d->stack, "gl-area");
+    }
+#endif
+
     g_signal_connect(display, "grab-broken-event", G_CALLBACK(grab_broken), NULL);
     g_signal_connect(display, "grab-notify", G_CALLBACK(grab_notify), NULL);
 
@@ -1160,6 +1283,7 @@ static void try_mouse_ungrab(SpiceDisplay *display)
 
     d->mouse_grab_active = false;
 
+    cursor_move_flush(display);
     spice_display_get_scaling(display, &s, &x, &y, NULL, NULL);
 
     window = gtk_widget_get_window(GTK_WIDGET(display));
@@ -1224,51 +1348,347 @@ static void recalc_geometry(GtkWidget *widget)
 
 #define CONVERT_0555_TO_8888(s) (CONVERT_0555_TO_0888(s) | 0xff000000)
 
-static gboolean do_color_convert(SpiceDisplay *display, GdkRectangle *r)
+/*
+ * Several SpiceDisplay widgets may show different monitors of the same
+ * display channel. Instead of letting each of them handle every
+ * invalidation of the whole primary surface, a single dispatcher is
+ * attached to the channel: it routes updates only to the widgets whose
+ * area they intersect, and keeps a single 32 bits copy of 16 bits
+ * primaries that all the widgets of the channel share.
+ */
+#define DISPATCHER_KEY "spice-display-dispatcher"
+
+typedef struct DispatchEntry {
+    GdkRectangle            area;
+    SpiceDisplay            *display;
+} DispatchEntry;
+
+/* a converted buffer replaced by a resize while still held */
+typedef struct RetiredConvert {
+    guint32                 *data;
+    guint                   users;
+} RetiredConvert;
+
+static void retired_convert_free(gpointer data)
+{
+    RetiredConvert *r = data;
+
+    g_free(r->data);
+    g_free(r);
+}
+
+typedef struct DisplayDispatcher {
+    GArray                  *entries; /* DispatchEntry sorted by area.x */
+    gint                    max_width; /* widest area, bounds the lookup */
+    GdkRectangle            bounds; /* union of all the areas */
+    gboolean                gl; /* some display may have GL enabled */
+
+    struct {
+        guint32             *data;
+        guint16             *origin;
+        enum SpiceSurfaceFmt format;
+        gint                width, height, stride;
+        guint               users;
+        GSList              *retired; /* RetiredConvert, freed on last release */
+    } convert;
+} DisplayDispatcher;
+
+static void dispatcher_free(gpointer data)
+{
+    DisplayDispatcher *disp = data;
+
+    g_warn_if_fail(disp->entries->len == 0);
+    g_array_unref(disp->entries);
+    g_free(disp->convert.data);
+    g_slist_free_full(disp->convert.retired, retired_convert_free);
+    g_free(disp);
+}
+
+static DisplayDispatcher *dispatcher_get(SpiceDisplay *display)
 {
     SpiceDisplayPrivate *d = display->priv;
-    guint32 *dest = d->canvas.data;
-    guint16 *src = d->canvas.data_origin;
+
+    g_return_val_if_fail(d->display != NULL, NULL);
+
+    return g_object_get_data(G_OBJECT(d->display), DISPATCHER_KEY);
+}
+
+static gint dispatch_entry_cmp(gconstpointer a, gconstpointer b)
+{
+    const DispatchEntry *ea = a, *eb = b;
+
+    return ea->area.x - eb->area.x;
+}
+
+static void dispatcher_reindex(DisplayDispatcher *disp)
+{
+    guint i;
+
+    g_array_sort(disp->entries, dispatch_entry_cmp);
+
+    disp->max_width = 0;
+    memset(&disp->bounds, 0, sizeof(disp->bounds));
+    for (i = 0; i < disp->entries->len; i++) {
+        DispatchEntry *e = &g_array_index(disp->entries, DispatchEntry, i);
+
+        if (e->area.width <= 0 || e->area.height <= 0)
+            continue;
+
+        disp->max_width = MAX(disp->max_width, e->area.width);
+        if (disp->bounds.width == 0)
+            disp->bounds = e->area;
+        else
+            gdk_rectangle_union(&disp->bounds, &e->area, &disp->bounds);
+    }
+}
+
+static void dispatcher_convert(DisplayDispatcher *disp, const GdkRectangle *r)
+{
+    guint32 *dest = disp->convert.data;
+    guint16 *src = disp->convert.origin;
     gint x, y;
 
-    g_return_val_if_fail(r != NULL, false);
-    g_return_val_if_fail(d->canvas.format == SPICE_SURFACE_FMT_16_555 ||
-                         d->canvas.format == SPICE_SURFACE_FMT_16_565, false);
+    g_return_if_fail(r != NULL);
+    g_return_if_fail(disp->convert.format == SPICE_SURFACE_FMT_16_555 ||
+                     disp->convert.format == SPICE_SURFACE_FMT_16_565);
 
-    src += (d->canvas.stride / 2) * r->y + r->x;
-    dest += d->area.width * (r->y - d->area.y) + (r->x - d->area.x);
+    src += (disp->convert.stride / 2) * r->y + r->x;
+    dest += disp->convert.width * r->y + r->x;
 
-    if (d->canvas.format == SPICE_SURFACE_FMT_16_555) {
+    if (disp->convert.format == SPICE_SURFACE_FMT_16_555) {
         for (y = 0; y < r->height; y++) {
             for (x = 0; x < r->width; x++) {
                 dest[x] = CONVERT_0555_TO_0888(src[x]);
             }
 
-            dest += d->area.width;
-            src += d->canvas.stride / 2;
+            dest += disp->convert.width;
+            src += disp->convert.stride / 2;
         }
-    } else if (d->canvas.format == SPICE_SURFACE_FMT_16_565) {
+    } else if (disp->convert.format == SPICE_SURFACE_FMT_16_565) {
         for (y = 0; y < r->height; y++) {
             for (x = 0; x < r->width; x++) {
                 dest[x] = CONVERT_0565_TO_0888(src[x]);
             }
 
-            dest += d->area.width;
-            src += d->canvas.stride / 2;
+            dest += disp->convert.width;
+            src += disp->convert.stride / 2;
         }
     }
-
-    return true;
 }
 
+static void invalidate(SpiceDisplay *display, const GdkRectangle *rect);
 #if HAVE_EGL
-static void set_egl_enabled(SpiceDisplay *display, bool enabled)
+static void set_egl_enabled(SpiceDisplay *display, bool enabled);
+#endif
+
+static void dispatcher_invalidate(SpiceChannel *channel,
+                                  gint x, gint y, gint w, gint h, gpointer data)
+{
+    DisplayDispatcher *disp = data;
+    GdkRectangle rect = {
+        .x = x,
+        .y = y,
+        .width = w,
+        .height = h
+    };
+    GdkRectangle clip;
+    guint lo, hi;
+
+#if HAVE_EGL
+    if (disp->gl) {
+        guint i;
+
+        /* a canvas update switches all the monitors back to cairo */
+        for (i = 0; i < disp->entries->len; i++)
+            set_egl_enabled(g_array_index(disp->entries, DispatchEntry, i).display, false);
+        disp->gl = FALSE;
+    }
+#endif
+
+    if (!gdk_rectangle_intersect(&rect, &disp->bounds, &rect))
+        return;
+
+    if (disp->convert.users > 0) {
+        disp->convert.origin =
+            spice_display_channel_get_primary_data(SPICE_DISPLAY_CHANNEL(channel));
+        g_return_if_fail(disp->convert.origin != NULL);
+        dispatcher_convert(disp, &rect);
+    }
+
+    /* find the first area that may start early enough to reach rect */
+    lo = 0;
+    hi = disp->entries->len;
+    while (lo < hi) {
+        guint mid = (lo + hi) / 2;
+        DispatchEntry *e = &g_array_index(disp->entries, DispatchEntry, mid);
+
+        if (e->area.x + disp->max_width <= rect.x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (; lo < disp->entries->len; lo++) {
+        DispatchEntry *e = &g_array_index(disp->entries, DispatchEntry, lo);
+
+        if (e->area.x >= rect.x + rect.width)
+            break;
+
+        if (gdk_rectangle_intersect(&rect, &e->area, &clip))
+            invalidate(e->display, &clip);
+    }
+}
+
+static void dispatcher_add(SpiceDisplay *display)
 {
     SpiceDisplayPrivate *d = display->priv;
+    DisplayDispatcher *disp = dispatcher_get(display);
+    DispatchEntry entry = {
+        .area = d->area,
+        .display = display
+    };
 
-    if (egl_enabled(d) == enabled)
+    if (disp == NULL) {
+        disp = g_new0(DisplayDispatcher, 1);
+        disp->entries = g_array_new(FALSE, FALSE, sizeof(DispatchEntry));
+        g_object_set_data_full(G_OBJECT(d->display), DISPATCHER_KEY,
+                               disp, dispatcher_free);
+        g_signal_connect(d->display, "display-invalidate",
+                         G_CALLBACK(dispatcher_invalidate), disp);
+    }
+
+    g_array_append_val(disp->entries, entry);
+    dispatcher_reindex(disp);
+}
+
+static void dispatcher_remove(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    DisplayDispatcher *disp;
+    guint i;
+
+    if (d->display == NULL)
+        return;
+
+    disp = dispatcher_get(display);
+    if (disp == NULL)
+        return;
+
+    for (i = 0; i < disp->entries->len; i++) {
+        if (g_array_index(disp->entries, DispatchEntry, i).display == display) {
+            g_array_remove_index(disp->entries, i);
+            break;
+        }
+    }
+    dispatcher_reindex(disp);
+
+    if (disp->entries->len == 0) {
+        g_signal_handlers_disconnect_by_func(d->display, dispatcher_invalidate, disp);
+        g_object_set_data(G_OBJECT(d->display), DISPATCHER_KEY, NULL);
+    }
+}
+
+static void dispatcher_update_area(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    DisplayDispatcher *disp;
+    guint i;
+
+    if (d->display == NULL)
         return;
 
+    disp = dispatcher_get(display);
+    if (disp == NULL)
+        return;
+
+    for (i = 0; i < disp->entries->len; i++) {
+        DispatchEntry *e = &g_array_index(disp->entries, DispatchEntry, i);
+
+        if (e->display == display) {
+            e->area = d->area;
+            break;
+        }
+    }
+    dispatcher_reindex(disp);
+}
+
+/* Returns the 32 bits copy of the 16 bits primary, shared by all the
+ * monitors of the channel, with a stride of canvas.width * 4. If the
+ * canvas was resized, the monitors still holding the previous copy keep
+ * it, no longer updated, until they release it. */
+G_GNUC_INTERNAL
+gpointer spice_display_widget_acquire_converted(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+    DisplayDispatcher *disp = dispatcher_get(display);
+
+    g_return_val_if_fail(disp != NULL, NULL);
+
+    /* the origin is followed at each invalidate, as the primary may be
+     * presented through several buffers */
+    if (disp->convert.data == NULL ||
+        disp->convert.width != d->canvas.width ||
+        disp->convert.height != d->canvas.height) {
+        if (disp->convert.users > 0) {
+            RetiredConvert *r = g_new(RetiredConvert, 1);
+
+            r->data = disp->convert.data;
+            r->users = disp->convert.users;
+            disp->convert.retired = g_slist_prepend(disp->convert.retired, r);
+            disp->convert.users = 0;
+        } else {
+            g_free(disp->convert.data);
+        }
+        disp->convert.data = g_malloc0(d->canvas.width * d->canvas.height * 4);
+        disp->convert.origin = d->canvas.data_origin;
+        disp->convert.width = d->canvas.width;
+        disp->convert.height = d->canvas.height;
+    }
+    disp->convert.format = d->canvas.format;
+    disp->convert.stride = d->canvas.stride;
+    disp->convert.users++;
+
+    return disp->convert.data;
+}
+
+G_GNUC_INTERNAL
+void spice_display_widget_release_converted(SpiceDisplay *display, gpointer data)
+{
+    DisplayDispatcher *disp = dispatcher_get(display);
+
+    g_return_if_fail(disp != NULL);
+
+    if (data != disp->convert.data) {
+        GSList *l;
+
+        for (l = disp->convert.retired; l != NULL; l = l->next) {
+            RetiredConvert *r = l->data;
+
+            if (r->data != data)
+                continue;
+            if (--r->users == 0) {
+                disp->convert.retired = g_slist_delete_link(disp->convert.retired, l);
+                retired_convert_free(r);
+            }
+            return;
+        }
+        g_return_if_reached();
+    }
+
+    g_return_if_fail(disp->convert.users > 0);
+
+    if (--disp->convert.users == 0) {
+        g_clear_pointer(&disp->convert.data, g_free);
+        disp->convert.origin = NULL;
+        disp->convert.width = disp->convert.height = 0;
+    }
+}
+
+#if HAVE_EGL
+static void set_gl_visible(SpiceDisplay *display, bool gl)
+{
+    SpiceDisplayPrivate *d = display->priv;
+
 #ifdef GDK_WINDOWING_X11
     if (GDK_IS_X11_DISPLAY(gdk_display_get_default())) {
         /* even though the function is marked as deprecated, it's the
@@ -1276,19 +1696,58 @@ static void set_egl_enabled(SpiceDisplay *display, bool enabled)
          * resized. */
         GtkWidget *area = gtk_stack_get_child_by_name(d->stack, "draw-area");
         G_GNUC_BEGIN_IGNORE_DEPRECATIONS
-        gtk_widget_set_double_buffered(GTK_WIDGET(area), !enabled);
+        gtk_widget_set_double_buffered(GTK_WIDGET(area), !gl);
         G_GNUC_END_IGNORE_DEPRECATIONS
     } else
 #endif
     {
         gtk_stack_set_visible_child_name(d->stack,
-                                         enabled ? "gl-area" : "draw-area");
+                                         gl ? "gl-area" : "draw-area");
     }
+}
+
+static void set_egl_canvas(SpiceDisplay *display, bool enabled)
+{
+    SpiceDisplayPrivate *d = display->priv;
+
+    if (d->egl.canvas == enabled)
+        return;
+
+    DISPLAY_DEBUG(display, "GL canvas %s", enabled ? "enabled" : "disabled");
+    d->egl.canvas = enabled;
+    spice_egl_canvas_reset(display);
+    if (!egl_enabled(d))
+        set_gl_visible(display, enabled);
+
+    if (enabled) {
+        spice_egl_cursor_set(display);
+        if (!egl_canvas_queue_render(display))
+            gtk_widget_queue_draw(GTK_WIDGET(display));
+    }
+}
+
+static void set_egl_enabled(SpiceDisplay *display, bool enabled)
+{
+    SpiceDisplayPrivate *d = display->priv;
+
+    if (egl_enabled(d) == enabled)
+        return;
+
+    set_gl_visible(display, enabled || d->egl.canvas);
+    if (!enabled && d->egl.canvas)
+        spice_egl_canvas_reset(display);
 
     if (enabled && d->egl.context_ready) {
         spice_egl_resize_display(display, d->ww, d->wh);
     }
 
+    if (enabled && d->display != NULL) {
+        DisplayDispatcher *disp = dispatcher_get(display);
+
+        if (disp != NULL)
+            disp->gl = TRUE;
+    }
+
     d->egl.enabled = enabled;
 }
 #endif
@@ -1307,10 +1766,20 @@ static gboolean draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
     }
 #endif
 
+    update_primary_data(display);
     if (d->mark == 0 || d->canvas.data == NULL ||
         d->area.width == 0 || d->area.height == 0)
         return false;
 
+#if HAVE_EGL
+    if (d->egl.canvas && d->egl.context_ready &&
+        g_str_equal(gtk_stack_get_visible_child_name(d->stack), "draw-area")) {
+        spice_egl_canvas_draw(display);
+        update_mouse_pointer(display);
+        return false;
+    }
+#endif
+
     spice_cairo_draw_event(display, cr);
     update_mouse_pointer(display);
 
@@ -2095,8 +2564,8 @@ static void update_image(SpiceDisplay *display)
     SpiceDisplayPrivate *d = display->priv;
 
     spice_cairo_image_create(display);
-    if (d->canvas.convert)
-        do_color_convert(display, &d->area);
+    if (d->canvas.convert && d->canvas.data != NULL)
+        dispatcher_convert(dispatcher_get(display), &d->area);
 }
 
 static void realize(GtkWidget *widget)
@@ -2115,6 +2584,7 @@ static void realize(GtkWidget *widget)
 
 static void unrealize(GtkWidget *widget)
 {
+    cursor_move_flush(SPICE_DISPLAY(widget));
     spice_cairo_image_destroy(SPICE_DISPLAY(widget));
 #if HAVE_EGL
     if (SPICE_DISPLAY(widget)->priv->egl.context_ready)
@@ -2437,6 +2907,7 @@ static void update_mouse_mode(SpiceChannel *channel, gpointer data)
         try_mouse_ungrab(display);
         break;
     case SPICE_MOUSE_MODE_SERVER:
+        cursor_move_flush(display);
         d->mouse_guest_x = -1;
         d->mouse_guest_y = -1;
 
@@ -2487,6 +2958,7 @@ static void update_area(SpiceDisplay *display,
     if (!gdk_rectangle_intersect(&primary, &d->area, &d->area)) {
         DISPLAY_DEBUG(display, "The monitor area is not intersecting primary surface");
         memset(&d->area, '\0', sizeof(d->area));
+        dispatcher_update_area(display);
         set_monitor_ready(display, false);
         return;
     }
@@ -2497,6 +2969,10 @@ static void update_area(SpiceDisplay *display,
             update_image(display);
     }
 
+#if HAVE_EGL
+    spice_egl_canvas_reset(display);
+#endif
+    dispatcher_update_area(display);
     update_size_request(display);
 
     set_monitor_ready(display, true);
@@ -2524,6 +3000,10 @@ static void primary_destroy(SpiceDisplayChannel *channel, gpointer data)
     SpiceDisplayPrivate *d = display->priv;
 
     spice_cairo_image_destroy(display);
+#if HAVE_EGL
+    spice_egl_canvas_reset(display);
+#endif
+    g_hash_table_remove_all(d->stream_overlays);
     d->canvas.width  = 0;
     d->canvas.height = 0;
     d->canvas.stride = 0;
@@ -2532,6 +3012,54 @@ static void primary_destroy(SpiceDisplayChannel *channel, gpointer data)
     set_monitor_ready(display, false);
 }
 
+static const cairo_user_data_key_t stream_pixels_key;
+
+static gboolean stream_frame(SpiceDisplayChannel *channel, guint id,
+                             SpiceDisplayStreamFrame *frame, gpointer data)
+{
+    SpiceDisplay *display = SPICE_DISPLAY(data);
+    SpiceDisplayPrivate *d = display->priv;
+    SpiceStreamOverlay *overlay;
+    GdkRectangle clip;
+
+    /* written back to the primary, which gets invalidated */
+    if (frame->pixels == NULL) {
+        g_hash_table_remove(d->stream_overlays, GUINT_TO_POINTER(id));
+        return FALSE;
+    }
+
+    if (d->canvas.convert ||
+        frame->stride % 4 != 0 ||
+        egl_enabled(d)
+#if HAVE_EGL
+        || d->egl.canvas
+#endif
+        ) {
+        g_hash_table_remove(d->stream_overlays, GUINT_TO_POINTER(id));
+        return FALSE;
+    }
+
+    overlay = g_new0(SpiceStreamOverlay, 1);
+    overlay->dest.x = frame->x;
+    overlay->dest.y = frame->y;
+    overlay->dest.width = frame->width;
+    overlay->dest.height = frame->height;
+    overlay->width = frame->frame_width;
+    overlay->height = frame->frame_height;
+    overlay->surface = cairo_image_surface_create_for_data
+        ((guchar *)g_bytes_get_data(frame->pixels, NULL), CAIRO_FORMAT_RGB24,
+         frame->frame_width, frame->frame_height, frame->stride);
+    cairo_surface_set_user_data(overlay->surface, &stream_pixels_key,
+                                g_bytes_ref(frame->pixels),
+                                (cairo_destroy_func_t)g_bytes_unref);
+    g_hash_table_replace(d->stream_overlays, GUINT_TO_POINTER(id), overlay);
+
+    if (gdk_rectangle_intersect(&overlay->dest, &d->area, &clip))
+        invalidate(display, &clip);
+
+    return TRUE;
+}
+
 static void queue_draw_area(SpiceDisplay *display, gint x, gint y,
                             gint width, gint height)
 {
@@ -2569,42 +3097,33 @@ static void* prepare_streaming_mode(SpiceChannel *channel, bool streaming_mode,
     return NULL;
 }
 
-static void invalidate(SpiceChannel *channel,
-                       gint x, gint y, gint w, gint h, gpointer data)
+/* called by the dispatcher with rect already clipped to the area */
+static void invalidate(SpiceDisplay *display, const GdkRectangle *rect)
 {
-    SpiceDisplay *display = data;
     SpiceDisplayPrivate *d = display->priv;
     int display_x, display_y;
     int x1, y1, x2, y2;
     double s;
-    GdkRectangle rect = {
-        .x = x,
-        .y = y,
-        .width = w,
-        .height = h
-    };
-
-#if HAVE_EGL
-    set_egl_enabled(display, false);
-#endif
 
     if (!gtk_widget_get_window(GTK_WIDGET(display)))
         return;
 
-    if (!gdk_rectangle_intersect(&rect, &d->area, &rect))
-        return;
-
-    if (d->canvas.convert)
-        do_color_convert(display, &rect);
+#if HAVE_EGL
+    if (d->egl.canvas) {
+        spice_egl_canvas_invalidate(display, rect);
+        if (egl_canvas_queue_render(display))
+            return;
+    }
+#endif
 
     spice_display_get_scaling(display, &s,
                               &display_x, &display_y,
                               NULL, NULL);
 
-    x1 = floor ((rect.x - d->area.x) * s);
-    y1 = floor ((rect.y - d->area.y) * s);
-    x2 = ceil ((rect.x - d->area.x + rect.width) * s);
-    y2 = ceil ((rect.y - d->area.y + rect.height) * s);
+    x1 = floor ((rect->x - d->area.x) * s);
+    y1 = floor ((rect->y - d->area.y) * s);
+    x2 = ceil ((rect->x - d->area.x + rect->width) * s);
+    y2 = ceil ((rect->y - d->area.y + rect->height) * s);
 
     queue_draw_area(display,
                     display_x + x1, display_y + y1,
@@ -2647,6 +3166,7 @@ static void cursor_set(SpiceCursorChannel *channel,
 
     cursor_invalidate(display);
     g_clear_object(&d->mouse_pixbuf);
+    g_clear_pointer(&d->mouse_surface, cairo_surface_destroy);
     d->mouse_pixbuf = gdk_pixbuf_new_from_data(cursor_shape->data,
                                                GDK_COLORSPACE_RGB,
                                                TRUE, 8,
@@ -2654,6 +3174,8 @@ static void cursor_set(SpiceCursorChannel *channel,
                                                cursor_shape->height,
                                                cursor_shape->width * 4,
                                                cursor_shape_destroy, cursor_shape);
+    /* convert once rather than at each redraw */
+    d->mouse_surface = gdk_cairo_surface_create_from_pixbuf(d->mouse_pixbuf, 1, NULL);
     d->mouse_hotspot.x = cursor_shape->hot_spot_x;
     d->mouse_hotspot.y = cursor_shape->hot_spot_y;
     cursor = gdk_cursor_new_from_pixbuf(gtk_widget_get_display(GTK_WIDGET(display)),
@@ -2662,7 +3184,7 @@ static void cursor_set(SpiceCursorChannel *channel,
                                         d->mouse_hotspot.y);
 
 #if HAVE_EGL
-    if (egl_enabled(d))
+    if (egl_enabled(d) || d->egl.canvas)
         spice_egl_cursor_set(display);
 #endif
     if (d->show_cursor) {
@@ -2770,6 +3292,11 @@ static void cursor_invalidate(SpiceDisplay *display)
     if (!d->ready || !d->monitor_ready)
         return;
 
+#if HAVE_EGL
+    if (egl_canvas_queue_render(display))
+        return;
+#endif
+
     spice_display_get_scaling(display, &s, &x, &y, NULL, NULL);
 
     queue_draw_area(display,
@@ -2779,17 +3306,62 @@ static void cursor_invalidate(SpiceDisplay *display)
                     ceil (gdk_pixbuf_get_height(d->mouse_pixbuf) * s));
 }
 
-static void cursor_move(SpiceCursorChannel *channel, gint x, gint y, gpointer data)
+static void cursor_move_apply(SpiceDisplay *display)
 {
-    SpiceDisplay *display = data;
     SpiceDisplayPrivate *d = display->priv;
 
+    if (d->mouse_guest_x == d->mouse_move_x &&
+        d->mouse_guest_y == d->mouse_move_y)
+        return;
+
     cursor_invalidate(display);
 
-    d->mouse_guest_x = x;
-    d->mouse_guest_y = y;
+    d->mouse_guest_x = d->mouse_move_x;
+    d->mouse_guest_y = d->mouse_move_y;
 
     cursor_invalidate(display);
+}
+
+static gboolean cursor_move_tick(GtkWidget *widget,
+                                 GdkFrameClock *frame_clock,
+                                 gpointer data)
+{
+    SpiceDisplay *display = SPICE_DISPLAY(widget);
+
+    display->priv->mouse_move_tick_id = 0;
+    cursor_move_apply(display);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* apply a cursor move still waiting for the next frame */
+static void cursor_move_flush(SpiceDisplay *display)
+{
+    SpiceDisplayPrivate *d = display->priv;
+
+    if (d->mouse_move_tick_id == 0)
+        return;
+
+    gtk_widget_remove_tick_callback(GTK_WIDGET(display), d->mouse_move_tick_id);
+    d->mouse_move_tick_id = 0;
+    cursor_move_apply(display);
+}
+
+static void cursor_move(SpiceCursorChannel *channel, gint x, gint y, gpointer data)
+{
+    SpiceDisplay *display = data;
+    SpiceDisplayPrivate *d = display->priv;
+
+    /* several moves may be received during a frame, only the last
+     * position needs to be drawn */
+    d->mouse_move_x = x;
+    d->mouse_move_y = y;
+    if (!gtk_widget_get_realized(GTK_WIDGET(display))) {
+        cursor_move_apply(display);
+    } else if (d->mouse_move_tick_id == 0) {
+        d->mouse_move_tick_id =
+            gtk_widget_add_tick_callback(GTK_WIDGET(display), cursor_move_tick, NULL, NULL);
+    }
 
     /* apparently we have to restore cursor when "cursor_move" */
     if (d->show_cursor != NULL) {
@@ -2843,23 +3415,7 @@ void spice_display_widget_gl_scanout(SpiceDisplay *display)
     DISPLAY_DEBUG(display, "%s: got scanout",  __FUNCTION__);
 
 #ifdef GDK_WINDOWING_X11
-    GtkWidget *area = gtk_stack_get_child_by_name(d->stack, "draw-area");
-
-    if (GDK_IS_X11_DISPLAY(gdk_display_get_default()) &&
-        !d->egl.context_ready &&
-        gtk_widget_get_realized(area)) {
-        if (!spice_egl_init(display, &err)) {
-            g_critical("egl init failed: %s", err->message);
-            g_clear_error(&err);
-        }
-
-        if (!spice_egl_realize_display(display, gtk_widget_get_window(area), &err)) {
-            g_critical("egl realize failed: %s", err->message);
-            g_clear_error(&err);
-        }
-
-        spice_egl_resize_display(display, d->ww, d->wh);
-    }
+    egl_realize_x11(display);
 #endif
 
     set_egl_enabled(display, true);
@@ -2925,12 +3481,11 @@ static void channel_new(SpiceSession *s, SpiceChannel *channel, SpiceDisplay *di
         if (id != d->channel_id)
             return;
         d->display = SPICE_DISPLAY_CHANNEL(channel);
+        dispatcher_add(display);
         spice_g_signal_connect_object(channel, "display-primary-create",
                                       G_CALLBACK(primary_create), display, 0);
         spice_g_signal_connect_object(channel, "display-primary-destroy",
                                       G_CALLBACK(primary_destroy), display, 0);
-        spice_g_signal_connect_object(channel, "display-invalidate",
-                                      G_CALLBACK(invalidate), display, 0);
         spice_g_signal_connect_object(channel, "display-mark",
                                       G_CALLBACK(mark), display, G_CONNECT_AFTER | G_CONNECT_SWAPPED);
         spice_g_signal_connect_object(channel, "notify::monitors",
@@ -2938,6 +3493,10 @@ static void channel_new(SpiceSession *s, SpiceChannel *channel, SpiceDisplay *di
                                       display, G_CONNECT_AFTER | G_CONNECT_SWAPPED);
         spice_g_signal_connect_object(channel, "streaming-mode",
                                       G_CALLBACK(prepare_streaming_mode), display, G_CONNECT_AFTER);
+        /* without a handler, the channel doesn't offer the frames */
+        if (d->stream_overlay_enable)
+            spice_g_signal_connect_object(channel, "stream-frame",
+                                          G_CALLBACK(stream_frame), display, 0);
         if (spice_display_channel_get_primary(channel, 0, &primary)) {
             primary_create(channel, primary.format, primary.width, primary.height,
                            primary.stride, primary.shmid, primary.data, display);
@@ -3015,6 +3574,7 @@ static void channel_destroy(SpiceSession *s, SpiceChannel *channel, SpiceDisplay
         if (id != d->channel_id)
             return;
         primary_destroy(d->display, display);
+        dispatcher_remove(display);
         d->display = NULL;
         return;
     }
@@ -3129,15 +3689,37 @@ GdkPixbuf *spice_display_get_pixbuf(SpiceDisplay *display)
 #endif
     {
         guchar *src, *dest;
-        int x, y;
+        int x, y, stride;
 
         /* TODO: ensure d->data has been exposed? */
+        update_primary_data(display);
         g_return_val_if_fail(d->canvas.data != NULL, NULL);
+
+        if (d->canvas.surface != NULL && g_hash_table_size(d->stream_overlays) > 0) {
+            /* the video frames are not written to the canvas */
+            cairo_surface_t *surface;
+            cairo_t *cr;
+
+            surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                                 d->area.width, d->area.height);
+            cr = cairo_create(surface);
+            cairo_translate(cr, -d->area.x, -d->area.y);
+            cairo_set_source_surface(cr, d->canvas.surface, 0, 0);
+            cairo_paint(cr);
+            spice_cairo_paint_overlays(display, cr);
+            cairo_destroy(cr);
+            pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0,
+                                                 d->area.width, d->area.height);
+            cairo_surface_destroy(surface);
+            return pixbuf;
+        }
+
         data = g_malloc0(d->area.width * d->area.height * 3);
         src = d->canvas.data;
         dest = data;
 
-        src += d->area.y * d->canvas.stride + d->area.x * 4;
+        stride = d->canvas.convert ? d->canvas.width * 4 : d->canvas.stride;
+        src += d->area.y * stride + d->area.x * 4;
         for (y = 0; y < d->area.height; ++y) {
             for (x = 0; x < d->area.width; ++x) {
                 dest[0] = src[x * 4 + 2];
@@ -3145,7 +3727,7 @@ GdkPixbuf *spice_display_get_pixbuf(SpiceDisplay *display)
                 dest[2] = src[x * 4 + 0];
                 dest += 3;
             }
-            src += d->canvas.stride;
+            src += stride;
         }
         pixbuf = gdk_pixbuf_new_from_data(data, GDK_COLORSPACE_RGB, false,
                                           8, d->area.width, d->area.height,
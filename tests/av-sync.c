@@ -0,0 +1,104 @@
+#include <glib.h>
+
+#include "spice-av-sync.h"
+
+/* 30 fps */
+#define INTERVAL (G_USEC_PER_SEC / 30)
+
+/* Presents @n frames @lag ms after their audio, once the corrections
+ * so far are applied: they take effect at once */
+static void frames_run(AVSync *sync, gint64 *now, guint n, gint32 lag)
+{
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        gint32 offset = lag - av_sync_get_video_advance(sync) - av_sync_get_audio_delay(sync);
+
+        *now += INTERVAL;
+        av_sync_add_offset(sync, offset, *now);
+    }
+}
+
+static void test_in_sync(void)
+{
+    AVSync *sync = av_sync_new();
+    gint64 now = 0;
+    gint32 offset;
+
+    g_assert_false(av_sync_get_offset(sync, &offset));
+
+    frames_run(sync, &now, 300, 5);
+    g_assert_true(av_sync_get_offset(sync, &offset));
+    g_assert_cmpint(offset, ==, 5);
+    g_assert_cmpuint(av_sync_get_video_advance(sync), ==, 0);
+    g_assert_cmpuint(av_sync_get_audio_delay(sync), ==, 0);
+
+    av_sync_free(sync);
+}
+
+static void test_video_late(void)
+{
+    AVSync *sync = av_sync_new();
+    gint64 now = 0;
+    gint32 offset;
+
+    /* a late presentation is made up for by the video alone */
+    frames_run(sync, &now, 300, 30);
+    g_assert_cmpuint(av_sync_get_video_advance(sync), >=, 30 - 15);
+    g_assert_cmpuint(av_sync_get_video_advance(sync), <=, 30);
+    g_assert_cmpuint(av_sync_get_audio_delay(sync), ==, 0);
+    av_sync_get_offset(sync, &offset);
+    g_assert_cmpint(ABS(offset), <=, 15);
+
+    av_sync_free(sync);
+}
+
+static void test_audio_delay(void)
+{
+    AVSync *sync = av_sync_new();
+    gint64 now = 0;
+    gint32 offset;
+
+    /* too late for the video alone: the audio is delayed, slowly */
+    frames_run(sync, &now, 30, 100);
+    g_assert_cmpuint(av_sync_get_audio_delay(sync), ==, 0);
+    frames_run(sync, &now, 30 * 60, 100);
+    g_assert_cmpuint(av_sync_get_video_advance(sync), ==, 40);
+    g_assert_cmpuint(av_sync_get_audio_delay(sync), >=, 60 - 15);
+    av_sync_get_offset(sync, &offset);
+    g_assert_cmpint(ABS(offset), <=, 15);
+
+    /* the network got better: the audio latency is given back first */
+    frames_run(sync, &now, 30 * 60, 40);
+    g_assert_cmpuint(av_sync_get_audio_delay(sync), ==, 0);
+    g_assert_cmpuint(av_sync_get_video_advance(sync), >=, 40 - 15);
+
+    av_sync_free(sync);
+}
+
+static void test_reset(void)
+{
+    AVSync *sync = av_sync_new();
+    gint64 now = 0;
+    gint32 offset;
+
+    frames_run(sync, &now, 300, 30);
+    av_sync_reset(sync);
+    g_assert_false(av_sync_get_offset(sync, &offset));
+    /* the corrections are kept */
+    g_assert_cmpuint(av_sync_get_video_advance(sync), >, 0);
+
+    av_sync_free(sync);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/av-sync/in-sync", test_in_sync);
+    g_test_add_func("/av-sync/video-late", test_video_late);
+    g_test_add_func("/av-sync/audio-delay", test_audio_delay);
+    g_test_add_func("/av-sync/reset", test_reset);
+
+    return g_test_run();
+}
@@ -0,0 +1,188 @@
+#include <string.h>
+#include <spice/vd_agent.h>
+
+#include "mock-server.h"
+
+/* over CLIPBOARD_STREAM_MIN, so streamed both ways */
+#define CLIPBOARD_SIZE (300 * 1024 + 17)
+
+typedef struct Fixture {
+    SpiceSession *session;
+    SpiceChannel *channel;
+    MockServer *server;
+    GBytes *data;
+
+    /* what the client got */
+    GByteArray *received;
+    guint pieces;
+    gint complete;
+} Fixture;
+
+static const guint32 agent_caps =
+    (1 << VD_AGENT_CAP_CLIPBOARD_BY_DEMAND) | (1 << VD_AGENT_CAP_CLIPBOARD_SELECTION);
+
+static void fixture_setup(Fixture *f, gconstpointer user_data)
+{
+    guint8 *data = g_malloc(CLIPBOARD_SIZE);
+    guint i;
+
+    for (i = 0; i < CLIPBOARD_SIZE; i++)
+        data[i] = i * 7 + i / 251;
+    f->data = g_bytes_new_take(data, CLIPBOARD_SIZE);
+    f->received = g_byte_array_new();
+
+    f->session = spice_session_new();
+    g_object_set(f->session, "client-sockets", TRUE, NULL);
+    f->channel = spice_channel_new(f->session, SPICE_CHANNEL_MAIN, 0);
+    f->server = mock_server_new();
+    mock_server_link(f->server, f->channel);
+}
+
+static void fixture_teardown(Fixture *f, gconstpointer user_data)
+{
+    spice_session_disconnect(f->session);
+    mock_server_free(f->server);
+    while (g_main_context_iteration(NULL, FALSE));
+    g_object_unref(f->session);
+    g_byte_array_unref(f->received);
+    g_bytes_unref(f->data);
+}
+
+/* script context */
+static void wait_complete(Fixture *f)
+{
+    guint i;
+
+    for (i = 0; i < 5000 && !g_atomic_int_get(&f->complete); i++)
+        g_usleep(1000);
+    g_assert_true(g_atomic_int_get(&f->complete));
+}
+
+static gboolean notify_data(gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    spice_main_channel_clipboard_selection_notify_bytes(SPICE_MAIN_CHANNEL(f->channel),
+                                                        VD_AGENT_CLIPBOARD_SELECTION_PRIMARY,
+                                                        VD_AGENT_CLIPBOARD_IMAGE_PNG,
+                                                        f->data);
+    return G_SOURCE_REMOVE;
+}
+
+static void script_send(MockServer *server, gpointer user_data)
+{
+    Fixture *f = user_data;
+    const guint8 *payload;
+    GBytes *msg;
+    guint32 type;
+    gsize size;
+
+    mock_server_agent_start(server, 10, 0, &agent_caps, 1);
+    mock_server_invoke(server, notify_data, f);
+
+    do {
+        msg = mock_server_agent_recv(server, &type, 5000);
+        g_assert_nonnull(msg);
+        if (type != VD_AGENT_CLIPBOARD)
+            g_bytes_unref(msg);
+    } while (type != VD_AGENT_CLIPBOARD);
+
+    /* the selection, then the type of the data */
+    payload = g_bytes_get_data(msg, &size);
+    g_assert_cmpuint(size, ==, 4 + sizeof(VDAgentClipboard) + CLIPBOARD_SIZE);
+    g_assert_cmpuint(payload[0], ==, VD_AGENT_CLIPBOARD_SELECTION_PRIMARY);
+    g_assert_cmpuint(((VDAgentClipboard *)(payload + 4))->type, ==,
+                     VD_AGENT_CLIPBOARD_IMAGE_PNG);
+    g_assert_true(memcmp(payload + 4 + sizeof(VDAgentClipboard),
+                         g_bytes_get_data(f->data, NULL), CLIPBOARD_SIZE) == 0);
+    g_bytes_unref(msg);
+}
+
+static void test_send(Fixture *f, gconstpointer user_data)
+{
+    mock_server_run(f->server, script_send, f);
+}
+
+static void clipboard_data(SpiceMainChannel *channel, guint selection, guint type,
+                           gpointer data, guint size, guint offset, guint total,
+                           gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    g_assert_cmpuint(selection, ==, VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD);
+    g_assert_cmpuint(type, ==, VD_AGENT_CLIPBOARD_UTF8_TEXT);
+    g_assert_cmpuint(total, ==, CLIPBOARD_SIZE);
+    /* in order, without gaps */
+    g_assert_cmpuint(offset, ==, f->received->len);
+    g_assert_cmpuint(offset + size, <=, total);
+
+    g_byte_array_append(f->received, data, size);
+    f->pieces++;
+    if (offset + size == total)
+        g_atomic_int_set(&f->complete, TRUE);
+}
+
+static void script_receive(MockServer *server, gpointer user_data)
+{
+    Fixture *f = user_data;
+    gsize size = 4 + sizeof(VDAgentClipboard) + CLIPBOARD_SIZE;
+    guint8 *payload = g_malloc0(size);
+
+    mock_server_agent_start(server, 10, 0, &agent_caps, 1);
+
+    payload[0] = VD_AGENT_CLIPBOARD_SELECTION_CLIPBOARD;
+    ((VDAgentClipboard *)(payload + 4))->type = VD_AGENT_CLIPBOARD_UTF8_TEXT;
+    memcpy(payload + 4 + sizeof(VDAgentClipboard), g_bytes_get_data(f->data, NULL),
+           CLIPBOARD_SIZE);
+    mock_server_agent_send(server, VD_AGENT_CLIPBOARD, payload, size);
+    g_free(payload);
+
+    wait_complete(f);
+}
+
+static void test_receive(Fixture *f, gconstpointer user_data)
+{
+    g_signal_connect(f->channel, "main-clipboard-selection-data",
+                     G_CALLBACK(clipboard_data), f);
+    mock_server_run(f->server, script_receive, f);
+
+    /* handed over as it arrived, not once whole */
+    g_assert_cmpuint(f->pieces, >, 1);
+    g_assert_cmpuint(f->received->len, ==, CLIPBOARD_SIZE);
+    g_assert_true(memcmp(f->received->data, g_bytes_get_data(f->data, NULL),
+                         CLIPBOARD_SIZE) == 0);
+}
+
+static gboolean notify_at_limit(gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    /* the limit is exclusive */
+    g_object_set(f->channel, "max-clipboard", CLIPBOARD_SIZE, NULL);
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*max_clipboard*");
+    notify_data(f);
+    g_test_assert_expected_messages();
+    return G_SOURCE_REMOVE;
+}
+
+static void script_limit(MockServer *server, gpointer user_data)
+{
+    mock_server_agent_start(server, 10, 0, &agent_caps, 1);
+    mock_server_invoke(server, notify_at_limit, user_data);
+}
+
+static void test_limit(Fixture *f, gconstpointer user_data)
+{
+    mock_server_run(f->server, script_limit, f);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/clipboard/send", Fixture, NULL, fixture_setup, test_send, fixture_teardown);
+    g_test_add("/clipboard/receive", Fixture, NULL, fixture_setup, test_receive, fixture_teardown);
+    g_test_add("/clipboard/limit", Fixture, NULL, fixture_setup, test_limit, fixture_teardown);
+
+    return g_test_run();
+}
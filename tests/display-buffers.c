@@ -0,0 +1,163 @@
+#include <string.h>
+#include <glib.h>
+
+#include "channel-display-buffers.h"
+
+#define WIDTH 16
+#define HEIGHT 8
+#define STRIDE (WIDTH * 4)
+
+static void fill(guint32 *data, gint x, gint y, gint width, gint height, guint32 value)
+{
+    gint i, j;
+
+    for (j = y; j < y + height; j++)
+        for (i = x; i < x + width; i++)
+            data[j * WIDTH + i] = value;
+}
+
+static guint32 pixel(const guint8 *data, gint x, gint y)
+{
+    return ((const guint32 *)data)[y * WIDTH + x];
+}
+
+static void swap(primary_buffers *b, const guint32 *src)
+{
+    pixman_region32_t damage;
+
+    g_assert_true(primary_buffers_swap(b, (const guint8 *)src, &damage));
+    pixman_region32_fini(&damage);
+}
+
+static void test_swap(void)
+{
+    primary_buffers *b = primary_buffers_new(WIDTH, HEIGHT, STRIDE, 4, 2);
+    guint32 src[WIDTH * HEIGHT] = { 0, };
+    pixman_region32_t damage;
+    pixman_box32_t *box;
+    guint8 *front;
+    int n;
+
+    /* nothing to publish */
+    front = primary_buffers_get_front(b);
+    g_assert_false(primary_buffers_has_damage(b));
+    g_assert_false(primary_buffers_swap(b, (guint8 *)src, &damage));
+    g_assert_true(primary_buffers_get_front(b) == front);
+
+    /* a batch is only seen once swapped, clipped to the surface */
+    fill(src, 0, 0, 4, 4, 1);
+    primary_buffers_damage(b, -2, -2, 6, 6);
+    g_assert_true(primary_buffers_has_damage(b));
+    g_assert_true(primary_buffers_get_front(b) == front);
+    g_assert_true(primary_buffers_swap(b, (guint8 *)src, &damage));
+    g_assert_false(primary_buffers_has_damage(b));
+    box = pixman_region32_rectangles(&damage, &n);
+    g_assert_cmpint(n, ==, 1);
+    g_assert_cmpint(box->x1, ==, 0);
+    g_assert_cmpint(box->y1, ==, 0);
+    g_assert_cmpint(box->x2, ==, 4);
+    g_assert_cmpint(box->y2, ==, 4);
+    pixman_region32_fini(&damage);
+
+    g_assert_true(primary_buffers_get_front(b) != front);
+    front = primary_buffers_get_front(b);
+    g_assert_cmphex(pixel(front, 3, 3), ==, 1);
+    g_assert_cmphex(pixel(front, 4, 4), ==, 0);
+
+    /* the other buffer catches up with the batch it missed */
+    fill(src, 8, 4, 8, 4, 2);
+    primary_buffers_damage(b, 8, 4, 8, 4);
+    swap(b, src);
+    g_assert_true(primary_buffers_get_front(b) != front);
+    front = primary_buffers_get_front(b);
+    g_assert_cmphex(pixel(front, 3, 3), ==, 1);
+    g_assert_cmphex(pixel(front, 15, 7), ==, 2);
+
+    primary_buffers_free(b);
+}
+
+static void test_triple(void)
+{
+    primary_buffers *b = primary_buffers_new(WIDTH, HEIGHT, STRIDE, 4, 3);
+    guint32 src[WIDTH * HEIGHT] = { 0, };
+    guint8 *fronts[4];
+    guint i;
+
+    fronts[0] = primary_buffers_get_front(b);
+    for (i = 1; i < 4; i++) {
+        fill(src, 0, 0, WIDTH, HEIGHT, i);
+        primary_buffers_damage(b, 0, 0, WIDTH, HEIGHT);
+        swap(b, src);
+        fronts[i] = primary_buffers_get_front(b);
+        g_assert_cmphex(pixel(fronts[i], 0, 0), ==, i);
+        /* the previous front is left alone until the next swap */
+        g_assert_true(fronts[i] != fronts[i - 1]);
+        if (i >= 2) {
+            g_assert_true(fronts[i] != fronts[i - 2]);
+            g_assert_cmphex(pixel(fronts[i - 1], 0, 0), ==, i - 1);
+        }
+    }
+    g_assert_true(fronts[3] == fronts[0]);
+
+    primary_buffers_free(b);
+}
+
+#define THREAD_FRAMES 2000
+
+typedef struct Reader {
+    primary_buffers *b;
+    gint seen;
+} Reader;
+
+/* a rendering thread: each front it gets must be whole */
+static gpointer reader_thread(gpointer user_data)
+{
+    Reader *reader = user_data;
+    guint32 last = 0;
+
+    while (last < THREAD_FRAMES) {
+        const guint8 *front = primary_buffers_get_front(reader->b);
+        guint32 value = pixel(front, 0, 0);
+        gint x, y;
+
+        g_assert_cmpuint(value, >=, last);
+        for (y = 0; y < HEIGHT; y++)
+            for (x = 0; x < WIDTH; x++)
+                g_assert_cmphex(pixel(front, x, y), ==, value);
+        last = value;
+        g_atomic_int_set(&reader->seen, value);
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    Reader reader = { primary_buffers_new(WIDTH, HEIGHT, STRIDE, 4, 3), 0 };
+    guint32 src[WIDTH * HEIGHT] = { 0, };
+    GThread *thread;
+    guint i;
+
+    thread = g_thread_new("reader", reader_thread, &reader);
+    for (i = 1; i <= THREAD_FRAMES; i++) {
+        /* the buffer about to be written held frame i - 3: the reader
+         * must have moved on from it */
+        while (i >= 3 && g_atomic_int_get(&reader.seen) < (gint)i - 2)
+            g_thread_yield();
+        fill(src, 0, 0, WIDTH, HEIGHT, i);
+        primary_buffers_damage(reader.b, 0, 0, WIDTH, HEIGHT);
+        swap(reader.b, src);
+    }
+    g_thread_join(thread);
+    primary_buffers_free(reader.b);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/display-buffers/swap", test_swap);
+    g_test_add_func("/display-buffers/triple", test_triple);
+    g_test_add_func("/display-buffers/threads", test_threads);
+
+    return g_test_run();
+}
@@ -0,0 +1,153 @@
+#include <glib.h>
+
+#include "channel-display-timings.h"
+
+static void test_ring(void)
+{
+    stream_timings *t = stream_timings_new();
+    SpiceStreamTiming timing, *last;
+    gint first, frame;
+    guint i;
+
+    g_assert_false(stream_timings_get(t, 0, &timing));
+    g_assert_cmpuint(stream_timings_get_last(t, &timing, 1), ==, 0);
+
+    first = stream_timings_start(t, 3, 1000);
+    stream_timings_mark(t, first, SPICE_STREAM_TIMING_ARRIVAL, 10, 100);
+    stream_timings_mark(t, first, SPICE_STREAM_TIMING_PRESENTED, 20, -5);
+    g_assert_true(stream_timings_get(t, first, &timing));
+    g_assert_cmpuint(timing.stream_id, ==, 3);
+    g_assert_cmpuint(timing.mm_time, ==, 1000);
+    g_assert_cmpint(timing.time[SPICE_STREAM_TIMING_ARRIVAL], ==, 10);
+    g_assert_cmpint(timing.time[SPICE_STREAM_TIMING_DECODE_START], ==, 0);
+    g_assert_cmpint(timing.mm_delta[SPICE_STREAM_TIMING_PRESENTED], ==, -5);
+
+    /* once the ring went round, the old frame is gone for good */
+    for (i = 0; i < STREAM_TIMINGS_MAX; i++)
+        frame = stream_timings_start(t, 3, 1001 + i);
+    g_assert_false(stream_timings_get(t, first, &timing));
+    stream_timings_mark(t, first, SPICE_STREAM_TIMING_DECODE_END, 30, 0);
+    g_assert_true(stream_timings_get(t, frame, &timing));
+    g_assert_cmpint(timing.time[SPICE_STREAM_TIMING_DECODE_END], ==, 0);
+
+    last = g_new(SpiceStreamTiming, STREAM_TIMINGS_MAX + 1);
+    g_assert_cmpuint(stream_timings_get_last(t, last, STREAM_TIMINGS_MAX + 1), ==,
+                     STREAM_TIMINGS_MAX);
+    g_assert_cmpuint(last[0].mm_time, ==, 1001);
+    g_assert_cmpuint(last[STREAM_TIMINGS_MAX - 1].mm_time, ==, 1000 + STREAM_TIMINGS_MAX);
+    g_free(last);
+
+    stream_timings_free(t);
+}
+
+/* enough to go round the ring many times */
+#define THREAD_FRAMES (STREAM_TIMINGS_MAX * 40)
+
+typedef struct Race {
+    stream_timings *t;
+    /* the frames started, to be marked by the decoder */
+    GAsyncQueue *started;
+    gint done;
+} Race;
+
+/* every value of a frame derives from its number, so that a torn copy
+ * shows */
+static gint64 stage_time(gint frame, SpiceStreamTimingStage stage)
+{
+    return (gint64)frame * SPICE_STREAM_TIMING_LAST + stage + 1;
+}
+
+static void check_timing(const SpiceStreamTiming *timing)
+{
+    gint frame = timing->mm_time;
+    guint stage;
+
+    g_assert_cmpuint(timing->stream_id, ==, frame % 7);
+    for (stage = 0; stage < SPICE_STREAM_TIMING_LAST; stage++) {
+        if (timing->time[stage] == 0) {
+            g_assert_cmpint(timing->mm_delta[stage], ==, 0);
+            continue;
+        }
+        g_assert_cmpint(timing->time[stage], ==, stage_time(frame, stage));
+        g_assert_cmpint(timing->mm_delta[stage], ==, -frame);
+    }
+}
+
+static void mark(stream_timings *t, gint frame, SpiceStreamTimingStage stage)
+{
+    stream_timings_mark(t, frame, stage, stage_time(frame, stage), -frame);
+}
+
+/* the decoding thread */
+static gpointer decoder_thread(gpointer user_data)
+{
+    Race *race = user_data;
+    gpointer data;
+
+    while ((data = g_async_queue_pop(race->started)) != GINT_TO_POINTER(-1)) {
+        gint frame = GPOINTER_TO_INT(data) - 1;
+
+        mark(race->t, frame, SPICE_STREAM_TIMING_DECODE_START);
+        mark(race->t, frame, SPICE_STREAM_TIMING_DECODE_END);
+    }
+    return NULL;
+}
+
+/* an application thread polling the timings */
+static gpointer reader_thread(gpointer user_data)
+{
+    Race *race = user_data;
+    SpiceStreamTiming *timings = g_new(SpiceStreamTiming, STREAM_TIMINGS_MAX);
+
+    while (!g_atomic_int_get(&race->done)) {
+        guint i, n = stream_timings_get_last(race->t, timings, STREAM_TIMINGS_MAX);
+
+        for (i = 0; i < n; i++) {
+            check_timing(&timings[i]);
+            if (i > 0)
+                g_assert_cmpuint(timings[i].mm_time, >, timings[i - 1].mm_time);
+        }
+    }
+    g_free(timings);
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    Race race = { stream_timings_new(), g_async_queue_new(), FALSE };
+    GThread *decoder, *readers[2];
+    gint i, frame;
+
+    decoder = g_thread_new("decoder", decoder_thread, &race);
+    readers[0] = g_thread_new("reader", reader_thread, &race);
+    readers[1] = g_thread_new("reader", reader_thread, &race);
+
+    for (i = 0; i < THREAD_FRAMES; i++) {
+        frame = stream_timings_start(race.t, i % 7, i);
+        g_assert_cmpint(frame, ==, i);
+        mark(race.t, frame, SPICE_STREAM_TIMING_ARRIVAL);
+        g_async_queue_push(race.started, GINT_TO_POINTER(frame + 1));
+        mark(race.t, frame, SPICE_STREAM_TIMING_QUEUED);
+        /* presented by the main loop, behind the decoder */
+        if (i >= 8)
+            mark(race.t, frame - 8, SPICE_STREAM_TIMING_PRESENTED);
+    }
+    g_async_queue_push(race.started, GINT_TO_POINTER(-1));
+    g_thread_join(decoder);
+    g_atomic_int_set(&race.done, TRUE);
+    g_thread_join(readers[0]);
+    g_thread_join(readers[1]);
+
+    g_async_queue_unref(race.started);
+    stream_timings_free(race.t);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/display-timings/ring", test_ring);
+    g_test_add_func("/display-timings/threads", test_threads);
+
+    return g_test_run();
+}
@@ -0,0 +1,213 @@
+#include <string.h>
+#include <epoxy/egl.h>
+#include <epoxy/gl.h>
+
+#include "spice-widget-egl-canvas.h"
+
+/* the canvas, and the part of it the widget shows */
+#define WIDTH 300
+#define HEIGHT 200
+#define STRIDE (WIDTH * 4 + 64)
+
+typedef struct Fixture {
+    EGLDisplay display;
+    EGLContext ctx;
+    guint8 *data;
+    cairo_rectangle_int_t area;
+    EglCanvas canvas;
+    guint fb_id;
+} Fixture;
+
+/* a GL context without any window system, rendered by llvmpipe */
+static gboolean make_current(Fixture *f)
+{
+    static const EGLint conf_attrs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    static const EGLint ctx_attrs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 0,
+        EGL_NONE
+    };
+    EGLConfig conf;
+    EGLint nconf;
+
+    if (!epoxy_has_egl_extension(EGL_NO_DISPLAY, "EGL_EXT_platform_base") ||
+        !epoxy_has_egl_extension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless"))
+        return FALSE;
+    f->display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA,
+                                          EGL_DEFAULT_DISPLAY, NULL);
+    if (f->display == EGL_NO_DISPLAY || !eglInitialize(f->display, NULL, NULL))
+        return FALSE;
+    if (!epoxy_has_egl_extension(f->display, "EGL_KHR_surfaceless_context") ||
+        !eglBindAPI(EGL_OPENGL_API) ||
+        !eglChooseConfig(f->display, conf_attrs, &conf, 1, &nconf) || nconf < 1)
+        return FALSE;
+
+    f->ctx = eglCreateContext(f->display, conf, EGL_NO_CONTEXT, ctx_attrs);
+    return f->ctx != EGL_NO_CONTEXT &&
+        eglMakeCurrent(f->display, EGL_NO_SURFACE, EGL_NO_SURFACE, f->ctx);
+}
+
+static void fixture_setup(Fixture *f, gconstpointer user_data)
+{
+    guint i;
+
+    f->display = EGL_NO_DISPLAY;
+    f->ctx = EGL_NO_CONTEXT;
+    f->data = g_malloc(STRIDE * HEIGHT);
+    for (i = 0; i < STRIDE * HEIGHT; i++)
+        f->data[i] = i * 7 + i / 251;
+    f->area.x = 10;
+    f->area.y = 20;
+    f->area.width = 256;
+    f->area.height = 160;
+
+    if (!make_current(f))
+        return;
+    egl_canvas_init(&f->canvas);
+    glGenFramebuffers(1, &f->fb_id);
+}
+
+static void fixture_teardown(Fixture *f, gconstpointer user_data)
+{
+    if (f->ctx != EGL_NO_CONTEXT) {
+        glDeleteFramebuffers(1, &f->fb_id);
+        egl_canvas_cleanup(&f->canvas);
+        eglMakeCurrent(f->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(f->display, f->ctx);
+    }
+    if (f->display != EGL_NO_DISPLAY)
+        eglTerminate(f->display);
+    g_free(f->data);
+}
+
+static gboolean skip_without_gl(Fixture *f)
+{
+    if (f->ctx == EGL_NO_CONTEXT) {
+        g_test_skip("no surfaceless EGL context");
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* the texture must hold the area of the canvas, top row first */
+static void check_texture(Fixture *f, const guint8 *expected, gint stride)
+{
+    gsize row = f->area.width * 4;
+    guint8 *pixels = g_malloc(row * f->area.height);
+    gint y;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, f->fb_id);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, f->canvas.tex_id, 0);
+    g_assert_cmpint(glCheckFramebufferStatus(GL_FRAMEBUFFER), ==, GL_FRAMEBUFFER_COMPLETE);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, f->area.width, f->area.height,
+                 GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    g_assert_cmpint(glGetError(), ==, GL_NO_ERROR);
+
+    for (y = 0; y < f->area.height; y++) {
+        const guint8 *src = expected + (f->area.y + y) * stride + f->area.x * 4;
+
+        g_assert_true(memcmp(pixels + y * row, src, row) == 0);
+    }
+    g_free(pixels);
+}
+
+static void fill_rect(Fixture *f, gint x, gint y, gint width, gint height, guint8 value)
+{
+    gint i;
+
+    for (i = 0; i < height; i++)
+        memset(f->data + (y + i) * STRIDE + x * 4, value, width * 4);
+}
+
+static void test_upload(Fixture *f, gconstpointer user_data)
+{
+    cairo_rectangle_int_t small = { 50, 60, 8, 8 };
+    cairo_rectangle_int_t large = { 20, 80, 200, 100 };
+    guint8 *before;
+
+    if (skip_without_gl(f))
+        return;
+
+    /* all of it at first, through a pixel buffer */
+    egl_canvas_upload(&f->canvas, f->data, STRIDE, &f->area);
+    check_texture(f, f->data, STRIDE);
+
+    /* then the damage only, straight or through the pixel buffers */
+    fill_rect(f, small.x, small.y, small.width, small.height, 0x11);
+    fill_rect(f, large.x, large.y, large.width, large.height, 0x22);
+    egl_canvas_invalidate(&f->canvas, &small);
+    egl_canvas_invalidate(&f->canvas, &large);
+    egl_canvas_upload(&f->canvas, f->data, STRIDE, &f->area);
+    check_texture(f, f->data, STRIDE);
+
+    /* what wasn't invalidated is not uploaded */
+    before = g_memdup(f->data, STRIDE * HEIGHT);
+    fill_rect(f, 100, 40, 4, 4, 0x33);
+    egl_canvas_upload(&f->canvas, f->data, STRIDE, &f->area);
+    check_texture(f, before, STRIDE);
+    g_free(before);
+}
+
+static void test_many_rects(Fixture *f, gconstpointer user_data)
+{
+    cairo_rectangle_int_t r = { 0, 0, 2, 2 };
+    gint i;
+
+    if (skip_without_gl(f))
+        return;
+
+    egl_canvas_upload(&f->canvas, f->data, STRIDE, &f->area);
+    /* more than are uploaded one by one, some out of the area */
+    for (i = 0; i < 40; i++) {
+        r.x = (i * 37) % (WIDTH - 2);
+        r.y = (i * 23) % (HEIGHT - 2);
+        fill_rect(f, r.x, r.y, r.width, r.height, i);
+        egl_canvas_invalidate(&f->canvas, &r);
+    }
+    egl_canvas_upload(&f->canvas, f->data, STRIDE, &f->area);
+    check_texture(f, f->data, STRIDE);
+}
+
+static void test_resize(Fixture *f, gconstpointer user_data)
+{
+    if (skip_without_gl(f))
+        return;
+
+    egl_canvas_upload(&f->canvas, f->data, STRIDE, &f->area);
+
+    /* a new area is uploaded whole */
+    f->area.x = 0;
+    f->area.y = 0;
+    f->area.width = WIDTH;
+    f->area.height = HEIGHT;
+    egl_canvas_upload(&f->canvas, f->data, STRIDE, &f->area);
+    check_texture(f, f->data, STRIDE);
+
+    /* and again once reset */
+    fill_rect(f, 0, 0, WIDTH, HEIGHT, 0x44);
+    egl_canvas_reset(&f->canvas);
+    egl_canvas_upload(&f->canvas, f->data, STRIDE, &f->area);
+    check_texture(f, f->data, STRIDE);
+}
+
+int main(int argc, char* argv[])
+{
+    /* no GPU needed */
+    g_setenv("LIBGL_ALWAYS_SOFTWARE", "1", TRUE);
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/egl-canvas/upload", Fixture, NULL,
+               fixture_setup, test_upload, fixture_teardown);
+    g_test_add("/egl-canvas/many-rects", Fixture, NULL,
+               fixture_setup, test_many_rects, fixture_teardown);
+    g_test_add("/egl-canvas/resize", Fixture, NULL,
+               fixture_setup, test_resize, fixture_teardown);
+
+    return g_test_run();
+}
@@ -1,6 +1,8 @@
 #include <gio/gio.h>
+#include <spice/vd_agent.h>
 
 #include "spice-file-transfer-task-priv.h"
+#include "mock-server.h"
 
 typedef struct _Fixture {
     GFile         **files;
@@ -338,6 +340,227 @@ test_agent_cancel_on_read(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
     g_main_loop_run (f->loop);
 }
 
+/*******************************************************************************
+ * TEST WEIGHTED TURNS
+ ******************************************************************************/
+static void
+test_weighted_turns(Fixture *f, gconstpointer user_data G_GNUC_UNUSED)
+{
+    SpiceFileTransferTask *xfer_tasks[2];
+    SpiceFileTransferTurn turns[2] = { { 0, }, };
+    guint pending[2] = { 10, 24 };
+    GQueue sched = G_QUEUE_INIT;
+    SpiceFileTransferTurn *turn;
+    GString *order, *expected;
+    GList *values;
+    guint i;
+
+    f->xfer_tasks = spice_file_transfer_task_create_tasks(f->files, NULL, G_FILE_COPY_NONE, NULL);
+    values = g_hash_table_get_values(f->xfer_tasks);
+    xfer_tasks[0] = values->data;
+    xfer_tasks[1] = values->next->data;
+    g_list_free(values);
+    g_object_set(xfer_tasks[0], "weight", 1, NULL);
+    g_object_set(xfer_tasks[1], "weight", 3, NULL);
+
+    spice_file_transfer_turns_schedule(&sched, &turns[0]);
+    spice_file_transfer_turns_schedule(&sched, &turns[1]);
+    spice_file_transfer_turns_schedule(&sched, &turns[0]);
+    g_assert_cmpuint(g_queue_get_length(&sched), ==, 2);
+
+    /* send all the messages, recording whose they are */
+    order = g_string_new(NULL);
+    while ((turn = g_queue_peek_head(&sched)) != NULL) {
+        i = turn - turns;
+        g_assert_cmpuint(pending[i], >, 0);
+        pending[i]--;
+        g_string_append_c(order, 'a' + i);
+        spice_file_transfer_turns_next(&sched, spice_file_transfer_task_get_weight(xfer_tasks[i]),
+                                       TRUE, pending[i] > 0);
+    }
+
+    /* one message of the first task for three of the second while both
+     * have data, then the rest of the first */
+    expected = g_string_new(NULL);
+    for (i = 0; i < 8; i++)
+        g_string_append(expected, "abbb");
+    g_string_append(expected, "aa");
+    g_assert_cmpstr(order->str, ==, expected->str);
+    g_assert_false(turns[0].scheduled);
+    g_assert_false(turns[1].scheduled);
+
+    g_string_free(order, TRUE);
+    g_string_free(expected, TRUE);
+}
+
+/*******************************************************************************
+ * BENCHMARK
+ ******************************************************************************/
+#define BENCH_SIZE (4 * 1024 * 1024)
+/* the agent tokens the server gives the client */
+#define BENCH_TOKENS 10
+
+typedef struct _Bench {
+    SpiceMainChannel *channel;
+    GFile *files[2];
+    guint rtt;
+    guint64 received;
+    gboolean corrupted;
+    gint done;
+    gdouble rate;
+} Bench;
+
+/* the byte of the file at @offset, so that a misplaced piece shows */
+static guint8
+bench_pattern(guint64 offset)
+{
+    return offset % 251;
+}
+
+static void
+bench_copy_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    Bench *bench = user_data;
+    GError *err = NULL;
+
+    g_assert_true(spice_main_channel_file_copy_finish(SPICE_MAIN_CHANNEL(source), res, &err));
+    g_assert_no_error(err);
+    g_atomic_int_set(&bench->done, TRUE);
+}
+
+static gboolean
+bench_copy(gpointer user_data)
+{
+    Bench *bench = user_data;
+
+    spice_main_channel_file_copy_async(bench->channel, bench->files, G_FILE_COPY_NONE,
+                                       NULL, NULL, NULL, bench_copy_cb, bench);
+    return G_SOURCE_REMOVE;
+}
+
+/* the agent side of the transfer: it takes the file at once, then counts
+ * the data until it is all there */
+static void
+bench_script(MockServer *server, gpointer user_data)
+{
+    Bench *bench = user_data;
+    VDAgentFileXferStatusMessage status = { 0, };
+    GBytes *msg;
+    guint32 type;
+    guint i;
+
+    mock_server_agent_start(server, BENCH_TOKENS, bench->rtt, NULL, 0);
+
+    g_test_timer_start();
+    mock_server_invoke(server, bench_copy, bench);
+    while (bench->received < BENCH_SIZE &&
+           (msg = mock_server_agent_recv(server, &type, 5000)) != NULL) {
+        const guint8 *data = g_bytes_get_data(msg, NULL);
+
+        if (type == VD_AGENT_FILE_XFER_START) {
+            status.id = ((const VDAgentFileXferStartMessage *)data)->id;
+            status.result = VD_AGENT_FILE_XFER_STATUS_CAN_SEND_DATA;
+            mock_server_agent_send(server, VD_AGENT_FILE_XFER_STATUS,
+                                   &status, sizeof(status));
+        } else if (type == VD_AGENT_FILE_XFER_DATA) {
+            const VDAgentFileXferDataMessage *xfer = (const VDAgentFileXferDataMessage *)data;
+            guint64 j;
+
+            for (j = 0; j < xfer->size; j++) {
+                if (xfer->data[j] != bench_pattern(bench->received + j))
+                    bench->corrupted = TRUE;
+            }
+            bench->received += xfer->size;
+        }
+        g_bytes_unref(msg);
+    }
+    bench->rate = BENCH_SIZE / g_test_timer_elapsed() / (1024 * 1024);
+    g_assert_cmpuint(bench->received, ==, BENCH_SIZE);
+    g_assert_false(bench->corrupted);
+
+    status.result = VD_AGENT_FILE_XFER_STATUS_SUCCESS;
+    mock_server_agent_send(server, VD_AGENT_FILE_XFER_STATUS, &status, sizeof(status));
+    for (i = 0; i < 5000 && !g_atomic_int_get(&bench->done); i++)
+        g_usleep(1000);
+    g_assert_true(g_atomic_int_get(&bench->done));
+}
+
+/* MB/s through a main channel, whose agent gives each message back
+ * after @rtt ms, reading @chunks chunks ahead */
+static gdouble
+bench_transfer(guint rtt, guint chunks)
+{
+    Bench bench = { NULL, };
+    MockServer *server = mock_server_new();
+    SpiceSession *session;
+    GFileIOStream *iostream;
+    GError *err = NULL;
+    gchar *data, *value;
+    guint64 i;
+
+    bench.rtt = rtt;
+    /* read when the channel is created */
+    value = g_strdup_printf("%u", chunks);
+    g_setenv("SPICE_FILE_XFER_CHUNKS", value, TRUE);
+    g_free(value);
+
+    bench.files[0] = g_file_new_tmp("spice-file-transfer-XXXXXX", &iostream, &err);
+    g_assert_no_error(err);
+    g_clear_object(&iostream);
+    data = g_malloc(BENCH_SIZE);
+    for (i = 0; i < BENCH_SIZE; i++)
+        data[i] = bench_pattern(i);
+    g_assert_true(g_file_replace_contents(bench.files[0], data, BENCH_SIZE, NULL, FALSE,
+                                          G_FILE_CREATE_NONE, NULL, NULL, &err));
+    g_assert_no_error(err);
+    g_free(data);
+
+    session = spice_session_new();
+    g_object_set(session, "client-sockets", TRUE, NULL);
+    bench.channel = SPICE_MAIN_CHANNEL(spice_channel_new(session, SPICE_CHANNEL_MAIN, 0));
+    mock_server_link(server, SPICE_CHANNEL(bench.channel));
+    mock_server_run(server, bench_script, &bench);
+
+    spice_session_disconnect(session);
+    mock_server_free(server);
+    while (g_main_context_iteration(NULL, FALSE));
+    g_object_unref(session);
+    g_file_delete(bench.files[0], NULL, &err);
+    g_assert_no_error(err);
+    g_object_unref(bench.files[0]);
+    g_unsetenv("SPICE_FILE_XFER_CHUNKS");
+
+    return bench.rate;
+}
+
+/* The agent messages queued together are written with vectored writes,
+ * from the chunks read: they must get to the agent whole and in order */
+static void
+test_agent_vectored(void)
+{
+    bench_transfer(0, FILE_XFER_DEFAULT_CHUNKS);
+}
+
+static void
+test_bench(gconstpointer data)
+{
+    guint rtt = GPOINTER_TO_UINT(data);
+    gdouble rate;
+    guint chunks;
+
+    if (!g_test_perf()) {
+        g_test_skip("only run with -m perf");
+        return;
+    }
+
+    for (chunks = 1; chunks <= FILE_XFER_DEFAULT_CHUNKS; chunks++) {
+        rate = bench_transfer(rtt, chunks);
+        g_test_message("%u ms, %u chunks ahead: %.1f MB/s", rtt, chunks, rate);
+        g_test_maximized_result(rate, "MB/s with %u ms of latency and %u chunks ahead",
+                                rtt, chunks);
+    }
+}
+
 /* Tests summary:
  *
  * This tests are specific to SpiceFileTransferTask in order to verify:
@@ -403,6 +626,10 @@ int main(int argc, char* argv[])
                Fixture, GUINT_TO_POINTER(SINGLE_FILE),
                f_setup, test_agent_cancel_on_read, f_teardown);
 
+    g_test_add("/spice-file-transfer-task/multiple/weighted-turns",
+               Fixture, GUINT_TO_POINTER(MULTIPLE_FILES),
+               f_setup, test_weighted_turns, f_teardown);
+
     g_test_add("/spice-file-transfer-task/multiple/simple-transfer",
                Fixture, GUINT_TO_POINTER(MULTIPLE_FILES),
                f_setup, test_simple_transfer, f_teardown);
@@ -427,5 +654,11 @@ int main(int argc, char* argv[])
                Fixture, GUINT_TO_POINTER(MULTIPLE_FILES),
                f_setup, test_agent_cancel_on_read, f_teardown);
 
+    g_test_add_func("/spice-file-transfer-task/single/agent/vectored", test_agent_vectored);
+
+    g_test_add_data_func("/spice-file-transfer-task/bench/0ms", GUINT_TO_POINTER(0), test_bench);
+    g_test_add_data_func("/spice-file-transfer-task/bench/10ms", GUINT_TO_POINTER(10), test_bench);
+    g_test_add_data_func("/spice-file-transfer-task/bench/50ms", GUINT_TO_POINTER(50), test_bench);
+
     return g_test_run();
 }
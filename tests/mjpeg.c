@@ -0,0 +1,473 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "spice-client.h"
+#include "channel-display-priv.h"
+#include "spice-session-priv.h"
+#include "mock-server.h"
+
+#define BENCH_FRAMES 60
+
+/* Encodes a synthetic frame, with gradients and some noise so that it
+ * doesn't compress too well */
+static GBytes *encode_frame(guint width, guint height, guint seed)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *out = NULL;
+    unsigned long out_size = 0;
+    guint8 *line = g_malloc(width * 3);
+    GRand *rand = g_rand_new_with_seed(seed);
+    guint x;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &out, &out_size);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 80, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < height) {
+        for (x = 0; x < width; x++) {
+            line[x * 3 + 0] = x * 255 / width;
+            line[x * 3 + 1] = cinfo.next_scanline * 255 / height;
+            line[x * 3 + 2] = g_rand_int_range(rand, 0, 64) + seed;
+        }
+        jpeg_write_scanlines(&cinfo, &line, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    g_rand_free(rand);
+    g_free(line);
+    return g_bytes_new_with_free_func(out, out_size, free, out);
+}
+
+static void test_decode(void)
+{
+    GBytes *jpeg = encode_frame(64, 48, 0);
+    const guint32 *pixels;
+    uint32_t width, height;
+    GBytes *out;
+    gsize size;
+
+    out = mjpeg_decode(g_bytes_get_data(jpeg, NULL), g_bytes_get_size(jpeg),
+                       FALSE, &width, &height);
+    g_assert_nonnull(out);
+    g_assert_cmpuint(width, ==, 64);
+    g_assert_cmpuint(height, ==, 48);
+
+    pixels = g_bytes_get_data(out, &size);
+    g_assert_cmpuint(size, ==, 64 * 48 * 4);
+    /* the red gradient goes left to right, the green one top to bottom */
+    g_assert_cmpuint((pixels[63] >> 16) & 0xff, >, (pixels[0] >> 16) & 0xff);
+    g_assert_cmpuint((pixels[47 * 64] >> 8) & 0xff, >, (pixels[0] >> 8) & 0xff);
+
+    g_bytes_unref(out);
+    g_bytes_unref(jpeg);
+}
+
+/* The display messages, as the server marshals them */
+static void put_u8(GByteArray *msg, guint8 v)
+{
+    g_byte_array_append(msg, &v, 1);
+}
+
+static void put_u16(GByteArray *msg, guint16 v)
+{
+    v = GUINT16_TO_LE(v);
+    g_byte_array_append(msg, (guint8 *)&v, sizeof(v));
+}
+
+static void put_u32(GByteArray *msg, guint32 v)
+{
+    v = GUINT32_TO_LE(v);
+    g_byte_array_append(msg, (guint8 *)&v, sizeof(v));
+}
+
+static void put_u64(GByteArray *msg, guint64 v)
+{
+    v = GUINT64_TO_LE(v);
+    g_byte_array_append(msg, (guint8 *)&v, sizeof(v));
+}
+
+static void put_rect(GByteArray *msg, gint x, gint y, gint width, gint height)
+{
+    put_u32(msg, y);
+    put_u32(msg, x);
+    put_u32(msg, y + height);
+    put_u32(msg, x + width);
+}
+
+static void send_msg(MockServer *server, guint16 type, GByteArray *msg)
+{
+    mock_server_send(server, type, msg->data, msg->len);
+    g_byte_array_set_size(msg, 0);
+}
+
+static void send_surface_create(MockServer *server, guint32 id, guint width, guint height,
+                                guint32 flags)
+{
+    GByteArray *msg = g_byte_array_new();
+
+    put_u32(msg, id);
+    put_u32(msg, width);
+    put_u32(msg, height);
+    put_u32(msg, SPICE_SURFACE_FMT_32_xRGB);
+    put_u32(msg, flags);
+    send_msg(server, SPICE_MSG_DISPLAY_SURFACE_CREATE, msg);
+    g_byte_array_unref(msg);
+}
+
+/* a top-down MJPEG stream on the primary, shown at its size */
+static void send_stream_create(MockServer *server, guint32 id, guint width, guint height)
+{
+    GByteArray *msg = g_byte_array_new();
+
+    put_u32(msg, 0);
+    put_u32(msg, id);
+    put_u8(msg, SPICE_STREAM_FLAGS_TOP_DOWN);
+    put_u8(msg, SPICE_VIDEO_CODEC_TYPE_MJPEG);
+    put_u64(msg, 0);
+    put_u32(msg, width);
+    put_u32(msg, height);
+    put_u32(msg, width);
+    put_u32(msg, height);
+    put_rect(msg, 0, 0, width, height);
+    put_u8(msg, SPICE_CLIP_TYPE_NONE);
+    send_msg(server, SPICE_MSG_DISPLAY_STREAM_CREATE, msg);
+    g_byte_array_unref(msg);
+}
+
+static void send_stream_data(MockServer *server, guint32 id, guint32 mm_time, GBytes *jpeg)
+{
+    GByteArray *msg = g_byte_array_new();
+    gsize size;
+    const guint8 *data = g_bytes_get_data(jpeg, &size);
+
+    put_u32(msg, id);
+    put_u32(msg, mm_time);
+    put_u32(msg, size);
+    g_byte_array_append(msg, data, size);
+    send_msg(server, SPICE_MSG_DISPLAY_STREAM_DATA, msg);
+    g_byte_array_unref(msg);
+}
+
+/* copies the top-left corner of surface @src to (@x, @y) in surface @dest */
+static void send_draw_copy(MockServer *server, guint32 dest, gint x, gint y,
+                           guint32 src, guint width, guint height)
+{
+    GByteArray *msg = g_byte_array_new();
+    guint32 image;
+
+    put_u32(msg, dest);
+    put_rect(msg, x, y, width, height);
+    put_u8(msg, SPICE_CLIP_TYPE_NONE);
+    /* the source image goes after the fixed part */
+    image = msg->len + 4 + 16 + 2 + 1 + 1 + 8 + 4;
+    put_u32(msg, image);
+    put_rect(msg, 0, 0, width, height);
+    put_u16(msg, SPICE_ROPD_OP_PUT);
+    put_u8(msg, SPICE_IMAGE_SCALE_MODE_NEAREST);
+    /* no mask */
+    put_u8(msg, 0);
+    put_u32(msg, 0);
+    put_u32(msg, 0);
+    put_u32(msg, 0);
+    g_assert_cmpuint(msg->len, ==, image);
+    put_u64(msg, 0);
+    put_u8(msg, SPICE_IMAGE_TYPE_SURFACE);
+    put_u8(msg, 0);
+    put_u32(msg, width);
+    put_u32(msg, height);
+    put_u32(msg, src);
+    send_msg(server, SPICE_MSG_DISPLAY_DRAW_COPY, msg);
+    g_byte_array_unref(msg);
+}
+
+#define OVERLAY_WIDTH 64
+#define OVERLAY_HEIGHT 48
+
+typedef struct Overlay {
+    SpiceSession *session;
+    GBytes *pixels;
+    gint stride;
+    gint shown, flushed;
+} Overlay;
+
+/* keeps the frames, as a widget compositing them would */
+static gboolean overlay_frame(SpiceDisplayChannel *channel, guint id,
+                              SpiceDisplayStreamFrame *frame, gpointer user_data)
+{
+    Overlay *overlay = user_data;
+
+    if (frame->pixels == NULL) {
+        g_atomic_int_set(&overlay->flushed, TRUE);
+        return FALSE;
+    }
+
+    g_clear_pointer(&overlay->pixels, g_bytes_unref);
+    overlay->pixels = g_bytes_ref(frame->pixels);
+    overlay->stride = frame->stride;
+    g_atomic_int_set(&overlay->shown, TRUE);
+    return TRUE;
+}
+
+static void script_overlay(MockServer *server, gpointer user_data)
+{
+    Overlay *overlay = user_data;
+    GBytes *jpeg = encode_frame(OVERLAY_WIDTH, OVERLAY_HEIGHT, 1);
+    guint i;
+
+    send_surface_create(server, 0, 2 * OVERLAY_WIDTH, 2 * OVERLAY_HEIGHT,
+                        SPICE_SURFACE_FLAGS_PRIMARY);
+    send_surface_create(server, 1, OVERLAY_WIDTH, OVERLAY_HEIGHT, 0);
+    send_stream_create(server, 0, OVERLAY_WIDTH, OVERLAY_HEIGHT);
+    send_stream_data(server, 0, spice_session_get_mm_time(overlay->session) + 20, jpeg);
+    for (i = 0; i < 5000 && !g_atomic_int_get(&overlay->shown); i++)
+        g_usleep(1000);
+    g_assert_true(g_atomic_int_get(&overlay->shown));
+
+    /* the frame is read from the primary into an off-screen surface,
+     * then drawn back elsewhere, away from the stream */
+    send_draw_copy(server, 1, 0, 0, 0, OVERLAY_WIDTH, OVERLAY_HEIGHT);
+    send_draw_copy(server, 0, OVERLAY_WIDTH, OVERLAY_HEIGHT, 1,
+                   OVERLAY_WIDTH, OVERLAY_HEIGHT);
+    mock_server_sync(server);
+
+    g_bytes_unref(jpeg);
+}
+
+static void test_overlay_read(void)
+{
+    Overlay overlay = { NULL, };
+    MockServer *server = mock_server_new();
+    SpiceDisplayPrimary primary;
+    SpiceChannel *channel;
+    const guint8 *pixels;
+    guint x, y;
+
+    overlay.session = spice_session_new();
+    g_object_set(overlay.session, "client-sockets", TRUE, NULL);
+    channel = spice_channel_new(overlay.session, SPICE_CHANNEL_DISPLAY, 0);
+    g_signal_connect(channel, "stream-frame", G_CALLBACK(overlay_frame), &overlay);
+    mock_server_link(server, channel);
+    mock_server_run(server, script_overlay, &overlay);
+
+    /* the frame was written to the primary before it was read */
+    g_assert_true(overlay.flushed);
+    g_assert_true(spice_display_channel_get_primary(channel, 0, &primary));
+    pixels = g_bytes_get_data(overlay.pixels, NULL);
+    for (y = 0; y < OVERLAY_HEIGHT; y++) {
+        const guint32 *src = (const guint32 *)(pixels + y * overlay.stride);
+        const guint32 *dest = (const guint32 *)(primary.data +
+                                                (OVERLAY_HEIGHT + y) * primary.stride) +
+                              OVERLAY_WIDTH;
+
+        for (x = 0; x < OVERLAY_WIDTH; x++)
+            g_assert_cmphex(dest[x] & 0xffffff, ==, src[x] & 0xffffff);
+    }
+
+    spice_session_disconnect(overlay.session);
+    mock_server_free(server);
+    while (g_main_context_iteration(NULL, FALSE));
+    g_bytes_unref(overlay.pixels);
+    g_object_unref(overlay.session);
+}
+
+#define REPORT_WIDTH 32
+#define REPORT_HEIGHT 32
+#define REPORT_FRAMES 8
+
+typedef struct Report {
+    SpiceSession *session;
+    GMutex lock;
+    GCond cond;
+    gboolean held, released;
+} Report;
+
+/* main context: keeps the channel from reading until the script is done
+ * sending */
+static gboolean hold_main_loop(gpointer user_data)
+{
+    Report *report = user_data;
+
+    g_mutex_lock(&report->lock);
+    report->held = TRUE;
+    g_cond_signal(&report->cond);
+    while (!report->released)
+        g_cond_wait(&report->cond, &report->lock);
+    g_mutex_unlock(&report->lock);
+    return G_SOURCE_REMOVE;
+}
+
+static void script_report(MockServer *server, gpointer user_data)
+{
+    Report *report = user_data;
+    GBytes *jpeg = encode_frame(REPORT_WIDTH, REPORT_HEIGHT, 1);
+    GByteArray *msg = g_byte_array_new();
+    const guint32 *fields;
+    GBytes *bytes;
+    guint32 mm_time;
+    guint i;
+
+    send_surface_create(server, 0, REPORT_WIDTH, REPORT_HEIGHT,
+                        SPICE_SURFACE_FLAGS_PRIMARY);
+    send_stream_create(server, 0, REPORT_WIDTH, REPORT_HEIGHT);
+    put_u32(msg, 0);
+    put_u32(msg, 1);
+    put_u32(msg, REPORT_FRAMES);
+    put_u32(msg, 60000);
+    send_msg(server, SPICE_MSG_DISPLAY_STREAM_ACTIVATE_REPORT, msg);
+    mock_server_sync(server);
+
+    /* the frames come at once, as after a stall of the network */
+    g_idle_add(hold_main_loop, report);
+    g_mutex_lock(&report->lock);
+    while (!report->held)
+        g_cond_wait(&report->cond, &report->lock);
+    g_mutex_unlock(&report->lock);
+    mm_time = spice_session_get_mm_time(report->session) + 1000;
+    for (i = 0; i < REPORT_FRAMES; i++)
+        send_stream_data(server, 0, mm_time + i, jpeg);
+    g_mutex_lock(&report->lock);
+    report->released = TRUE;
+    g_cond_signal(&report->cond);
+    g_mutex_unlock(&report->lock);
+
+    /* the first frame is shown, the decoder skips to the last one: the
+     * skipped frames are counted in the report of the last one */
+    bytes = mock_server_recv(server, SPICE_MSGC_DISPLAY_STREAM_REPORT, 5000);
+    g_assert_nonnull(bytes);
+    g_assert_cmpuint(g_bytes_get_size(bytes), ==, 8 * sizeof(guint32));
+    fields = g_bytes_get_data(bytes, NULL);
+    g_assert_cmpuint(GUINT32_FROM_LE(fields[0]), ==, 0);
+    g_assert_cmpuint(GUINT32_FROM_LE(fields[1]), ==, 1);
+    g_assert_cmpuint(GUINT32_FROM_LE(fields[2]), ==, mm_time);
+    g_assert_cmpuint(GUINT32_FROM_LE(fields[3]), ==, mm_time + REPORT_FRAMES - 1);
+    g_assert_cmpuint(GUINT32_FROM_LE(fields[4]), ==, REPORT_FRAMES);
+    g_assert_cmpuint(GUINT32_FROM_LE(fields[5]), ==, REPORT_FRAMES - 2);
+    g_assert_cmpint((gint32)GUINT32_FROM_LE(fields[6]), >=, 0);
+    g_bytes_unref(bytes);
+
+    /* and not one report per skipped frame */
+    g_assert_null(mock_server_recv(server, SPICE_MSGC_DISPLAY_STREAM_REPORT, 100));
+
+    g_byte_array_unref(msg);
+    g_bytes_unref(jpeg);
+}
+
+static void test_report_drops(void)
+{
+    Report report = { NULL, };
+    MockServer *server = mock_server_new();
+    SpiceChannel *channel;
+
+    g_mutex_init(&report.lock);
+    g_cond_init(&report.cond);
+    report.session = spice_session_new();
+    g_object_set(report.session, "client-sockets", TRUE,
+                 "low-latency-video", TRUE, NULL);
+    channel = spice_channel_new(report.session, SPICE_CHANNEL_DISPLAY, 0);
+    mock_server_link(server, channel);
+    mock_server_run(server, script_report, &report);
+
+    spice_session_disconnect(report.session);
+    mock_server_free(server);
+    while (g_main_context_iteration(NULL, FALSE));
+    g_object_unref(report.session);
+    g_cond_clear(&report.cond);
+    g_mutex_clear(&report.lock);
+}
+
+typedef struct BenchFrame {
+    GBytes *jpeg;
+    GBytes *out;
+} BenchFrame;
+
+static void bench_decode(gpointer data, gpointer user_data)
+{
+    BenchFrame *frame = data;
+    uint32_t width, height;
+
+    frame->out = mjpeg_decode(g_bytes_get_data(frame->jpeg, NULL),
+                              g_bytes_get_size(frame->jpeg),
+                              FALSE, &width, &height);
+}
+
+/* Decodes a stream one frame after the other, then with @threads decoding
+ * the frames concurrently, as with SPICE_MJPEG_THREADS */
+static void bench_stream(guint width, guint height, guint threads)
+{
+    BenchFrame frames[BENCH_FRAMES];
+    GThreadPool *pool;
+    gdouble serial, parallel;
+    guint i;
+
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        frames[i].jpeg = encode_frame(width, height, i);
+        frames[i].out = NULL;
+    }
+
+    g_test_timer_start();
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        bench_decode(&frames[i], NULL);
+        g_assert_nonnull(frames[i].out);
+        g_clear_pointer(&frames[i].out, g_bytes_unref);
+    }
+    serial = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    pool = g_thread_pool_new(bench_decode, NULL, threads, TRUE, NULL);
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        g_thread_pool_push(pool, &frames[i], NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+    parallel = g_test_timer_elapsed();
+
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        g_assert_nonnull(frames[i].out);
+        g_bytes_unref(frames[i].out);
+        g_bytes_unref(frames[i].jpeg);
+    }
+
+    g_test_message("%ux%u: %.1f fps serial, %.1f fps with %u threads",
+                   width, height, BENCH_FRAMES / serial, BENCH_FRAMES / parallel, threads);
+    g_test_maximized_result(BENCH_FRAMES / parallel, "%ux%u fps with %u threads",
+                            width, height, threads);
+}
+
+static void test_bench(gconstpointer data)
+{
+    const guint *size = data;
+    guint threads = MAX(g_get_num_processors(), 2);
+
+    if (!g_test_perf()) {
+        g_test_skip("only run with -m perf");
+        return;
+    }
+
+    bench_stream(size[0], size[1], threads);
+}
+
+static const guint size_1080p[] = { 1920, 1080 };
+static const guint size_4k[] = { 3840, 2160 };
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/mjpeg/decode", test_decode);
+    g_test_add_func("/mjpeg/overlay/read", test_overlay_read);
+    g_test_add_func("/mjpeg/report/drops", test_report_drops);
+    g_test_add_data_func("/mjpeg/bench/1080p", size_1080p, test_bench);
+    g_test_add_data_func("/mjpeg/bench/4k", size_4k, test_bench);
+
+    return g_test_run();
+}
@@ -0,0 +1,565 @@
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <spice/protocol.h>
+#include <spice/vd_agent.h>
+
+#include "mock-server.h"
+
+/* the RSA public key the client encrypts its ticket with, which nobody
+ * decrypts */
+static const guint8 pub_key[SPICE_TICKET_PUBKEY_BYTES] = {
+    0x30, 0x81, 0x9f, 0x30, 0x0d, 0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7,
+    0x0d, 0x01, 0x01, 0x01, 0x05, 0x00, 0x03, 0x81, 0x8d, 0x00, 0x30, 0x81,
+    0x89, 0x02, 0x81, 0x81, 0x00, 0xeb, 0xa2, 0x03, 0xea, 0x56, 0x11, 0xf5,
+    0x0f, 0xca, 0xff, 0xd8, 0x64, 0xab, 0x58, 0x5d, 0x07, 0xbe, 0xea, 0x1c,
+    0x07, 0x0f, 0xec, 0xd0, 0x73, 0x58, 0xcf, 0xe0, 0xe6, 0xd5, 0x5a, 0xa6,
+    0x32, 0x96, 0xd9, 0x2a, 0x06, 0x9e, 0x30, 0x79, 0xd0, 0x46, 0xb0, 0xeb,
+    0x7b, 0x49, 0xf6, 0x34, 0x70, 0x82, 0xea, 0x10, 0x47, 0x3a, 0xe5, 0xd0,
+    0x3a, 0xc1, 0xf7, 0x58, 0x12, 0xe5, 0x0a, 0x58, 0x61, 0xfa, 0x9f, 0xe6,
+    0xcf, 0xf7, 0xc9, 0x39, 0xe7, 0xac, 0xd3, 0x4d, 0x9e, 0xb3, 0x86, 0xc0,
+    0xfc, 0x53, 0x6c, 0xb5, 0x91, 0x73, 0x79, 0x5e, 0x37, 0x60, 0x8c, 0x22,
+    0x3f, 0xb1, 0x3e, 0x70, 0xc5, 0xae, 0x5d, 0x87, 0xb0, 0xcc, 0xa2, 0xd3,
+    0x6c, 0x15, 0x3d, 0x36, 0x9b, 0xe0, 0x01, 0x0b, 0xdb, 0x23, 0x87, 0x09,
+    0xab, 0x42, 0xf8, 0x0e, 0xa2, 0xfa, 0x85, 0x95, 0x55, 0x45, 0x66, 0x2d,
+    0x53, 0x02, 0x03, 0x01, 0x00, 0x01,
+};
+/* the size of the key, so of the encrypted ticket */
+#define TICKET_SIZE 128
+
+#define MINI_HEADER_SIZE 6
+
+typedef struct MockMessage {
+    guint16 type;
+    GBytes *payload; /* NULL once the connection is cut */
+} MockMessage;
+
+struct MockServer {
+    GMutex lock;
+    GCond cond;
+    GMutex write_lock;
+    guint32 *caps;
+    guint ncaps;
+
+    /* the current connection */
+    int fd;
+    GThread *reader;
+    gboolean connected, linked;
+    gint stop_reading;
+    GAsyncQueue *in;
+
+    /* the agent, see mock_server_agent_start() */
+    guint agent_rtt;
+    GThread *token_thread;
+    GAsyncQueue *tokens;
+    GByteArray *agent_stream;
+};
+
+static void mock_message_free(gpointer data)
+{
+    MockMessage *msg = data;
+
+    g_clear_pointer(&msg->payload, g_bytes_unref);
+    g_free(msg);
+}
+
+static gboolean read_all(MockServer *server, int fd, void *data, gsize size)
+{
+    guint8 *p = data;
+
+    while (size > 0) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        gssize n;
+
+        /* see mock_server_stop_reading() */
+        if (g_atomic_int_get(&server->stop_reading))
+            return FALSE;
+        if (poll(&pfd, 1, 10) <= 0)
+            continue;
+        n = recv(fd, p, size, 0);
+
+        if (n <= 0)
+            return FALSE;
+        p += n;
+        size -= n;
+    }
+    return TRUE;
+}
+
+static gboolean write_all(int fd, const void *data, gsize size)
+{
+    const guint8 *p = data;
+
+    while (size > 0) {
+        gssize n = send(fd, p, size, MSG_NOSIGNAL);
+
+        if (n <= 0)
+            return FALSE;
+        p += n;
+        size -= n;
+    }
+    return TRUE;
+}
+
+/* reader thread: answers the link of the client, with the mini header
+ * and the channel caps, and takes any ticket */
+static gboolean mock_server_accept_link(MockServer *server, int fd)
+{
+    SpiceLinkHeader header;
+    SpiceLinkReply reply;
+    guint8 *link_mess, ticket[TICKET_SIZE];
+    guint32 common_caps = GUINT32_TO_LE(1 << SPICE_COMMON_CAP_MINI_HEADER);
+    guint32 link_res = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    guint i;
+    gboolean ok;
+
+    if (!read_all(server, fd, &header, sizeof(header)))
+        return FALSE;
+    g_assert_cmpuint(GUINT32_FROM_LE(header.magic), ==, SPICE_MAGIC);
+    link_mess = g_malloc(GUINT32_FROM_LE(header.size));
+    ok = read_all(server, fd, link_mess, GUINT32_FROM_LE(header.size));
+    g_free(link_mess);
+    if (!ok)
+        return FALSE;
+
+    header.magic = GUINT32_TO_LE(SPICE_MAGIC);
+    header.major_version = GUINT32_TO_LE(SPICE_VERSION_MAJOR);
+    header.minor_version = GUINT32_TO_LE(SPICE_VERSION_MINOR);
+    header.size = GUINT32_TO_LE(sizeof(reply) + (1 + server->ncaps) * sizeof(guint32));
+    memset(&reply, 0, sizeof(reply));
+    reply.error = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
+    memcpy(reply.pub_key, pub_key, sizeof(pub_key));
+    reply.num_common_caps = GUINT32_TO_LE(1);
+    reply.num_channel_caps = GUINT32_TO_LE(server->ncaps);
+    reply.caps_offset = GUINT32_TO_LE(sizeof(reply));
+
+    g_mutex_lock(&server->write_lock);
+    ok = write_all(fd, &header, sizeof(header)) &&
+         write_all(fd, &reply, sizeof(reply)) &&
+         write_all(fd, &common_caps, sizeof(common_caps));
+    for (i = 0; ok && i < server->ncaps; i++) {
+        guint32 caps = GUINT32_TO_LE(server->caps[i]);
+        ok = write_all(fd, &caps, sizeof(caps));
+    }
+    g_mutex_unlock(&server->write_lock);
+
+    return ok &&
+        read_all(server, fd, ticket, sizeof(ticket)) &&
+        write_all(fd, &link_res, sizeof(link_res));
+}
+
+/* reader thread: a message of the client */
+static MockMessage *mock_server_read_message(MockServer *server, int fd)
+{
+    guint8 header[MINI_HEADER_SIZE];
+    MockMessage *msg;
+    guint32 size;
+    guint8 *payload;
+
+    if (!read_all(server, fd, header, sizeof(header)))
+        return NULL;
+
+    size = header[2] | header[3] << 8 | header[4] << 16 | (guint32)header[5] << 24;
+    payload = g_malloc(size);
+    if (!read_all(server, fd, payload, size)) {
+        g_free(payload);
+        return NULL;
+    }
+
+    msg = g_new0(MockMessage, 1);
+    msg->type = header[0] | header[1] << 8;
+    msg->payload = g_bytes_new_take(payload, size);
+    return msg;
+}
+
+static gpointer mock_server_reader(gpointer user_data)
+{
+    MockServer *server = user_data;
+    MockMessage *msg;
+    int fd;
+
+    g_mutex_lock(&server->lock);
+    fd = server->fd;
+    g_mutex_unlock(&server->lock);
+
+    if (mock_server_accept_link(server, fd)) {
+        g_mutex_lock(&server->lock);
+        server->linked = TRUE;
+        g_cond_broadcast(&server->cond);
+        g_mutex_unlock(&server->lock);
+
+        while ((msg = mock_server_read_message(server, fd)) != NULL) {
+            if (msg->type == SPICE_MSGC_MAIN_AGENT_DATA && server->tokens != NULL) {
+                /* the agent gives the token back once it got the message */
+                gint64 *due = g_new(gint64, 1);
+
+                *due = g_get_monotonic_time() + server->agent_rtt * G_TIME_SPAN_MILLISECOND;
+                g_async_queue_push(server->tokens, due);
+            }
+            g_async_queue_push(server->in, msg);
+        }
+    }
+
+    g_mutex_lock(&server->lock);
+    server->connected = FALSE;
+    server->linked = FALSE;
+    g_cond_broadcast(&server->cond);
+    g_mutex_unlock(&server->lock);
+    g_async_queue_push(server->in, g_new0(MockMessage, 1));
+    return NULL;
+}
+
+MockServer *mock_server_new(void)
+{
+    MockServer *server = g_new0(MockServer, 1);
+
+    g_mutex_init(&server->lock);
+    g_cond_init(&server->cond);
+    g_mutex_init(&server->write_lock);
+    server->fd = -1;
+    server->in = g_async_queue_new_full(mock_message_free);
+    server->agent_stream = g_byte_array_new();
+    return server;
+}
+
+static gpointer mock_server_token_thread(gpointer user_data);
+
+void mock_server_free(MockServer *server)
+{
+    mock_server_disconnect(server);
+    if (server->token_thread != NULL) {
+        gint64 *stop = g_new0(gint64, 1);
+
+        *stop = -1;
+        g_async_queue_push(server->tokens, stop);
+        g_thread_join(server->token_thread);
+        g_async_queue_unref(server->tokens);
+    }
+    g_async_queue_unref(server->in);
+    g_byte_array_unref(server->agent_stream);
+    g_free(server->caps);
+    g_mutex_clear(&server->lock);
+    g_cond_clear(&server->cond);
+    g_mutex_clear(&server->write_lock);
+    g_free(server);
+}
+
+void mock_server_set_channel_caps(MockServer *server, const guint32 *caps, guint ncaps)
+{
+    g_free(server->caps);
+    server->caps = g_memdup(caps, ncaps * sizeof(guint32));
+    server->ncaps = ncaps;
+}
+
+void mock_server_link(MockServer *server, SpiceChannel *channel)
+{
+    MockMessage *msg;
+    int fds[2];
+
+    mock_server_disconnect(server);
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+
+    /* what the previous connection left */
+    while ((msg = g_async_queue_try_pop(server->in)) != NULL)
+        mock_message_free(msg);
+    g_byte_array_set_size(server->agent_stream, 0);
+
+    g_mutex_lock(&server->lock);
+    server->fd = fds[0];
+    server->connected = TRUE;
+    server->linked = FALSE;
+    g_atomic_int_set(&server->stop_reading, FALSE);
+    server->reader = g_thread_new("mock-server", mock_server_reader, server);
+    g_mutex_unlock(&server->lock);
+
+    g_assert_true(spice_channel_open_fd(channel, fds[1]));
+}
+
+void mock_server_disconnect(MockServer *server)
+{
+    GThread *reader;
+
+    g_mutex_lock(&server->lock);
+    reader = server->reader;
+    server->reader = NULL;
+    if (server->fd >= 0)
+        shutdown(server->fd, SHUT_RDWR);
+    g_mutex_unlock(&server->lock);
+
+    if (reader != NULL)
+        g_thread_join(reader);
+
+    g_mutex_lock(&server->lock);
+    if (server->fd >= 0)
+        close(server->fd);
+    server->fd = -1;
+    g_mutex_unlock(&server->lock);
+}
+
+void mock_server_stop_reading(MockServer *server)
+{
+    GThread *reader;
+
+    g_atomic_int_set(&server->stop_reading, TRUE);
+    g_mutex_lock(&server->lock);
+    reader = server->reader;
+    server->reader = NULL;
+    g_mutex_unlock(&server->lock);
+
+    if (reader != NULL)
+        g_thread_join(reader);
+}
+
+void mock_server_reset(MockServer *server)
+{
+    struct pollfd pfd = { -1, POLLIN, 0 };
+
+    g_mutex_lock(&server->lock);
+    g_assert_null(server->reader);
+    pfd.fd = server->fd;
+    server->fd = -1;
+    g_mutex_unlock(&server->lock);
+
+    g_assert_cmpint(pfd.fd, >=, 0);
+    /* closed with data left unread, the socket of the client gets
+     * ECONNRESET, where it would just see the end of the stream */
+    g_assert_cmpint(poll(&pfd, 1, 5000), ==, 1);
+    close(pfd.fd);
+    g_atomic_int_set(&server->stop_reading, FALSE);
+}
+
+gboolean mock_server_is_connected(MockServer *server)
+{
+    gboolean connected;
+
+    g_mutex_lock(&server->lock);
+    connected = server->connected;
+    g_mutex_unlock(&server->lock);
+    return connected;
+}
+
+typedef struct MockRun {
+    MockServer *server;
+    MockServerScript script;
+    gpointer user_data;
+    gint done;
+} MockRun;
+
+static gpointer mock_server_script(gpointer user_data)
+{
+    MockRun *run = user_data;
+
+    run->script(run->server, run->user_data);
+    g_atomic_int_set(&run->done, TRUE);
+    g_main_context_wakeup(NULL);
+    return NULL;
+}
+
+void mock_server_run(MockServer *server, MockServerScript script, gpointer user_data)
+{
+    MockRun run = { server, script, user_data, FALSE };
+    GThread *thread;
+
+    thread = g_thread_new("mock-server-script", mock_server_script, &run);
+    while (!g_atomic_int_get(&run.done))
+        g_main_context_iteration(NULL, TRUE);
+    g_thread_join(thread);
+}
+
+typedef struct MockInvoke {
+    MockServer *server;
+    GSourceFunc func;
+    gpointer user_data;
+    gboolean done;
+} MockInvoke;
+
+static gboolean mock_server_invoke_cb(gpointer user_data)
+{
+    MockInvoke *invoke = user_data;
+
+    invoke->func(invoke->user_data);
+    g_mutex_lock(&invoke->server->lock);
+    invoke->done = TRUE;
+    g_cond_broadcast(&invoke->server->cond);
+    g_mutex_unlock(&invoke->server->lock);
+    return G_SOURCE_REMOVE;
+}
+
+void mock_server_invoke(MockServer *server, GSourceFunc func, gpointer user_data)
+{
+    MockInvoke invoke = { server, func, user_data, FALSE };
+
+    /* not g_main_context_invoke(), which may run it right here */
+    g_idle_add(mock_server_invoke_cb, &invoke);
+    g_mutex_lock(&server->lock);
+    while (!invoke.done)
+        g_cond_wait(&server->cond, &server->lock);
+    g_mutex_unlock(&server->lock);
+}
+
+void mock_server_send(MockServer *server, guint16 type, const void *data, gsize size)
+{
+    guint8 header[MINI_HEADER_SIZE] = {
+        type & 0xff, type >> 8,
+        size & 0xff, (size >> 8) & 0xff, (size >> 16) & 0xff, size >> 24,
+    };
+    int fd;
+
+    g_mutex_lock(&server->lock);
+    while (server->connected && !server->linked)
+        g_cond_wait(&server->cond, &server->lock);
+    fd = server->linked ? server->fd : -1;
+    g_mutex_unlock(&server->lock);
+    if (fd < 0)
+        return;
+
+    g_mutex_lock(&server->write_lock);
+    if (write_all(fd, header, sizeof(header)))
+        write_all(fd, data, size);
+    g_mutex_unlock(&server->write_lock);
+}
+
+GBytes *mock_server_recv(MockServer *server, guint16 type, guint timeout)
+{
+    gint64 end = g_get_monotonic_time() + timeout * G_TIME_SPAN_MILLISECOND;
+    MockMessage *msg;
+    GBytes *payload;
+
+    for (;;) {
+        gint64 left = end - g_get_monotonic_time();
+
+        if (left <= 0)
+            return NULL;
+        msg = g_async_queue_timeout_pop(server->in, left);
+        if (msg == NULL)
+            return NULL;
+        if (msg->payload == NULL) {
+            mock_message_free(msg);
+            return NULL;
+        }
+        if (msg->type == type)
+            break;
+        mock_message_free(msg);
+    }
+
+    payload = g_bytes_ref(msg->payload);
+    mock_message_free(msg);
+    return payload;
+}
+
+void mock_server_sync(MockServer *server)
+{
+    /* the id, then the timestamp */
+    guint8 ping[12] = { 0, };
+    GBytes *pong;
+
+    mock_server_send(server, SPICE_MSG_PING, ping, sizeof(ping));
+    pong = mock_server_recv(server, SPICE_MSGC_PONG, 5000);
+    g_assert_nonnull(pong);
+    g_bytes_unref(pong);
+}
+
+/* gives the agent tokens back when they are due */
+static gpointer mock_server_token_thread(gpointer user_data)
+{
+    MockServer *server = user_data;
+    gint64 *due;
+
+    while ((due = g_async_queue_pop(server->tokens)) != NULL && *due >= 0) {
+        guint32 tokens = GUINT32_TO_LE(1);
+        gint64 wait = *due - g_get_monotonic_time();
+
+        if (wait > 0)
+            g_usleep(wait);
+        mock_server_send(server, SPICE_MSG_MAIN_AGENT_TOKEN, &tokens, sizeof(tokens));
+        g_free(due);
+    }
+    g_free(due);
+    return NULL;
+}
+
+void mock_server_agent_start(MockServer *server, guint tokens, guint rtt,
+                             const guint32 *caps, guint ncaps)
+{
+    guint32 init[8] = {
+        GUINT32_TO_LE(1), /* session id */
+        GUINT32_TO_LE(1), /* display channels hint */
+        GUINT32_TO_LE(SPICE_MOUSE_MODE_SERVER | SPICE_MOUSE_MODE_CLIENT),
+        GUINT32_TO_LE(SPICE_MOUSE_MODE_SERVER),
+        GUINT32_TO_LE(1), /* agent connected */
+        GUINT32_TO_LE(tokens),
+        0, /* multimedia time */
+        0, /* ram hint */
+    };
+    gsize size = sizeof(VDAgentAnnounceCapabilities) + ncaps * sizeof(guint32);
+    VDAgentAnnounceCapabilities *announce = g_malloc0(size);
+    GBytes *msg;
+    guint32 type;
+
+    g_return_if_fail(server->tokens == NULL);
+
+    server->agent_rtt = rtt;
+    server->tokens = g_async_queue_new();
+    server->token_thread = g_thread_new("mock-agent-tokens", mock_server_token_thread, server);
+    mock_server_send(server, SPICE_MSG_MAIN_INIT, init, sizeof(init));
+
+    /* the client asks for the caps of the agent */
+    do {
+        msg = mock_server_agent_recv(server, &type, 5000);
+        g_assert_nonnull(msg);
+        g_bytes_unref(msg);
+    } while (type != VD_AGENT_ANNOUNCE_CAPABILITIES);
+
+    if (ncaps > 0)
+        memcpy(announce->caps, caps, ncaps * sizeof(guint32));
+    mock_server_agent_send(server, VD_AGENT_ANNOUNCE_CAPABILITIES, announce, size);
+    g_free(announce);
+}
+
+void mock_server_agent_send(MockServer *server, guint32 type, const void *data, gsize size)
+{
+    GByteArray *stream = g_byte_array_sized_new(sizeof(VDAgentMessage) + size);
+    VDAgentMessage header = {
+        .protocol = VD_AGENT_PROTOCOL,
+        .type = type,
+        .opaque = 0,
+        .size = size,
+    };
+    gsize pos;
+
+    g_byte_array_append(stream, (const guint8 *)&header, sizeof(header));
+    g_byte_array_append(stream, data, size);
+    for (pos = 0; pos < stream->len; pos += VD_AGENT_MAX_DATA_SIZE) {
+        mock_server_send(server, SPICE_MSG_MAIN_AGENT_DATA, stream->data + pos,
+                         MIN(stream->len - pos, VD_AGENT_MAX_DATA_SIZE));
+    }
+    g_byte_array_unref(stream);
+}
+
+GBytes *mock_server_agent_recv(MockServer *server, guint32 *type, guint timeout)
+{
+    GByteArray *stream = server->agent_stream;
+    VDAgentMessage header;
+    GBytes *payload;
+
+    for (;;) {
+        GBytes *msg;
+
+        if (stream->len >= sizeof(header)) {
+            memcpy(&header, stream->data, sizeof(header));
+            if (stream->len >= sizeof(header) + header.size)
+                break;
+        }
+        msg = mock_server_recv(server, SPICE_MSGC_MAIN_AGENT_DATA, timeout);
+        if (msg == NULL)
+            return NULL;
+        g_byte_array_append(stream, g_bytes_get_data(msg, NULL), g_bytes_get_size(msg));
+        g_bytes_unref(msg);
+    }
+
+    *type = header.type;
+    payload = g_bytes_new(stream->data + sizeof(header), header.size);
+    g_byte_array_remove_range(stream, 0, sizeof(header) + header.size);
+    return payload;
+}
@@ -0,0 +1,60 @@
+#ifndef MOCK_SERVER_H
+#define MOCK_SERVER_H
+
+#include <spice-client.h>
+
+G_BEGIN_DECLS
+
+/* A SPICE server stand-in for the channel tests. It links a channel
+ * through a socket pair, then exchanges messages with it from a script
+ * running in its own thread, while the test runs the main loop of the
+ * channel. The messages use the mini header. */
+typedef struct MockServer MockServer;
+
+typedef void (*MockServerScript)(MockServer *server, gpointer user_data);
+
+MockServer *mock_server_new(void);
+void mock_server_free(MockServer *server);
+void mock_server_set_channel_caps(MockServer *server, const guint32 *caps, guint ncaps);
+
+/* main context: opens @channel on a new socket pair, linked in the
+ * background; the channel must belong to a session with client-sockets */
+void mock_server_link(MockServer *server, SpiceChannel *channel);
+/* any context: cuts the connection, like a network error */
+void mock_server_disconnect(MockServer *server);
+/* script context: stops reading what the client sends, which piles up in
+ * the socket */
+void mock_server_stop_reading(MockServer *server);
+/* script context: once reading stopped and the client sent more, cuts the
+ * connection with an error, like a network outage: the client gets an
+ * I/O error on the write it is blocked on */
+void mock_server_reset(MockServer *server);
+gboolean mock_server_is_connected(MockServer *server);
+
+/* main context: runs @script in its own thread, and the main loop until
+ * it returns */
+void mock_server_run(MockServer *server, MockServerScript script, gpointer user_data);
+/* script context: runs @func in the main context, and waits for it */
+void mock_server_invoke(MockServer *server, GSourceFunc func, gpointer user_data);
+
+/* script context: sends a message, once linked */
+void mock_server_send(MockServer *server, guint16 type, const void *data, gsize size);
+/* script context: the payload of the next message of @type, skipping the
+ * others, or NULL if the connection is cut or nothing comes within
+ * @timeout ms */
+GBytes *mock_server_recv(MockServer *server, guint16 type, guint timeout);
+/* script context: waits for the channel to handle the messages sent
+ * before, with a ping */
+void mock_server_sync(MockServer *server);
+
+/* The guest agent on the main channel. The client gets @tokens agent
+ * tokens, and each message it sends is given back after @rtt ms. */
+void mock_server_agent_start(MockServer *server, guint tokens, guint rtt,
+                             const guint32 *caps, guint ncaps);
+void mock_server_agent_send(MockServer *server, guint32 type, const void *data, gsize size);
+/* the payload of the next whole agent message, whose type goes in @type */
+GBytes *mock_server_agent_recv(MockServer *server, guint32 *type, guint timeout);
+
+G_END_DECLS
+
+#endif /* MOCK_SERVER_H */
@@ -0,0 +1,179 @@
+#include <glib.h>
+
+#include "channel-playback-jitter.h"
+
+/* Opus, 10ms packets */
+#define FREQUENCY 48000
+#define CHANNELS 2
+#define PACKET_FRAMES 480
+#define PACKET_MS 10
+
+/* Feeds @n packets arriving @delay ms after their time, plus up to @jitter
+ * random ms. Returns the number of packets reported as lost. */
+static guint packets_run(PlaybackJitter *jb, guint32 *time, guint n,
+                         guint delay, guint jitter, GRand *rand)
+{
+    guint i, lost = 0;
+
+    for (i = 0; i < n; i++) {
+        gint64 arrival = *time + delay + (jitter ? g_rand_int_range(rand, 0, jitter) : 0);
+
+        lost += playback_jitter_add_packet(jb, *time, arrival * 1000);
+        playback_jitter_set_packet_frames(jb, PACKET_FRAMES);
+        *time += PACKET_MS;
+    }
+
+    return lost;
+}
+
+static void test_steady(void)
+{
+    PlaybackJitter *jb = playback_jitter_new(FREQUENCY, CHANNELS);
+    SpicePlaybackStats stats;
+    guint32 time = 1000;
+
+    g_assert_cmpuint(packets_run(jb, &time, 500, 30, 0, NULL), ==, 0);
+    g_assert_cmpuint(playback_jitter_get_target(jb, 0), ==, 40);
+    /* the server has the last word */
+    g_assert_cmpuint(playback_jitter_get_target(jb, 200), ==, 200);
+
+    playback_jitter_get_stats(jb, &stats);
+    g_assert_cmpuint(stats.jitter, ==, 0);
+    g_assert_cmpuint(stats.lost, ==, 0);
+
+    playback_jitter_free(jb);
+}
+
+static void test_jitter(void)
+{
+    PlaybackJitter *jb = playback_jitter_new(FREQUENCY, CHANNELS);
+    GRand *rand = g_rand_new_with_seed(42);
+    guint32 time = 1000;
+    guint32 target;
+
+    packets_run(jb, &time, 500, 30, 80, rand);
+    target = playback_jitter_get_target(jb, 0);
+    g_assert_cmpuint(target, >=, 70);
+    g_assert_cmpuint(target, <=, 80 + PACKET_MS + 20);
+
+    /* held for a while once the network calms down */
+    packets_run(jb, &time, 100, 30, 0, rand);
+    g_assert_cmpuint(playback_jitter_get_target(jb, 0), ==, target);
+
+    /* then back down */
+    packets_run(jb, &time, 1000, 30, 0, rand);
+    g_assert_cmpuint(playback_jitter_get_target(jb, 0), <, 50);
+
+    g_rand_free(rand);
+    playback_jitter_free(jb);
+}
+
+static void test_loss(void)
+{
+    PlaybackJitter *jb = playback_jitter_new(FREQUENCY, CHANNELS);
+    SpicePlaybackStats stats;
+    guint32 time = 1000;
+
+    packets_run(jb, &time, 10, 30, 0, NULL);
+
+    /* two packets missing */
+    time += 2 * PACKET_MS;
+    g_assert_cmpuint(packets_run(jb, &time, 1, 30, 0, NULL), ==, 2);
+    playback_jitter_add_concealed(jb, 2);
+
+    /* the server paused */
+    time += 100 * PACKET_MS;
+    g_assert_cmpuint(packets_run(jb, &time, 1, 30, 0, NULL), ==, 0);
+
+    playback_jitter_get_stats(jb, &stats);
+    g_assert_cmpuint(stats.lost, ==, 2);
+    g_assert_cmpuint(stats.concealed, ==, 2);
+
+    playback_jitter_free(jb);
+}
+
+/* Returns the number of frames out of @n packets resampled with the
+ * backend holding @delay ms */
+static gsize resample_run(PlaybackJitter *jb, guint n, guint32 delay)
+{
+    gint16 in[PACKET_FRAMES * CHANNELS];
+    gint16 *out = g_new(gint16, playback_jitter_resample_max(jb, PACKET_FRAMES) * CHANNELS);
+    gsize total = 0;
+    guint i, j;
+
+    for (j = 0; j < G_N_ELEMENTS(in); j++) {
+        in[j] = j * 64;
+    }
+
+    playback_jitter_set_delay(jb, delay);
+    for (i = 0; i < n; i++) {
+        total += playback_jitter_resample(jb, in, PACKET_FRAMES, out,
+                                          playback_jitter_resample_max(jb, PACKET_FRAMES));
+    }
+
+    g_free(out);
+    return total;
+}
+
+static void test_resample(void)
+{
+    PlaybackJitter *jb = playback_jitter_new(FREQUENCY, CHANNELS);
+    SpicePlaybackStats stats;
+    guint32 time = 1000;
+    gsize total;
+
+    packets_run(jb, &time, 100, 30, 0, NULL);
+    g_assert_cmpuint(playback_jitter_get_target(jb, 0), ==, 40);
+
+    /* on target, the output lags one frame */
+    total = resample_run(jb, 100, 40);
+    g_assert_cmpuint(total, ==, 100 * PACKET_FRAMES - 1);
+
+    /* too much buffered, play faster */
+    total = resample_run(jb, 100, 200);
+    playback_jitter_get_stats(jb, &stats);
+    g_assert_cmpint(stats.drift, >, 0);
+    g_assert_cmpuint(total, <, 100 * PACKET_FRAMES);
+    g_assert_cmpuint(total, >=, 100 * PACKET_FRAMES * 99 / 100);
+
+    /* too little, play slower */
+    total = resample_run(jb, 100, 0);
+    playback_jitter_get_stats(jb, &stats);
+    g_assert_cmpint(stats.drift, <, 0);
+    g_assert_cmpuint(total, >, 100 * PACKET_FRAMES);
+
+    playback_jitter_free(jb);
+}
+
+static void test_underrun(void)
+{
+    PlaybackJitter *jb = playback_jitter_new(FREQUENCY, CHANNELS);
+    SpicePlaybackStats stats;
+    guint32 time = 1000;
+    guint32 target;
+
+    packets_run(jb, &time, 100, 30, 0, NULL);
+    target = playback_jitter_get_target(jb, 0);
+
+    playback_jitter_add_underrun(jb);
+    playback_jitter_add_underrun(jb);
+    g_assert_cmpuint(playback_jitter_get_target(jb, 0), >, target);
+
+    playback_jitter_get_stats(jb, &stats);
+    g_assert_cmpuint(stats.underruns, ==, 2);
+
+    playback_jitter_free(jb);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/playback-jitter/steady", test_steady);
+    g_test_add_func("/playback-jitter/jitter", test_jitter);
+    g_test_add_func("/playback-jitter/loss", test_loss);
+    g_test_add_func("/playback-jitter/resample", test_resample);
+    g_test_add_func("/playback-jitter/underrun", test_underrun);
+
+    return g_test_run();
+}
@@ -0,0 +1,150 @@
+#include <string.h>
+
+#include "mock-server.h"
+#include "channel-playback-priv.h"
+
+/* more than fit in the ring, of growing sizes, so that its slots are
+ * reused and have to grow */
+#define PACKETS 200
+#define PACKET_SIZE(i) (64 + ((i) % 50) * 40)
+
+typedef struct Fixture {
+    SpiceSession *session;
+    SpiceChannel *channel;
+    MockServer *server;
+    GByteArray *sent;
+
+    SpicePlaybackSink sink;
+    GMutex lock;
+    GByteArray *played;
+    GThread *main_thread;
+    gboolean played_in_thread;
+} Fixture;
+
+/* decoding thread */
+static gpointer sink_begin_write(SpicePlaybackSink *sink, gsize size, guint8 **data)
+{
+    *data = g_malloc(size);
+    return *data;
+}
+
+/* decoding thread */
+static void sink_write(SpicePlaybackSink *sink, gpointer buffer, gsize size)
+{
+    Fixture *f = G_STRUCT_MEMBER_P(sink, -G_STRUCT_OFFSET(Fixture, sink));
+
+    g_mutex_lock(&f->lock);
+    g_byte_array_append(f->played, buffer, size);
+    if (g_thread_self() != f->main_thread)
+        f->played_in_thread = TRUE;
+    g_mutex_unlock(&f->lock);
+    g_free(buffer);
+}
+
+static void fixture_setup(Fixture *f, gconstpointer user_data)
+{
+    f->sent = g_byte_array_new();
+    f->played = g_byte_array_new();
+    g_mutex_init(&f->lock);
+    f->main_thread = g_thread_self();
+    f->sink.thread_safe = TRUE;
+    f->sink.begin_write = sink_begin_write;
+    f->sink.write = sink_write;
+
+    f->session = spice_session_new();
+    g_object_set(f->session, "client-sockets", TRUE, NULL);
+    f->channel = spice_channel_new(f->session, SPICE_CHANNEL_PLAYBACK, 0);
+    spice_playback_channel_set_sink(SPICE_PLAYBACK_CHANNEL(f->channel), &f->sink);
+    f->server = mock_server_new();
+    mock_server_link(f->server, f->channel);
+}
+
+static void fixture_teardown(Fixture *f, gconstpointer user_data)
+{
+    spice_session_disconnect(f->session);
+    mock_server_free(f->server);
+    while (g_main_context_iteration(NULL, FALSE));
+    spice_playback_channel_set_sink(SPICE_PLAYBACK_CHANNEL(f->channel), NULL);
+    g_object_unref(f->session);
+    g_mutex_clear(&f->lock);
+    g_byte_array_unref(f->played);
+    g_byte_array_unref(f->sent);
+}
+
+/* The playback messages, as the server marshals them */
+static void put_u16(GByteArray *msg, guint16 v)
+{
+    v = GUINT16_TO_LE(v);
+    g_byte_array_append(msg, (guint8 *)&v, sizeof(v));
+}
+
+static void put_u32(GByteArray *msg, guint32 v)
+{
+    v = GUINT32_TO_LE(v);
+    g_byte_array_append(msg, (guint8 *)&v, sizeof(v));
+}
+
+static void send_msg(MockServer *server, guint16 type, GByteArray *msg)
+{
+    mock_server_send(server, type, msg->data, msg->len);
+    g_byte_array_set_size(msg, 0);
+}
+
+static void script_thread(MockServer *server, gpointer user_data)
+{
+    Fixture *f = user_data;
+    GByteArray *msg = g_byte_array_new();
+    guint i, j;
+
+    put_u32(msg, 0);
+    put_u16(msg, SPICE_AUDIO_DATA_MODE_RAW);
+    send_msg(server, SPICE_MSG_PLAYBACK_MODE, msg);
+
+    put_u32(msg, 2);
+    put_u16(msg, SPICE_AUDIO_FMT_S16);
+    put_u32(msg, 48000);
+    put_u32(msg, 1000);
+    send_msg(server, SPICE_MSG_PLAYBACK_START, msg);
+
+    for (i = 0; i < PACKETS; i++) {
+        put_u32(msg, 1000 + i * 10);
+        for (j = 0; j < PACKET_SIZE(i); j++) {
+            guint8 sample = i * 13 + j;
+
+            g_byte_array_append(msg, &sample, 1);
+            g_byte_array_append(f->sent, &sample, 1);
+        }
+        send_msg(server, SPICE_MSG_PLAYBACK_DATA, msg);
+        /* let the decoding thread keep up, a full ring drops packets */
+        if (i % 16 == 15)
+            mock_server_sync(server);
+    }
+
+    /* what is left in the ring is played on stop */
+    send_msg(server, SPICE_MSG_PLAYBACK_STOP, msg);
+    mock_server_sync(server);
+    g_byte_array_unref(msg);
+}
+
+static void test_thread(Fixture *f, gconstpointer user_data)
+{
+    if (g_getenv("SPICE_DISABLE_AUDIO_THREAD")) {
+        g_test_skip("the audio thread is disabled");
+        return;
+    }
+
+    mock_server_run(f->server, script_thread, f);
+
+    g_assert_true(f->played_in_thread);
+    g_assert_cmpuint(f->played->len, ==, f->sent->len);
+    g_assert_true(memcmp(f->played->data, f->sent->data, f->sent->len) == 0);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/playback/thread", Fixture, NULL, fixture_setup, test_thread, fixture_teardown);
+
+    return g_test_run();
+}
@@ -0,0 +1,788 @@
+#include <string.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <spice/vd_agent.h>
+#ifdef G_OS_UNIX
+#include <sys/socket.h>
+#include <unistd.h>
+#include <gio/gunixsocketaddress.h>
+#endif
+
+#include "port-forward.h"
+
+#define REMOTE_PORT 5900
+#define CONNECTION_ID 1
+/* what the agent asks to be acknowledged, and how much it sends ahead */
+#define AGENT_ACK_INTERVAL (512 * 1024)
+#define AGENT_WINDOW (8 * 1024 * 1024)
+#define AGENT_CHUNK 2000
+
+#define TRANSFER_SIZE (32 * 1024 * 1024)
+#define BENCH_SIZE (256 * 1024 * 1024)
+
+/* A guest agent, which acknowledges the data it gets after @rtt ms */
+typedef struct Agent {
+    PortForwarder *pf;
+    GMainLoop *loop;
+    guint rtt;
+    gboolean connected, closed;
+    guint32 ack_interval;
+    /* what the forwarder sent */
+    guint64 received;
+    guint32 unacked;
+    gboolean corrupted;
+    /* what the agent sent */
+    guint64 sent, acked, size;
+    guint send_id, pull_id;
+    GQueue acks;
+} Agent;
+
+typedef struct Ack {
+    Agent *agent;
+    guint32 size;
+    guint id;
+} Ack;
+
+static guint8 pattern(guint64 offset)
+{
+    return offset % 251;
+}
+
+/* the next message for the agent, as the main channel sends it */
+static GBytes *pop_message(PortForwarder *pf, guint32 *command)
+{
+    VDAgentPortForwardDataMessage head;
+    gsize head_size;
+    GBytes *data = port_forwarder_pop_data(pf, command, &head, &head_size);
+    GByteArray *msg;
+
+    if (data == NULL) {
+        return NULL;
+    }
+    msg = g_byte_array_new();
+    g_byte_array_append(msg, (guint8 *)&head, head_size);
+    g_byte_array_append(msg, g_bytes_get_data(data, NULL), g_bytes_get_size(data));
+    g_bytes_unref(data);
+    return g_byte_array_free_to_bytes(msg);
+}
+
+static gboolean agent_ack(gpointer user_data)
+{
+    Ack *ack = user_data;
+    VDAgentPortForwardAckMessage msg = { .id = CONNECTION_ID, .size = ack->size };
+
+    g_queue_remove(&ack->agent->acks, ack);
+    port_forwarder_handle_message(ack->agent->pf, VD_AGENT_PORT_FORWARD_ACK, &msg);
+    g_free(ack);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean agent_send(gpointer user_data);
+
+static void agent_send_command(void *channel, guint32 command,
+                               const guint8 *data, guint32 data_size)
+{
+    Agent *agent = channel;
+    const VDAgentPortForwardDataMessage *msg;
+    const VDAgentPortForwardAckMessage *ack_msg;
+    Ack *ack;
+    guint32 i;
+
+    switch (command) {
+    case VD_AGENT_PORT_FORWARD_DATA:
+        msg = (const VDAgentPortForwardDataMessage *)data;
+        g_assert_cmpuint(msg->id, ==, CONNECTION_ID);
+        g_assert_cmpuint(data_size, ==, sizeof(*msg) + msg->size);
+        g_assert_cmpuint(data_size, <=, VD_AGENT_MAX_DATA_SIZE - sizeof(VDAgentMessage));
+        for (i = 0; i < msg->size; i++) {
+            agent->corrupted |= msg->data[i] != pattern(agent->received + i);
+        }
+        agent->received += msg->size;
+        agent->unacked += msg->size;
+        if (agent->unacked >= agent->ack_interval) {
+            /* answered later, like through the network */
+            ack = g_new0(Ack, 1);
+            ack->agent = agent;
+            ack->size = agent->unacked;
+            ack->id = g_timeout_add(agent->rtt, agent_ack, ack);
+            g_queue_push_tail(&agent->acks, ack);
+            agent->unacked = 0;
+        }
+        break;
+    case VD_AGENT_PORT_FORWARD_ACK:
+        ack_msg = (const VDAgentPortForwardAckMessage *)data;
+        g_assert_cmpuint(ack_msg->id, ==, CONNECTION_ID);
+        if (!agent->connected) {
+            agent->connected = TRUE;
+            agent->ack_interval = ack_msg->size;
+        } else {
+            agent->acked += ack_msg->size;
+        }
+        if (agent->send_id == 0 && agent->sent < agent->size) {
+            agent->send_id = g_idle_add(agent_send, agent);
+        }
+        break;
+    case VD_AGENT_PORT_FORWARD_CLOSE:
+        agent->closed = TRUE;
+        g_main_loop_quit(agent->loop);
+        break;
+    default:
+        break;
+    }
+}
+
+/* takes the data in turns, like the main channel */
+static gboolean agent_pull(gpointer user_data)
+{
+    Agent *agent = user_data;
+    guint32 command;
+    GBytes *msg;
+
+    agent->pull_id = 0;
+    while ((msg = pop_message(agent->pf, &command)) != NULL) {
+        agent_send_command(agent, command, g_bytes_get_data(msg, NULL), g_bytes_get_size(msg));
+        g_bytes_unref(msg);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void agent_data_ready(void *channel)
+{
+    Agent *agent = channel;
+
+    if (agent->pull_id == 0) {
+        agent->pull_id = g_idle_add(agent_pull, agent);
+    }
+}
+
+static gboolean agent_send(gpointer user_data)
+{
+    Agent *agent = user_data;
+    guint8 buffer[sizeof(VDAgentPortForwardDataMessage) + AGENT_CHUNK];
+    VDAgentPortForwardDataMessage *msg = (VDAgentPortForwardDataMessage *)buffer;
+    guint32 i;
+
+    while (agent->sent < agent->size && agent->sent - agent->acked < AGENT_WINDOW) {
+        msg->id = CONNECTION_ID;
+        msg->size = MIN(agent->size - agent->sent, AGENT_CHUNK);
+        for (i = 0; i < msg->size; i++) {
+            msg->data[i] = pattern(agent->sent + i);
+        }
+        port_forwarder_handle_message(agent->pf, VD_AGENT_PORT_FORWARD_DATA, msg);
+        agent->sent += msg->size;
+    }
+
+    agent->send_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static Agent *agent_new(guint rtt)
+{
+    Agent *agent = g_new0(Agent, 1);
+
+    agent->pf = new_port_forwarder(agent, agent_send_command, agent_data_ready);
+    agent->loop = g_main_loop_new(NULL, FALSE);
+    agent->rtt = rtt;
+    g_queue_init(&agent->acks);
+    return agent;
+}
+
+static void agent_free(Agent *agent)
+{
+    Ack *ack;
+
+    while ((ack = g_queue_pop_head(&agent->acks)) != NULL) {
+        g_source_remove(ack->id);
+        g_free(ack);
+    }
+    if (agent->send_id != 0) {
+        g_source_remove(agent->send_id);
+    }
+    if (agent->pull_id != 0) {
+        g_source_remove(agent->pull_id);
+    }
+    delete_port_forwarder(agent->pf);
+    g_main_loop_unref(agent->loop);
+    g_free(agent);
+}
+
+/* Forwards REMOTE_PORT in the guest to a local server, listening on the
+ * Unix socket @path if not NULL, and has the agent accept a connection
+ * on it */
+static GSocketListener *agent_accept(Agent *agent, const gchar *path)
+{
+    GSocketListener *listener = g_socket_listener_new();
+    VDAgentPortForwardAcceptedMessage msg;
+    GError *error = NULL;
+    guint16 port;
+
+    if (path != NULL) {
+#ifdef G_OS_UNIX
+        GSocketAddress *address = g_unix_socket_address_new(path);
+
+        g_socket_listener_add_address(listener, address, G_SOCKET_TYPE_STREAM,
+                                      G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error);
+        g_assert_no_error(error);
+        g_object_unref(address);
+        g_assert_true(port_forwarder_associate_remote_unix(agent->pf, NULL, REMOTE_PORT,
+                                                           path));
+#endif
+    } else {
+        port = g_socket_listener_add_any_inet_port(listener, NULL, &error);
+        g_assert_no_error(error);
+        g_assert_true(port_forwarder_associate_remote(agent->pf, NULL, REMOTE_PORT,
+                                                      "127.0.0.1", port));
+    }
+    msg.id = CONNECTION_ID;
+    msg.port = REMOTE_PORT;
+    msg.ack_interval = AGENT_ACK_INTERVAL;
+    port_forwarder_handle_message(agent->pf, VD_AGENT_PORT_FORWARD_ACCEPTED, &msg);
+
+    return listener;
+}
+
+typedef struct Server {
+    GSocketListener *listener;
+    Agent *agent;
+    guint64 size;
+    gboolean corrupted;
+} Server;
+
+/* the local server reads what the guest sends, in its own thread */
+static gpointer server_read(gpointer user_data)
+{
+    Server *server = user_data;
+    GSocketConnection *conn;
+    GInputStream *stream;
+    GError *error = NULL;
+    guint8 buffer[65536];
+    guint64 received = 0;
+    gssize i, n;
+
+    conn = g_socket_listener_accept(server->listener, NULL, NULL, &error);
+    g_assert_no_error(error);
+    stream = g_io_stream_get_input_stream(G_IO_STREAM(conn));
+    while (received < server->size) {
+        n = g_input_stream_read(stream, buffer, sizeof(buffer), NULL, &error);
+        g_assert_no_error(error);
+        g_assert_cmpint(n, >, 0);
+        for (i = 0; i < n; i++) {
+            server->corrupted |= buffer[i] != pattern(received + i);
+        }
+        received += n;
+    }
+    g_object_unref(conn);
+
+    g_main_loop_quit(server->agent->loop);
+    return NULL;
+}
+
+/* the local server sends to the guest, in its own thread */
+static gpointer server_write(gpointer user_data)
+{
+    Server *server = user_data;
+    GSocketConnection *conn;
+    GOutputStream *stream;
+    GError *error = NULL;
+    guint8 buffer[65536];
+    guint64 sent = 0;
+    gsize i, n;
+
+    conn = g_socket_listener_accept(server->listener, NULL, NULL, &error);
+    g_assert_no_error(error);
+    stream = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+    while (sent < server->size) {
+        n = MIN(server->size - sent, sizeof(buffer));
+        for (i = 0; i < n; i++) {
+            buffer[i] = pattern(sent + i);
+        }
+        g_output_stream_write_all(stream, buffer, n, NULL, NULL, &error);
+        g_assert_no_error(error);
+        sent += n;
+    }
+    g_io_stream_close(G_IO_STREAM(conn), NULL, NULL);
+    g_object_unref(conn);
+    return NULL;
+}
+
+/* Sends @size bytes from the local server to the guest, returns the
+ * throughput in MB/s */
+static gdouble transfer_to_guest(guint64 size, guint rtt, const gchar *path)
+{
+    Agent *agent = agent_new(rtt);
+    Server server = { .agent = agent, .size = size };
+    GThread *thread;
+    gdouble elapsed;
+
+    server.listener = agent_accept(agent, path);
+    thread = g_thread_new("server", server_write, &server);
+    g_test_timer_start();
+    g_main_loop_run(agent->loop);
+    elapsed = g_test_timer_elapsed();
+    g_thread_join(thread);
+
+    g_assert_true(agent->closed);
+    g_assert_cmpuint(agent->received, ==, size);
+    g_assert_false(agent->corrupted);
+
+    g_object_unref(server.listener);
+    agent_free(agent);
+    return size / elapsed / (1024 * 1024);
+}
+
+/* Sends @size bytes from the guest to the local server, returns the
+ * throughput in MB/s */
+static gdouble transfer_from_guest(guint64 size, guint rtt, const gchar *path)
+{
+    Agent *agent = agent_new(rtt);
+    Server server = { .agent = agent, .size = size };
+    GThread *thread;
+    gdouble elapsed;
+
+    agent->size = size;
+    server.listener = agent_accept(agent, path);
+    thread = g_thread_new("server", server_read, &server);
+    g_test_timer_start();
+    g_main_loop_run(agent->loop);
+    elapsed = g_test_timer_elapsed();
+    g_thread_join(thread);
+
+    g_assert_true(agent->connected);
+    g_assert_cmpuint(agent->sent, ==, size);
+    g_assert_false(server.corrupted);
+
+    g_object_unref(server.listener);
+    agent_free(agent);
+    return size / elapsed / (1024 * 1024);
+}
+
+static void test_to_guest(void)
+{
+    transfer_to_guest(TRANSFER_SIZE, 1, NULL);
+}
+
+static void test_from_guest(void)
+{
+    transfer_from_guest(TRANSFER_SIZE, 1, NULL);
+}
+
+static void ignore_command(void *channel, guint32 command,
+                           const guint8 *data, guint32 data_size)
+{
+}
+
+static void ignore_data_ready(void *channel)
+{
+}
+
+static void accept_callback(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GSocketConnection **conn = user_data;
+    GError *error = NULL;
+
+    *conn = g_socket_listener_accept_finish(G_SOCKET_LISTENER(source), res, NULL, &error);
+    g_assert_no_error(error);
+}
+
+/* Has the agent accept a connection on @rport, forwarded to a local
+ * server which returns its end */
+static GSocketConnection *connection_open(PortForwarder *pf, guint32 id, guint16 rport)
+{
+    GSocketListener *listener = g_socket_listener_new();
+    VDAgentPortForwardAcceptedMessage msg;
+    GSocketConnection *conn = NULL;
+    GError *error = NULL;
+    guint16 port;
+
+    port = g_socket_listener_add_any_inet_port(listener, NULL, &error);
+    g_assert_no_error(error);
+    g_socket_listener_accept_async(listener, NULL, accept_callback, &conn);
+    port_forwarder_associate_remote(pf, NULL, rport, "127.0.0.1", port);
+    msg.id = id;
+    msg.port = rport;
+    msg.ack_interval = AGENT_ACK_INTERVAL;
+    port_forwarder_handle_message(pf, VD_AGENT_PORT_FORWARD_ACCEPTED, &msg);
+
+    while (conn == NULL) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_object_unref(listener);
+    return conn;
+}
+
+static SpicePortForwardStats *stats_find(GArray *array, guint32 id)
+{
+    guint i;
+
+    for (i = 0; i < array->len; i++) {
+        SpicePortForwardStats *stats = &g_array_index(array, SpicePortForwardStats, i);
+
+        if (stats->id == id) {
+            return stats;
+        }
+    }
+    g_assert_not_reached();
+    return NULL;
+}
+
+/* Writes @size bytes on @conn, and waits for the forwarder to queue them */
+static void connection_write(PortForwarder *pf, GSocketConnection *conn, guint32 id,
+                             const guint8 *data, gsize size)
+{
+    GOutputStream *stream = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+    guint64 queued;
+    GArray *array;
+
+    g_output_stream_write_all_async(stream, data, size, G_PRIORITY_DEFAULT, NULL, NULL, NULL);
+    do {
+        g_main_context_iteration(NULL, TRUE);
+        array = port_forwarder_get_stats(pf);
+        queued = stats_find(array, id)->queued_bytes;
+        g_array_unref(array);
+    } while (queued < size);
+}
+
+#define BLOCK_ID 1
+
+static void test_no_copy(void)
+{
+    PortForwarder *pf = new_port_forwarder(NULL, ignore_command, ignore_data_ready);
+    GSocketConnection *conn;
+    guint8 data[3 * 1024];
+    VDAgentPortForwardDataMessage head;
+    GBytes *first, *second;
+    const guint8 *p1, *p2;
+    gsize head_size, n1, n2;
+    guint32 command;
+    guint i;
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = pattern(i);
+    }
+    conn = connection_open(pf, BLOCK_ID, REMOTE_PORT);
+    connection_write(pf, conn, BLOCK_ID, data, sizeof(data));
+
+    /* the messages of a read are slices of it */
+    first = port_forwarder_pop_data(pf, &command, &head, &head_size);
+    g_assert_cmpuint(command, ==, VD_AGENT_PORT_FORWARD_DATA);
+    g_assert_cmpuint(head_size, ==, sizeof(head));
+    g_assert_cmpuint(head.id, ==, BLOCK_ID);
+    p1 = g_bytes_get_data(first, &n1);
+    g_assert_cmpuint(head.size, ==, n1);
+    second = port_forwarder_pop_data(pf, &command, &head, &head_size);
+    p2 = g_bytes_get_data(second, &n2);
+    g_assert_cmpuint(n1 + n2, ==, sizeof(data));
+    g_assert_true(p2 == p1 + n1);
+    g_assert_cmpint(memcmp(p1, data, n1), ==, 0);
+    g_assert_cmpint(memcmp(p2, data + n1, n2), ==, 0);
+    g_bytes_unref(first);
+    g_bytes_unref(second);
+
+    g_object_unref(conn);
+    delete_port_forwarder(pf);
+}
+
+#define BULK_ID 1
+#define INTERACTIVE_ID 2
+#define BULK_SIZE (4 * 1024 * 1024)
+
+static void test_fairness(void)
+{
+    PortForwarder *pf = new_port_forwarder(NULL, ignore_command, ignore_data_ready);
+    GSocketConnection *bulk, *interactive;
+    guint8 *data = g_malloc0(BULK_SIZE);
+    const VDAgentPortForwardDataMessage *msg;
+    SpicePortForwardStats *stats;
+    guint64 bulk_sent = 0;
+    guint32 command;
+    GArray *array;
+    GBytes *bytes;
+    guint i;
+
+    bulk = connection_open(pf, BULK_ID, REMOTE_PORT);
+    interactive = connection_open(pf, INTERACTIVE_ID, REMOTE_PORT + 1);
+
+    /* a backlog of bulk data, some of it sent */
+    connection_write(pf, bulk, BULK_ID, data, BULK_SIZE);
+    for (i = 0; i < 10; i++) {
+        bytes = pop_message(pf, &command);
+        bulk_sent += g_bytes_get_size(bytes) - sizeof(*msg);
+        g_bytes_unref(bytes);
+    }
+
+    /* a keystroke doesn't wait behind it */
+    connection_write(pf, interactive, INTERACTIVE_ID, (const guint8 *)"ls\n", 3);
+    bytes = pop_message(pf, &command);
+    msg = g_bytes_get_data(bytes, NULL);
+    g_assert_cmpuint(command, ==, VD_AGENT_PORT_FORWARD_DATA);
+    g_assert_cmpuint(msg->id, ==, INTERACTIVE_ID);
+    g_assert_cmpuint(msg->size, ==, 3);
+    g_bytes_unref(bytes);
+
+    /* then the rest of the backlog */
+    while ((bytes = pop_message(pf, &command)) != NULL) {
+        msg = g_bytes_get_data(bytes, NULL);
+        g_assert_cmpuint(msg->id, ==, BULK_ID);
+        bulk_sent += msg->size;
+        g_bytes_unref(bytes);
+    }
+    g_assert_cmpuint(bulk_sent, ==, BULK_SIZE);
+    g_assert_cmpuint(port_forwarder_get_queued(pf), ==, 0);
+
+    array = port_forwarder_get_stats(pf);
+    g_assert_cmpuint(array->len, ==, 2);
+    stats = stats_find(array, BULK_ID);
+    g_assert_cmpuint(stats->port, ==, REMOTE_PORT);
+    g_assert_cmpuint(stats->sent_bytes, ==, BULK_SIZE);
+    g_assert_cmpuint(stats->queued_bytes, ==, 0);
+    stats = stats_find(array, INTERACTIVE_ID);
+    g_assert_cmpuint(stats->sent_bytes, ==, 3);
+    g_array_unref(array);
+
+    g_object_unref(bulk);
+    g_object_unref(interactive);
+    delete_port_forwarder(pf);
+    g_free(data);
+}
+
+#define HEAVY_ID 3
+#define LIGHT_ID 4
+#define WEIGHT_SIZE (1024 * 1024)
+
+static void test_weight(void)
+{
+    PortForwarder *pf = new_port_forwarder(NULL, ignore_command, ignore_data_ready);
+    GSocketConnection *heavy, *light;
+    guint8 *data = g_malloc0(WEIGHT_SIZE);
+    const VDAgentPortForwardDataMessage *msg;
+    guint64 heavy_sent = 0, light_sent = 0;
+    guint32 command;
+    GArray *array;
+    GBytes *bytes;
+
+    heavy = connection_open(pf, HEAVY_ID, REMOTE_PORT);
+    light = connection_open(pf, LIGHT_ID, REMOTE_PORT + 1);
+    g_assert_true(port_forwarder_set_weight(pf, HEAVY_ID, 3));
+    g_assert_false(port_forwarder_set_weight(pf, 42, 3));
+    g_assert_cmpuint(port_forwarder_get_weight(pf), ==, 0);
+
+    connection_write(pf, heavy, HEAVY_ID, data, WEIGHT_SIZE);
+    connection_write(pf, light, LIGHT_ID, data, WEIGHT_SIZE);
+    g_assert_cmpuint(port_forwarder_get_weight(pf), ==, 4);
+
+    /* the heavy one sends 3 times as much while both have data */
+    while (heavy_sent < WEIGHT_SIZE / 2) {
+        bytes = pop_message(pf, &command);
+        msg = g_bytes_get_data(bytes, NULL);
+        if (msg->id == HEAVY_ID) {
+            heavy_sent += msg->size;
+        } else {
+            light_sent += msg->size;
+        }
+        g_bytes_unref(bytes);
+    }
+    g_assert_cmpfloat(ABS((gdouble)heavy_sent / light_sent - 3.0), <, 0.2);
+
+    while ((bytes = pop_message(pf, &command)) != NULL) {
+        g_bytes_unref(bytes);
+    }
+    g_assert_cmpuint(port_forwarder_get_weight(pf), ==, 0);
+
+    array = port_forwarder_get_stats(pf);
+    g_assert_cmpuint(stats_find(array, HEAVY_ID)->weight, ==, 3);
+    g_assert_cmpuint(stats_find(array, LIGHT_ID)->weight, ==, 1);
+    g_array_unref(array);
+
+    g_object_unref(heavy);
+    g_object_unref(light);
+    delete_port_forwarder(pf);
+    g_free(data);
+}
+
+#ifdef G_OS_UNIX
+static void test_unix(void)
+{
+    GError *error = NULL;
+    gchar *dir = g_dir_make_tmp("port-forward-XXXXXX", &error);
+    gchar *path;
+
+    g_assert_no_error(error);
+    path = g_build_filename(dir, "socket", NULL);
+    transfer_to_guest(TRANSFER_SIZE, 1, path);
+    g_unlink(path);
+    transfer_from_guest(TRANSFER_SIZE, 1, path);
+    g_unlink(path);
+
+    g_rmdir(dir);
+    g_free(path);
+    g_free(dir);
+}
+
+static guint32 connect_id;
+static gchar *connect_host;
+static guint16 connect_port;
+
+static void connect_command(void *channel, guint32 command,
+                            const guint8 *data, guint32 data_size)
+{
+    const VDAgentPortForwardConnectMessage *msg = (const VDAgentPortForwardConnectMessage *)data;
+
+    if (command == VD_AGENT_PORT_FORWARD_CONNECT) {
+        connect_id = msg->id;
+        connect_port = msg->port;
+        g_free(connect_host);
+        connect_host = g_strdup(msg->host);
+    }
+}
+
+static void test_fd(void)
+{
+    PortForwarder *pf = new_port_forwarder(NULL, connect_command, ignore_data_ready);
+    VDAgentPortForwardAckMessage ack;
+    guint8 buffer[sizeof(VDAgentPortForwardDataMessage) + 16];
+    VDAgentPortForwardDataMessage *msg = (VDAgentPortForwardDataMessage *)buffer;
+    const VDAgentPortForwardDataMessage *data;
+    SpicePortForwardStats *stats;
+    guint64 received;
+    GArray *array;
+    GBytes *bytes;
+    guint32 command;
+    int fds[2];
+    gchar reply[16];
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+    g_assert_true(port_forwarder_connect_fd(pf, fds[1], "localhost", 22));
+    g_assert_cmpstr(connect_host, ==, "localhost");
+    g_assert_cmpuint(connect_port, ==, 22);
+
+    /* the guest end is connected */
+    ack.id = connect_id;
+    ack.size = AGENT_ACK_INTERVAL;
+    port_forwarder_handle_message(pf, VD_AGENT_PORT_FORWARD_ACK, &ack);
+
+    g_assert_cmpint(write(fds[0], "ping", 4), ==, 4);
+    while (port_forwarder_get_queued(pf) == 0) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    bytes = pop_message(pf, &command);
+    data = g_bytes_get_data(bytes, NULL);
+    g_assert_cmpuint(command, ==, VD_AGENT_PORT_FORWARD_DATA);
+    g_assert_cmpuint(data->id, ==, connect_id);
+    g_assert_cmpuint(data->size, ==, 4);
+    g_assert_cmpint(memcmp(data->data, "ping", 4), ==, 0);
+    g_bytes_unref(bytes);
+
+    msg->id = connect_id;
+    msg->size = 4;
+    memcpy(msg->data, "pong", 4);
+    port_forwarder_handle_message(pf, VD_AGENT_PORT_FORWARD_DATA, msg);
+    do {
+        g_main_context_iteration(NULL, TRUE);
+        array = port_forwarder_get_stats(pf);
+        stats = stats_find(array, connect_id);
+        g_assert_cmpuint(stats->port, ==, 0);
+        received = stats->received_bytes;
+        g_array_unref(array);
+    } while (received < 4);
+    g_assert_cmpint(read(fds[0], reply, sizeof(reply)), ==, 4);
+    g_assert_cmpint(memcmp(reply, "pong", 4), ==, 0);
+
+    close(fds[0]);
+    delete_port_forwarder(pf);
+    g_clear_pointer(&connect_host, g_free);
+}
+
+static void test_local_unix(void)
+{
+    PortForwarder *pf = new_port_forwarder(NULL, connect_command, ignore_data_ready);
+    GSocketClient *client = g_socket_client_new();
+    GError *error = NULL;
+    gchar *dir = g_dir_make_tmp("port-forward-XXXXXX", &error);
+    GSocketAddress *address;
+    GSocketConnection *conn;
+    gchar *path;
+
+    g_assert_no_error(error);
+    path = g_build_filename(dir, "socket", NULL);
+    address = g_unix_socket_address_new(path);
+
+    g_assert_true(port_forwarder_associate_local_unix(pf, path, "localhost", 22));
+    g_assert_true(g_file_test(path, G_FILE_TEST_EXISTS));
+    /* associated again, it replaces the socket */
+    g_assert_true(port_forwarder_associate_local_unix(pf, path, "localhost", 23));
+
+    /* a connection made to the socket is forwarded */
+    conn = g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+    g_assert_no_error(error);
+    while (connect_host == NULL) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_assert_cmpstr(connect_host, ==, "localhost");
+    g_assert_cmpuint(connect_port, ==, 23);
+    g_object_unref(conn);
+
+    /* the socket goes away with the association */
+    g_assert_true(port_forwarder_disassociate_local_unix(pf, path));
+    g_assert_false(g_file_test(path, G_FILE_TEST_EXISTS));
+    g_assert_false(port_forwarder_disassociate_local_unix(pf, path));
+    conn = g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+    g_assert_null(conn);
+    g_assert_nonnull(error);
+    g_clear_error(&error);
+
+    /* and with the forwarder */
+    g_assert_true(port_forwarder_associate_local_unix(pf, path, "localhost", 22));
+    g_assert_true(g_file_test(path, G_FILE_TEST_EXISTS));
+    delete_port_forwarder(pf);
+    g_assert_false(g_file_test(path, G_FILE_TEST_EXISTS));
+
+    /* let the cancelled accepts complete */
+    while (g_main_context_iteration(NULL, FALSE));
+
+    g_rmdir(dir);
+    g_object_unref(address);
+    g_object_unref(client);
+    g_free(path);
+    g_free(dir);
+    g_clear_pointer(&connect_host, g_free);
+}
+#endif
+
+static void test_bench(gconstpointer data)
+{
+    guint rtt = GPOINTER_TO_UINT(data);
+    gdouble to_guest, from_guest;
+
+    if (!g_test_perf()) {
+        g_test_skip("only run with -m perf");
+        return;
+    }
+
+    to_guest = transfer_to_guest(BENCH_SIZE, rtt, NULL);
+    from_guest = transfer_from_guest(BENCH_SIZE, rtt, NULL);
+    g_test_message("%u ms: %.1f MB/s to the guest, %.1f MB/s from the guest",
+                   rtt, to_guest, from_guest);
+    g_test_maximized_result(to_guest, "MB/s to the guest with %u ms of latency", rtt);
+    g_test_maximized_result(from_guest, "MB/s from the guest with %u ms of latency", rtt);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/port-forward/to-guest", test_to_guest);
+    g_test_add_func("/port-forward/from-guest", test_from_guest);
+    g_test_add_func("/port-forward/no-copy", test_no_copy);
+    g_test_add_func("/port-forward/fairness", test_fairness);
+    g_test_add_func("/port-forward/weight", test_weight);
+#ifdef G_OS_UNIX
+    g_test_add_func("/port-forward/unix", test_unix);
+    g_test_add_func("/port-forward/fd", test_fd);
+    g_test_add_func("/port-forward/local-unix", test_local_unix);
+#endif
+    g_test_add_data_func("/port-forward/bench/0ms", GUINT_TO_POINTER(0), test_bench);
+    g_test_add_data_func("/port-forward/bench/10ms", GUINT_TO_POINTER(10), test_bench);
+    g_test_add_data_func("/port-forward/bench/50ms", GUINT_TO_POINTER(50), test_bench);
+
+    return g_test_run();
+}
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/snd_codec.h"
+#include "mock-server.h"
+
+/* uncompressed, as the server has no codec capability */
+#define FREQUENCY 48000
+#define FRAME_BYTES (SND_CODEC_MAX_FRAME_SIZE * 2 * 2)
+/* the round trip time to assume: up to 4 frames are held, for 1s */
+#define COALESCE_RTT "4000"
+
+typedef struct Fixture {
+    SpiceSession *session;
+    SpiceChannel *channel;
+    MockServer *server;
+    guint8 *pcm;
+    gsize pcm_size;
+
+    /* what the next send_data() hands over */
+    const gsize *pieces;
+    guint npieces;
+    gsize sent;
+    SpiceRecordStats stats;
+} Fixture;
+
+static void fixture_setup(Fixture *f, gconstpointer user_data)
+{
+    const gchar *coalesce = user_data;
+    guint i;
+
+    if (coalesce != NULL)
+        g_setenv("SPICE_RECORD_COALESCE", coalesce, TRUE);
+    else
+        g_unsetenv("SPICE_RECORD_COALESCE");
+
+    f->pcm_size = FRAME_BYTES * 8;
+    f->pcm = g_malloc(f->pcm_size);
+    for (i = 0; i < f->pcm_size; i++)
+        f->pcm[i] = i * 7 + i / 251;
+
+    f->session = spice_session_new();
+    g_object_set(f->session, "client-sockets", TRUE, NULL);
+    f->channel = spice_channel_new(f->session, SPICE_CHANNEL_RECORD, 0);
+    f->server = mock_server_new();
+    mock_server_link(f->server, f->channel);
+}
+
+static void fixture_teardown(Fixture *f, gconstpointer user_data)
+{
+    spice_session_disconnect(f->session);
+    mock_server_free(f->server);
+    while (g_main_context_iteration(NULL, FALSE));
+    g_object_unref(f->session);
+    g_free(f->pcm);
+    g_unsetenv("SPICE_RECORD_COALESCE");
+}
+
+/* script context */
+static void send_start(MockServer *server)
+{
+    guint8 start[10];
+    guint32 channels = GUINT32_TO_LE(2), frequency = GUINT32_TO_LE(FREQUENCY);
+    guint16 format = GUINT16_TO_LE(SPICE_AUDIO_FMT_S16);
+
+    memcpy(start, &channels, 4);
+    memcpy(start + 4, &frequency, 4);
+    memcpy(start + 8, &format, 2);
+    mock_server_send(server, SPICE_MSG_RECORD_START, start, sizeof(start));
+    mock_server_sync(server);
+}
+
+static gboolean send_data(gpointer user_data)
+{
+    Fixture *f = user_data;
+    guint i;
+
+    for (i = 0; i < f->npieces; i++) {
+        g_assert_cmpuint(f->sent + f->pieces[i], <=, f->pcm_size);
+        spice_record_channel_send_data(SPICE_RECORD_CHANNEL(f->channel),
+                                       f->pcm + f->sent, f->pieces[i], 42);
+        f->sent += f->pieces[i];
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* script context: hands @npieces pieces of PCM to the channel */
+static void send_pieces(Fixture *f, const gsize *pieces, guint npieces)
+{
+    f->pieces = pieces;
+    f->npieces = npieces;
+    mock_server_invoke(f->server, send_data, f);
+}
+
+/* script context: the next frame must be the one numbered @n */
+static void recv_frame(Fixture *f, guint n, guint timeout)
+{
+    GBytes *msg = mock_server_recv(f->server, SPICE_MSGC_RECORD_DATA, timeout);
+    const guint8 *data;
+    gsize size;
+
+    g_assert_nonnull(msg);
+    data = g_bytes_get_data(msg, &size);
+    /* the time, then the samples */
+    g_assert_cmpuint(size, ==, 4 + FRAME_BYTES);
+    g_assert_cmpuint(GUINT32_FROM_LE(*(guint32 *)data), ==, 42);
+    g_assert_true(memcmp(data + 4, f->pcm + n * FRAME_BYTES, FRAME_BYTES) == 0);
+    g_bytes_unref(msg);
+}
+
+/* script context */
+static void recv_nothing(Fixture *f, guint timeout)
+{
+    g_assert_null(mock_server_recv(f->server, SPICE_MSGC_RECORD_DATA, timeout));
+}
+
+static void script_fragment(MockServer *server, gpointer user_data)
+{
+    Fixture *f = user_data;
+    /* frames cut across the pieces, and a piece holding several */
+    const gsize pieces[] = { 1000, FRAME_BYTES * 2 + 17, FRAME_BYTES / 2 };
+
+    send_start(server);
+    send_pieces(f, pieces, G_N_ELEMENTS(pieces));
+
+    recv_frame(f, 0, 5000);
+    recv_frame(f, 1, 5000);
+    recv_frame(f, 2, 5000);
+    /* the rest waits for the end of its frame */
+    recv_nothing(f, 200);
+}
+
+static void test_fragment(Fixture *f, gconstpointer user_data)
+{
+    mock_server_run(f->server, script_fragment, f);
+}
+
+static gboolean get_stats(gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    g_assert_true(spice_record_channel_get_stats(SPICE_RECORD_CHANNEL(f->channel),
+                                                 &f->stats));
+    return G_SOURCE_REMOVE;
+}
+
+static void script_coalesce(MockServer *server, gpointer user_data)
+{
+    Fixture *f = user_data;
+    const gsize three[] = { FRAME_BYTES * 3 }, one[] = { FRAME_BYTES };
+    gint64 start;
+
+    send_start(server);
+
+    /* held until there are enough of them */
+    send_pieces(f, three, 1);
+    recv_nothing(f, 200);
+    send_pieces(f, one, 1);
+    recv_frame(f, 0, 5000);
+    recv_frame(f, 1, 5000);
+    recv_frame(f, 2, 5000);
+    recv_frame(f, 3, 5000);
+    mock_server_invoke(server, get_stats, f);
+    g_assert_cmpuint(f->stats.rtt, ==, atoi(COALESCE_RTT));
+    g_assert_cmpuint(f->stats.batch, ==, 4);
+    g_assert_cmpuint(f->stats.frames, ==, 4);
+
+    /* or until the first of them waited for a quarter of the round trip */
+    start = g_get_monotonic_time();
+    send_pieces(f, one, 1);
+    recv_frame(f, 4, 5000);
+    g_assert_cmpint(g_get_monotonic_time() - start, >=,
+                    atoi(COALESCE_RTT) / 4 * G_TIME_SPAN_MILLISECOND);
+}
+
+static void test_coalesce(Fixture *f, gconstpointer user_data)
+{
+    mock_server_run(f->server, script_coalesce, f);
+}
+
+static void script_stop(MockServer *server, gpointer user_data)
+{
+    Fixture *f = user_data;
+    const gsize two[] = { FRAME_BYTES * 2 };
+
+    send_start(server);
+    send_pieces(f, two, 1);
+    recv_nothing(f, 200);
+
+    /* what was held goes out with the end of the recording */
+    mock_server_send(server, SPICE_MSG_RECORD_STOP, NULL, 0);
+    recv_frame(f, 0, 500);
+    recv_frame(f, 1, 500);
+}
+
+static void test_stop(Fixture *f, gconstpointer user_data)
+{
+    mock_server_run(f->server, script_stop, f);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add("/record/fragment", Fixture, NULL,
+               fixture_setup, test_fragment, fixture_teardown);
+    g_test_add("/record/coalesce", Fixture, COALESCE_RTT,
+               fixture_setup, test_coalesce, fixture_teardown);
+    g_test_add("/record/stop", Fixture, COALESCE_RTT,
+               fixture_setup, test_stop, fixture_teardown);
+
+    return g_test_run();
+}
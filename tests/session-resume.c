@@ -0,0 +1,330 @@
+#include <string.h>
+
+#include "common/snd_codec.h"
+#include "mock-server.h"
+#include "spice-session-resume.h"
+
+/* the channels are opaque to the tracker */
+static gint main_channel, display_channel, inputs_channel;
+
+static void test_outage(void)
+{
+    SessionResume *resume = session_resume_new();
+    SpiceSessionResumeStats stats;
+    GList *lost;
+
+    g_assert_false(session_resume_is_active(resume));
+
+    session_resume_channel_lost(resume, &main_channel, 1000);
+    session_resume_channel_lost(resume, &display_channel, 2000);
+    session_resume_channel_lost(resume, &inputs_channel, 3000);
+    /* lost again while reconnecting */
+    session_resume_channel_lost(resume, &main_channel, 4000);
+    g_assert_true(session_resume_is_active(resume));
+    g_assert_true(session_resume_is_lost(resume, &display_channel));
+
+    lost = session_resume_get_lost(resume);
+    g_assert_cmpuint(g_list_length(lost), ==, 3);
+    g_assert_true(lost->data == &main_channel);
+    g_list_free(lost);
+
+    g_assert_false(session_resume_channel_usable(resume, &main_channel, 50000));
+    g_assert_false(session_resume_channel_usable(resume, &inputs_channel, 60000));
+    /* not lost */
+    g_assert_false(session_resume_channel_usable(resume, &inputs_channel, 70000));
+    g_assert_true(session_resume_channel_usable(resume, &display_channel, 101000));
+    g_assert_false(session_resume_is_active(resume));
+
+    session_resume_get_stats(resume, &stats);
+    g_assert_cmpuint(stats.resumed, ==, 1);
+    g_assert_cmpuint(stats.expired, ==, 0);
+    g_assert_cmpint(stats.last_usable_time, ==, 100000);
+    g_assert_cmpint(stats.max_usable_time, ==, 100000);
+
+    /* a shorter one */
+    session_resume_channel_lost(resume, &inputs_channel, 200000);
+    g_assert_true(session_resume_channel_usable(resume, &inputs_channel, 210000));
+    session_resume_get_stats(resume, &stats);
+    g_assert_cmpuint(stats.resumed, ==, 2);
+    g_assert_cmpint(stats.last_usable_time, ==, 10000);
+    g_assert_cmpint(stats.max_usable_time, ==, 100000);
+
+    session_resume_free(resume);
+}
+
+static void test_retry(void)
+{
+    SessionResume *resume = session_resume_new();
+    guint delay, last = 0;
+    guint i;
+
+    session_resume_channel_lost(resume, &main_channel, 0);
+    /* the first attempt is made at once */
+    g_assert_cmpuint(session_resume_next_retry(resume), ==, 0);
+    for (i = 0; i < 10; i++) {
+        delay = session_resume_next_retry(resume);
+        g_assert_cmpuint(delay, >, 0);
+        g_assert_cmpuint(delay, >=, last);
+        last = delay;
+    }
+    g_assert_cmpuint(last, <=, 2000);
+
+    /* a new outage starts over */
+    g_assert_true(session_resume_channel_usable(resume, &main_channel, 1000));
+    session_resume_channel_lost(resume, &main_channel, 2000);
+    g_assert_cmpuint(session_resume_next_retry(resume), ==, 0);
+
+    session_resume_free(resume);
+}
+
+static void test_caches(void)
+{
+    SessionResume *resume = session_resume_new();
+    SpiceSessionResumeStats stats;
+
+    session_resume_channel_lost(resume, &display_channel, 0);
+    g_assert_true(session_resume_reset_caches(resume));
+    /* once per outage */
+    g_assert_false(session_resume_reset_caches(resume));
+    g_assert_true(session_resume_channel_usable(resume, &display_channel, 1000));
+
+    session_resume_channel_lost(resume, &display_channel, 2000);
+    g_assert_true(session_resume_reset_caches(resume));
+
+    session_resume_get_stats(resume, &stats);
+    g_assert_cmpuint(stats.cache_resets, ==, 2);
+
+    session_resume_free(resume);
+}
+
+static void test_expire(void)
+{
+    SessionResume *resume = session_resume_new();
+    SpiceSessionResumeStats stats;
+
+    session_resume_channel_lost(resume, &main_channel, 0);
+    session_resume_channel_lost(resume, &display_channel, 0);
+    session_resume_forget(resume, &display_channel);
+    g_assert_false(session_resume_is_lost(resume, &display_channel));
+    session_resume_expire(resume);
+    g_assert_false(session_resume_is_active(resume));
+
+    /* disconnected, doesn't count */
+    session_resume_channel_lost(resume, &main_channel, 0);
+    session_resume_cancel(resume);
+    g_assert_false(session_resume_is_active(resume));
+
+    session_resume_get_stats(resume, &stats);
+    g_assert_cmpuint(stats.expired, ==, 1);
+    g_assert_cmpuint(stats.resumed, ==, 0);
+
+    session_resume_free(resume);
+}
+
+/* A record channel, which the mock server cuts while it sends */
+#define FRAME_BYTES (SND_CODEC_MAX_FRAME_SIZE * 2 * 2)
+/* more than the socket holds, so that the channel is blocked writing */
+#define BLOCKED_BYTES (FRAME_BYTES * 1024)
+
+typedef struct Fixture {
+    SpiceSession *session;
+    SpiceChannel *channel;
+    MockServer *server;
+    guint8 *pcm;
+    gsize pcm_size;
+
+    /* whether the server is back for the channel to link again */
+    gboolean server_up;
+    guint open_fds;
+    guint errors, closed, opened;
+    guint resuming_changes;
+} Fixture;
+
+static void channel_open_fd(SpiceChannel *channel, gint with_tls, gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    f->open_fds++;
+    if (f->server_up)
+        mock_server_link(f->server, channel);
+}
+
+static void channel_event(SpiceChannel *channel, SpiceChannelEvent event, gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    if (event == SPICE_CHANNEL_OPENED)
+        f->opened++;
+    else if (event == SPICE_CHANNEL_CLOSED)
+        f->closed++;
+    else if (event == SPICE_CHANNEL_ERROR_IO)
+        f->errors++;
+}
+
+static void resuming_changed(GObject *gobject, GParamSpec *pspec, gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    f->resuming_changes++;
+}
+
+static void fixture_setup(Fixture *f, gconstpointer user_data)
+{
+    guint resume_timeout = GPOINTER_TO_UINT(user_data);
+
+    f->pcm_size = BLOCKED_BYTES;
+    f->pcm = g_malloc0(f->pcm_size);
+
+    f->session = spice_session_new();
+    g_object_set(f->session,
+                 "client-sockets", TRUE,
+                 "resume-timeout", resume_timeout,
+                 NULL);
+    g_signal_connect(f->session, "notify::resuming", G_CALLBACK(resuming_changed), f);
+    f->channel = spice_channel_new(f->session, SPICE_CHANNEL_RECORD, 0);
+    g_signal_connect(f->channel, "open-fd", G_CALLBACK(channel_open_fd), f);
+    g_signal_connect(f->channel, "channel-event", G_CALLBACK(channel_event), f);
+    f->server = mock_server_new();
+    mock_server_link(f->server, f->channel);
+}
+
+static void fixture_teardown(Fixture *f, gconstpointer user_data)
+{
+    spice_session_disconnect(f->session);
+    mock_server_free(f->server);
+    while (g_main_context_iteration(NULL, FALSE));
+    g_object_unref(f->session);
+    g_free(f->pcm);
+}
+
+/* script context */
+static void send_start(MockServer *server)
+{
+    guint8 start[10];
+    guint32 channels = GUINT32_TO_LE(2), frequency = GUINT32_TO_LE(48000);
+    guint16 format = GUINT16_TO_LE(SPICE_AUDIO_FMT_S16);
+
+    memcpy(start, &channels, 4);
+    memcpy(start + 4, &frequency, 4);
+    memcpy(start + 8, &format, 2);
+    mock_server_send(server, SPICE_MSG_RECORD_START, start, sizeof(start));
+    mock_server_sync(server);
+}
+
+static gboolean send_frame(gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    spice_record_channel_send_data(SPICE_RECORD_CHANNEL(f->channel), f->pcm, FRAME_BYTES, 0);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean send_blocked(gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    spice_record_channel_send_data(SPICE_RECORD_CHANNEL(f->channel), f->pcm, f->pcm_size, 0);
+    return G_SOURCE_REMOVE;
+}
+
+/* script context: the network goes down while the channel sends */
+static void script_lose(MockServer *server, gpointer user_data)
+{
+    Fixture *f = user_data;
+
+    send_start(server);
+    mock_server_stop_reading(server);
+    mock_server_invoke(server, send_blocked, f);
+    mock_server_reset(server);
+}
+
+/* script context: the channel links again by itself, and works */
+static void script_resume(MockServer *server, gpointer user_data)
+{
+    Fixture *f = user_data;
+    GBytes *msg;
+    guint i;
+
+    script_lose(server, f);
+    for (i = 0; i < 5000 && !mock_server_is_connected(server); i++)
+        g_usleep(1000);
+    g_assert_true(mock_server_is_connected(server));
+
+    send_start(server);
+    mock_server_invoke(server, send_frame, f);
+    msg = mock_server_recv(server, SPICE_MSGC_RECORD_DATA, 5000);
+    g_assert_nonnull(msg);
+    g_bytes_unref(msg);
+}
+
+static void test_channel_resume(Fixture *f, gconstpointer user_data)
+{
+    SpiceSessionResumeStats stats;
+    gboolean resuming;
+
+    f->server_up = TRUE;
+    mock_server_run(f->server, script_resume, f);
+
+    /* the socket came from the application again, and the loss of the
+     * channel was not reported */
+    g_assert_cmpuint(f->open_fds, ==, 1);
+    g_assert_cmpuint(f->errors, ==, 0);
+    g_assert_cmpuint(f->closed, ==, 0);
+    g_assert_cmpuint(f->opened, ==, 2);
+
+    g_object_get(f->session, "resuming", &resuming, NULL);
+    g_assert_false(resuming);
+    g_assert_cmpuint(f->resuming_changes, ==, 2);
+    spice_session_get_resume_stats(f->session, &stats);
+    g_assert_cmpuint(stats.resumed, ==, 1);
+    g_assert_cmpuint(stats.expired, ==, 0);
+    g_assert_cmpuint(stats.attempts, ==, 1);
+}
+
+static void script_sync(MockServer *server, gpointer user_data)
+{
+    mock_server_sync(server);
+}
+
+static void test_channel_expire(Fixture *f, gconstpointer user_data)
+{
+    SpiceSessionResumeStats stats;
+    gboolean resuming;
+
+    /* the server doesn't come back in time */
+    mock_server_run(f->server, script_lose, f);
+    while (f->errors == 0)
+        g_main_context_iteration(NULL, TRUE);
+
+    g_assert_cmpuint(f->open_fds, ==, 1);
+    g_assert_cmpuint(f->errors, ==, 1);
+    g_assert_cmpuint(f->closed, ==, 1);
+    g_object_get(f->session, "resuming", &resuming, NULL);
+    g_assert_false(resuming);
+    spice_session_get_resume_stats(f->session, &stats);
+    g_assert_cmpuint(stats.resumed, ==, 0);
+    g_assert_cmpuint(stats.expired, ==, 1);
+
+    /* then the application connects it again from scratch */
+    f->server_up = TRUE;
+    g_assert_true(spice_channel_connect(f->channel));
+    g_assert_cmpuint(f->open_fds, ==, 2);
+    mock_server_run(f->server, script_sync, f);
+    g_assert_cmpuint(f->opened, ==, 2);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/session-resume/outage", test_outage);
+    g_test_add_func("/session-resume/retry", test_retry);
+    g_test_add_func("/session-resume/caches", test_caches);
+    g_test_add_func("/session-resume/expire", test_expire);
+    g_test_add("/session-resume/channel/resume", Fixture, GUINT_TO_POINTER(5),
+               fixture_setup, test_channel_resume, fixture_teardown);
+    g_test_add("/session-resume/channel/expire", Fixture, GUINT_TO_POINTER(1),
+               fixture_setup, test_channel_expire, fixture_teardown);
+
+    return g_test_run();
+}
@@ -0,0 +1,211 @@
+#include <glib.h>
+
+#include "channel-display-controller.h"
+
+/* 30 fps, 1080p */
+#define INTERVAL (G_USEC_PER_SEC / 30)
+#define PIXELS (1920 * 1080)
+#define FRAME_SIZE 40000
+
+/* Feeds @n frames of a simulated stream, decoded in @decode_time us with
+ * @socket_queue bytes waiting behind each of them */
+static void stream_run(StreamController *ctl, gint64 *now, guint n, gint codec_type,
+                       gint64 decode_time, guint64 socket_queue)
+{
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        *now += INTERVAL;
+        stream_controller_add_arrival(ctl, 0, *now, FRAME_SIZE, socket_queue);
+        stream_controller_add_decode(ctl, codec_type, PIXELS, decode_time);
+        stream_controller_adjust_latency(ctl, 100);
+    }
+}
+
+static void test_healthy(void)
+{
+    StreamController *ctl = stream_controller_new();
+    SpiceStreamingState state;
+    gint64 now = 0;
+
+    g_assert_false(stream_controller_get_state(ctl, &state));
+
+    stream_run(ctl, &now, 100, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL / 4, 0);
+    g_assert_true(stream_controller_get_state(ctl, &state));
+    g_assert_cmpint(state.bottleneck, ==, SPICE_STREAMING_BOTTLENECK_NONE);
+    g_assert_cmpint(state.frame_interval, ==, INTERVAL);
+    g_assert_cmpint(state.latency_adjustment, ==, 0);
+    g_assert_false(stream_controller_congestion_started(ctl));
+    g_assert_cmpint(stream_controller_adjust_latency(ctl, 100), ==, 100);
+    g_assert_cmpint(stream_controller_pick_codec(ctl, now), ==, 0);
+
+    stream_controller_free(ctl);
+}
+
+static void test_decode_bound(void)
+{
+    StreamController *ctl = stream_controller_new();
+    SpiceStreamingState state;
+    gint64 now = 0;
+
+    stream_run(ctl, &now, 100, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL * 3 / 2, 0);
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpint(state.bottleneck, ==, SPICE_STREAMING_BOTTLENECK_DECODE);
+    g_assert_cmpint(state.latency_adjustment, >, 0);
+
+    /* the server hears about it once */
+    g_assert_true(stream_controller_congestion_started(ctl));
+    g_assert_false(stream_controller_congestion_started(ctl));
+
+    /* a frame on time is never reported as a drop, a drop stays one */
+    g_assert_cmpint(stream_controller_adjust_latency(ctl, 100), ==,
+                    100 - state.latency_adjustment);
+    g_assert_cmpint(stream_controller_adjust_latency(ctl, 1), ==, 0);
+    g_assert_cmpint(stream_controller_adjust_latency(ctl, -1), ==, -1);
+
+    /* back to normal */
+    stream_run(ctl, &now, 100, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL / 4, 0);
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpint(state.bottleneck, ==, SPICE_STREAMING_BOTTLENECK_NONE);
+    g_assert_true(stream_controller_congestion_started(ctl) == FALSE);
+
+    stream_controller_free(ctl);
+}
+
+static void test_main_loop_bound(void)
+{
+    StreamController *ctl = stream_controller_new();
+    SpiceStreamingState state;
+    gint64 now = 0;
+    guint i;
+
+    stream_run(ctl, &now, 10, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL / 4, 0);
+    for (i = 0; i < 50; i++) {
+        stream_controller_add_loop_lag(ctl, 50 * 1000);
+    }
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpint(state.bottleneck, ==, SPICE_STREAMING_BOTTLENECK_MAIN_LOOP);
+    g_assert_cmpint(state.loop_lag, >, 40 * 1000);
+    g_assert_cmpint(state.latency_adjustment, >=, 40);
+
+    stream_controller_free(ctl);
+}
+
+static void test_network_bound(void)
+{
+    StreamController *ctl = stream_controller_new();
+    SpiceStreamingState state;
+    gint64 now = 0;
+    guint i;
+
+    /* 5 frames pile up on the socket */
+    stream_run(ctl, &now, 100, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL / 4, 5 * FRAME_SIZE);
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpint(state.bottleneck, ==, SPICE_STREAMING_BOTTLENECK_NETWORK);
+    g_assert_cmpint(state.latency_adjustment, >=, 4 * INTERVAL / 1000);
+    stream_controller_free(ctl);
+
+    /* the frames arrive late */
+    ctl = stream_controller_new();
+    stream_run(ctl, &now, 10, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL / 4, 0);
+    for (i = 0; i < 20; i++) {
+        stream_controller_adjust_latency(ctl, -10);
+    }
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpint(state.bottleneck, ==, SPICE_STREAMING_BOTTLENECK_NETWORK);
+    stream_controller_free(ctl);
+}
+
+static void test_codec_switch(void)
+{
+    StreamController *ctl = stream_controller_new();
+    SpiceStreamingState state;
+    gint64 now = 0;
+
+    /* VP8 was seen to decode fast, MJPEG can't keep up */
+    stream_run(ctl, &now, 50, SPICE_VIDEO_CODEC_TYPE_VP8, INTERVAL / 4, 0);
+    stream_run(ctl, &now, 50, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL * 2, 0);
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpint(state.preferred_codec, ==, SPICE_VIDEO_CODEC_TYPE_VP8);
+    g_assert_cmpint(stream_controller_pick_codec(ctl, now), ==, SPICE_VIDEO_CODEC_TYPE_VP8);
+
+    /* no flapping */
+    stream_run(ctl, &now, 50, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL * 2, 0);
+    g_assert_cmpint(stream_controller_pick_codec(ctl, now), ==, 0);
+
+    /* still decoder bound after the hold off */
+    now += 10 * G_USEC_PER_SEC;
+    g_assert_cmpint(stream_controller_pick_codec(ctl, now), ==, SPICE_VIDEO_CODEC_TYPE_VP8);
+
+    /* not worth switching for a small gain */
+    stream_controller_free(ctl);
+    ctl = stream_controller_new();
+    now = 0;
+    stream_run(ctl, &now, 50, SPICE_VIDEO_CODEC_TYPE_VP8, INTERVAL * 9 / 10, 0);
+    stream_run(ctl, &now, 50, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL, 0);
+    g_assert_cmpint(stream_controller_pick_codec(ctl, now), ==, 0);
+
+    stream_controller_free(ctl);
+}
+
+static void test_streams(void)
+{
+    StreamController *ctl = stream_controller_new();
+    SpiceStreamingState state;
+    gint64 now = 0;
+    guint i;
+
+    /* two streams, each at the frame rate, half an interval apart */
+    for (i = 0; i < 100; i++) {
+        stream_controller_add_arrival(ctl, 1, now, FRAME_SIZE, 0);
+        stream_controller_add_arrival(ctl, 2, now + INTERVAL / 2, FRAME_SIZE, 0);
+        now += INTERVAL;
+    }
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpint(state.frame_interval, ==, INTERVAL);
+
+    /* the gap before a new stream isn't an interval */
+    stream_controller_remove_stream(ctl, 1);
+    stream_controller_remove_stream(ctl, 2);
+    now += 5 * G_USEC_PER_SEC;
+    stream_run(ctl, &now, 2, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL / 4, 0);
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpint(state.frame_interval, ==, INTERVAL);
+
+    /* nor is the gap before a stream with a reused id */
+    stream_controller_remove_stream(ctl, 0);
+    now += 5 * G_USEC_PER_SEC;
+    stream_run(ctl, &now, 2, SPICE_VIDEO_CODEC_TYPE_MJPEG, INTERVAL / 4, 0);
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpint(state.frame_interval, ==, INTERVAL);
+
+    stream_controller_free(ctl);
+}
+
+static void test_drops(void)
+{
+    StreamController *ctl = stream_controller_new();
+    SpiceStreamingState state;
+
+    stream_controller_add_drop(ctl);
+    stream_controller_add_drop(ctl);
+    stream_controller_get_state(ctl, &state);
+    g_assert_cmpuint(state.drops, ==, 2);
+
+    stream_controller_free(ctl);
+}
+
+int main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/stream-controller/healthy", test_healthy);
+    g_test_add_func("/stream-controller/decode-bound", test_decode_bound);
+    g_test_add_func("/stream-controller/main-loop-bound", test_main_loop_bound);
+    g_test_add_func("/stream-controller/network-bound", test_network_bound);
+    g_test_add_func("/stream-controller/codec-switch", test_codec_switch);
+    g_test_add_func("/stream-controller/streams", test_streams);
+    g_test_add_func("/stream-controller/drops", test_drops);
+
+    return g_test_run();
+}
@@ -73,6 +73,45 @@ static void test_unix2dos(void)
     }
 }
 
+/* converting a text in two pieces, split anywhere, gives the same result */
+static void test_newlines_chunk(void)
+{
+    unsigned int i;
+    gsize split, len, n;
+
+    for (i = 0; i < G_N_ELEMENTS(dosunix); i++) {
+        if (dosunix[i].flags & DOS2UNIX) {
+            len = strlen(dosunix[i].d);
+            for (split = 0; split <= len; split++) {
+                GString *out = g_string_new(NULL);
+                gboolean cr = FALSE;
+
+                spice_dos2unix_chunk(dosunix[i].d, split, &cr, out);
+                spice_dos2unix_chunk(dosunix[i].d + split, len - split, &cr, out);
+                spice_dos2unix_chunk(NULL, 0, &cr, out);
+                g_assert_cmpstr(out->str, ==, dosunix[i].u);
+                g_string_free(out, TRUE);
+            }
+        }
+
+        if (dosunix[i].flags & UNIX2DOS) {
+            len = strlen(dosunix[i].u);
+            g_assert_cmpuint(spice_unix2dos_len(dosunix[i].u, len), ==,
+                             strlen(dosunix[i].d));
+            for (split = 0; split <= len; split++) {
+                gchar *out = g_malloc0(2 * len + 1);
+                gchar last = 0;
+
+                n = spice_unix2dos_chunk(dosunix[i].u, split, &last, out);
+                n += spice_unix2dos_chunk(dosunix[i].u + split, len - split, &last, out + n);
+                g_assert_cmpuint(n, ==, strlen(dosunix[i].d));
+                g_assert_cmpstr(out, ==, dosunix[i].d);
+                g_free(out);
+            }
+        }
+    }
+}
+
 static const struct {
     unsigned width;
     unsigned height;
@@ -196,6 +235,7 @@ int main(int argc, char* argv[])
 
   g_test_add_func("/util/dos2unix", test_dos2unix);
   g_test_add_func("/util/unix2dos", test_unix2dos);
+  g_test_add_func("/util/newlines_chunk", test_newlines_chunk);
   g_test_add_func("/util/mono_edge_highlight", test_mono_edge_highlight);
 
   return g_test_run ();
@@ -0,0 +1,88 @@
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include "spice-client.h"
+#include "channel-display-priv.h"
+
+typedef struct Probe {
+    GMainLoop *loop;
+    GArray *codecs;
+    GError *error;
+} Probe;
+
+static void probe_done(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    Probe *probe = user_data;
+
+    probe->codecs = gstvideo_probe_codecs_finish(res, &probe->error);
+    g_main_loop_quit(probe->loop);
+}
+
+/* The decoders of the probe have no stream: the decoding pipeline must
+ * not go after one */
+static void test_codecs(gconstpointer user_data)
+{
+    const gchar *cache_dir = user_data;
+    Probe probe = { g_main_loop_new(NULL, FALSE), NULL, NULL };
+    gboolean seen[SPICE_VIDEO_CODEC_TYPE_ENUM_END] = { FALSE, };
+    gchar *filename;
+    guint i;
+
+    gstvideo_probe_codecs_async(NULL, probe_done, &probe);
+    g_main_loop_run(probe.loop);
+    g_main_loop_unref(probe.loop);
+    if (probe.error != NULL) {
+        g_test_skip(probe.error->message);
+        g_clear_error(&probe.error);
+        return;
+    }
+
+    g_assert_nonnull(probe.codecs);
+    for (i = 0; i < probe.codecs->len; i++) {
+        gint codec_type = g_array_index(probe.codecs, gint, i);
+
+        g_assert_cmpint(codec_type, >=, SPICE_VIDEO_CODEC_TYPE_MJPEG);
+        g_assert_cmpint(codec_type, <, SPICE_VIDEO_CODEC_TYPE_ENUM_END);
+        g_assert_false(seen[codec_type]);
+        seen[codec_type] = TRUE;
+    }
+    g_array_unref(probe.codecs);
+
+    /* measured, not loaded */
+    filename = g_build_filename(cache_dir, "spice-gtk", "video-decoders.ini", NULL);
+    g_assert_true(g_file_test(filename, G_FILE_TEST_IS_REGULAR));
+    g_unlink(filename);
+    g_free(filename);
+}
+
+static void test_timing_without_stream(void)
+{
+    SpiceFrame frame = { 0, };
+
+    stream_timing_mark(NULL, &frame, SPICE_STREAM_TIMING_DECODE_START);
+    stream_timing_mark(NULL, &frame, SPICE_STREAM_TIMING_DECODE_END);
+}
+
+int main(int argc, char* argv[])
+{
+    gchar *cache_dir = g_dir_make_tmp("spice-video-probe-XXXXXX", NULL);
+    gchar *dir;
+    int ret;
+
+    /* before GLib looks it up */
+    g_setenv("XDG_CACHE_HOME", cache_dir, TRUE);
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_data_func("/video-probe/codecs", cache_dir, test_codecs);
+    g_test_add_func("/video-probe/timing-without-stream", test_timing_without_stream);
+
+    ret = g_test_run();
+
+    dir = g_build_filename(cache_dir, "spice-gtk", NULL);
+    g_rmdir(dir);
+    g_free(dir);
+    g_rmdir(cache_dir);
+    g_free(cache_dir);
+    return ret;
+}
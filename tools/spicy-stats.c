@@ -23,10 +23,34 @@
 
 /* config */
 static gboolean version = FALSE;
+static gboolean stream_timings = FALSE;
 
 /* state */
 static SpiceSession  *session;
 static GMainLoop     *mainloop;
+static SpiceDisplayChannel *display;
+
+/* ------------------------------------------------------------------ */
+static gboolean print_stream_timings(gpointer data)
+{
+    SpiceStreamTimingStats stats;
+
+    if (display == NULL)
+        return G_SOURCE_CONTINUE;
+
+    spice_display_channel_get_stream_timing_stats(display, &stats);
+    if (stats.frames == 0)
+        return G_SOURCE_CONTINUE;
+
+    printf("frames: %u presented: %u "
+           "decode ms p50/p95/p99: %.1f/%.1f/%.1f "
+           "lag ms p50/p95/p99: %.1f/%.1f/%.1f\n",
+           stats.frames, stats.presented,
+           stats.decode_p50 / 1000., stats.decode_p95 / 1000., stats.decode_p99 / 1000.,
+           stats.lag_p50 / 1000., stats.lag_p95 / 1000., stats.lag_p99 / 1000.);
+
+    return G_SOURCE_CONTINUE;
+}
 
 /* ------------------------------------------------------------------ */
 static void main_channel_event(SpiceChannel *channel, SpiceChannelEvent event,
@@ -55,6 +79,8 @@ static void channel_new(SpiceSession *s, SpiceChannel *channel, gpointer *data)
         g_object_get(channel, "channel-id", &id, NULL);
         if (id != 0)
             return;
+        display = SPICE_DISPLAY_CHANNEL(channel);
+        g_object_add_weak_pointer(G_OBJECT(channel), (gpointer *)&display);
     }
 
     spice_channel_connect(channel);
@@ -69,6 +95,12 @@ static GOptionEntry app_entries[] = {
         .arg_data         = &version,
         .description      = "Display version and quit",
     },
+    {
+        .long_name        = "stream-timings",
+        .arg              = G_OPTION_ARG_NONE,
+        .arg_data         = &stream_timings,
+        .description      = "Print the video stream timings every second",
+    },
     {
         /* end of list */
     }
@@ -115,6 +147,9 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    if (stream_timings)
+        g_timeout_add_seconds(1, print_stream_timings, NULL);
+
     g_main_loop_run(mainloop);
     {
         GList *iter, *list = spice_session_get_channels(session);